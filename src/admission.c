@@ -0,0 +1,292 @@
+/**
+ * admission.c
+ *
+ * Optimistic admission: clients with plausible tokens are admitted right away
+ * and verified in background, failed clients are disconnected on the next tick
+ */
+
+#include "admission.h"
+#include "config.h"
+#include "auth.h"
+
+
+struct oauth2plugin_Admission* oauth2plugin_initAdmission(
+	struct oauth2plugin_Plugin* plugin
+) {
+	struct oauth2plugin_Admission* admission = calloc(1, sizeof(*admission));
+	if (!admission) return NULL;
+	admission->plugin = plugin;
+	admission->queue_tail = &admission->queue;
+	atomic_init(&admission->pending, 0);
+	atomic_init(&admission->admitted, 0);
+	atomic_init(&admission->disconnected, 0);
+	pthread_mutex_init(&admission->mutex, NULL);
+	pthread_cond_init(&admission->cond, NULL);
+	return admission;
+}
+
+
+void oauth2plugin_freeAdmission(
+	struct oauth2plugin_Admission* admission
+) {
+	if (!admission) return;
+
+	// Stop workers (each finishes its current verification)
+	pthread_mutex_lock(&admission->mutex);
+	admission->stop = true;
+	pthread_cond_broadcast(&admission->cond);
+	pthread_mutex_unlock(&admission->mutex);
+	for (size_t i = 0; i < admission->threads_count; i++) pthread_join(admission->threads[i], NULL);
+
+	// Drop pending entries
+	struct oauth2plugin_PendingAdmission* lists[] = { admission->queue, admission->running, admission->done };
+	for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+		while (lists[i]) {
+			struct oauth2plugin_PendingAdmission* next = lists[i]->next;
+			oauth2plugin_freePendingAdmission(admission, lists[i]);
+			lists[i] = next;
+		}
+	}
+	pthread_cond_destroy(&admission->cond);
+	pthread_mutex_destroy(&admission->mutex);
+	free(admission);
+}
+
+
+bool oauth2plugin_admitClient(
+	struct oauth2plugin_Admission* admission,
+	const struct oauth2plugin_Options* profile,
+	const struct mosquitto* client,
+	const char* client_id,
+	const char* username,
+	const char* token,
+	struct oauth2plugin_Session* session
+) {
+	// Enabled for the profile and below the cap of unverified clients; a failed
+	// verification must deny, as a deferred verdict cannot be applied after the CONNACK
+	if (
+		!admission
+		|| !profile->optimistic_admission
+		|| profile->username_replacement
+		|| profile->token_verification_error == verification_error_DEFER
+		|| (profile->username_validation && profile->username_validation_error == verification_error_DEFER)
+		|| !token
+		|| atomic_load(&admission->pending) >= profile->optimistic_max_pending
+	) return false;
+
+	// Unverified expiration must lie in the future
+	cJSON* claims = oauth2plugin_parseJWTPayload(token);
+	cJSON* exp = cJSON_GetObjectItemCaseSensitive(claims, "exp");
+	int64_t expires_at = cJSON_IsNumber(exp) ? (int64_t) exp->valuedouble : 0;
+	cJSON_Delete(claims);
+	int64_t now = oauth2plugin_getRealTime() / 1000000;
+	if (expires_at <= now) return false;
+
+	// Create entry
+	struct oauth2plugin_PendingAdmission* entry = calloc(1, sizeof(*entry));
+	if (!entry) return false;
+	entry->client = client;
+	entry->client_id = client_id ? strdup(client_id) : NULL;
+	entry->username = username ? strdup(username) : NULL;
+	entry->token = strdup(token);
+	entry->profile = profile->name ? strdup(profile->name) : NULL;
+	entry->admitted_at = oauth2plugin_getMonotonicTime();
+	entry->authenticated_at = now;
+	if (
+		(client_id && !entry->client_id)
+		|| (username && !entry->username)
+		|| !entry->token
+		|| (profile->name && !entry->profile)
+	) {
+		oauth2plugin_freePendingAdmission(admission, entry);
+		return false;
+	}
+
+	// Queue for the workers (started with the first admission)
+	pthread_mutex_lock(&admission->mutex);
+	while (admission->threads_count < OAUTH2PLUGIN_ADMISSION_WORKERS) {
+		if (pthread_create(&admission->threads[admission->threads_count], NULL, oauth2plugin_runAdmission, admission) != 0) break;
+		admission->threads_count++;
+	}
+	if (admission->threads_count == 0) {
+		pthread_mutex_unlock(&admission->mutex);
+		oauth2plugin_freePendingAdmission(admission, entry);
+		return false;
+	}
+	*admission->queue_tail = entry;
+	admission->queue_tail = &entry->next;
+	pthread_cond_signal(&admission->cond);
+	pthread_mutex_unlock(&admission->mutex);
+	atomic_fetch_add(&admission->pending, 1);
+	atomic_fetch_add(&admission->admitted, 1);
+
+	// Session until the verdict: unverified expiration, no claims
+	if (session) {
+		session->expires_at = expires_at;
+		session->profile = oauth2plugin_internString(admission->plugin->strings, profile->name);
+	}
+	return true;
+}
+
+
+void oauth2plugin_cancelAdmission(
+	struct oauth2plugin_Admission* admission,
+	const struct mosquitto* client
+) {
+	if (!admission || atomic_load(&admission->pending) == 0) return;
+
+	// Mark all entries of the client, wherever they are
+	pthread_mutex_lock(&admission->mutex);
+	struct oauth2plugin_PendingAdmission* lists[] = { admission->queue, admission->running, admission->done };
+	for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+		for (struct oauth2plugin_PendingAdmission* entry = lists[i]; entry; entry = entry->next) {
+			if (entry->client == client) entry->cancelled = true;
+		}
+	}
+	pthread_mutex_unlock(&admission->mutex);
+}
+
+
+void oauth2plugin_applyAdmission(
+	struct oauth2plugin_Admission* admission
+) {
+	if (!admission || atomic_load(&admission->pending) == 0) return;
+
+	// Take completed entries
+	pthread_mutex_lock(&admission->mutex);
+	struct oauth2plugin_PendingAdmission* done = admission->done;
+	admission->done = NULL;
+	pthread_mutex_unlock(&admission->mutex);
+	if (!done) return;
+
+	// Apply verdicts
+	struct oauth2plugin_Plugin* plugin = admission->plugin;
+	struct oauth2plugin_Options* options = oauth2plugin_acquireOptions(plugin);
+	while (done) {
+		struct oauth2plugin_PendingAdmission* entry = done;
+		done = entry->next;
+		if (!entry->cancelled) {
+			if (entry->result == MOSQ_ERR_SUCCESS) {
+				// Replace the unverified session by the one with the introspected claims
+				if (entry->session) oauth2plugin_putSession(plugin->sessions, entry->session);
+				entry->session = NULL;
+			} else {
+				OAUTH2PLUGIN_LOG_INFO("Token verification failed after admission, disconnecting client (MQTT Client ID: %s).", entry->client_id ? entry->client_id : "<unknown>");
+				oauth2plugin_removeSession(plugin->sessions, entry->client);
+				if (entry->client_id) mosquitto_kick_client_by_clientid(entry->client_id, false);
+				atomic_fetch_add(&admission->disconnected, 1);
+
+				// Other nodes may have admitted the same token
+				if (entry->audit_record.reason == audit_reason_TOKEN_INACTIVE) oauth2plugin_announceInvalidToken(plugin->cluster, entry->token);
+			}
+
+			// Audit verdict (total latency is the time the client was unverified)
+			if (options->audit_log) {
+				entry->audit_record.timestamp = oauth2plugin_getRealTime();
+				entry->audit_record.total_latency = (uint32_t) (oauth2plugin_getMonotonicTime() - entry->admitted_at);
+				entry->audit_record.result = entry->result;
+				if (entry->client_id) strncpy(entry->audit_record.client_id, entry->client_id, sizeof(entry->audit_record.client_id) - 1);
+				oauth2plugin_writeAuditRecord(options->audit_log, &entry->audit_record);
+			}
+		}
+		oauth2plugin_freePendingAdmission(admission, entry);
+		atomic_fetch_sub(&admission->pending, 1);
+	}
+	oauth2plugin_releaseOptions(plugin, options);
+}
+
+
+static void* oauth2plugin_runAdmission(
+	void* userdata
+) {
+	struct oauth2plugin_Admission* admission = (struct oauth2plugin_Admission*) userdata;
+
+	pthread_mutex_lock(&admission->mutex);
+	while (true) {
+		while (!admission->stop && !admission->queue) pthread_cond_wait(&admission->cond, &admission->mutex);
+		if (admission->stop) break;
+
+		// Take the oldest entry
+		struct oauth2plugin_PendingAdmission* entry = admission->queue;
+		admission->queue = entry->next;
+		if (!admission->queue) admission->queue_tail = &admission->queue;
+		entry->next = admission->running;
+		admission->running = entry;
+		bool cancelled = entry->cancelled;
+		pthread_mutex_unlock(&admission->mutex);
+
+		// Verify (skipped if the client is gone already)
+		if (!cancelled) oauth2plugin_verifyAdmission(admission, entry);
+
+		// Hand over to the next tick
+		pthread_mutex_lock(&admission->mutex);
+		struct oauth2plugin_PendingAdmission** link = &admission->running;
+		while (*link != entry) link = &(*link)->next;
+		*link = entry->next;
+		entry->next = admission->done;
+		admission->done = entry;
+	}
+	pthread_mutex_unlock(&admission->mutex);
+	return NULL;
+}
+
+
+static void oauth2plugin_verifyAdmission(
+	struct oauth2plugin_Admission* admission,
+	struct oauth2plugin_PendingAdmission* entry
+) {
+	struct oauth2plugin_Plugin* plugin = admission->plugin;
+	struct oauth2plugin_Options* options = oauth2plugin_acquireOptions(plugin);
+
+	// Profile of the client (removed by a reload: the client has to reconnect)
+	struct oauth2plugin_Options* profile = entry->profile ? NULL : options;
+	for (size_t i = 0; i < options->profiles_count && !profile; i++) {
+		if (oauth2plugin_strEqual(options->profiles[i]->name, entry->profile)) profile = options->profiles[i];
+	}
+
+	// Verify token and username
+	entry->audit_record.reason = audit_reason_OK;
+	struct oauth2plugin_Session* session = oauth2plugin_createSession(entry->client, entry->client_id);
+	if (profile) {
+		entry->result = oauth2plugin_verifyClientToken(
+			profile,
+			plugin->strings,
+			NULL,
+			entry->client_id,
+			entry->username,
+			entry->token,
+			&entry->audit_record,
+			NULL,
+			session
+		);
+	} else {
+		entry->result = MOSQ_ERR_AUTH;
+		entry->audit_record.reason = audit_reason_INTROSPECTION_FAILED;
+	}
+
+	// Keep session for the broker thread
+	if (entry->result == MOSQ_ERR_SUCCESS && session) {
+		session->authenticated_at = entry->authenticated_at;
+		session->validated_at = oauth2plugin_getRealTime() / 1000000;
+		if (options->revalidation_rate > 0) session->token = strdup(entry->token); // Kept for revalidation only
+		if (options->invalidation_topic) session->hashed = oauth2plugin_hashToken(entry->token, session->token_hash);
+		entry->session = session;
+	} else {
+		oauth2plugin_freeSession(plugin->sessions, session);
+	}
+	oauth2plugin_releaseOptions(plugin, options);
+}
+
+
+static void oauth2plugin_freePendingAdmission(
+	struct oauth2plugin_Admission* admission,
+	struct oauth2plugin_PendingAdmission* entry
+) {
+	if (!entry) return;
+	oauth2plugin_freeSession(admission->plugin->sessions, entry->session);
+	free(entry->client_id);
+	free(entry->username);
+	free(entry->token);
+	free(entry->profile);
+	free(entry);
+}
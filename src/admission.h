@@ -0,0 +1,185 @@
+/**
+ * admission.h
+ *
+ * Optimistic admission: clients with plausible tokens are admitted right away
+ * and verified in background, failed clients are disconnected on the next tick
+ */
+
+#ifndef OAUTH2PLUGIN_ADMISSION_H
+#define OAUTH2PLUGIN_ADMISSION_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include "cJSON.h"
+
+#include "options.h"
+#include "session.h"
+#include "audit.h"
+#include "cluster.h"
+#include "jwt.h"
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_ADMISSION_WORKERS 4
+
+
+struct oauth2plugin_Plugin;
+
+
+struct oauth2plugin_PendingAdmission {
+	struct oauth2plugin_PendingAdmission*	next;				// Next entry in the queue or in the list of running or completed entries.
+	const struct mosquitto*					client;				// Broker client (only compared, never dereferenced off the broker thread).
+	char*									client_id;			// MQTT client id.
+	char*									username;			// MQTT username (NULL = none).
+	char*									token;				// Token to verify.
+	char*									profile;			// Name of the issuer profile (NULL = default profile).
+	int64_t									admitted_at;		// Monotonic time of the admission in microseconds.
+	int64_t									authenticated_at;	// Unix time of the admission in seconds.
+	bool									cancelled;			// Client disconnected before the verdict was applied.
+	int										result;				// Verdict: MOSQ_ERR_SUCCESS or the error of the verification.
+	struct oauth2plugin_Session*			session;			// Session with verified claims (NULL unless verified).
+	struct oauth2plugin_AuditRecord			audit_record;		// Stages and reason of the verification.
+};
+
+
+struct oauth2plugin_Admission {
+	struct oauth2plugin_Plugin*				plugin;					// Plugin state with sessions and configuration.
+	pthread_mutex_t							mutex;					// Protects all fields below except the counters.
+	pthread_cond_t							cond;					// Wakes workers up for new entries or to stop.
+	bool									stop;					// Workers shall exit.
+	pthread_t								threads[OAUTH2PLUGIN_ADMISSION_WORKERS];	// Workers (started with the first admission).
+	size_t									threads_count;			// Number of started workers.
+	struct oauth2plugin_PendingAdmission*	queue;					// Entries waiting for a worker (FIFO).
+	struct oauth2plugin_PendingAdmission**	queue_tail;				// Next pointer of the last queued entry.
+	struct oauth2plugin_PendingAdmission*	running;				// Entries being verified by workers.
+	struct oauth2plugin_PendingAdmission*	done;					// Verified entries to apply on the next tick.
+	atomic_long								pending;				// Admitted clients whose verdict was not applied yet.
+	atomic_ulong							admitted;				// Clients admitted before verification.
+	atomic_ulong							disconnected;			// Admitted clients disconnected after failed verification.
+};
+
+
+/**
+ * @brief Create the optimistic admission queue. Workers are started with the first admission.
+ *
+ * @param plugin	Plugin state. Must outlive the queue.
+ * @return			Pointer to a new queue or NULL if allocation fails.
+ */
+struct oauth2plugin_Admission* oauth2plugin_initAdmission(
+	struct oauth2plugin_Plugin* plugin
+);
+
+
+/**
+ * @brief Stop the workers and release the queue with all pending entries.
+ *
+ * @param admission	Queue created by oauth2plugin_initAdmission(). May be NULL.
+ */
+void oauth2plugin_freeAdmission(
+	struct oauth2plugin_Admission* admission
+);
+
+
+/**
+ * @brief Admit a client before its token is verified, if the profile allows it.
+ *
+ * A client is admitted if plugin_opt_optimistic_admission is enabled, the
+ * username is not replaced (which needs the claims before the CONNACK), the
+ * profile denies on verification errors (a deferred verdict cannot be applied
+ * after the CONNACK, so "defer" profiles are verified synchronously), the
+ * token is a JWT whose unverified "exp" lies in the future and fewer than
+ * plugin_opt_optimistic_max_pending clients wait for their verdict. The
+ * caller has run all other local checks (revocation list, pre-screening)
+ * before. Must be called on the broker thread.
+ *
+ * @param admission			Queue. May be NULL.
+ * @param profile			Issuer profile of the client.
+ * @param client			Broker client.
+ * @param client_id			MQTT client id.
+ * @param username			MQTT username. May be NULL.
+ * @param token				Token supplied by the client.
+ * @param session			Output: unverified expiration and profile. May be NULL.
+ * @return					true if the client was admitted and queued for verification, false if it must be verified synchronously.
+ */
+bool oauth2plugin_admitClient(
+	struct oauth2plugin_Admission* admission,
+	const struct oauth2plugin_Options* profile,
+	const struct mosquitto* client,
+	const char* client_id,
+	const char* username,
+	const char* token,
+	struct oauth2plugin_Session* session
+);
+
+
+/**
+ * @brief Forget the pending verification of a disconnected client.
+ *
+ * Must be called on the broker thread (MOSQ_EVT_DISCONNECT).
+ *
+ * @param admission	Queue. May be NULL.
+ * @param client	Broker client.
+ */
+void oauth2plugin_cancelAdmission(
+	struct oauth2plugin_Admission* admission,
+	const struct mosquitto* client
+);
+
+
+/**
+ * @brief Apply the verdicts of completed verifications.
+ *
+ * Verified clients get their session with the introspected claims, the
+ * others are disconnected. Must be called on the broker thread (MOSQ_EVT_TICK).
+ *
+ * @param admission	Queue. May be NULL.
+ */
+void oauth2plugin_applyAdmission(
+	struct oauth2plugin_Admission* admission
+);
+
+
+/**
+ * @brief Worker thread: verify queued tokens.
+ *
+ * @param userdata	Queue.
+ * @return			NULL.
+ */
+static void* oauth2plugin_runAdmission(
+	void* userdata
+);
+
+
+/**
+ * @brief Verify the token of one admitted client with its profile.
+ *
+ * @param admission	Queue.
+ * @param entry		Entry to verify (owned by the calling worker).
+ */
+static void oauth2plugin_verifyAdmission(
+	struct oauth2plugin_Admission* admission,
+	struct oauth2plugin_PendingAdmission* entry
+);
+
+
+/**
+ * @brief Release an entry.
+ *
+ * @param admission	Queue.
+ * @param entry		Entry. May be NULL.
+ */
+static void oauth2plugin_freePendingAdmission(
+	struct oauth2plugin_Admission* admission,
+	struct oauth2plugin_PendingAdmission* entry
+);
+
+#endif // OAUTH2PLUGIN_ADMISSION_H
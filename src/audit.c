@@ -0,0 +1,357 @@
+/**
+ * audit.c
+ *
+ * Asynchronous audit log of authentication decisions
+ */
+
+#include "audit.h"
+
+
+static const char* oauth2plugin_audit_stage_names[audit_stage_COUNT] = {
+	"prevalidation",
+	"introspection",
+	"parsing",
+	"postvalidation"
+};
+
+static const char* oauth2plugin_audit_reason_names[] = {
+	"ok",
+	"username_invalid",
+	"no_token",
+	"introspection_failed",
+	"parsing_failed",
+	"token_inactive",
+	"username_replacement_failed",
+	"token_revoked",
+	"token_malformed",
+	"token_expired",
+	"issuer_invalid",
+	"unverified"
+};
+
+
+struct oauth2plugin_AuditLog* oauth2plugin_initAuditLog(
+	const char* file_path,
+	long max_size,
+	long rotate_count,
+	long buffer_size
+) {
+	// Validate
+	if (!file_path) return NULL;
+
+	// Round ring size up to a power of two (index = position & (capacity - 1))
+	size_t capacity = 2;
+	while (capacity < (size_t) (buffer_size > 0 ? buffer_size : 1)) capacity <<= 1;
+
+	// Init
+	struct oauth2plugin_AuditLog* audit_log = calloc(1, sizeof(*audit_log));
+	if (!audit_log) return NULL;
+	audit_log->slots = calloc(capacity, sizeof(*audit_log->slots));
+	audit_log->file_path = strdup(file_path);
+	if (!audit_log->slots || !audit_log->file_path) {
+		free(audit_log->slots);
+		free(audit_log->file_path);
+		free(audit_log);
+		return NULL;
+	}
+	audit_log->capacity = capacity;
+	for (size_t i = 0; i < capacity; i++) atomic_init(&audit_log->slots[i].sequence, i);
+	atomic_init(&audit_log->enqueue_position, 0);
+	atomic_init(&audit_log->dropped, 0);
+	atomic_init(&audit_log->running, true);
+	atomic_init(&audit_log->references, 1);
+	audit_log->max_size = max_size;
+	audit_log->rotate_count = rotate_count;
+
+	// Open file
+	audit_log->file = fopen(file_path, "a");
+	if (!audit_log->file) {
+		OAUTH2PLUGIN_LOG_ERROR("Cannot open audit log file %s.", file_path);
+		free(audit_log->slots);
+		free(audit_log->file_path);
+		free(audit_log);
+		return NULL;
+	}
+	struct stat file_stat;
+	if (fstat(fileno(audit_log->file), &file_stat) == 0) audit_log->file_size = (long) file_stat.st_size;
+
+	// Start writer thread
+	if (pthread_create(&audit_log->thread, NULL, oauth2plugin_runAuditLog, audit_log) != 0) {
+		fclose(audit_log->file);
+		free(audit_log->slots);
+		free(audit_log->file_path);
+		free(audit_log);
+		return NULL;
+	}
+
+	return audit_log;
+}
+
+
+struct oauth2plugin_AuditLog* oauth2plugin_retainAuditLog(
+	struct oauth2plugin_AuditLog* audit_log
+) {
+	atomic_fetch_add(&audit_log->references, 1);
+	return audit_log;
+}
+
+
+void oauth2plugin_freeAuditLog(
+	struct oauth2plugin_AuditLog* audit_log
+) {
+	if (!audit_log) return;
+	if (atomic_fetch_sub(&audit_log->references, 1) != 1) return;
+
+	// Stop writer thread (it drains the ring buffer before exiting)
+	atomic_store(&audit_log->running, false);
+	pthread_join(audit_log->thread, NULL);
+
+	fclose(audit_log->file);
+	free(audit_log->slots);
+	free(audit_log->file_path);
+	free(audit_log);
+}
+
+
+bool oauth2plugin_writeAuditRecord(
+	struct oauth2plugin_AuditLog* audit_log,
+	const struct oauth2plugin_AuditRecord* record
+) {
+	if (!audit_log || !record) return false;
+
+	// Claim a slot (bounded MPMC queue: a slot is free if its sequence equals the position)
+	size_t mask = audit_log->capacity - 1;
+	size_t position = atomic_load_explicit(&audit_log->enqueue_position, memory_order_relaxed);
+	struct oauth2plugin_AuditSlot* slot;
+	for (;;) {
+		slot = &audit_log->slots[position & mask];
+		size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+		if (difference == 0) {
+			if (atomic_compare_exchange_weak_explicit(&audit_log->enqueue_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) break;
+		} else if (difference < 0) {
+			// Ring buffer full -> drop, never block the broker
+			atomic_fetch_add_explicit(&audit_log->dropped, 1, memory_order_relaxed);
+			return false;
+		} else {
+			position = atomic_load_explicit(&audit_log->enqueue_position, memory_order_relaxed);
+		}
+	}
+
+	// Fill slot and hand it to the writer thread
+	slot->record = *record;
+	atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+	return true;
+}
+
+
+const char* oauth2plugin_AuditReason_toString(
+	enum oauth2plugin_AuditReason reason
+) {
+	return (size_t) reason < sizeof(oauth2plugin_audit_reason_names) / sizeof(oauth2plugin_audit_reason_names[0])
+		? oauth2plugin_audit_reason_names[reason]
+		: "unknown";
+}
+
+
+void oauth2plugin_endAuditStage(
+	struct oauth2plugin_AuditRecord* record,
+	enum oauth2plugin_AuditStage stage,
+	int64_t* stage_start
+) {
+	int64_t now = oauth2plugin_getMonotonicTime();
+	record->stage_latencies[stage] = (uint32_t) (now - *stage_start);
+	*stage_start = now;
+	OAUTH2PLUGIN_PROBE2(stage, oauth2plugin_audit_stage_names[stage], (int64_t) record->stage_latencies[stage]);
+}
+
+
+int64_t oauth2plugin_getMonotonicTime() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+int64_t oauth2plugin_getRealTime() {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+static void* oauth2plugin_runAuditLog(
+	void* arg
+) {
+	struct oauth2plugin_AuditLog* audit_log = (struct oauth2plugin_AuditLog*) arg;
+	struct oauth2plugin_AuditRecord record;
+	unsigned long reported_dropped = 0;
+
+	for (;;) {
+		bool running = atomic_load(&audit_log->running);
+
+		// Drain ring buffer
+		size_t written = 0;
+		while (oauth2plugin_readAuditRecord(audit_log, &record)) {
+			oauth2plugin_formatAuditRecord(audit_log, &record);
+			written++;
+		}
+
+		// Report dropped records
+		unsigned long dropped = atomic_load_explicit(&audit_log->dropped, memory_order_relaxed);
+		if (dropped != reported_dropped) {
+			char timestamp[32];
+			time_t seconds = (time_t) (oauth2plugin_getRealTime() / 1000000);
+			struct tm tm;
+			gmtime_r(&seconds, &tm);
+			strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+			int length = fprintf(audit_log->file, "{\"ts\":\"%s\",\"event\":\"dropped\",\"count\":%lu}\n", timestamp, dropped - reported_dropped);
+			if (length > 0) audit_log->file_size += length;
+			OAUTH2PLUGIN_LOG_WARNING("Audit log buffer full, dropped %lu records.", dropped - reported_dropped);
+			reported_dropped = dropped;
+			written++;
+		}
+
+		// Flush once per batch
+		if (written > 0) {
+			fflush(audit_log->file);
+			oauth2plugin_rotateAuditLog(audit_log);
+		}
+
+		// Exit after the final drain
+		if (!running) break;
+
+		// Idle: producers never signal (lock-free), so poll
+		if (written == 0) {
+			struct timespec idle = { .tv_sec = 0, .tv_nsec = 20 * 1000 * 1000 };
+			nanosleep(&idle, NULL);
+		}
+	}
+
+	return NULL;
+}
+
+
+static bool oauth2plugin_readAuditRecord(
+	struct oauth2plugin_AuditLog* audit_log,
+	struct oauth2plugin_AuditRecord* record
+) {
+	// Single consumer: the slot is ready if its sequence is one ahead of the position
+	size_t position = audit_log->dequeue_position;
+	struct oauth2plugin_AuditSlot* slot = &audit_log->slots[position & (audit_log->capacity - 1)];
+	size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+	if (sequence != position + 1) return false;
+
+	// Copy record and free the slot for the next lap
+	*record = slot->record;
+	atomic_store_explicit(&slot->sequence, position + audit_log->capacity, memory_order_release);
+	audit_log->dequeue_position = position + 1;
+	return true;
+}
+
+
+static void oauth2plugin_formatAuditRecord(
+	struct oauth2plugin_AuditLog* audit_log,
+	const struct oauth2plugin_AuditRecord* record
+) {
+	// Timestamp (RFC 3339, microseconds, UTC)
+	char timestamp[40];
+	time_t seconds = (time_t) (record->timestamp / 1000000);
+	struct tm tm;
+	gmtime_r(&seconds, &tm);
+	size_t timestamp_length = strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &tm);
+	snprintf(timestamp + timestamp_length, sizeof(timestamp) - timestamp_length, ".%06ldZ", (long) (record->timestamp % 1000000));
+
+	// Escape client id
+	char client_id[OAUTH2PLUGIN_AUDIT_CLIENT_ID_SIZE * 6 + 1];
+	size_t client_id_length = 0;
+	for (size_t i = 0; i < OAUTH2PLUGIN_AUDIT_CLIENT_ID_SIZE && record->client_id[i]; i++) {
+		unsigned char c = (unsigned char) record->client_id[i];
+		if (c == '"' || c == '\\') {
+			client_id[client_id_length++] = '\\';
+			client_id[client_id_length++] = (char) c;
+		} else if (c < 0x20) {
+			client_id_length += (size_t) snprintf(client_id + client_id_length, 7, "\\u%04x", c);
+		} else {
+			client_id[client_id_length++] = (char) c;
+		}
+	}
+	client_id[client_id_length] = '\0';
+
+	// Outcome
+	const char* outcome = "deny";
+	if (record->result == MOSQ_ERR_SUCCESS) outcome = "allow";
+	else if (record->result == MOSQ_ERR_PLUGIN_DEFER) outcome = "defer";
+	const char* reason = oauth2plugin_AuditReason_toString(record->reason);
+
+	// Stage latencies
+	char latencies[256];
+	size_t latencies_length = 0;
+	for (size_t i = 0; i < audit_stage_COUNT && latencies_length < sizeof(latencies); i++) {
+		latencies_length += (size_t) snprintf(
+			latencies + latencies_length,
+			sizeof(latencies) - latencies_length,
+			",\"%s\":%u",
+			oauth2plugin_audit_stage_names[i],
+			record->stage_latencies[i]
+		);
+	}
+
+	// Write JSON line
+	int length = fprintf(
+		audit_log->file,
+		"{\"ts\":\"%s\",\"client_id\":\"%s\",\"outcome\":\"%s\",\"result\":%d,\"reason\":\"%s\",\"http_code\":%u,\"cache_hit\":%s,\"latency_us\":{\"total\":%u%s}}\n",
+		timestamp,
+		client_id,
+		outcome,
+		(int) record->result,
+		reason,
+		(unsigned int) record->http_code,
+		record->cache_hit ? "true" : "false",
+		record->total_latency,
+		latencies
+	);
+	if (length > 0) audit_log->file_size += length;
+}
+
+
+static void oauth2plugin_rotateAuditLog(
+	struct oauth2plugin_AuditLog* audit_log
+) {
+	if (
+		audit_log->max_size <= 0
+		|| audit_log->file_size < audit_log->max_size
+	) return;
+
+	// Shift "<file>.N-1" -> "<file>.N", ..., "<file>" -> "<file>.1"
+	size_t path_size = strlen(audit_log->file_path) + 24;
+	char* from = malloc(path_size);
+	char* to = malloc(path_size);
+	if (!from || !to) {
+		free(from);
+		free(to);
+		return;
+	}
+	fclose(audit_log->file);
+	if (audit_log->rotate_count > 0) {
+		for (long i = audit_log->rotate_count - 1; i >= 1; i--) {
+			snprintf(from, path_size, "%s.%ld", audit_log->file_path, i);
+			snprintf(to, path_size, "%s.%ld", audit_log->file_path, i + 1);
+			rename(from, to);
+		}
+		snprintf(to, path_size, "%s.1", audit_log->file_path);
+		rename(audit_log->file_path, to);
+	} else {
+		remove(audit_log->file_path);
+	}
+	free(from);
+	free(to);
+
+	// Reopen; if that fails keep appending to nothing rather than crash
+	audit_log->file = fopen(audit_log->file_path, "a");
+	if (!audit_log->file) {
+		OAUTH2PLUGIN_LOG_ERROR("Cannot reopen audit log file %s after rotation.", audit_log->file_path);
+		audit_log->file = fopen("/dev/null", "a");
+	}
+	audit_log->file_size = 0;
+}
@@ -0,0 +1,240 @@
+/**
+ * audit.h
+ *
+ * Asynchronous audit log of authentication decisions
+ */
+
+#ifndef OAUTH2PLUGIN_AUDIT_H
+#define OAUTH2PLUGIN_AUDIT_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+
+#include "probes.h"
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_AUDIT_CLIENT_ID_SIZE 64
+
+
+enum oauth2plugin_AuditStage {
+	audit_stage_PREVALIDATION,		// Checks before the introspection request.
+	audit_stage_INTROSPECTION,		// HTTP request to the introspection endpoint.
+	audit_stage_PARSING,			// JSON parsing and claim extraction.
+	audit_stage_POSTVALIDATION,		// Token state, username validation and replacement.
+	audit_stage_COUNT
+};
+
+
+enum oauth2plugin_AuditReason {
+	audit_reason_OK,
+	audit_reason_USERNAME_INVALID,
+	audit_reason_NO_TOKEN,
+	audit_reason_INTROSPECTION_FAILED,
+	audit_reason_PARSING_FAILED,
+	audit_reason_TOKEN_INACTIVE,
+	audit_reason_USERNAME_REPLACEMENT_FAILED,
+	audit_reason_TOKEN_REVOKED,
+	audit_reason_TOKEN_MALFORMED,
+	audit_reason_TOKEN_EXPIRED,
+	audit_reason_ISSUER_INVALID,
+	audit_reason_UNVERIFIED
+};
+
+
+struct oauth2plugin_AuditRecord {
+	int64_t							timestamp;									// Wall clock time of the decision in microseconds since the epoch.
+	uint32_t						stage_latencies[audit_stage_COUNT];			// Latency per stage in microseconds (0 if skipped).
+	uint32_t						total_latency;								// Total latency in microseconds.
+	int32_t							result;										// Mosquitto result code returned to the broker.
+	uint16_t						http_code;									// HTTP status code of the introspection response (0 if not called).
+	uint8_t							reason;										// enum oauth2plugin_AuditReason.
+	bool							cache_hit;									// Decision was made without calling the endpoint.
+	char							client_id[OAUTH2PLUGIN_AUDIT_CLIENT_ID_SIZE];	// MQTT client id (truncated).
+};
+
+
+struct oauth2plugin_AuditSlot {
+	atomic_size_t						sequence;	// Slot state of the bounded MPMC queue.
+	struct oauth2plugin_AuditRecord		record;
+};
+
+
+struct oauth2plugin_AuditLog {
+	struct oauth2plugin_AuditSlot*	slots;				// Ring buffer, capacity is a power of two.
+	size_t							capacity;			// Number of slots.
+	atomic_size_t					enqueue_position;	// Next slot for producers.
+	size_t							dequeue_position;	// Next slot for the writer thread.
+	atomic_ulong					dropped;			// Records dropped because the ring was full.
+	atomic_bool						running;			// Cleared to stop the writer thread.
+	atomic_long						references;			// Configurations using this audit log.
+	pthread_t						thread;				// Writer thread.
+	char*							file_path;			// Path of the JSON Lines file.
+	FILE*							file;				// Open log file.
+	long							max_size;			// Rotate when the file reaches this size in bytes (0 = never).
+	long							rotate_count;		// Number of rotated files to keep.
+	long							file_size;			// Current size of the file.
+};
+
+
+/**
+ * @brief Open the audit log file and start the writer thread.
+ *
+ * Producers push fixed-size records into a lock-free ring buffer with
+ * oauth2plugin_writeAuditRecord(). A background thread formats the records as
+ * JSON Lines and writes them to @p file_path, rotating the file to
+ * "<file_path>.1" ... "<file_path>.<rotate_count>" when it reaches @p max_size.
+ *
+ * @param file_path		Path of the log file.
+ * @param max_size		Rotation size in bytes (0 disables rotation).
+ * @param rotate_count	Number of rotated files to keep.
+ * @param buffer_size	Minimum number of records the ring buffer can hold (rounded up to a power of two).
+ * @return				Pointer to a new audit log or NULL on failure.
+ */
+struct oauth2plugin_AuditLog* oauth2plugin_initAuditLog(
+	const char* file_path,
+	long max_size,
+	long rotate_count,
+	long buffer_size
+);
+
+
+/**
+ * @brief Take an additional reference to an audit log (e.g. when a reloaded configuration keeps it).
+ *
+ * @param audit_log		Audit log.
+ * @return				@p audit_log.
+ */
+struct oauth2plugin_AuditLog* oauth2plugin_retainAuditLog(
+	struct oauth2plugin_AuditLog* audit_log
+);
+
+
+/**
+ * @brief Release a reference to an audit log.
+ *
+ * When the last reference is released, the writer thread is stopped, all
+ * pending records are written and the file is closed.
+ *
+ * @param audit_log		Audit log created by oauth2plugin_initAuditLog(). May be NULL.
+ */
+void oauth2plugin_freeAuditLog(
+	struct oauth2plugin_AuditLog* audit_log
+);
+
+
+/**
+ * @brief Push a record into the ring buffer.
+ *
+ * Never blocks: if the ring buffer is full, the record is dropped and counted.
+ *
+ * @param audit_log		Audit log. May be NULL (record is ignored).
+ * @param record		Record to copy into the ring buffer.
+ * @return				true if the record was queued, false if it was dropped.
+ */
+bool oauth2plugin_writeAuditRecord(
+	struct oauth2plugin_AuditLog* audit_log,
+	const struct oauth2plugin_AuditRecord* record
+);
+
+
+/**
+ * @brief Get the audit log name of a reason.
+ *
+ * @param reason	Reason.
+ * @return			Name, e.g. "token_inactive", or "unknown".
+ */
+const char* oauth2plugin_AuditReason_toString(
+	enum oauth2plugin_AuditReason reason
+);
+
+
+/**
+ * @brief Store the latency of a finished stage and start timing the next one.
+ *
+ * Fires the "stage" probe with the stage name and its latency.
+ *
+ * @param record		Record to update.
+ * @param stage			Finished stage.
+ * @param stage_start	Input: start time of the finished stage. Output: current time.
+ */
+void oauth2plugin_endAuditStage(
+	struct oauth2plugin_AuditRecord* record,
+	enum oauth2plugin_AuditStage stage,
+	int64_t* stage_start
+);
+
+
+/**
+ * @brief Get the current time in microseconds from a monotonic clock.
+ *
+ * @return	Microseconds since an unspecified starting point.
+ */
+int64_t oauth2plugin_getMonotonicTime();
+
+
+/**
+ * @brief Get the current wall clock time in microseconds since the epoch.
+ *
+ * @return	Microseconds since 1970-01-01T00:00:00Z.
+ */
+int64_t oauth2plugin_getRealTime();
+
+
+/**
+ * @brief Writer thread: drains the ring buffer into the log file.
+ *
+ * @param arg	Pointer to the oauth2plugin_AuditLog.
+ * @return		Always NULL.
+ */
+static void* oauth2plugin_runAuditLog(
+	void* arg
+);
+
+
+/**
+ * @brief Take the next record from the ring buffer (writer thread only).
+ *
+ * @param audit_log		Audit log.
+ * @param record		Output record.
+ * @return				true if a record was taken, false if the ring buffer is empty.
+ */
+static bool oauth2plugin_readAuditRecord(
+	struct oauth2plugin_AuditLog* audit_log,
+	struct oauth2plugin_AuditRecord* record
+);
+
+
+/**
+ * @brief Format a record as JSON line and write it to the log file.
+ *
+ * @param audit_log		Audit log.
+ * @param record		Record to write.
+ */
+static void oauth2plugin_formatAuditRecord(
+	struct oauth2plugin_AuditLog* audit_log,
+	const struct oauth2plugin_AuditRecord* record
+);
+
+
+/**
+ * @brief Rotate the log file if it reached its maximum size.
+ *
+ * @param audit_log		Audit log.
+ */
+static void oauth2plugin_rotateAuditLog(
+	struct oauth2plugin_AuditLog* audit_log
+);
+
+#endif // OAUTH2PLUGIN_AUDIT_H
@@ -14,107 +14,295 @@ int oauth2plugin_callback_mosquittoBasicAuthentication(
 ) {
 	// Unused Parameters
 	(void) event;
-	
+
 	// Init
 	struct mosquitto_evt_basic_auth* data = (struct mosquitto_evt_basic_auth*) event_data;
-	struct oauth2plugin_Options* _options = (struct oauth2plugin_Options*) userdata;
-	struct oauth2plugin_CURLBuffer buffer = { .data = NULL, .size = 0 };
+	struct oauth2plugin_AuditRecord audit_record = { .reason = audit_reason_OK };
+	int64_t start = oauth2plugin_getMonotonicTime();
+	OAUTH2PLUGIN_PROBE1(auth__start, mosquitto_client_id(data->client));
+
+	// Authenticate with the current configuration (kept alive across reloads until done)
+	struct oauth2plugin_Plugin* plugin = (struct oauth2plugin_Plugin*) userdata;
+	struct oauth2plugin_Options* _options = oauth2plugin_acquireOptions(plugin);
+	struct oauth2plugin_CaptureEvent capture_event = { 0 };
+	if (_options->capture) {
+		const char* mqtt_username = mosquitto_client_username(data->client); // Copied, may be replaced during authentication
+		if (mqtt_username) capture_event.username = strdup(mqtt_username);
+		oauth2plugin_setCaptureToken(&capture_event, data->password);
+	}
+	struct oauth2plugin_Session* session = oauth2plugin_createSession(data->client, mosquitto_client_id(data->client));
+	int result;
+	if (oauth2plugin_checkRevocation(_options, plugin->cluster, data, session, &audit_record)) {
+		result = MOSQ_ERR_AUTH;
+	} else {
+		result = oauth2plugin_authenticateClient(_options, plugin, data, &audit_record, _options->capture ? &capture_event.response : NULL, session);
+	}
+
+	// Remember authenticated client
+	if (session) {
+		if (result == MOSQ_ERR_SUCCESS) {
+			session->authenticated_at = oauth2plugin_getRealTime() / 1000000;
+			session->validated_at = session->authenticated_at;
+			if (_options->revalidation_rate > 0) session->token = strdup(data->password); // Kept for revalidation only
+			oauth2plugin_putSession(plugin->sessions, session);
+		} else {
+			oauth2plugin_freeSession(plugin->sessions, session);
+		}
+	}
+
+	// Audit decision (copied into the ring buffer, written by a background thread)
+	uint32_t total_latency = (uint32_t) (oauth2plugin_getMonotonicTime() - start);
+	if (_options->audit_log) {
+		const char* mqtt_client_id = mosquitto_client_id(data->client);
+		audit_record.timestamp = oauth2plugin_getRealTime();
+		audit_record.total_latency = total_latency;
+		audit_record.result = result;
+		if (mqtt_client_id) strncpy(audit_record.client_id, mqtt_client_id, sizeof(audit_record.client_id) - 1);
+		oauth2plugin_writeAuditRecord(_options->audit_log, &audit_record);
+	}
+
+	// Capture sanitized event for offline replay
+	if (_options->capture) {
+		const char* mqtt_client_id = mosquitto_client_id(data->client);
+		capture_event.timestamp = oauth2plugin_getRealTime();
+		capture_event.total_latency = total_latency;
+		capture_event.introspection_latency = audit_record.stage_latencies[audit_stage_INTROSPECTION];
+		capture_event.result = result;
+		capture_event.reason = audit_record.reason;
+		capture_event.http_code = audit_record.http_code;
+		capture_event.client_id = mqtt_client_id ? strdup(mqtt_client_id) : NULL;
+		oauth2plugin_writeCaptureEvent(_options->capture, &capture_event);
+		oauth2plugin_freeCaptureEvent(&capture_event);
+	}
+	oauth2plugin_releaseOptions(plugin, _options);
+
+	// Return
+	OAUTH2PLUGIN_PROBE4(auth__done, mosquitto_client_id(data->client), result, oauth2plugin_AuditReason_toString(audit_record.reason), (int64_t) total_latency);
+	return result;
+}
+
+
+int oauth2plugin_callback_mosquittoDisconnect(
+	int event,
+	void* event_data,
+	void* userdata
+) {
+	// Unused Parameters
+	(void) event;
+
+	// Forget session record and pending verification
+	struct mosquitto_evt_disconnect* data = (struct mosquitto_evt_disconnect*) event_data;
+	struct oauth2plugin_Plugin* plugin = (struct oauth2plugin_Plugin*) userdata;
+	oauth2plugin_removeSession(plugin->sessions, data->client);
+	oauth2plugin_cancelAdmission(plugin->admission, data->client);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static bool oauth2plugin_checkRevocation(
+	struct oauth2plugin_Options* _options,
+	struct oauth2plugin_Cluster* cluster,
+	struct mosquitto_evt_basic_auth* data,
+	struct oauth2plugin_Session* session,
+	struct oauth2plugin_AuditRecord* audit_record
+) {
+	if ((!_options->revocation_list && !_options->invalidation_topic) || !data->password) return false;
+
+	// Look up token hash (and jti) in the mapped filter, then in the tokens invalidated by the cluster
+	int64_t stage_start = oauth2plugin_getMonotonicTime();
+	unsigned char token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE];
+	if (!oauth2plugin_hashToken(data->password, token_hash)) return false;
+	if (session) {
+		memcpy(session->token_hash, token_hash, OAUTH2PLUGIN_TOKEN_HASH_SIZE);
+		session->hashed = true;
+	}
+	bool revoked = oauth2plugin_isTokenRevoked(_options->revocation_list, token_hash, data->password);
+	bool invalidated = !revoked && oauth2plugin_isTokenInvalidated(cluster, token_hash);
+	oauth2plugin_endAuditStage(audit_record, audit_stage_PREVALIDATION, &stage_start);
+	if (!revoked && !invalidated) return false;
+
+	// Deny without calling the introspection endpoint
+	if (invalidated) OAUTH2PLUGIN_LOG_INFO("Token was invalidated by the cluster (MQTT Client ID: %s).", mosquitto_client_id(data->client));
+	else OAUTH2PLUGIN_LOG_INFO("Token is revoked (MQTT Client ID: %s).", mosquitto_client_id(data->client));
+	audit_record->reason = audit_reason_TOKEN_REVOKED;
+	return true;
+}
+
+
+static int oauth2plugin_authenticateClient(
+	struct oauth2plugin_Options* _options,
+	struct oauth2plugin_Plugin* plugin,
+	struct mosquitto_evt_basic_auth* data,
+	struct oauth2plugin_AuditRecord* audit_record,
+	char** captured_response,
+	struct oauth2plugin_Session* session
+) {
+	// Init
+	int64_t stage_start = oauth2plugin_getMonotonicTime();
 	const char* mqtt_client_id = mosquitto_client_id(data->client);
 	const char* mqtt_username  = mosquitto_client_username(data->client);
 	const char* mqtt_password = data->password;
 
 	// Log
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D] Starting client authentication.");
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - MQTT Client ID: %s", mqtt_client_id);
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - MQTT Client Username: %s", mqtt_username ? mqtt_username : "<none>");
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - MQTT Client Password: %s", mqtt_password ? mqtt_password : "<none>");
+	OAUTH2PLUGIN_LOG_DEBUG("Starting client authentication.");
+	OAUTH2PLUGIN_LOG_DEBUG(" - MQTT Client ID: %s", mqtt_client_id);
+	OAUTH2PLUGIN_LOG_DEBUG(" - MQTT Client Username: %s", mqtt_username ? mqtt_username : "<none>");
+	OAUTH2PLUGIN_LOG_DEBUG(" - MQTT Client Password: %s", oauth2plugin_logRedact(mqtt_password));
+
+	// Select issuer profile
+	if (_options->router) {
+#if OAUTH2PLUGIN_ROUTER_LISTENER_SUPPORTED
+		int mqtt_listener_port = mosquitto_client_port(data->client);
+#else
+		int mqtt_listener_port = 0; // match_listener is rejected at load
+#endif
+		struct oauth2plugin_Options* profile = oauth2plugin_routeClient(_options->router, mqtt_listener_port, mqtt_username, mqtt_password);
+		if (profile) _options = profile;
+		OAUTH2PLUGIN_LOG_DEBUG(" - Issuer Profile: %s", profile ? profile->name : "<Default>");
+	}
 
 	////
 	// Step 1: Before OAuth2 validation
 	////
 
-	// Validate username
+	// Validate username (literal prefix, suffix and fixed segments of the template)
 	if (
 		_options->username_validation
-		&& strstr(_options->username_validation_template, "%%") == NULL
 		&& !oauth2plugin_isUsernameValid(
 			mqtt_username,
-			_options->username_validation_template,
+			_options->username_validation_compiled,
 			NULL,
 			0
 		)
 	) {
-		mosquitto_log_printf(MOSQ_LOG_INFO, "[OAuth2 Plugin][I] Username from MQTT client is not valid (MQTT Client ID: %s).", mqtt_client_id);
-		return oauth2plugin_getMosquittoAuthError(_options->username_validation_error, data->client);
+		OAUTH2PLUGIN_LOG_INFO("Username from MQTT client is not valid (MQTT Client ID: %s).", mqtt_client_id);
+		oauth2plugin_endAuditStage(audit_record, audit_stage_PREVALIDATION, &stage_start);
+		audit_record->reason = audit_reason_USERNAME_INVALID;
+		return oauth2plugin_getMosquittoAuthError(_options->username_validation_error, mqtt_client_id);
 	}
 	
 	// Validate empty password field
 	if (mqtt_password == NULL) {
-		mosquitto_log_printf(MOSQ_LOG_WARNING, "[OAuth2 Plugin][W] Empty password field -> No token to validate (MQTT Client ID: %s).", mqtt_client_id);
-		return oauth2plugin_getMosquittoAuthError(_options->token_verification_error, data->client);
+		OAUTH2PLUGIN_LOG_WARNING("Empty password field -> No token to validate (MQTT Client ID: %s).", mqtt_client_id);
+		oauth2plugin_endAuditStage(audit_record, audit_stage_PREVALIDATION, &stage_start);
+		audit_record->reason = audit_reason_NO_TOKEN;
+		return oauth2plugin_getMosquittoAuthError(_options->token_verification_error, mqtt_client_id);
 	}
 
-	////
-	// Step 2: Perform OAuth2 request
-	////
+	// Reject tokens that cannot be valid without calling the endpoint
+	enum oauth2plugin_PrescreenResult prescreen_result = oauth2plugin_prescreenToken(_options->prescreen, mqtt_password);
+	if (prescreen_result != prescreen_result_OK) {
+		OAUTH2PLUGIN_LOG_INFO("Token rejected by pre-screening: %s (MQTT Client ID: %s).", oauth2plugin_PrescreenResult_toString(prescreen_result), mqtt_client_id);
+		oauth2plugin_endAuditStage(audit_record, audit_stage_PREVALIDATION, &stage_start);
+		audit_record->reason =
+			prescreen_result == prescreen_result_EXPIRED ? audit_reason_TOKEN_EXPIRED
+			: prescreen_result == prescreen_result_ISSUER ? audit_reason_ISSUER_INVALID
+			: audit_reason_TOKEN_MALFORMED;
+		return oauth2plugin_getMosquittoAuthError(_options->token_verification_error, mqtt_client_id);
+	}
+
+	oauth2plugin_endAuditStage(audit_record, audit_stage_PREVALIDATION, &stage_start);
 
-	// Call introspection endpoint
-	int error = oauth2plugin_callIntrospectionEndpoint(
-		_options->introspection_endpoint,
-		_options->client_id,
-		_options->client_secret,
+	// Admit without waiting for the endpoint, the token is verified in background (opt-in)
+	if (oauth2plugin_admitClient(plugin->admission, _options, data->client, mqtt_client_id, mqtt_username, mqtt_password, session)) {
+		OAUTH2PLUGIN_LOG_INFO("Client admitted before verification (MQTT Client ID: %s).", mqtt_client_id);
+		audit_record->reason = audit_reason_UNVERIFIED;
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	// Verify token and username
+	return oauth2plugin_verifyClientToken(
+		_options,
+		plugin->strings,
+		data->client,
+		mqtt_client_id,
+		mqtt_username,
 		mqtt_password,
-		_options->tls_verification,
-		_options->timeout,
-		&buffer
+		audit_record,
+		captured_response,
+		session
 	);
+}
 
-	// Check for error or empty response data
-	if (
-		error
-		|| !buffer.data
-	) {
-		mosquitto_log_printf(MOSQ_LOG_WARNING, "[OAuth2 Plugin][W] Failed to validate token (MQTT Client ID: %s).", mqtt_client_id);
-		free(buffer.data);
-		return oauth2plugin_getMosquittoAuthError(_options->token_verification_error, data->client);
-	}
 
-	// Parse JSON
-	cJSON* cjson = cJSON_Parse(buffer.data);
-	if (!cjson) {
-		mosquitto_log_printf(MOSQ_LOG_WARNING, "[OAuth2 Plugin][W] Failed to parse data from introspection endpoint (MQTT Client ID: %s).", mqtt_client_id);
-		free(buffer.data);
-		return oauth2plugin_getMosquittoAuthError(_options->token_verification_error, data->client);
+int oauth2plugin_verifyClientToken(
+	struct oauth2plugin_Options* _options,
+	struct oauth2plugin_StringPool* strings,
+	struct mosquitto* client,
+	const char* mqtt_client_id,
+	const char* mqtt_username,
+	const char* mqtt_password,
+	struct oauth2plugin_AuditRecord* audit_record,
+	char** captured_response,
+	struct oauth2plugin_Session* session
+) {
+	// Init
+	int64_t stage_start = oauth2plugin_getMonotonicTime();
+
+	////
+	// Step 2: Verify token
+	////
+
+	// Run the verifier chain (token store, sidecar, introspection endpoint), requesting the claims used by the templates
+	const char* claim_names[oauth2plugin_oidc_template_placeholders_count];
+	for (size_t i = 0; i < oauth2plugin_oidc_template_placeholders_count; i++)
+		claim_names[i] = oauth2plugin_template_placeholders[i].oidc_key;
+	struct oauth2plugin_VerifierRequest request = {
+		.token = mqtt_password,
+		.token_hash = session && session->hashed ? session->token_hash : NULL,
+		.username = mqtt_username,
+		.client_id = mqtt_client_id,
+		.claim_names = claim_names,
+		.claim_count = oauth2plugin_oidc_template_placeholders_count,
+		.capture = captured_response != NULL
+	};
+	struct oauth2plugin_VerifierResponse response = { .claims = NULL };
+	int error = oauth2plugin_runVerifierChain(_options, &request, &response);
+	oauth2plugin_endAuditStage(audit_record, audit_stage_INTROSPECTION, &stage_start);
+	audit_record->http_code = (uint16_t) response.http_code;
+	audit_record->cache_hit = !response.remote;
+	if (captured_response && response.response) *captured_response = oauth2plugin_redactResponse(response.response);
+	free(response.response);
+	if (error) {
+		if (response.reason != audit_reason_PARSING_FAILED) OAUTH2PLUGIN_LOG_WARNING("Failed to validate token (MQTT Client ID: %s).", mqtt_client_id);
+		audit_record->reason = response.reason;
+		return oauth2plugin_getMosquittoAuthError(_options->token_verification_error, mqtt_client_id);
 	}
+	cJSON* cjson = response.claims;
 
-	// Extract JSON fields and create oauth2plugin_strReplacementMap
+	// Extract JSON fields (interned, shared with session records) and create oauth2plugin_strReplacementMap
+	OAUTH2PLUGIN_PROBE0(claims__start);
 	size_t replacement_map_count = oauth2plugin_oidc_template_placeholders_count;
 	struct oauth2plugin_strReplacementMap replacement_map[replacement_map_count] = {};
+	int64_t claims_found = 0;
 	for (size_t i = 0; i < replacement_map_count; i++) {
 		replacement_map[i].needle = oauth2plugin_template_placeholders[i].placeholder;
 		cJSON* item = cJSON_GetObjectItemCaseSensitive(cjson, oauth2plugin_template_placeholders[i].oidc_key);
 		if (
 			cJSON_IsString(item)
 		) {
-			replacement_map[i].replacement = strdup(item->valuestring);
+			replacement_map[i].replacement = oauth2plugin_internString(strings, item->valuestring);
 		} else if (
 			cJSON_IsNumber(item)
 		) {
 			char num_buf[32];
 			snprintf(num_buf, sizeof(num_buf), "%d", item->valueint);
-			replacement_map[i].replacement = strdup(num_buf);
+			replacement_map[i].replacement = oauth2plugin_internString(strings, num_buf);
 		} else if (
 			cJSON_IsBool(item)
 		) {
-			replacement_map[i].replacement = strdup(cJSON_IsTrue(item) ? "true" : "false");
+			replacement_map[i].replacement = oauth2plugin_internString(strings, cJSON_IsTrue(item) ? "true" : "false");
 		} else if (
 			cJSON_IsObject(item) && item->child && item->child->string
 		) {
-			replacement_map[i].replacement = strdup(item->child->string);
+			replacement_map[i].replacement = oauth2plugin_internString(strings, item->child->string);
 		} else {
 			replacement_map[i].replacement = NULL;
 		}
+		if (replacement_map[i].replacement) claims_found++;
 	}
+	OAUTH2PLUGIN_PROBE1(claims__done, claims_found);
+	oauth2plugin_endAuditStage(audit_record, audit_stage_PARSING, &stage_start);
 
 	
 	////
@@ -125,11 +313,12 @@ int oauth2plugin_callback_mosquittoBasicAuthentication(
 	if (
 		!oauth2plugin_isTokenActive(cjson)
 	) {
-		mosquitto_log_printf(MOSQ_LOG_INFO, "[OAuth2 Plugin][I] Token is not active (MQTT Client ID: %s).", mqtt_client_id);
-		oauth2plugin_freeReplacementMap(replacement_map, replacement_map_count);
+		OAUTH2PLUGIN_LOG_INFO("Token is not active (MQTT Client ID: %s).", mqtt_client_id);
+		oauth2plugin_endAuditStage(audit_record, audit_stage_POSTVALIDATION, &stage_start);
+		audit_record->reason = audit_reason_TOKEN_INACTIVE;
+		oauth2plugin_releaseClaims(strings, replacement_map, replacement_map_count);
 		cJSON_Delete(cjson);
-		free(buffer.data);
-		return oauth2plugin_getMosquittoAuthError(_options->token_verification_error, data->client);
+		return oauth2plugin_getMosquittoAuthError(_options->token_verification_error, mqtt_client_id);
 	}
 	
 	// Validate username 
@@ -137,103 +326,151 @@ int oauth2plugin_callback_mosquittoBasicAuthentication(
 		_options->username_validation
 		&& !oauth2plugin_isUsernameValid(
 			mqtt_username,
-			_options->username_validation_template,
+			_options->username_validation_compiled,
 			replacement_map,
 			replacement_map_count
 		)
 	) {
-		mosquitto_log_printf(MOSQ_LOG_INFO, "[OAuth2 Plugin][I] Username from MQTT client is not valid (MQTT Client ID: %s).", mqtt_client_id);
-		oauth2plugin_freeReplacementMap(replacement_map, replacement_map_count);
+		OAUTH2PLUGIN_LOG_INFO("Username from MQTT client is not valid (MQTT Client ID: %s).", mqtt_client_id);
+		oauth2plugin_endAuditStage(audit_record, audit_stage_POSTVALIDATION, &stage_start);
+		audit_record->reason = audit_reason_USERNAME_INVALID;
+		oauth2plugin_releaseClaims(strings, replacement_map, replacement_map_count);
 		cJSON_Delete(cjson);
-		free(buffer.data);
-		return oauth2plugin_getMosquittoAuthError(_options->username_validation_error, data->client);
+		return oauth2plugin_getMosquittoAuthError(_options->username_validation_error, mqtt_client_id);
 	}
 	
 	// Change username
 	if (
 		_options->username_replacement
-		&& !oauth2plugin_setUsername(
-			data->client,
+		&& (!client || !oauth2plugin_setUsername(
+			client,
 			_options->username_replacement_template,
 			replacement_map,
 			replacement_map_count
-		)
+		))
 	) {
-		mosquitto_log_printf(MOSQ_LOG_WARNING, "[OAuth2 Plugin][W] Error setting username (MQTT Client ID: %s).", mqtt_client_id);
-		oauth2plugin_freeReplacementMap(replacement_map, replacement_map_count);
+		OAUTH2PLUGIN_LOG_WARNING("Error setting username (MQTT Client ID: %s).", mqtt_client_id);
+		oauth2plugin_endAuditStage(audit_record, audit_stage_POSTVALIDATION, &stage_start);
+		audit_record->reason = audit_reason_USERNAME_REPLACEMENT_FAILED;
+		oauth2plugin_releaseClaims(strings, replacement_map, replacement_map_count);
 		cJSON_Delete(cjson);
-		free(buffer.data);
-		return oauth2plugin_getMosquittoAuthError(_options->username_replacement_error, data->client);
+		return oauth2plugin_getMosquittoAuthError(_options->username_replacement_error, mqtt_client_id);
+	}
+
+	// Hand claims over to the session record
+	if (session) {
+		for (size_t i = 0; i < replacement_map_count; i++) {
+			session->claims[i] = replacement_map[i].replacement;
+			replacement_map[i].replacement = NULL;
+		}
+		cJSON* exp = cJSON_GetObjectItemCaseSensitive(cjson, "exp");
+		if (cJSON_IsNumber(exp)) session->expires_at = (int64_t) exp->valuedouble;
+		session->profile = oauth2plugin_internString(strings, _options->name);
 	}
 
 	// Free objects
-	oauth2plugin_freeReplacementMap(replacement_map, replacement_map_count);
+	oauth2plugin_endAuditStage(audit_record, audit_stage_POSTVALIDATION, &stage_start);
+	oauth2plugin_releaseClaims(strings, replacement_map, replacement_map_count);
 	cJSON_Delete(cjson);
-	free(buffer.data);
 	
 	// Return
-	mosquitto_log_printf(MOSQ_LOG_INFO, "[OAuth2 Plugin][I] Authentication successful (MQTT Client ID: %s).", mqtt_client_id);
+	OAUTH2PLUGIN_LOG_INFO("Authentication successful (MQTT Client ID: %s).", mqtt_client_id);
 	return MOSQ_ERR_SUCCESS; // Access granted
 	
 }
 
 
-static int oauth2plugin_callIntrospectionEndpoint(
+int oauth2plugin_callIntrospectionEndpoint(
+	struct oauth2plugin_HTTPPool* http_pool,
 	const char* introspection_endpoint,
 	const char* client_id,
 	const char* client_secret,
+	struct oauth2plugin_Credentials* credentials,
 	const char* token,
 	const bool tls_verification,
 	const long timeout,
-	struct oauth2plugin_CURLBuffer* buffer
+	struct oauth2plugin_CURLBuffer* buffer,
+	long* http_code
 ) {
 	// Validate
 	if (
 		!introspection_endpoint
 		|| !client_id
-		|| !client_secret
+		|| (!client_secret && !credentials)
 		|| !token
 	) return MOSQ_ERR_UNKNOWN;
 
-	// Init CURL
-	CURL* curl = curl_easy_init();
-	if (!curl) return MOSQ_ERR_UNKNOWN;
+	// Get cached access token or client assertion (no secret is sent then)
+	char* credentials_value = NULL;
+	if (credentials) {
+		int credentials_error = oauth2plugin_getCredentials(credentials, &credentials_value);
+		if (credentials_error) {
+			OAUTH2PLUGIN_LOG_WARNING("No valid client credentials for the introspection endpoint.");
+			return credentials_error;
+		}
+	}
+
+	// Init CURL (reuses a keep-alive connection from the pool)
+	CURL* curl = oauth2plugin_acquireHTTPHandle(http_pool);
+	if (!curl) {
+		free(credentials_value);
+		return MOSQ_ERR_UNKNOWN;
+	}
 
 	// Escape client_id and client_secret
-	char* esc_client_id = curl_easy_escape(curl, client_id, 0);
-	char* esc_client_secret = curl_easy_escape(curl, client_secret, 0);
-	if (!esc_client_id
-		|| !esc_client_secret) {
-		curl_easy_cleanup(curl);
+	char* esc_client_id = credentials ? NULL : curl_easy_escape(curl, client_id, 0);
+	char* esc_client_secret = credentials ? NULL : curl_easy_escape(curl, client_secret, 0);
+	if (
+		!credentials
+		&& (!esc_client_id || !esc_client_secret)
+	) {
+		curl_free(esc_client_id);
+		curl_free(esc_client_secret);
+		oauth2plugin_releaseHTTPHandle(http_pool, curl);
 		return MOSQ_ERR_UNKNOWN;
 	}
 
-	// Create POST data for token
+	// Create POST data for token (followed by the client assertion with private_key_jwt)
+	bool bearer = credentials && credentials->method == client_authentication_CLIENT_CREDENTIALS;
+	const char* postdata_assertion = credentials && !bearer ? credentials_value : NULL;
 	char* postadata_token_parameter = "token";
 	char* postdata_token_value = curl_easy_escape(curl, token, 0);
 	if (!postdata_token_value) {
-		curl_easy_cleanup(curl);
+		curl_free(esc_client_id);
+		curl_free(esc_client_secret);
+		free(credentials_value);
+		oauth2plugin_releaseHTTPHandle(http_pool, curl);
 		return MOSQ_ERR_UNKNOWN;
 	}
 	size_t postdata_token_len = strlen(postadata_token_parameter) + strlen(postdata_token_value) + 2; // +1 for '=' and +1 for null terminator
+	if (postdata_assertion) postdata_token_len += strlen(postdata_assertion) + 1; // +1 for '&'
 	char* postdata_token = (char*) malloc(postdata_token_len);
 	if (!postdata_token) {
 		curl_free(postdata_token_value);
-		curl_easy_cleanup(curl);
+		curl_free(esc_client_id);
+		curl_free(esc_client_secret);
+		free(credentials_value);
+		oauth2plugin_releaseHTTPHandle(http_pool, curl);
 		return MOSQ_ERR_NOMEM;
 	}
-	snprintf(postdata_token, postdata_token_len, "%s=%s", postadata_token_parameter, postdata_token_value);
+	snprintf(postdata_token, postdata_token_len, "%s=%s%s%s", postadata_token_parameter, postdata_token_value, postdata_assertion ? "&" : "", postdata_assertion ? postdata_assertion : "");
 	curl_free(postdata_token_value);
 
 	// Create heder
 	struct curl_slist* headers = NULL;
 	headers = curl_slist_append(headers, "Content-Type: application/x-www-form-urlencoded");
+	if (bearer && headers) {
+		struct curl_slist* headers_bearer = curl_slist_append(headers, credentials_value);
+		if (headers_bearer) headers = headers_bearer;
+	}
 
 	// Setup CURL
 	curl_easy_setopt(curl, CURLOPT_URL, introspection_endpoint);
-	curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
-	curl_easy_setopt(curl, CURLOPT_USERNAME, esc_client_id);
-	curl_easy_setopt(curl, CURLOPT_PASSWORD, esc_client_secret);
+	if (!credentials) {
+		curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+		curl_easy_setopt(curl, CURLOPT_USERNAME, esc_client_id);
+		curl_easy_setopt(curl, CURLOPT_PASSWORD, esc_client_secret);
+	}
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postdata_token);
 	if (headers) curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, oauth2plugin_callback_curlWriteFunction);
@@ -245,39 +482,47 @@ static int oauth2plugin_callIntrospectionEndpoint(
 	curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
 
 	// Log
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D] Performing introspection endpoint request...");
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - URL: %s", introspection_endpoint);
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - OAuth2 Client ID: %s", client_id);
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - OAuth2 Client Secret: %zu chars", strlen(client_secret));
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - POST Data: %s", postdata_token);
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - TLS: %s", tls_verification ? "<Enabled>" : "<Disabled>");
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Timeout: %ld", timeout);
+	OAUTH2PLUGIN_LOG_DEBUG("Performing introspection endpoint request...");
+	OAUTH2PLUGIN_LOG_DEBUG(" - URL: %s", introspection_endpoint);
+	OAUTH2PLUGIN_LOG_DEBUG(" - OAuth2 Client ID: %s", client_id);
+	if (credentials) OAUTH2PLUGIN_LOG_DEBUG(" - OAuth2 Client Authentication: %s", oauth2plugin_Options_client_authentication_toString(credentials->method));
+	else OAUTH2PLUGIN_LOG_DEBUG(" - OAuth2 Client Secret: %zu chars", strlen(client_secret));
+	OAUTH2PLUGIN_LOG_DEBUG(" - POST Data: %s", oauth2plugin_logRedact(postdata_token));
+	OAUTH2PLUGIN_LOG_DEBUG(" - TLS: %s", tls_verification ? "<Enabled>" : "<Disabled>");
+	OAUTH2PLUGIN_LOG_DEBUG(" - Timeout: %ld", timeout);
 	
 	// Perform HTTP request
+	OAUTH2PLUGIN_PROBE1(http__start, introspection_endpoint);
 	CURLcode curl_code = curl_easy_perform(curl);
 	curl_free(esc_client_id);
 	curl_free(esc_client_secret);
 	if (headers) curl_slist_free_all(headers);
 	free(postdata_token);
 	if (curl_code != CURLE_OK) {
-		mosquitto_log_printf(MOSQ_LOG_WARNING, "[OAuth2 Plugin][W] Failed to call introspection endpoint (Error: %s).", curl_easy_strerror(curl_code));
-		curl_easy_cleanup(curl);
+		OAUTH2PLUGIN_PROBE3(http__done, introspection_endpoint, (int64_t) curl_code, (int64_t) 0);
+		OAUTH2PLUGIN_LOG_WARNING("Failed to call introspection endpoint (Error: %s).", curl_easy_strerror(curl_code));
+		free(credentials_value);
+		oauth2plugin_releaseHTTPHandle(http_pool, curl);
 		return MOSQ_ERR_UNKNOWN;
 	}
 
 	// Get Status Code
-	long http_code = 0;
-	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-	curl_easy_cleanup(curl);
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, http_code);
+	OAUTH2PLUGIN_PROBE3(http__done, introspection_endpoint, (int64_t) curl_code, (int64_t) *http_code);
+	oauth2plugin_releaseHTTPHandle(http_pool, curl);
+
+	// Renew credentials rejected by the endpoint (e.g. an access token revoked before its expiry)
+	if (*http_code == 401) oauth2plugin_invalidateCredentials(credentials, credentials_value);
+	free(credentials_value);
 
 	// Log
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D] Received response from introspection endpoint.");
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - HTTP Code: %ld", http_code);
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Data: %s", buffer->data);
+	OAUTH2PLUGIN_LOG_DEBUG("Received response from introspection endpoint.");
+	OAUTH2PLUGIN_LOG_DEBUG(" - HTTP Code: %ld", *http_code);
+	OAUTH2PLUGIN_LOG_DEBUG(" - Data: %s", oauth2plugin_logRedact(buffer->data));
 
 	// Validate HTTP status code
-	if (http_code != 200) {
-		mosquitto_log_printf(MOSQ_LOG_WARNING, "[OAuth2 Plugin][W] Failed to call introspection endpoint (HTTP Code: %ld).", http_code);
+	if (*http_code != 200) {
+		OAUTH2PLUGIN_LOG_WARNING("Failed to call introspection endpoint (HTTP Code: %ld).", *http_code);
 		return MOSQ_ERR_UNKNOWN;
 	}
 
@@ -286,33 +531,9 @@ static int oauth2plugin_callIntrospectionEndpoint(
 }
 
 
-static size_t oauth2plugin_callback_curlWriteFunction(
-	void* contents,
-	size_t size,
-	size_t nmemb,
-	void* userp
-) {
-	size_t contents_size = size * nmemb;
-	struct oauth2plugin_CURLBuffer* buffer = (struct oauth2plugin_CURLBuffer*) userp;
-
-	char* data = realloc(buffer->data, buffer->size + contents_size + 1);
-	if (!data) return 0;
-
-	buffer->data = data;
-
-	memcpy(&(buffer->data[buffer->size]), contents, contents_size);
-
-	buffer->size += contents_size;
-	buffer->data[buffer->size] = '\0';
-	
-	return contents_size;
-}
-
-
-
 static bool oauth2plugin_isUsernameValid(
 	const char* username,
-	const char* template,
+	const struct oauth2plugin_Template* template,
 	const struct oauth2plugin_strReplacementMap* replacement_map,
 	size_t replacement_map_count
 ) {
@@ -321,48 +542,46 @@ static bool oauth2plugin_isUsernameValid(
 	
 	// Empty username cannot be not validated
 	if (strlen(username) == 0) {
-		mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D] MQTT client sent empty username.");
-		mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - MQTT client username: %s", username ? username : "<none>");
-		mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Username verification template: %s", template);
+		OAUTH2PLUGIN_LOG_DEBUG("MQTT client sent empty username.");
+		OAUTH2PLUGIN_LOG_DEBUG(" - MQTT client username: %s", username ? username : "<none>");
+		OAUTH2PLUGIN_LOG_DEBUG(" - Username verification template: %s", template->source);
 		return false;
 	}
 	
-	// Replace placeholders in template
-	char* username_comparison = NULL;
-	if (strstr(template, "%%") != NULL) {
-		// Username template contains placeholders -> replace
-		if (!replacement_map
-			|| replacement_map_count == 0) return false;
-		username_comparison = oauth2plugin_strReplaceMap(
-			template,
-			replacement_map,
-			replacement_map_count
-		);
-	} else {
-		// Username template does not contain any placeholders
-		username_comparison = strdup(template);
-	}
-	if (username_comparison == NULL) return false;
-	
-	// Compare username with template
-	if (strcmp(username, username_comparison) == 0) {
-		free(username_comparison);
-		return true;
-	} else {
-		mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D] Username from MQTT client does not match username template in config file.");
-		mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - MQTT client username: %s", username ? username : "<none>");
-		mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Username verification template: %s", template);
-		mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Username comparison string: %s", username_comparison);
+	// Compare username with template (literal segments only before introspection)
+	OAUTH2PLUGIN_PROBE1(template__start, template->source);
+	bool valid = replacement_map
+		? oauth2plugin_matchTemplate(template, username, replacement_map, replacement_map_count)
+		: oauth2plugin_canMatchTemplate(template, username);
+	OAUTH2PLUGIN_PROBE2(template__done, template->source, valid);
+	if (valid) return true;
+
+	// Log
+	OAUTH2PLUGIN_LOG_DEBUG("Username from MQTT client does not match username template in config file.");
+	OAUTH2PLUGIN_LOG_DEBUG(" - MQTT client username: %s", username);
+	OAUTH2PLUGIN_LOG_DEBUG(" - Username verification template: %s", template->source);
+	if (replacement_map && OAUTH2PLUGIN_LOG_ENABLED(OAUTH2PLUGIN_LOG_LEVEL_DEBUG)) {
+		char* username_comparison = oauth2plugin_strReplaceMap(template->source, replacement_map, replacement_map_count);
+		OAUTH2PLUGIN_LOG_DEBUG(" - Username comparison string: %s", username_comparison ? username_comparison : "<none>");
 		free(username_comparison);
-		return false;
 	}
-	
-	free(username_comparison);
 	return false;
 }
 
 
-static bool oauth2plugin_isTokenActive(
+static void oauth2plugin_releaseClaims(
+	struct oauth2plugin_StringPool* strings,
+	struct oauth2plugin_strReplacementMap* replacement_map,
+	size_t replacement_map_count
+) {
+	for (size_t i = 0; i < replacement_map_count; i++) {
+		oauth2plugin_releaseString(strings, replacement_map[i].replacement);
+		replacement_map[i].replacement = NULL;
+	}
+}
+
+
+bool oauth2plugin_isTokenActive(
 	const cJSON* introspection_response
 ) {
 	// Validate
@@ -376,7 +595,7 @@ static bool oauth2plugin_isTokenActive(
 	) return true;
 	
 	// Otherwise return false
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D] Introspection response is not {\"active\": true}. Token is not active.");
+	OAUTH2PLUGIN_LOG_DEBUG("Introspection response is not {\"active\": true}. Token is not active.");
 	return false;
 }
 
@@ -389,13 +608,19 @@ static bool oauth2plugin_setUsername(
 ) {
 	// Validate
 	if (!client || !template) return false;
+	OAUTH2PLUGIN_PROBE1(username__start, mosquitto_client_id(client));
 	
 	// Replace placeholders in template
 	char* username = NULL;
+	OAUTH2PLUGIN_PROBE1(template__start, template);
 	if (strstr(template, "%%") != NULL) {
 		// Username template contains placeholders -> replace
 		if (!replacement_map
-			|| replacement_map_count == 0) return false;
+			|| replacement_map_count == 0) {
+			OAUTH2PLUGIN_PROBE2(template__done, template, 0);
+			OAUTH2PLUGIN_PROBE3(username__done, mosquitto_client_id(client), (const char*) NULL, 0);
+			return false;
+		}
 		username = oauth2plugin_strReplaceMap(
 			template,
 			replacement_map,
@@ -405,14 +630,19 @@ static bool oauth2plugin_setUsername(
 		// Username template does not contain any placeholders
 		username = strdup(template);
 	}
-	if (username == NULL) return false;
+	OAUTH2PLUGIN_PROBE2(template__done, template, username != NULL);
+	if (username == NULL) {
+		OAUTH2PLUGIN_PROBE3(username__done, mosquitto_client_id(client), (const char*) NULL, 0);
+		return false;
+	}
 
 	// Replace username
 	if (username) {
-		mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D] Replacing username with template from config file.");
-		mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Username replacement template: %s", template ? template : "<none>");
-		mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - New username: %s", username ? username : "<none>");
-		mosquitto_set_username(client, username);
+		OAUTH2PLUGIN_LOG_DEBUG("Replacing username with template from config file.");
+		OAUTH2PLUGIN_LOG_DEBUG(" - Username replacement template: %s", template ? template : "<none>");
+		OAUTH2PLUGIN_LOG_DEBUG(" - New username: %s", username ? username : "<none>");
+		int set_username_error = mosquitto_set_username(client, username);
+		OAUTH2PLUGIN_PROBE3(username__done, mosquitto_client_id(client), username, set_username_error == MOSQ_ERR_SUCCESS);
 		free(username);
 		return true;
 	}
@@ -424,16 +654,15 @@ static bool oauth2plugin_setUsername(
 
 static int oauth2plugin_getMosquittoAuthError(
 	enum oauth2plugin_Options_verification_error error,
-	const struct mosquitto* client
+	const char* mqtt_client_id
 ) {
-	const char* mqtt_client_id = mosquitto_client_id(client);
 	switch (error) {
 		case verification_error_DENY:
-			mosquitto_log_printf(MOSQ_LOG_INFO, "[OAuth2 Plugin][I] Authentication failed. ACCESS DENIED (MQTT Client ID: %s).", mqtt_client_id ? mqtt_client_id : "<unknown>");
+			OAUTH2PLUGIN_LOG_INFO("Authentication failed. ACCESS DENIED (MQTT Client ID: %s).", mqtt_client_id ? mqtt_client_id : "<unknown>");
 			return MOSQ_ERR_AUTH; // Access denied
 			break;
 		case verification_error_DEFER:
-			mosquitto_log_printf(MOSQ_LOG_INFO, "[OAuth2 Plugin][I] Authentication failed. DEFERRING AUTHENTICATION (MQTT Client ID: %s).", mqtt_client_id ? mqtt_client_id : "<unknown>");
+			OAUTH2PLUGIN_LOG_INFO("Authentication failed. DEFERRING AUTHENTICATION (MQTT Client ID: %s).", mqtt_client_id ? mqtt_client_id : "<unknown>");
 			return MOSQ_ERR_PLUGIN_DEFER; // Deferring authentication
 			break;
 	}
@@ -19,13 +19,24 @@
 
 #include "options.h"
 #include "tools.h"
-
-
-
-struct oauth2plugin_CURLBuffer {
-	char* data;
-	size_t size;
-};
+#include "http.h"
+#include "router.h"
+#include "config.h"
+#include "audit.h"
+#include "capture.h"
+#include "revocation.h"
+#include "tokenstore.h"
+#include "verifier.h"
+#include "sidecar.h"
+#include "credentials.h"
+#include "prescreen.h"
+#include "template.h"
+#include "intern.h"
+#include "session.h"
+#include "admission.h"
+#include "cluster.h"
+#include "probes.h"
+#include "log.h"
 
 
 
@@ -33,10 +44,11 @@ struct oauth2plugin_CURLBuffer {
  * @brief Mosquitto BASIC_AUTH callback used for OAuth2 authentication.
  *
  * This function is registered with the broker and executed for each incoming connection attempt. It performs validation of the MQTT username/password combination by querying the configured OAuth2 introspection endpoint.
+ * If issuer profiles are configured, the client is first routed to its profile, whose endpoint, credentials, templates and error policies are used instead of the default ones.
  *
  * @param event			Event type (unused, expected to be MOSQ_EVT_BASIC_AUTH).
  * @param event_data	Pointer to struct mosquitto_evt_basic_auth provided by Mosquitto.
- * @param userdata		Plugin specific data pointer supplied during registration.
+ * @param userdata		Plugin state (struct oauth2plugin_Plugin) supplied during registration.
  * @return				MOSQ_ERR_SUCCESS if authentication succeeds or a mosquitto error code describing the failure.
  */
 int oauth2plugin_callback_mosquittoBasicAuthentication(
@@ -46,71 +58,171 @@ int oauth2plugin_callback_mosquittoBasicAuthentication(
 );
 
 
+/**
+ * @brief Mosquitto DISCONNECT callback: forget the session record of the client.
+ *
+ * @param event			Event type (unused, expected to be MOSQ_EVT_DISCONNECT).
+ * @param event_data	Pointer to struct mosquitto_evt_disconnect provided by Mosquitto.
+ * @param userdata		Plugin state (struct oauth2plugin_Plugin) supplied during registration.
+ * @return				MOSQ_ERR_SUCCESS.
+ */
+int oauth2plugin_callback_mosquittoDisconnect(
+	int event,
+	void* event_data,
+	void* userdata
+);
+
+
 /**
  * @brief Query the OAuth2 introspection endpoint and store the response.
  *
+ * The request is sent on a keep-alive connection taken from @p http_pool.
+ * Thread safe; also used by the reference sidecar (tools/sidecar).
+ *
+ * @param http_pool					Connection pool used for the request. If NULL, a new connection is opened.
  * @param introspection_endpoint	URL of the introspection endpoint.
  * @param client_id 				OAuth2 client identifier.
- * @param client_secret				OAuth2 client secret.
+ * @param client_secret				OAuth2 client secret (used with HTTP Basic authentication if @p credentials is NULL).
+ * @param credentials				Cached access token or client assertion authenticating the client instead. May be NULL.
  * @param token						Access token supplied by the MQTT client.
  * @param tls_verification			Whether to verify TLS certificates.
  * @param timeout					HTTP request timeout in seconds.
  * @param buffer					Output buffer receiving the response body.
+ * @param http_code					Output: HTTP status code (0 if no response was received).
  * @return							MOSQ_ERR_SUCCESS on success, MOSQ_ERR_UNKNOWN otherwise.
  */
-static int oauth2plugin_callIntrospectionEndpoint(
+int oauth2plugin_callIntrospectionEndpoint(
+	struct oauth2plugin_HTTPPool* http_pool,
 	const char* introspection_endpoint,
 	const char* client_id,
 	const char* client_secret,
+	struct oauth2plugin_Credentials* credentials,
 	const char* token,
 	const bool tls_verification,
 	const long timeout,
-	struct oauth2plugin_CURLBuffer* buffer
+	struct oauth2plugin_CURLBuffer* buffer,
+	long* http_code
 );
 
 
 /**
- * @brief CURL write callback used to collect HTTP response data.
+ * @brief Verify a token with the verifier chain of a profile and check the username against its claims.
  *
- * @param contents	Pointer to the received data chunk.
- * @param size		Size of one element in bytes.
- * @param nmemb		Number of elements pointed to by @p contents.
- * @param userp		Pointer to an oauth2plugin_CURLBuffer used as destination.
- * @return 			Number of bytes processed. Returning a different value will abort the transfer.
+ * Thread safe unless @p client is given and the username is replaced, which
+ * must happen on the broker thread.
+ *
+ * @param _options				Issuer profile.
+ * @param strings				Pool for interned claim values.
+ * @param client				Broker client whose username is replaced. May be NULL if username replacement is disabled.
+ * @param mqtt_client_id		MQTT client id (for logging).
+ * @param mqtt_username			MQTT username. May be NULL.
+ * @param mqtt_password			Token supplied by the MQTT client.
+ * @param audit_record			Output: stage latencies, HTTP status code and reason of the decision.
+ * @param captured_response		Output: redacted introspection response for the capture trace. NULL if not capturing.
+ * @param session				Output: claims, expiration and profile if verification succeeds. May be NULL.
+ * @return						MOSQ_ERR_SUCCESS if the token is active and the username is valid, otherwise a mosquitto error code.
+ */
+int oauth2plugin_verifyClientToken(
+	struct oauth2plugin_Options* _options,
+	struct oauth2plugin_StringPool* strings,
+	struct mosquitto* client,
+	const char* mqtt_client_id,
+	const char* mqtt_username,
+	const char* mqtt_password,
+	struct oauth2plugin_AuditRecord* audit_record,
+	char** captured_response,
+	struct oauth2plugin_Session* session
+);
+
+
+/**
+ * @brief Check whether the token described by the introspection response is active.
+ *
+ * @param introspection_response	Parsed JSON object returned from the introspection endpoint.
+ * @return 							true if the response contains {"active": true}, otherwise false.
  */
-static size_t oauth2plugin_callback_curlWriteFunction(
-	void* contents,
-	size_t size,
-	size_t nmemb,
-	void* userp
+bool oauth2plugin_isTokenActive(
+	const cJSON* introspection_response
+);
+
+
+/**
+ * @brief Check the token of a client against the revocation list and the tokens invalidated by the cluster.
+ *
+ * Runs before routing and introspection, so a revoked token never costs a
+ * network call.
+ *
+ * @param _options		Configuration acquired with oauth2plugin_acquireOptions().
+ * @param cluster		Cluster invalidation state. May be NULL.
+ * @param data			Event data provided by Mosquitto.
+ * @param session		Output: hash of the token (if it was computed). May be NULL.
+ * @param audit_record	Output: lookup latency and reason if the token is revoked.
+ * @return				true if the token is revoked.
+ */
+static bool oauth2plugin_checkRevocation(
+	struct oauth2plugin_Options* _options,
+	struct oauth2plugin_Cluster* cluster,
+	struct mosquitto_evt_basic_auth* data,
+	struct oauth2plugin_Session* session,
+	struct oauth2plugin_AuditRecord* audit_record
+);
+
+
+/**
+ * @brief Authenticate a client with the given configuration.
+ *
+ * Runs the local checks, then either admits the client optimistically (see
+ * admission.h) or verifies the token with oauth2plugin_verifyClientToken().
+ *
+ * @param _options				Configuration acquired with oauth2plugin_acquireOptions().
+ * @param plugin				Plugin state with the string pool and the optimistic admission queue.
+ * @param data					Event data provided by Mosquitto.
+ * @param audit_record			Output: stage latencies, HTTP status code and reason of the decision.
+ * @param captured_response		Output: redacted introspection response for the capture trace. NULL if not capturing.
+ * @param session				Output: claims, expiration and profile if authentication succeeds. May be NULL.
+ * @return						MOSQ_ERR_SUCCESS if authentication succeeds or a mosquitto error code describing the failure.
+ */
+static int oauth2plugin_authenticateClient(
+	struct oauth2plugin_Options* _options,
+	struct oauth2plugin_Plugin* plugin,
+	struct mosquitto_evt_basic_auth* data,
+	struct oauth2plugin_AuditRecord* audit_record,
+	char** captured_response,
+	struct oauth2plugin_Session* session
 );
 
 
 /**
  * @brief Validate a username against a template with optional placeholders.
  *
+ * Without @p replacement_map (before introspection) placeholders match any
+ * text, so only usernames that can never match are rejected.
+ *
  * @param username					Actual MQTT username provided by the client.
- * @param template					Template string that the username must match.
- * @param replacement_map			Array of placeholder replacements.
+ * @param template					Compiled template that the username must match.
+ * @param replacement_map			Array of placeholder replacements or NULL before introspection.
  * @param replacement_map_count		Number of entries in @p replacement_map.
  * @return 							true if the username matches the template, otherwise false.
  */
 static bool oauth2plugin_isUsernameValid(
 	const char* username,
-	const char* template,
+	const struct oauth2plugin_Template* template,
 	const struct oauth2plugin_strReplacementMap* replacement_map,
 	size_t replacement_map_count
 );
 
 
 /**
- * @brief Check whether the token described by the introspection response is active.
+ * @brief Release the interned claim values of a replacement map.
  *
- * @param introspection_response	Parsed JSON object returned from the introspection endpoint.
- * @return 							true if the response contains {"active": true}, otherwise false.
+ * @param strings					Pool the values were interned in.
+ * @param replacement_map			Array of placeholder replacements.
+ * @param replacement_map_count		Number of entries in @p replacement_map.
  */
-static bool oauth2plugin_isTokenActive(
-	const cJSON* introspection_response
+static void oauth2plugin_releaseClaims(
+	struct oauth2plugin_StringPool* strings,
+	struct oauth2plugin_strReplacementMap* replacement_map,
+	size_t replacement_map_count
 );
 
 
@@ -134,13 +246,13 @@ static bool oauth2plugin_setUsername(
 /**
  * @brief Translate a verification error to the corresponding mosquitto error.
  *
- * @param error		Desired behaviour after a failed verification step.
- * @param client 	Mosquitto client instance used for logging purposes.
- * @return			MOSQ_ERR_AUTH, MOSQ_ERR_PLUGIN_DEFER or other mosquitto error codes based on @p error.
+ * @param error			Desired behaviour after a failed verification step.
+ * @param mqtt_client_id	MQTT client id used for logging purposes. May be NULL.
+ * @return					MOSQ_ERR_AUTH, MOSQ_ERR_PLUGIN_DEFER or other mosquitto error codes based on @p error.
  */
 static int oauth2plugin_getMosquittoAuthError(
 	enum oauth2plugin_Options_verification_error error,
-	const struct mosquitto* client
+	const char* mqtt_client_id
 );
 
 #endif // OAUTH2PLUGIN_AUTH_H
\ No newline at end of file
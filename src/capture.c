@@ -0,0 +1,289 @@
+/**
+ * capture.c
+ *
+ * Capture of sanitized authentication events into a binary trace file
+ */
+
+#include "capture.h"
+
+
+static const char* oauth2plugin_capture_secret_keys[] = {
+	"access_token",
+	"refresh_token",
+	"id_token",
+	"token",
+	"client_secret",
+	"secret",
+	"password",
+	"assertion",
+	"jti"
+};
+
+
+struct oauth2plugin_Capture* oauth2plugin_initCapture(
+	const char* file_path
+) {
+	if (!file_path) return NULL;
+
+	struct oauth2plugin_Capture* capture = calloc(1, sizeof(*capture));
+	if (!capture) return NULL;
+	capture->file = fopen(file_path, "wb");
+	if (!capture->file) {
+		OAUTH2PLUGIN_LOG_ERROR("Cannot open capture file %s.", file_path);
+		free(capture);
+		return NULL;
+	}
+	pthread_mutex_init(&capture->mutex, NULL);
+	atomic_init(&capture->references, 1);
+
+	// Write file header
+	unsigned char header[12];
+	size_t offset = 0;
+	memcpy(header, OAUTH2PLUGIN_CAPTURE_MAGIC, 8);
+	offset += 8;
+	oauth2plugin_putCaptureInt(header, &offset, OAUTH2PLUGIN_CAPTURE_VERSION, 4);
+	fwrite(header, 1, offset, capture->file);
+
+	return capture;
+}
+
+
+struct oauth2plugin_Capture* oauth2plugin_retainCapture(
+	struct oauth2plugin_Capture* capture
+) {
+	atomic_fetch_add(&capture->references, 1);
+	return capture;
+}
+
+
+void oauth2plugin_freeCapture(
+	struct oauth2plugin_Capture* capture
+) {
+	if (!capture) return;
+	if (atomic_fetch_sub(&capture->references, 1) != 1) return;
+	fclose(capture->file);
+	pthread_mutex_destroy(&capture->mutex);
+	free(capture);
+}
+
+
+void oauth2plugin_setCaptureToken(
+	struct oauth2plugin_CaptureEvent* event,
+	const char* token
+) {
+	if (!token) return;
+	event->flags |= OAUTH2PLUGIN_CAPTURE_FLAG_TOKEN;
+	if (oauth2plugin_isJWT(token)) event->flags |= OAUTH2PLUGIN_CAPTURE_FLAG_JWT;
+	event->token_length = (uint32_t) strlen(token);
+	oauth2plugin_hashToken(token, event->token_hash);
+}
+
+
+int oauth2plugin_writeCaptureEvent(
+	struct oauth2plugin_Capture* capture,
+	const struct oauth2plugin_CaptureEvent* event
+) {
+	if (!capture || !event) return MOSQ_ERR_SUCCESS;
+
+	// Sizes
+	size_t client_id_length = event->client_id ? strlen(event->client_id) : 0;
+	size_t username_length = event->username ? strlen(event->username) : 0;
+	size_t response_length = event->response ? strlen(event->response) : 0;
+	if (client_id_length > UINT16_MAX) client_id_length = UINT16_MAX;
+	if (username_length > UINT16_MAX) username_length = UINT16_MAX;
+	size_t size = 4 + 8 + 4 + 4 + 4 + 1 + 1 + 2 + OAUTH2PLUGIN_TOKEN_HASH_SIZE + 4
+		+ 2 + client_id_length
+		+ 2 + username_length
+		+ 4 + response_length;
+
+	// Encode
+	unsigned char* buffer = malloc(size);
+	if (!buffer) return MOSQ_ERR_NOMEM;
+	size_t offset = 0;
+	oauth2plugin_putCaptureInt(buffer, &offset, size - 4, 4);
+	oauth2plugin_putCaptureInt(buffer, &offset, (uint64_t) event->timestamp, 8);
+	oauth2plugin_putCaptureInt(buffer, &offset, event->total_latency, 4);
+	oauth2plugin_putCaptureInt(buffer, &offset, event->introspection_latency, 4);
+	oauth2plugin_putCaptureInt(buffer, &offset, (uint32_t) event->result, 4);
+	oauth2plugin_putCaptureInt(buffer, &offset, event->reason, 1);
+	oauth2plugin_putCaptureInt(buffer, &offset, event->flags | (event->username ? OAUTH2PLUGIN_CAPTURE_FLAG_USERNAME : 0), 1);
+	oauth2plugin_putCaptureInt(buffer, &offset, event->http_code, 2);
+	memcpy(buffer + offset, event->token_hash, OAUTH2PLUGIN_TOKEN_HASH_SIZE);
+	offset += OAUTH2PLUGIN_TOKEN_HASH_SIZE;
+	oauth2plugin_putCaptureInt(buffer, &offset, event->token_length, 4);
+	oauth2plugin_putCaptureInt(buffer, &offset, client_id_length, 2);
+	if (client_id_length) memcpy(buffer + offset, event->client_id, client_id_length);
+	offset += client_id_length;
+	oauth2plugin_putCaptureInt(buffer, &offset, username_length, 2);
+	if (username_length) memcpy(buffer + offset, event->username, username_length);
+	offset += username_length;
+	oauth2plugin_putCaptureInt(buffer, &offset, response_length, 4);
+	if (response_length) memcpy(buffer + offset, event->response, response_length);
+	offset += response_length;
+
+	// Write (stdio buffers the events, the file is flushed when the capture is closed)
+	pthread_mutex_lock(&capture->mutex);
+	size_t written = fwrite(buffer, 1, offset, capture->file);
+	pthread_mutex_unlock(&capture->mutex);
+	free(buffer);
+	return written == offset ? MOSQ_ERR_SUCCESS : MOSQ_ERR_ERRNO;
+}
+
+
+bool oauth2plugin_readCaptureHeader(
+	FILE* file
+) {
+	unsigned char header[12];
+	if (fread(header, 1, sizeof(header), file) != sizeof(header)) return false;
+	if (memcmp(header, OAUTH2PLUGIN_CAPTURE_MAGIC, 8) != 0) return false;
+	size_t offset = 8;
+	uint64_t version = 0;
+	oauth2plugin_getCaptureInt(header, sizeof(header), &offset, 4, &version);
+	return version == OAUTH2PLUGIN_CAPTURE_VERSION;
+}
+
+
+bool oauth2plugin_readCaptureEvent(
+	FILE* file,
+	struct oauth2plugin_CaptureEvent* event
+) {
+	memset(event, 0, sizeof(*event));
+
+	// Read event
+	unsigned char size_buffer[4];
+	if (fread(size_buffer, 1, sizeof(size_buffer), file) != sizeof(size_buffer)) return false;
+	size_t offset = 0;
+	uint64_t size = 0;
+	oauth2plugin_getCaptureInt(size_buffer, sizeof(size_buffer), &offset, 4, &size);
+	unsigned char* buffer = malloc(size ? size : 1);
+	if (!buffer) return false;
+	if (fread(buffer, 1, size, file) != size) {
+		free(buffer);
+		return false;
+	}
+
+	// Decode
+	uint64_t value = 0;
+	offset = 0;
+	bool ok = oauth2plugin_getCaptureInt(buffer, size, &offset, 8, &value);
+	event->timestamp = (int64_t) value;
+	ok = ok && oauth2plugin_getCaptureInt(buffer, size, &offset, 4, &value);
+	event->total_latency = (uint32_t) value;
+	ok = ok && oauth2plugin_getCaptureInt(buffer, size, &offset, 4, &value);
+	event->introspection_latency = (uint32_t) value;
+	ok = ok && oauth2plugin_getCaptureInt(buffer, size, &offset, 4, &value);
+	event->result = (int32_t) (uint32_t) value;
+	ok = ok && oauth2plugin_getCaptureInt(buffer, size, &offset, 1, &value);
+	event->reason = (uint8_t) value;
+	ok = ok && oauth2plugin_getCaptureInt(buffer, size, &offset, 1, &value);
+	event->flags = (uint8_t) value;
+	ok = ok && oauth2plugin_getCaptureInt(buffer, size, &offset, 2, &value);
+	event->http_code = (uint16_t) value;
+	ok = ok && offset + OAUTH2PLUGIN_TOKEN_HASH_SIZE <= size;
+	if (ok) {
+		memcpy(event->token_hash, buffer + offset, OAUTH2PLUGIN_TOKEN_HASH_SIZE);
+		offset += OAUTH2PLUGIN_TOKEN_HASH_SIZE;
+	}
+	ok = ok && oauth2plugin_getCaptureInt(buffer, size, &offset, 4, &value);
+	event->token_length = (uint32_t) value;
+	ok = ok && oauth2plugin_getCaptureString(buffer, size, &offset, 2, true, &event->client_id);
+	ok = ok && oauth2plugin_getCaptureString(buffer, size, &offset, 2, event->flags & OAUTH2PLUGIN_CAPTURE_FLAG_USERNAME, &event->username);
+	ok = ok && oauth2plugin_getCaptureString(buffer, size, &offset, 4, true, &event->response);
+	free(buffer);
+
+	// Empty response means the endpoint was not called
+	if (ok && event->response && event->response[0] == '\0') {
+		free(event->response);
+		event->response = NULL;
+	}
+
+	if (!ok) oauth2plugin_freeCaptureEvent(event);
+	return ok;
+}
+
+
+void oauth2plugin_freeCaptureEvent(
+	struct oauth2plugin_CaptureEvent* event
+) {
+	if (!event) return;
+	free(event->client_id);
+	free(event->username);
+	free(event->response);
+	event->client_id = NULL;
+	event->username = NULL;
+	event->response = NULL;
+}
+
+
+char* oauth2plugin_redactResponse(
+	const char* response
+) {
+	if (!response) return NULL;
+	cJSON* cjson = cJSON_Parse(response);
+	if (!cjson) return NULL;
+	oauth2plugin_redactJSON(cjson);
+	char* redacted = cJSON_PrintUnformatted(cjson);
+	cJSON_Delete(cjson);
+	return redacted;
+}
+
+
+static void oauth2plugin_redactJSON(
+	cJSON* item
+) {
+	cJSON* child = NULL;
+	cJSON_ArrayForEach(child, item) {
+		if (cJSON_IsString(child) && child->valuestring) {
+			bool secret = oauth2plugin_isJWT(child->valuestring);
+			for (size_t i = 0; !secret && child->string && i < sizeof(oauth2plugin_capture_secret_keys) / sizeof(oauth2plugin_capture_secret_keys[0]); i++)
+				secret = strcmp(child->string, oauth2plugin_capture_secret_keys[i]) == 0;
+			if (secret) memset(child->valuestring, '*', strlen(child->valuestring));
+		} else {
+			oauth2plugin_redactJSON(child);
+		}
+	}
+}
+
+
+static void oauth2plugin_putCaptureInt(
+	unsigned char* buffer,
+	size_t* offset,
+	uint64_t value,
+	size_t bytes
+) {
+	for (size_t i = 0; i < bytes; i++) buffer[(*offset)++] = (unsigned char) (value >> (8 * i));
+}
+
+
+static bool oauth2plugin_getCaptureInt(
+	const unsigned char* buffer,
+	size_t size,
+	size_t* offset,
+	size_t bytes,
+	uint64_t* value
+) {
+	if (*offset + bytes > size) return false;
+	*value = 0;
+	for (size_t i = 0; i < bytes; i++) *value |= (uint64_t) buffer[(*offset)++] << (8 * i);
+	return true;
+}
+
+
+static bool oauth2plugin_getCaptureString(
+	const unsigned char* buffer,
+	size_t size,
+	size_t* offset,
+	size_t length_bytes,
+	bool present,
+	char** value
+) {
+	uint64_t length = 0;
+	if (!oauth2plugin_getCaptureInt(buffer, size, offset, length_bytes, &length)) return false;
+	if (*offset + length > size) return false;
+	if (present) {
+		*value = strndup((const char*) buffer + *offset, length);
+		if (!*value) return false;
+	}
+	*offset += length;
+	return true;
+}
@@ -0,0 +1,251 @@
+/**
+ * capture.h
+ *
+ * Capture of sanitized authentication events into a binary trace file
+ *
+ * Trace format (all integers little endian):
+ *   File header:	"O2PTRACE" (8 bytes), u32 version
+ *   Event:			u32 size of the remaining event bytes
+ *					i64 timestamp (microseconds since the epoch)
+ *					u32 total latency (microseconds)
+ *					u32 introspection latency (microseconds)
+ *					i32 mosquitto result code
+ *					u8  reason (enum oauth2plugin_AuditReason)
+ *					u8  flags (OAUTH2PLUGIN_CAPTURE_FLAG_*)
+ *					u16 HTTP status code (0 if the endpoint was not called)
+ *					u8[32] SHA-256 of the token
+ *					u32 token length
+ *					u16 client id length, client id bytes
+ *					u16 username length, username bytes
+ *					u32 response length, response bytes (secrets redacted)
+ *
+ * Readers skip unknown trailing event bytes, so fields can be appended in
+ * later versions.
+ */
+
+#ifndef OAUTH2PLUGIN_CAPTURE_H
+#define OAUTH2PLUGIN_CAPTURE_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include "cJSON.h"
+
+#include "tools.h"
+#include "jwt.h"
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_CAPTURE_MAGIC "O2PTRACE"
+#define OAUTH2PLUGIN_CAPTURE_VERSION 1
+
+#define OAUTH2PLUGIN_CAPTURE_FLAG_JWT		0x01	// Token has JWT structure.
+#define OAUTH2PLUGIN_CAPTURE_FLAG_USERNAME	0x02	// Client sent a username.
+#define OAUTH2PLUGIN_CAPTURE_FLAG_TOKEN		0x04	// Client sent a password (token).
+
+
+struct oauth2plugin_CaptureEvent {
+	int64_t			timestamp;								// Wall clock time in microseconds since the epoch.
+	uint32_t		total_latency;							// Authentication latency in microseconds.
+	uint32_t		introspection_latency;					// Introspection request latency in microseconds.
+	int32_t			result;									// Mosquitto result code.
+	uint8_t			reason;									// enum oauth2plugin_AuditReason.
+	uint8_t			flags;									// OAUTH2PLUGIN_CAPTURE_FLAG_*.
+	uint16_t		http_code;								// HTTP status code of the introspection response.
+	unsigned char	token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE];	// SHA-256 of the token.
+	uint32_t		token_length;							// Length of the token.
+	char*			client_id;								// MQTT client id.
+	char*			username;								// MQTT username sent by the client (NULL if none).
+	char*			response;								// Redacted introspection response (NULL if none).
+};
+
+
+struct oauth2plugin_Capture {
+	pthread_mutex_t		mutex;			// Serializes writes.
+	FILE*				file;			// Trace file.
+	atomic_long			references;		// Configurations using this capture.
+};
+
+
+/**
+ * @brief Open a trace file for writing.
+ *
+ * An existing file is truncated.
+ *
+ * @param file_path		Path of the trace file.
+ * @return				Pointer to a new capture or NULL on failure.
+ */
+struct oauth2plugin_Capture* oauth2plugin_initCapture(
+	const char* file_path
+);
+
+
+/**
+ * @brief Take an additional reference to a capture.
+ *
+ * @param capture	Capture.
+ * @return			@p capture.
+ */
+struct oauth2plugin_Capture* oauth2plugin_retainCapture(
+	struct oauth2plugin_Capture* capture
+);
+
+
+/**
+ * @brief Release a reference to a capture; the file is closed with the last one.
+ *
+ * @param capture	Capture created by oauth2plugin_initCapture(). May be NULL.
+ */
+void oauth2plugin_freeCapture(
+	struct oauth2plugin_Capture* capture
+);
+
+
+/**
+ * @brief Fill the token fields of an event (hash, length and shape).
+ *
+ * @param event		Event to update.
+ * @param token		Token sent by the client. May be NULL.
+ */
+void oauth2plugin_setCaptureToken(
+	struct oauth2plugin_CaptureEvent* event,
+	const char* token
+);
+
+
+/**
+ * @brief Append an event to the trace file.
+ *
+ * @param capture	Capture. May be NULL (event is ignored).
+ * @param event		Event to write.
+ * @return			MOSQ_ERR_SUCCESS on success or a mosquitto error code on failure.
+ */
+int oauth2plugin_writeCaptureEvent(
+	struct oauth2plugin_Capture* capture,
+	const struct oauth2plugin_CaptureEvent* event
+);
+
+
+/**
+ * @brief Check the header of a trace file opened for reading.
+ *
+ * @param file		Trace file positioned at the start.
+ * @return			true if the file is a supported trace.
+ */
+bool oauth2plugin_readCaptureHeader(
+	FILE* file
+);
+
+
+/**
+ * @brief Read the next event of a trace file.
+ *
+ * @param file		Trace file positioned after the header or a previous event.
+ * @param event		Output event. Release its strings with oauth2plugin_freeCaptureEvent().
+ * @return			true if an event was read, false at the end of the file or on a malformed event.
+ */
+bool oauth2plugin_readCaptureEvent(
+	FILE* file,
+	struct oauth2plugin_CaptureEvent* event
+);
+
+
+/**
+ * @brief Free the strings of an event.
+ *
+ * @param event		Event. May be NULL.
+ */
+void oauth2plugin_freeCaptureEvent(
+	struct oauth2plugin_CaptureEvent* event
+);
+
+
+/**
+ * @brief Redact secrets in an introspection response.
+ *
+ * String values of secret members (tokens, secrets, "jti") and string values
+ * that are JWTs are replaced by '*' characters of the same length, so the
+ * response keeps its size and structure.
+ *
+ * @param response	Introspection response.
+ * @return			Newly allocated redacted JSON, or NULL if @p response is not valid JSON. Caller is responsible for freeing it.
+ */
+char* oauth2plugin_redactResponse(
+	const char* response
+);
+
+
+/**
+ * @brief Recursively redact the members of a JSON value.
+ *
+ * @param item		JSON value.
+ */
+static void oauth2plugin_redactJSON(
+	cJSON* item
+);
+
+
+/**
+ * @brief Append a little endian integer to an event buffer.
+ *
+ * @param buffer	Event buffer.
+ * @param offset	Input/Output: write position.
+ * @param value		Value.
+ * @param bytes		Number of bytes (1, 2, 4 or 8).
+ */
+static void oauth2plugin_putCaptureInt(
+	unsigned char* buffer,
+	size_t* offset,
+	uint64_t value,
+	size_t bytes
+);
+
+
+/**
+ * @brief Read a little endian integer from an event buffer.
+ *
+ * @param buffer	Event buffer.
+ * @param size		Size of @p buffer.
+ * @param offset	Input/Output: read position.
+ * @param bytes		Number of bytes (1, 2, 4 or 8).
+ * @param value		Output: value.
+ * @return			false if the buffer is too short.
+ */
+static bool oauth2plugin_getCaptureInt(
+	const unsigned char* buffer,
+	size_t size,
+	size_t* offset,
+	size_t bytes,
+	uint64_t* value
+);
+
+
+/**
+ * @brief Read a length prefixed string from an event buffer.
+ *
+ * @param buffer		Event buffer.
+ * @param size			Size of @p buffer.
+ * @param offset		Input/Output: read position.
+ * @param length_bytes	Size of the length prefix (2 or 4).
+ * @param present		Whether the string is present (otherwise NULL is returned after skipping it).
+ * @param value			Output: newly allocated string or NULL.
+ * @return				false if the buffer is too short or allocation fails.
+ */
+static bool oauth2plugin_getCaptureString(
+	const unsigned char* buffer,
+	size_t size,
+	size_t* offset,
+	size_t length_bytes,
+	bool present,
+	char** value
+);
+
+#endif // OAUTH2PLUGIN_CAPTURE_H
@@ -0,0 +1,351 @@
+/**
+ * cluster.c
+ *
+ * Cluster-wide invalidation over an MQTT control topic
+ */
+
+#include "cluster.h"
+#include "config.h"
+
+
+struct oauth2plugin_Cluster* oauth2plugin_initCluster(
+	struct oauth2plugin_Plugin* plugin
+) {
+	struct oauth2plugin_Cluster* cluster = calloc(1, sizeof(*cluster));
+	if (!cluster) return NULL;
+	cluster->plugin = plugin;
+	atomic_init(&cluster->enabled, false);
+	atomic_init(&cluster->received, 0);
+	atomic_init(&cluster->published, 0);
+	atomic_init(&cluster->disconnected, 0);
+	pthread_mutex_init(&cluster->mutex, NULL);
+	return cluster;
+}
+
+
+void oauth2plugin_freeCluster(
+	struct oauth2plugin_Cluster* cluster
+) {
+	if (!cluster) return;
+	if (cluster->subscribed) mosquitto_callback_unregister(cluster->plugin->id, MOSQ_EVT_MESSAGE, oauth2plugin_callback_mosquittoMessage, NULL);
+	oauth2plugin_purgeInvalidatedTokens(cluster, INT64_MAX);
+	struct oauth2plugin_ClusterMessage* lists[] = { cluster->outbox, cluster->kicks };
+	for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+		while (lists[i]) {
+			struct oauth2plugin_ClusterMessage* next = lists[i]->next;
+			free(lists[i]);
+			lists[i] = next;
+		}
+	}
+	free(cluster->topic);
+	free(cluster->publishers);
+	pthread_mutex_destroy(&cluster->mutex);
+	free(cluster);
+}
+
+
+int oauth2plugin_configureCluster(
+	struct oauth2plugin_Cluster* cluster,
+	const struct oauth2plugin_Options* options
+) {
+	char* topic = options->invalidation_topic ? strdup(options->invalidation_topic) : NULL;
+	char* publishers = options->invalidation_publishers ? strdup(options->invalidation_publishers) : NULL;
+	if (
+		(options->invalidation_topic && !topic)
+		|| (options->invalidation_publishers && !publishers)
+	) {
+		free(topic);
+		free(publishers);
+		return MOSQ_ERR_NOMEM;
+	}
+
+	// Receive messages only while a control topic is configured
+	struct oauth2plugin_Plugin* plugin = cluster->plugin;
+	if (topic && !cluster->subscribed) {
+		int register_callback_error = mosquitto_callback_register(plugin->id, MOSQ_EVT_MESSAGE, oauth2plugin_callback_mosquittoMessage, NULL, plugin);
+		if (register_callback_error != MOSQ_ERR_SUCCESS) {
+			OAUTH2PLUGIN_LOG_ERROR("Cannot register message callback function (Error: %s).", mosquitto_strerror(register_callback_error));
+			free(topic);
+			free(publishers);
+			return register_callback_error;
+		}
+		cluster->subscribed = true;
+	} else if (!topic && cluster->subscribed) {
+		mosquitto_callback_unregister(plugin->id, MOSQ_EVT_MESSAGE, oauth2plugin_callback_mosquittoMessage, NULL);
+		cluster->subscribed = false;
+	}
+	free(cluster->topic);
+	free(cluster->publishers);
+	cluster->topic = topic;
+	cluster->publishers = publishers;
+	cluster->ttl = options->invalidation_ttl;
+
+	// Disabled: forget invalidated tokens and queued messages
+	atomic_store(&cluster->enabled, topic != NULL);
+	if (!topic) {
+		pthread_mutex_lock(&cluster->mutex);
+		oauth2plugin_purgeInvalidatedTokens(cluster, INT64_MAX);
+		while (cluster->outbox) {
+			struct oauth2plugin_ClusterMessage* next = cluster->outbox->next;
+			free(cluster->outbox);
+			cluster->outbox = next;
+		}
+		pthread_mutex_unlock(&cluster->mutex);
+	} else if (!publishers) {
+		OAUTH2PLUGIN_LOG_WARNING("No invalidation publishers configured, invalidation messages from other nodes are rejected.");
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+bool oauth2plugin_isTokenInvalidated(
+	struct oauth2plugin_Cluster* cluster,
+	const unsigned char token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE]
+) {
+	if (!cluster || !atomic_load(&cluster->enabled)) return false;
+
+	int64_t now = oauth2plugin_getRealTime() / 1000000;
+	size_t bucket = (size_t) (token_hash[0] | (token_hash[1] << 8)) & (OAUTH2PLUGIN_CLUSTER_BUCKETS - 1);
+	bool invalidated = false;
+	pthread_mutex_lock(&cluster->mutex);
+	for (struct oauth2plugin_InvalidatedToken* entry = cluster->tokens[bucket]; entry && !invalidated; entry = entry->next) {
+		invalidated = entry->expires_at > now && memcmp(entry->hash, token_hash, OAUTH2PLUGIN_TOKEN_HASH_SIZE) == 0;
+	}
+	pthread_mutex_unlock(&cluster->mutex);
+	return invalidated;
+}
+
+
+void oauth2plugin_announceInvalidToken(
+	struct oauth2plugin_Cluster* cluster,
+	const char* token
+) {
+	if (!cluster || !token || !atomic_load(&cluster->enabled)) return;
+
+	// Deny locally, announce once
+	unsigned char token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE];
+	if (!oauth2plugin_hashToken(token, token_hash)) return;
+	char message[sizeof("token ") + 2 * OAUTH2PLUGIN_TOKEN_HASH_SIZE];
+	memcpy(message, "token ", 6);
+	oauth2plugin_hexEncode(token_hash, OAUTH2PLUGIN_TOKEN_HASH_SIZE, message + 6);
+	pthread_mutex_lock(&cluster->mutex);
+	if (oauth2plugin_addInvalidatedToken(cluster, token_hash, oauth2plugin_getRealTime() / 1000000)) {
+		oauth2plugin_queueClusterMessage(&cluster->outbox, message);
+	}
+	pthread_mutex_unlock(&cluster->mutex);
+}
+
+
+void oauth2plugin_applyClusterInvalidations(
+	struct oauth2plugin_Cluster* cluster
+) {
+	if (!cluster || !atomic_load(&cluster->enabled)) return;
+
+	// Take queued messages and disconnects
+	int64_t now = oauth2plugin_getRealTime() / 1000000;
+	pthread_mutex_lock(&cluster->mutex);
+	struct oauth2plugin_ClusterMessage* outbox = cluster->outbox;
+	struct oauth2plugin_ClusterMessage* kicks = cluster->kicks;
+	cluster->outbox = NULL;
+	cluster->kicks = NULL;
+	if (now != cluster->purged_at) {
+		oauth2plugin_purgeInvalidatedTokens(cluster, now);
+		cluster->purged_at = now;
+	}
+	pthread_mutex_unlock(&cluster->mutex);
+
+	// Publish to the other nodes (bridges forward the control topic)
+	while (outbox) {
+		struct oauth2plugin_ClusterMessage* next = outbox->next;
+		int error = mosquitto_broker_publish_copy(NULL, cluster->topic, (int) strlen(outbox->text), outbox->text, OAUTH2PLUGIN_CLUSTER_QOS, false, NULL);
+		if (error) OAUTH2PLUGIN_LOG_WARNING("Failed to publish invalidation message (Error: %s).", mosquitto_strerror(error));
+		else atomic_fetch_add(&cluster->published, 1);
+		free(outbox);
+		outbox = next;
+	}
+
+	// Disconnect invalidated clients
+	while (kicks) {
+		struct oauth2plugin_ClusterMessage* next = kicks->next;
+		OAUTH2PLUGIN_LOG_INFO("Token was invalidated by the cluster, disconnecting client (MQTT Client ID: %s).", kicks->text);
+		mosquitto_kick_client_by_clientid(kicks->text, false);
+		atomic_fetch_add(&cluster->disconnected, 1);
+		free(kicks);
+		kicks = next;
+	}
+}
+
+
+int oauth2plugin_callback_mosquittoMessage(
+	int event,
+	void* event_data,
+	void* userdata
+) {
+	// Unused Parameters
+	(void) event;
+
+	// Only the control topic is of interest
+	struct mosquitto_evt_message* data = (struct mosquitto_evt_message*) event_data;
+	struct oauth2plugin_Plugin* plugin = (struct oauth2plugin_Plugin*) userdata;
+	struct oauth2plugin_Cluster* cluster = plugin->cluster;
+	if (
+		!cluster->topic
+		|| !data->topic
+		|| strcmp(data->topic, cluster->topic) != 0
+	) return MOSQ_ERR_SUCCESS;
+
+	// Only listed publishers (e.g. the bridge users of the other nodes) may invalidate
+	const char* mqtt_username = mosquitto_client_username(data->client);
+	if (!oauth2plugin_isClusterPublisher(cluster->publishers, mqtt_username)) {
+		OAUTH2PLUGIN_LOG_WARNING("Rejected invalidation message from unauthorized client (MQTT Client ID: %s).", mosquitto_client_id(data->client));
+		return MOSQ_ERR_ACL_DENIED;
+	}
+
+	// Apply (the message is still delivered, so bridges pass it on)
+	if (!oauth2plugin_applyInvalidationMessage(cluster, (const char*) data->payload, data->payloadlen)) {
+		OAUTH2PLUGIN_LOG_WARNING("Ignored malformed invalidation message (MQTT Client ID: %s).", mosquitto_client_id(data->client));
+		return MOSQ_ERR_SUCCESS;
+	}
+	atomic_fetch_add(&cluster->received, 1);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static bool oauth2plugin_applyInvalidationMessage(
+	struct oauth2plugin_Cluster* cluster,
+	const char* payload,
+	size_t length
+) {
+	struct oauth2plugin_SessionTable* sessions = cluster->plugin->sessions;
+	if (!payload) return false;
+	while (length > 0 && isspace((unsigned char) payload[length - 1])) length--;
+
+	// flush: forget tokens, revalidate every client on the next rounds
+	if (length == 5 && memcmp(payload, "flush", 5) == 0) {
+		OAUTH2PLUGIN_LOG_INFO("Flushing invalidated tokens on request of the cluster.");
+		pthread_mutex_lock(&cluster->mutex);
+		oauth2plugin_purgeInvalidatedTokens(cluster, INT64_MAX);
+		pthread_mutex_unlock(&cluster->mutex);
+		oauth2plugin_resetSessionValidation(sessions);
+		return true;
+	}
+
+	// token <hash>: deny and disconnect its clients
+	char** client_ids = NULL;
+	size_t count = 0;
+	if (length == 6 + 2 * OAUTH2PLUGIN_TOKEN_HASH_SIZE && memcmp(payload, "token ", 6) == 0) {
+		unsigned char token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE];
+		for (size_t i = 0; i < OAUTH2PLUGIN_TOKEN_HASH_SIZE; i++) {
+			char byte[3] = { payload[6 + 2 * i], payload[7 + 2 * i], '\0' };
+			if (!isxdigit((unsigned char) byte[0]) || !isxdigit((unsigned char) byte[1])) return false;
+			token_hash[i] = (unsigned char) strtoul(byte, NULL, 16);
+		}
+		pthread_mutex_lock(&cluster->mutex);
+		oauth2plugin_addInvalidatedToken(cluster, token_hash, oauth2plugin_getRealTime() / 1000000);
+		pthread_mutex_unlock(&cluster->mutex);
+		client_ids = oauth2plugin_findSessionClients(sessions, token_hash, 0, NULL, &count);
+	}
+
+	// sub <value>: disconnect its clients, they reconnect with fresh claims
+	else if (length > 4 && memcmp(payload, "sub ", 4) == 0) {
+		char* subject = strndup(payload + 4, length - 4);
+		if (!subject) return true;
+		for (size_t i = 0; i < oauth2plugin_oidc_template_placeholders_count; i++) {
+			if (strcmp(oauth2plugin_template_placeholders[i].oidc_key, "sub") != 0) continue;
+			client_ids = oauth2plugin_findSessionClients(sessions, NULL, i, subject, &count);
+			break;
+		}
+		free(subject);
+	}
+	else return false;
+
+	// Disconnect on the next tick
+	pthread_mutex_lock(&cluster->mutex);
+	for (size_t i = 0; i < count; i++) oauth2plugin_queueClusterMessage(&cluster->kicks, client_ids[i]);
+	pthread_mutex_unlock(&cluster->mutex);
+	for (size_t i = 0; i < count; i++) free(client_ids[i]);
+	free(client_ids);
+	return true;
+}
+
+
+static bool oauth2plugin_addInvalidatedToken(
+	struct oauth2plugin_Cluster* cluster,
+	const unsigned char token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE],
+	int64_t now
+) {
+	// Known: extend
+	size_t bucket = (size_t) (token_hash[0] | (token_hash[1] << 8)) & (OAUTH2PLUGIN_CLUSTER_BUCKETS - 1);
+	for (struct oauth2plugin_InvalidatedToken* entry = cluster->tokens[bucket]; entry; entry = entry->next) {
+		if (memcmp(entry->hash, token_hash, OAUTH2PLUGIN_TOKEN_HASH_SIZE) != 0) continue;
+		bool expired = entry->expires_at <= now;
+		entry->expires_at = now + cluster->ttl;
+		return expired;
+	}
+
+	// New
+	if (cluster->tokens_count >= OAUTH2PLUGIN_CLUSTER_MAX_TOKENS) {
+		OAUTH2PLUGIN_LOG_WARNING("Too many invalidated tokens, not remembering another one.");
+		return false;
+	}
+	struct oauth2plugin_InvalidatedToken* entry = malloc(sizeof(*entry));
+	if (!entry) return false;
+	memcpy(entry->hash, token_hash, OAUTH2PLUGIN_TOKEN_HASH_SIZE);
+	entry->expires_at = now + cluster->ttl;
+	entry->next = cluster->tokens[bucket];
+	cluster->tokens[bucket] = entry;
+	cluster->tokens_count++;
+	return true;
+}
+
+
+static void oauth2plugin_purgeInvalidatedTokens(
+	struct oauth2plugin_Cluster* cluster,
+	int64_t before
+) {
+	for (size_t i = 0; i < OAUTH2PLUGIN_CLUSTER_BUCKETS; i++) {
+		struct oauth2plugin_InvalidatedToken** link = &cluster->tokens[i];
+		while (*link) {
+			struct oauth2plugin_InvalidatedToken* entry = *link;
+			if (entry->expires_at > before) {
+				link = &entry->next;
+				continue;
+			}
+			*link = entry->next;
+			free(entry);
+			cluster->tokens_count--;
+		}
+	}
+}
+
+
+static void oauth2plugin_queueClusterMessage(
+	struct oauth2plugin_ClusterMessage** list,
+	const char* text
+) {
+	size_t length = strlen(text);
+	struct oauth2plugin_ClusterMessage* message = malloc(sizeof(*message) + length + 1);
+	if (!message) return;
+	memcpy(message->text, text, length + 1);
+	message->next = *list;
+	*list = message;
+}
+
+
+static bool oauth2plugin_isClusterPublisher(
+	const char* publishers,
+	const char* username
+) {
+	if (!username) return false;
+	size_t username_length = strlen(username);
+	const char* item = publishers;
+	while (item && *item) {
+		size_t item_length = strcspn(item, ",");
+		const char* next = item[item_length] ? item + item_length + 1 : item + item_length;
+		while (item_length > 0 && *item == ' ') { item++; item_length--; }
+		while (item_length > 0 && item[item_length - 1] == ' ') item_length--;
+		if (item_length == username_length && strncmp(item, username, item_length) == 0) return true;
+		item = next;
+	}
+	return false;
+}
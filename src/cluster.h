@@ -0,0 +1,243 @@
+/**
+ * cluster.h
+ *
+ * Cluster-wide invalidation over an MQTT control topic
+ *
+ * Messages (one command per message, UTF-8 text):
+ *   token <64 hex digits>	SHA-256 of a token that is no longer active
+ *   sub <value>			Subject whose claims changed (e.g. roles)
+ *   flush					Forget all invalidated tokens and revalidate all clients
+ */
+
+#ifndef OAUTH2PLUGIN_CLUSTER_H
+#define OAUTH2PLUGIN_CLUSTER_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+
+#include "options.h"
+#include "session.h"
+#include "tools.h"
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_CLUSTER_BUCKETS 1024				// Buckets of the invalidated tokens table (power of two).
+#define OAUTH2PLUGIN_CLUSTER_MAX_TOKENS 100000			// Invalidated tokens kept at most.
+#define OAUTH2PLUGIN_CLUSTER_QOS 1						// QoS of published invalidation messages.
+
+
+struct oauth2plugin_Plugin;
+
+
+struct oauth2plugin_InvalidatedToken {
+	struct oauth2plugin_InvalidatedToken*	next;									// Next token in the same bucket.
+	unsigned char							hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE];		// SHA-256 of the token.
+	int64_t									expires_at;								// Unix time in seconds the entry is dropped at.
+};
+
+
+struct oauth2plugin_ClusterMessage {
+	struct oauth2plugin_ClusterMessage*		next;			// Next queued message or client id.
+	char									text[];			// Message payload or MQTT client id.
+};
+
+
+struct oauth2plugin_Cluster {
+	struct oauth2plugin_Plugin*				plugin;			// Plugin state with sessions.
+	atomic_bool								enabled;		// A control topic is configured.
+	char*									topic;			// Control topic (broker thread only).
+	char*									publishers;		// Comma separated usernames allowed to publish on the topic (broker thread only).
+	bool									subscribed;		// The message callback is registered (broker thread only).
+	long									ttl;			// Seconds an invalidated token is denied.
+	pthread_mutex_t							mutex;			// Protects all fields below except the counters.
+	struct oauth2plugin_InvalidatedToken*	tokens[OAUTH2PLUGIN_CLUSTER_BUCKETS];	// Invalidated tokens by hash.
+	size_t									tokens_count;	// Number of invalidated tokens.
+	int64_t									purged_at;		// Unix time of the last removal of expired tokens.
+	struct oauth2plugin_ClusterMessage*		outbox;			// Messages to publish on the next tick.
+	struct oauth2plugin_ClusterMessage*		kicks;			// Clients to disconnect on the next tick.
+	atomic_ulong							received;		// Invalidation messages applied.
+	atomic_ulong							published;		// Invalidation messages published.
+	atomic_ulong							disconnected;	// Clients disconnected by invalidation messages.
+};
+
+
+/**
+ * @brief Create the cluster invalidation state (disabled until oauth2plugin_configureCluster()).
+ *
+ * @param plugin	Plugin state. Must outlive the cluster state.
+ * @return			Pointer to new state or NULL if allocation fails.
+ */
+struct oauth2plugin_Cluster* oauth2plugin_initCluster(
+	struct oauth2plugin_Plugin* plugin
+);
+
+
+/**
+ * @brief Release the cluster invalidation state and unregister its MESSAGE callback.
+ *
+ * @param cluster	State created by oauth2plugin_initCluster(). May be NULL.
+ */
+void oauth2plugin_freeCluster(
+	struct oauth2plugin_Cluster* cluster
+);
+
+
+/**
+ * @brief Apply the control topic settings of a configuration.
+ *
+ * Must be called on the broker thread (plugin init and MOSQ_EVT_RELOAD).
+ * Invalidated tokens are kept across reloads; disabling the topic drops them.
+ * The MESSAGE callback is registered only while a topic is configured, so
+ * brokers without cluster invalidation do not pay for it on every message.
+ *
+ * @param cluster	Cluster state.
+ * @param options	Configuration (default profile).
+ * @return			MOSQ_ERR_SUCCESS, MOSQ_ERR_NOMEM or the error of mosquitto_callback_register().
+ */
+int oauth2plugin_configureCluster(
+	struct oauth2plugin_Cluster* cluster,
+	const struct oauth2plugin_Options* options
+);
+
+
+/**
+ * @brief Check whether a token was invalidated by this or another node.
+ *
+ * Thread safe.
+ *
+ * @param cluster		Cluster state. May be NULL.
+ * @param token_hash	SHA-256 of the token (see oauth2plugin_hashToken()).
+ * @return				true if the token must be denied.
+ */
+bool oauth2plugin_isTokenInvalidated(
+	struct oauth2plugin_Cluster* cluster,
+	const unsigned char token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE]
+);
+
+
+/**
+ * @brief Deny a token found inactive and announce it to the other nodes.
+ *
+ * Thread safe. Only tokens this node had accepted before should be announced
+ * (failed revalidation or optimistic admission), so clients cannot flood the
+ * cluster with random tokens. Tokens already known are not announced again.
+ *
+ * @param cluster		Cluster state. May be NULL.
+ * @param token			Token.
+ */
+void oauth2plugin_announceInvalidToken(
+	struct oauth2plugin_Cluster* cluster,
+	const char* token
+);
+
+
+/**
+ * @brief Publish announced invalidations, disconnect invalidated clients and drop expired tokens.
+ *
+ * Must be called on the broker thread (MOSQ_EVT_TICK).
+ *
+ * @param cluster	Cluster state. May be NULL.
+ */
+void oauth2plugin_applyClusterInvalidations(
+	struct oauth2plugin_Cluster* cluster
+);
+
+
+/**
+ * @brief Mosquitto MESSAGE callback.
+ *
+ * Applies invalidation messages published on the control topic. Messages on
+ * the control topic from clients not listed in
+ * plugin_opt_invalidation_publishers are rejected. All other messages pass
+ * unchanged.
+ *
+ * @param event			Event type (unused, expected to be MOSQ_EVT_MESSAGE).
+ * @param event_data	Pointer to struct mosquitto_evt_message provided by Mosquitto.
+ * @param userdata		Plugin state.
+ * @return				MOSQ_ERR_SUCCESS or MOSQ_ERR_ACL_DENIED.
+ */
+int oauth2plugin_callback_mosquittoMessage(
+	int event,
+	void* event_data,
+	void* userdata
+);
+
+
+/**
+ * @brief Apply one invalidation message.
+ *
+ * @param cluster	Cluster state.
+ * @param payload	Message payload.
+ * @param length	Length of @p payload.
+ * @return			true if the message was understood.
+ */
+static bool oauth2plugin_applyInvalidationMessage(
+	struct oauth2plugin_Cluster* cluster,
+	const char* payload,
+	size_t length
+);
+
+
+/**
+ * @brief Remember an invalidated token.
+ *
+ * @param cluster		Cluster state (locked).
+ * @param token_hash	SHA-256 of the token.
+ * @param now			Current Unix time in seconds.
+ * @return				true if the token was not known before.
+ */
+static bool oauth2plugin_addInvalidatedToken(
+	struct oauth2plugin_Cluster* cluster,
+	const unsigned char token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE],
+	int64_t now
+);
+
+
+/**
+ * @brief Drop invalidated tokens, all or only the expired ones.
+ *
+ * @param cluster	Cluster state (locked).
+ * @param before	Drop entries expiring at or before this Unix time (INT64_MAX = all).
+ */
+static void oauth2plugin_purgeInvalidatedTokens(
+	struct oauth2plugin_Cluster* cluster,
+	int64_t before
+);
+
+
+/**
+ * @brief Queue a text for the next tick.
+ *
+ * @param list	List to add to (oauth2plugin_Cluster.outbox or .kicks, locked).
+ * @param text	Text to copy.
+ */
+static void oauth2plugin_queueClusterMessage(
+	struct oauth2plugin_ClusterMessage** list,
+	const char* text
+);
+
+
+/**
+ * @brief Check whether a username is listed in plugin_opt_invalidation_publishers.
+ *
+ * @param publishers	Comma separated usernames. May be NULL.
+ * @param username		Username. May be NULL.
+ * @return				true if @p username is listed.
+ */
+static bool oauth2plugin_isClusterPublisher(
+	const char* publishers,
+	const char* username
+);
+
+#endif // OAUTH2PLUGIN_CLUSTER_H
@@ -0,0 +1,541 @@
+/**
+ * config.c
+ *
+ * Load, publish and hot reload the plugin configuration
+ */
+
+#include "config.h"
+
+
+struct oauth2plugin_Plugin* oauth2plugin_initPlugin(
+	mosquitto_plugin_id_t* identifier,
+	const struct mosquitto_opt* mosquitto_options,
+	const int mosquitto_options_count,
+	int* error
+) {
+	struct oauth2plugin_Plugin* plugin = calloc(1, sizeof(*plugin));
+	if (!plugin) {
+		*error = MOSQ_ERR_NOMEM;
+		return NULL;
+	}
+	plugin->id = identifier;
+	pthread_mutex_init(&plugin->options_mutex, NULL);
+
+	// Messages of background threads are logged on the next tick of this thread
+	oauth2plugin_setLogBrokerThread();
+
+	// Create resolver (shared by all profiles and configurations, TTLs are set by oauth2plugin_loadOptions())
+	plugin->resolver = oauth2plugin_initResolver(0, 0);
+	if (!plugin->resolver) {
+		*error = MOSQ_ERR_NOMEM;
+		oauth2plugin_freePlugin(plugin);
+		return NULL;
+	}
+
+	// Create session records (claim values are interned, shared by all clients)
+	plugin->strings = oauth2plugin_initStringPool();
+	plugin->sessions = plugin->strings ? oauth2plugin_initSessionTable(plugin->strings) : NULL;
+	if (!plugin->sessions) {
+		*error = MOSQ_ERR_NOMEM;
+		oauth2plugin_freePlugin(plugin);
+		return NULL;
+	}
+
+	// Load configuration
+	plugin->options = oauth2plugin_loadOptions(plugin, mosquitto_options, mosquitto_options_count, NULL, error);
+	if (!plugin->options) {
+		oauth2plugin_freePlugin(plugin);
+		return NULL;
+	}
+
+	// Join cluster invalidation (idle unless plugin_opt_invalidation_topic is set)
+	plugin->cluster = oauth2plugin_initCluster(plugin);
+	*error = plugin->cluster ? oauth2plugin_configureCluster(plugin->cluster, plugin->options) : MOSQ_ERR_NOMEM;
+	if (*error != MOSQ_ERR_SUCCESS) {
+		oauth2plugin_freePlugin(plugin);
+		return NULL;
+	}
+
+	// Prepare revalidation of connected clients (thread started once plugin_opt_revalidation_rate is set)
+	plugin->revalidator = oauth2plugin_initRevalidator(plugin);
+	*error = plugin->revalidator ? oauth2plugin_configureRevalidator(plugin->revalidator, plugin->options) : MOSQ_ERR_NOMEM;
+	if (*error != MOSQ_ERR_SUCCESS) {
+		oauth2plugin_freePlugin(plugin);
+		return NULL;
+	}
+
+	// Create queue for optimistic admission (workers are started with the first admitted client)
+	plugin->admission = oauth2plugin_initAdmission(plugin);
+	if (!plugin->admission) {
+		*error = MOSQ_ERR_NOMEM;
+		oauth2plugin_freePlugin(plugin);
+		return NULL;
+	}
+
+	return plugin;
+}
+
+
+void oauth2plugin_freePlugin(
+	struct oauth2plugin_Plugin* plugin
+) {
+	if (!plugin) return;
+	oauth2plugin_freeAdmission(plugin->admission);
+	oauth2plugin_freeRevalidator(plugin->revalidator);
+	oauth2plugin_freeCluster(plugin->cluster);
+	oauth2plugin_releaseOptions(plugin, plugin->options);
+	oauth2plugin_freeResolver(plugin->resolver);
+	oauth2plugin_freeSessionTable(plugin->sessions);
+	oauth2plugin_freeStringPool(plugin->strings);
+	pthread_mutex_destroy(&plugin->options_mutex);
+	free(plugin);
+	oauth2plugin_flushLog();
+}
+
+
+struct oauth2plugin_Options* oauth2plugin_acquireOptions(
+	struct oauth2plugin_Plugin* plugin
+) {
+	pthread_mutex_lock(&plugin->options_mutex);
+	struct oauth2plugin_Options* options = plugin->options;
+	options->references++;
+	pthread_mutex_unlock(&plugin->options_mutex);
+	return options;
+}
+
+
+void oauth2plugin_releaseOptions(
+	struct oauth2plugin_Plugin* plugin,
+	struct oauth2plugin_Options* options
+) {
+	if (!options) return;
+	pthread_mutex_lock(&plugin->options_mutex);
+	long references = --options->references;
+	pthread_mutex_unlock(&plugin->options_mutex);
+	if (references == 0) oauth2plugin_freeOptions(options);
+}
+
+
+int oauth2plugin_callback_mosquittoReload(
+	int event,
+	void* event_data,
+	void* userdata
+) {
+	// Unused Parameters
+	(void) event;
+
+	// Init
+	struct mosquitto_evt_reload* data = (struct mosquitto_evt_reload*) event_data;
+	struct oauth2plugin_Plugin* plugin = (struct oauth2plugin_Plugin*) userdata;
+
+	// Log
+	OAUTH2PLUGIN_LOG_INFO("Reloading configuration...");
+
+	// Load new configuration, carrying over state from the current one
+	struct oauth2plugin_Options* previous = oauth2plugin_acquireOptions(plugin);
+	int load_options_error = MOSQ_ERR_SUCCESS;
+	struct oauth2plugin_Options* options = oauth2plugin_loadOptions(plugin, data->options, data->option_count, previous, &load_options_error);
+	oauth2plugin_releaseOptions(plugin, previous);
+	if (!options) {
+		oauth2plugin_setLogSettings(plugin->options->log_level, plugin->options->log_sensitive);
+		oauth2plugin_setResolverTTL(plugin->resolver, plugin->options->dns_min_ttl, plugin->options->dns_max_ttl);
+		oauth2plugin_pruneResolverHosts(plugin, plugin->options);
+		OAUTH2PLUGIN_LOG_ERROR("Failed to reload configuration (Error: %s). Keeping current configuration.", mosquitto_strerror(load_options_error));
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	// Publish new configuration; the old one is freed once its last reader is done
+	pthread_mutex_lock(&plugin->options_mutex);
+	previous = plugin->options;
+	plugin->options = options;
+	pthread_mutex_unlock(&plugin->options_mutex);
+	oauth2plugin_releaseOptions(plugin, previous);
+
+	// Drop cached addresses of endpoints that are no longer used
+	oauth2plugin_pruneResolverHosts(plugin, options);
+
+	// Follow control topic changes
+	int configure_cluster_error = oauth2plugin_configureCluster(plugin->cluster, options);
+	if (configure_cluster_error) OAUTH2PLUGIN_LOG_WARNING("Failed to apply cluster invalidation settings (Error: %s).", mosquitto_strerror(configure_cluster_error));
+
+	// Follow revalidation rate changes
+	int configure_revalidator_error = oauth2plugin_configureRevalidator(plugin->revalidator, options);
+	if (configure_revalidator_error) OAUTH2PLUGIN_LOG_WARNING("Failed to apply revalidation settings (Error: %s).", mosquitto_strerror(configure_revalidator_error));
+
+	// Log
+	pthread_mutex_lock(&plugin->sessions->mutex);
+	size_t sessions_count = plugin->sessions->count;
+	pthread_mutex_unlock(&plugin->sessions->mutex);
+	pthread_mutex_lock(&plugin->strings->mutex);
+	size_t strings_count = plugin->strings->count;
+	size_t strings_bytes = plugin->strings->bytes;
+	pthread_mutex_unlock(&plugin->strings->mutex);
+	OAUTH2PLUGIN_LOG_INFO("Configuration reloaded.");
+	OAUTH2PLUGIN_LOG_DEBUG(" - Sessions: %zu (%zu interned claim values, %zu bytes)", sessions_count, strings_count, strings_bytes);
+	OAUTH2PLUGIN_LOG_DEBUG(" - Revalidation: %lu tokens checked, %lu clients disconnected", atomic_load(&plugin->revalidator->revalidated), atomic_load(&plugin->revalidator->disconnected));
+	OAUTH2PLUGIN_LOG_DEBUG(" - Optimistic admission: %lu clients admitted, %ld pending, %lu disconnected", atomic_load(&plugin->admission->admitted), atomic_load(&plugin->admission->pending), atomic_load(&plugin->admission->disconnected));
+	OAUTH2PLUGIN_LOG_DEBUG(" - Cluster invalidation: %lu messages received, %lu published, %lu clients disconnected", atomic_load(&plugin->cluster->received), atomic_load(&plugin->cluster->published), atomic_load(&plugin->cluster->disconnected));
+	for (size_t i = 0; i < verifier_COUNT; i++) {
+		struct oauth2plugin_VerifierStats* stats = &plugin->verifier_stats[i];
+		unsigned long calls = atomic_load(&stats->calls);
+		if (calls == 0) continue;
+		OAUTH2PLUGIN_LOG_DEBUG(" - Verifier '%s': %lu tokens, %lu hits, %lu misses, %lu failures, %lu us average", oauth2plugin_Options_verifier_toString((enum oauth2plugin_Options_verifier) i), calls, atomic_load(&stats->hits), atomic_load(&stats->misses), atomic_load(&stats->failures), atomic_load(&stats->latency) / calls);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int oauth2plugin_callback_mosquittoTick(
+	int event,
+	void* event_data,
+	void* userdata
+) {
+	// Unused Parameters
+	(void) event;
+	(void) event_data;
+
+	// Swap in rebuilt revocation filter and token stores
+	struct oauth2plugin_Plugin* plugin = (struct oauth2plugin_Plugin*) userdata;
+	struct oauth2plugin_Options* options = oauth2plugin_acquireOptions(plugin);
+	oauth2plugin_publishRevocationFilter(options->revocation_list);
+	for (size_t i = 0; i <= options->profiles_count; i++) {
+		struct oauth2plugin_Options* profile = i == 0 ? options : options->profiles[i - 1];
+		oauth2plugin_publishTokenStore(profile->token_store);
+	}
+	oauth2plugin_releaseOptions(plugin, options);
+
+	// Disconnect clients whose tokens failed revalidation
+	oauth2plugin_applyRevalidation(plugin->revalidator);
+
+	// Apply verdicts of optimistically admitted clients
+	oauth2plugin_applyAdmission(plugin->admission);
+
+	// Publish and apply cluster invalidations
+	oauth2plugin_applyClusterInvalidations(plugin->cluster);
+
+	// Log messages of background threads
+	oauth2plugin_flushLog();
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static struct oauth2plugin_Options* oauth2plugin_loadOptions(
+	struct oauth2plugin_Plugin* plugin,
+	const struct mosquitto_opt* mosquitto_options,
+	const int mosquitto_options_count,
+	const struct oauth2plugin_Options* previous,
+	int* error
+) {
+	// Handle plugin_opt_* options from mosquitto.conf file
+	struct oauth2plugin_Options* options = oauth2plugin_initOptions();
+	if (!options) {
+		*error = MOSQ_ERR_NOMEM;
+		return NULL;
+	}
+	options->id = plugin->id;
+	options->references = 1;
+
+	// Apply options from mosquitto.conf
+	int apply_options_error = oauth2plugin_applyOptions(options, mosquitto_options, mosquitto_options_count);
+	if (apply_options_error) {
+		if (apply_options_error == MOSQ_ERR_INVAL)
+			OAUTH2PLUGIN_LOG_ERROR("Options 'plugin_opt_introspection_endpoint' (or 'plugin_opt_issuer'), 'plugin_opt_client_id' and 'plugin_opt_client_secret' (or 'plugin_opt_client_assertion_key' with 'plugin_opt_client_authentication private_key_jwt', or 'plugin_opt_sidecar_socket' with 'plugin_opt_verifier sidecar') are mandatory.");
+		oauth2plugin_freeOptions(options);
+		*error = apply_options_error;
+		return NULL;
+	}
+
+	// Apply log settings (before preparing endpoints, so their messages are filtered already)
+	oauth2plugin_setLogSettings(options->log_level, options->log_sensitive);
+
+	// Apply resolver settings (restored by the reload callback if loading fails)
+	oauth2plugin_setResolverTTL(plugin->resolver, options->dns_min_ttl, options->dns_max_ttl);
+
+	// Load token stores, discover endpoints, resolve addresses and open warm connections of all profiles
+	for (size_t i = 0; i <= options->profiles_count; i++) {
+		struct oauth2plugin_Options* profile = i == 0 ? options : options->profiles[i - 1];
+		profile->verifier_stats = plugin->verifier_stats;
+		int prepare_token_store_error = oauth2plugin_prepareTokenStore(
+			profile,
+			i == 0 ? NULL : options,
+			oauth2plugin_findPreviousProfile(previous, profile->name)
+		);
+		if (prepare_token_store_error) {
+			oauth2plugin_freeOptions(options);
+			*error = prepare_token_store_error;
+			return NULL;
+		}
+		if (oauth2plugin_hasVerifierStage(profile, verifier_SIDECAR)) {
+			int prepare_sidecar_error = oauth2plugin_prepareSidecar(
+				profile,
+				oauth2plugin_findPreviousProfile(previous, profile->name)
+			);
+			if (prepare_sidecar_error) {
+				oauth2plugin_freeOptions(options);
+				*error = prepare_sidecar_error;
+				return NULL;
+			}
+		}
+		if (!oauth2plugin_hasVerifierStage(profile, verifier_INTROSPECTION)) continue;
+		if (!profile->introspection_endpoint && !profile->issuer) continue; // Default profile without endpoint
+		int prepare_endpoint_error = oauth2plugin_prepareEndpoint(
+			profile,
+			plugin->resolver,
+			oauth2plugin_findPreviousProfile(previous, profile->name)
+		);
+		if (prepare_endpoint_error) {
+			OAUTH2PLUGIN_LOG_ERROR("Cannot prepare introspection endpoint (Profile: %s).", profile->name ? profile->name : "<Default>");
+			oauth2plugin_freeOptions(options);
+			*error = prepare_endpoint_error;
+			return NULL;
+		}
+		int prepare_credentials_error = oauth2plugin_prepareCredentials(
+			profile,
+			plugin->resolver,
+			oauth2plugin_findPreviousProfile(previous, profile->name)
+		);
+		if (prepare_credentials_error) {
+			OAUTH2PLUGIN_LOG_ERROR("Cannot prepare client authentication '%s' (Profile: %s).", oauth2plugin_Options_client_authentication_toString(profile->client_authentication), profile->name ? profile->name : "<Default>");
+			oauth2plugin_freeOptions(options);
+			*error = prepare_credentials_error;
+			return NULL;
+		}
+	}
+
+	// Open audit log (kept across reloads if its settings did not change)
+	int prepare_audit_log_error = oauth2plugin_prepareAuditLog(options, previous);
+	if (prepare_audit_log_error) {
+		oauth2plugin_freeOptions(options);
+		*error = prepare_audit_log_error;
+		return NULL;
+	}
+
+	// Load revocation list (kept across reloads if its settings did not change)
+	int prepare_revocation_list_error = oauth2plugin_prepareRevocationList(options, previous);
+	if (prepare_revocation_list_error) {
+		oauth2plugin_freeOptions(options);
+		*error = prepare_revocation_list_error;
+		return NULL;
+	}
+
+	// Open capture trace (kept across reloads if the file did not change)
+	if (options->capture_file) {
+		if (
+			previous
+			&& previous->capture
+			&& oauth2plugin_strEqual(options->capture_file, previous->capture_file)
+		) {
+			options->capture = oauth2plugin_retainCapture(previous->capture);
+		} else {
+			options->capture = oauth2plugin_initCapture(options->capture_file);
+			if (!options->capture) {
+				oauth2plugin_freeOptions(options);
+				*error = MOSQ_ERR_UNKNOWN;
+				return NULL;
+			}
+			OAUTH2PLUGIN_LOG_WARNING("Capturing authentication events to %s.", options->capture_file);
+		}
+	}
+
+	// Return
+	*error = MOSQ_ERR_SUCCESS;
+	return options;
+}
+
+
+static int oauth2plugin_prepareAuditLog(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_Options* previous
+) {
+	if (!options->audit_log_file) return MOSQ_ERR_SUCCESS;
+
+	// Reuse the writer of the previous configuration
+	if (
+		previous
+		&& previous->audit_log
+		&& oauth2plugin_strEqual(options->audit_log_file, previous->audit_log_file)
+		&& options->audit_log_max_size == previous->audit_log_max_size
+		&& options->audit_log_rotate_count == previous->audit_log_rotate_count
+		&& options->audit_log_buffer_size == previous->audit_log_buffer_size
+	) {
+		options->audit_log = oauth2plugin_retainAuditLog(previous->audit_log);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	// Open new audit log
+	options->audit_log = oauth2plugin_initAuditLog(
+		options->audit_log_file,
+		options->audit_log_max_size,
+		options->audit_log_rotate_count,
+		options->audit_log_buffer_size
+	);
+	if (!options->audit_log) {
+		OAUTH2PLUGIN_LOG_ERROR("Cannot open audit log %s.", options->audit_log_file);
+		return MOSQ_ERR_UNKNOWN;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int oauth2plugin_prepareRevocationList(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_Options* previous
+) {
+	if (!options->revocation_file) return MOSQ_ERR_SUCCESS;
+
+	// Reuse the list of the previous configuration
+	if (
+		previous
+		&& previous->revocation_list
+		&& oauth2plugin_strEqual(options->revocation_file, previous->revocation_file)
+		&& oauth2plugin_strEqual(options->revocation_index_file, previous->revocation_index_file)
+		&& options->revocation_check_interval == previous->revocation_check_interval
+	) {
+		options->revocation_list = oauth2plugin_retainRevocationList(previous->revocation_list);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	// Load new list
+	options->revocation_list = oauth2plugin_initRevocationList(
+		options->revocation_file,
+		options->revocation_index_file,
+		options->revocation_check_interval
+	);
+	if (!options->revocation_list) {
+		OAUTH2PLUGIN_LOG_ERROR("Cannot load revocation list %s.", options->revocation_file);
+		return MOSQ_ERR_UNKNOWN;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int oauth2plugin_prepareTokenStore(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_Options* shared,
+	const struct oauth2plugin_Options* previous
+) {
+	if (!options->token_store_file) return MOSQ_ERR_SUCCESS;
+
+	// Reuse the store of the default profile or of the previous configuration
+	const struct oauth2plugin_Options* candidates[] = { shared, previous };
+	for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+		const struct oauth2plugin_Options* candidate = candidates[i];
+		if (
+			candidate
+			&& candidate->token_store
+			&& oauth2plugin_strEqual(options->token_store_file, candidate->token_store_file)
+			&& oauth2plugin_strEqual(options->token_store_index_file, candidate->token_store_index_file)
+			&& options->token_store_check_interval == candidate->token_store_check_interval
+		) {
+			options->token_store = oauth2plugin_retainTokenStore(candidate->token_store);
+			return MOSQ_ERR_SUCCESS;
+		}
+	}
+
+	// Load new store
+	options->token_store = oauth2plugin_initTokenStore(
+		options->token_store_file,
+		options->token_store_index_file,
+		options->token_store_check_interval
+	);
+	if (!options->token_store) {
+		OAUTH2PLUGIN_LOG_ERROR("Cannot load token store %s (Profile: %s).", options->token_store_file, options->name ? options->name : "<Default>");
+		return MOSQ_ERR_UNKNOWN;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int oauth2plugin_prepareSidecar(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_Options* previous
+) {
+	// Reuse the connection of the previous configuration
+	if (
+		previous
+		&& previous->sidecar
+		&& oauth2plugin_strEqual(options->sidecar_socket, previous->sidecar_socket)
+		&& options->timeout == previous->timeout
+	) {
+		options->sidecar = oauth2plugin_retainSidecar(previous->sidecar);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	// Connect lazily with the first request, so the broker may start before the sidecar
+	options->sidecar = oauth2plugin_initSidecar(options->sidecar_socket, options->timeout);
+	if (!options->sidecar) return MOSQ_ERR_NOMEM;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int oauth2plugin_prepareCredentials(
+	struct oauth2plugin_Options* options,
+	struct oauth2plugin_Resolver* resolver,
+	const struct oauth2plugin_Options* previous
+) {
+	if (options->client_authentication == client_authentication_CLIENT_SECRET_BASIC) return MOSQ_ERR_SUCCESS;
+
+	// Token endpoint is needed to obtain access tokens
+	if (
+		options->client_authentication == client_authentication_CLIENT_CREDENTIALS
+		&& !options->token_endpoint
+	) {
+		OAUTH2PLUGIN_LOG_ERROR("Option 'plugin_opt_token_endpoint' is mandatory for client authentication 'client_credentials' unless the issuer publishes one.");
+		return MOSQ_ERR_INVAL;
+	}
+
+	// Reuse the cached access token of the previous configuration
+	if (
+		previous
+		&& previous->credentials
+		&& options->client_authentication == client_authentication_CLIENT_CREDENTIALS
+		&& previous->client_authentication == client_authentication_CLIENT_CREDENTIALS
+		&& oauth2plugin_strEqual(options->client_id, previous->client_id)
+		&& oauth2plugin_strEqual(options->client_secret, previous->client_secret)
+		&& oauth2plugin_strEqual(options->token_endpoint, previous->token_endpoint)
+		&& oauth2plugin_strEqual(options->token_scope, previous->token_scope)
+		&& options->tls_verification == previous->tls_verification
+		&& options->timeout == previous->timeout
+	) {
+		options->credentials = oauth2plugin_retainCredentials(previous->credentials);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	// Create credentials (the first access token is requested in background)
+	if (options->client_authentication == client_authentication_CLIENT_CREDENTIALS) oauth2plugin_addResolverHost(resolver, options->token_endpoint);
+	options->credentials = oauth2plugin_initCredentials(options);
+	if (!options->credentials) return MOSQ_ERR_UNKNOWN;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static const struct oauth2plugin_Options* oauth2plugin_findPreviousProfile(
+	const struct oauth2plugin_Options* options,
+	const char* name
+) {
+	if (!options) return NULL;
+	if (!name) return options;
+	for (size_t i = 0; i < options->profiles_count; i++) {
+		if (oauth2plugin_strEqual(options->profiles[i]->name, name)) return options->profiles[i];
+	}
+	return NULL;
+}
+
+
+static void oauth2plugin_pruneResolverHosts(
+	struct oauth2plugin_Plugin* plugin,
+	const struct oauth2plugin_Options* options
+) {
+	// Collect the endpoints registered by oauth2plugin_prepareEndpoint() and oauth2plugin_prepareCredentials()
+	size_t urls_count = 0;
+	const char** urls = calloc(2 * (options->profiles_count + 1), sizeof(*urls));
+	if (!urls) return;
+	for (size_t i = 0; i <= options->profiles_count; i++) {
+		const struct oauth2plugin_Options* profile = i == 0 ? options : options->profiles[i - 1];
+		urls[urls_count++] = profile->introspection_endpoint;
+		if (profile->client_authentication == client_authentication_CLIENT_CREDENTIALS) urls[urls_count++] = profile->token_endpoint;
+	}
+
+	oauth2plugin_retainResolverHosts(plugin->resolver, urls, urls_count);
+	free(urls);
+}
@@ -0,0 +1,279 @@
+/**
+ * config.h
+ *
+ * Load, publish and hot reload the plugin configuration
+ */
+
+#ifndef OAUTH2PLUGIN_CONFIG_H
+#define OAUTH2PLUGIN_CONFIG_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+
+#include "options.h"
+#include "resolver.h"
+#include "discovery.h"
+#include "audit.h"
+#include "capture.h"
+#include "revocation.h"
+#include "tokenstore.h"
+#include "verifier.h"
+#include "sidecar.h"
+#include "credentials.h"
+#include "intern.h"
+#include "session.h"
+#include "revalidate.h"
+#include "admission.h"
+#include "cluster.h"
+#include "log.h"
+
+
+struct oauth2plugin_Plugin {
+	mosquitto_plugin_id_t*				id;					// Plugin ID from MQTT Broker.
+	pthread_mutex_t						options_mutex;		// Protects options and the reference counts of all options generations.
+	struct oauth2plugin_Options*		options;			// Current configuration (holds one reference).
+	struct oauth2plugin_Resolver*		resolver;			// Address cache shared by all profiles and configurations.
+	struct oauth2plugin_StringPool*		strings;			// Interned claim values and profile names.
+	struct oauth2plugin_SessionTable*	sessions;			// Authenticated clients (kept across reloads).
+	struct oauth2plugin_Revalidator*	revalidator;		// Background revalidation of connected clients.
+	struct oauth2plugin_Admission*		admission;			// Background verification of optimistically admitted clients.
+	struct oauth2plugin_Cluster*		cluster;			// Invalidations shared with other nodes over the control topic.
+	struct oauth2plugin_VerifierStats	verifier_stats[verifier_COUNT];	// Latency and hit counts per verifier stage (kept across reloads).
+};
+
+
+/**
+ * @brief Allocate the plugin state and load the initial configuration.
+ *
+ * @param identifier				Plugin identifier provided by Mosquitto.
+ * @param mosquitto_options			Array of options supplied by the broker.
+ * @param mosquitto_options_count	Number of entries in @p mosquitto_options.
+ * @param error						Output: mosquitto error code if NULL is returned.
+ * @return							Pointer to the plugin state or NULL on failure.
+ */
+struct oauth2plugin_Plugin* oauth2plugin_initPlugin(
+	mosquitto_plugin_id_t* identifier,
+	const struct mosquitto_opt* mosquitto_options,
+	const int mosquitto_options_count,
+	int* error
+);
+
+
+/**
+ * @brief Release the plugin state and the current configuration.
+ *
+ * @param plugin	Plugin state created by oauth2plugin_initPlugin(). May be NULL.
+ */
+void oauth2plugin_freePlugin(
+	struct oauth2plugin_Plugin* plugin
+);
+
+
+/**
+ * @brief Get a reference to the current configuration.
+ *
+ * The returned configuration stays valid until it is handed back with
+ * oauth2plugin_releaseOptions(), even if a reload publishes a new one in the
+ * meantime (RCU-style: readers never wait for reloads and finish on the
+ * configuration they started with).
+ *
+ * @param plugin	Plugin state.
+ * @return			Current configuration.
+ */
+struct oauth2plugin_Options* oauth2plugin_acquireOptions(
+	struct oauth2plugin_Plugin* plugin
+);
+
+
+/**
+ * @brief Hand back a reference obtained by oauth2plugin_acquireOptions().
+ *
+ * The configuration is freed when its last reference is released.
+ *
+ * @param plugin	Plugin state.
+ * @param options	Configuration to release. May be NULL.
+ */
+void oauth2plugin_releaseOptions(
+	struct oauth2plugin_Plugin* plugin,
+	struct oauth2plugin_Options* options
+);
+
+
+/**
+ * @brief Mosquitto RELOAD callback.
+ *
+ * Parses the new plugin_opt_* values into a new configuration and publishes it
+ * atomically. Connection pools, discovered endpoints and cached addresses that
+ * are still valid under the new configuration are carried over. If the new
+ * configuration is invalid, the current one is kept. Control topic settings
+ * for cluster invalidation and the revalidation rate are applied as well.
+ *
+ * @param event			Event type (unused, expected to be MOSQ_EVT_RELOAD).
+ * @param event_data	Pointer to struct mosquitto_evt_reload provided by Mosquitto.
+ * @param userdata		Plugin state.
+ * @return				MOSQ_ERR_SUCCESS.
+ */
+int oauth2plugin_callback_mosquittoReload(
+	int event,
+	void* event_data,
+	void* userdata
+);
+
+
+/**
+ * @brief Mosquitto TICK callback.
+ *
+ * Publishes revocation filters rebuilt by the background watcher, so the old
+ * filter is only unmapped on the broker thread that reads it, disconnects
+ * clients whose tokens failed background revalidation, applies the verdicts
+ * of optimistically admitted clients, exchanges cluster invalidations and logs
+ * the messages of background threads.
+ *
+ * @param event			Event type (unused, expected to be MOSQ_EVT_TICK).
+ * @param event_data	Pointer to struct mosquitto_evt_tick provided by Mosquitto (unused).
+ * @param userdata		Plugin state.
+ * @return				MOSQ_ERR_SUCCESS.
+ */
+int oauth2plugin_callback_mosquittoTick(
+	int event,
+	void* event_data,
+	void* userdata
+);
+
+
+/**
+ * @brief Parse options and prepare the endpoints of all profiles.
+ *
+ * @param plugin					Plugin state.
+ * @param mosquitto_options			Array of options supplied by the broker.
+ * @param mosquitto_options_count	Number of entries in @p mosquitto_options.
+ * @param previous					Configuration to carry state over from. May be NULL.
+ * @param error						Output: mosquitto error code if NULL is returned.
+ * @return							New configuration with one reference or NULL on failure.
+ */
+static struct oauth2plugin_Options* oauth2plugin_loadOptions(
+	struct oauth2plugin_Plugin* plugin,
+	const struct mosquitto_opt* mosquitto_options,
+	const int mosquitto_options_count,
+	const struct oauth2plugin_Options* previous,
+	int* error
+);
+
+
+/**
+ * @brief Open the audit log of a configuration.
+ *
+ * If @p previous writes to the same file with the same settings, its writer is
+ * reused so no records are lost during a reload.
+ *
+ * @param options	New configuration (default profile).
+ * @param previous	Configuration to carry the audit log over from. May be NULL.
+ * @return			MOSQ_ERR_SUCCESS on success (also if no audit log is configured) or a mosquitto error code on failure.
+ */
+static int oauth2plugin_prepareAuditLog(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_Options* previous
+);
+
+
+/**
+ * @brief Load the revocation list of a configuration.
+ *
+ * If @p previous uses the same files and check interval, its list is reused
+ * so the index is neither recompiled nor remapped during a reload.
+ *
+ * @param options	New configuration (default profile).
+ * @param previous	Configuration to carry the revocation list over from. May be NULL.
+ * @return			MOSQ_ERR_SUCCESS on success (also if no revocation list is configured) or a mosquitto error code on failure.
+ */
+static int oauth2plugin_prepareRevocationList(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_Options* previous
+);
+
+
+/**
+ * @brief Load the static token store of a profile.
+ *
+ * Profiles inherit the store of the default profile, so a store configured
+ * once is loaded once and shared. Otherwise the store of the same profile in
+ * @p previous is reused if it uses the same files and check interval.
+ *
+ * @param options	New profile.
+ * @param shared	Default profile of the new configuration (NULL when preparing the default profile itself).
+ * @param previous	Profile to carry the token store over from. May be NULL.
+ * @return			MOSQ_ERR_SUCCESS on success (also if no token store is configured) or a mosquitto error code on failure.
+ */
+static int oauth2plugin_prepareTokenStore(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_Options* shared,
+	const struct oauth2plugin_Options* previous
+);
+
+
+/**
+ * @brief Create the sidecar client of a profile.
+ *
+ * If @p previous uses the same socket and timeout, its client and connection
+ * are reused.
+ *
+ * @param options	New profile with verifier "sidecar".
+ * @param previous	Profile to carry the sidecar client over from. May be NULL.
+ * @return			MOSQ_ERR_SUCCESS on success or MOSQ_ERR_NOMEM.
+ */
+static int oauth2plugin_prepareSidecar(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_Options* previous
+);
+
+
+/**
+ * @brief Create the client credentials of a profile authenticating with an access token or client assertion.
+ *
+ * If @p previous uses the same client_credentials settings, its cached access
+ * token and refresh thread are reused. Client assertion keys are read again
+ * on every reload, so a rotated key file takes effect.
+ *
+ * @param options	New profile with a prepared endpoint.
+ * @param resolver	Resolver shared by all profiles.
+ * @param previous	Profile to carry the credentials over from. May be NULL.
+ * @return			MOSQ_ERR_SUCCESS on success or a mosquitto error code.
+ */
+static int oauth2plugin_prepareCredentials(
+	struct oauth2plugin_Options* options,
+	struct oauth2plugin_Resolver* resolver,
+	const struct oauth2plugin_Options* previous
+);
+
+
+/**
+ * @brief Find the profile with the same name in another configuration.
+ *
+ * @param options	Configuration to search.
+ * @param name		Profile name or NULL for the default profile.
+ * @return			Matching profile or NULL.
+ */
+static const struct oauth2plugin_Options* oauth2plugin_findPreviousProfile(
+	const struct oauth2plugin_Options* options,
+	const char* name
+);
+
+
+/**
+ * @brief Stop resolving hosts that no profile of a configuration uses.
+ *
+ * @param plugin	Plugin state.
+ * @param options	Published configuration.
+ */
+static void oauth2plugin_pruneResolverHosts(
+	struct oauth2plugin_Plugin* plugin,
+	const struct oauth2plugin_Options* options
+);
+
+#endif // OAUTH2PLUGIN_CONFIG_H
@@ -0,0 +1,464 @@
+/**
+ * credentials.c
+ *
+ * Client authentication at the introspection endpoint with a cached access
+ * token (client credentials grant) or a signed client assertion (private_key_jwt)
+ */
+
+#include "credentials.h"
+
+
+struct oauth2plugin_Credentials* oauth2plugin_initCredentials(
+	const struct oauth2plugin_Options* options
+) {
+	// Validate
+	if (
+		!options
+		|| !options->client_id
+		|| options->client_authentication == client_authentication_CLIENT_SECRET_BASIC
+	) return NULL;
+
+	struct oauth2plugin_Credentials* credentials = calloc(1, sizeof(*credentials));
+	if (!credentials) return NULL;
+	credentials->method = options->client_authentication;
+	credentials->lifetime = options->client_assertion_lifetime > 0 ? options->client_assertion_lifetime : 60;
+	credentials->tls_verification = options->tls_verification;
+	credentials->timeout = options->timeout;
+	atomic_init(&credentials->references, 1);
+	pthread_mutex_init(&credentials->mutex, NULL);
+	pthread_condattr_t cond_attributes;
+	pthread_condattr_init(&cond_attributes);
+	pthread_condattr_setclock(&cond_attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&credentials->cond, &cond_attributes);
+	pthread_condattr_destroy(&cond_attributes);
+
+	// Copy settings
+	const char* audience = options->client_assertion_audience;
+	if (!audience) audience = options->token_endpoint;
+	if (!audience) audience = options->issuer;
+	if (!audience) audience = options->introspection_endpoint;
+	credentials->client_id = strdup(options->client_id);
+	if (options->client_secret) credentials->client_secret = strdup(options->client_secret);
+	if (options->token_endpoint) credentials->token_endpoint = strdup(options->token_endpoint);
+	if (options->token_scope) credentials->scope = strdup(options->token_scope);
+	if (audience) credentials->audience = strdup(audience);
+	if (options->client_assertion_key_id) credentials->key_id = strdup(options->client_assertion_key_id);
+	if (
+		!credentials->client_id
+		|| (options->client_secret && !credentials->client_secret)
+		|| (options->token_endpoint && !credentials->token_endpoint)
+		|| (options->token_scope && !credentials->scope)
+		|| (audience && !credentials->audience)
+		|| (options->client_assertion_key_id && !credentials->key_id)
+	) {
+		oauth2plugin_freeCredentials(credentials);
+		return NULL;
+	}
+
+	// private_key_jwt: load the signing key
+	if (credentials->method == client_authentication_PRIVATE_KEY_JWT) {
+		if (!credentials->audience) {
+			oauth2plugin_freeCredentials(credentials);
+			return NULL;
+		}
+		credentials->key = oauth2plugin_loadClientAssertionKey(options->client_assertion_key, &credentials->algorithm);
+		if (!credentials->key) {
+			oauth2plugin_freeCredentials(credentials);
+			return NULL;
+		}
+		return credentials;
+	}
+
+	// client_credentials: request the first access token in background
+	if (
+		!credentials->client_secret
+		|| !credentials->token_endpoint
+		|| !options->http_pool
+	) {
+		oauth2plugin_freeCredentials(credentials);
+		return NULL;
+	}
+	credentials->http_pool = oauth2plugin_retainHTTPPool(options->http_pool);
+	if (pthread_create(&credentials->thread, NULL, oauth2plugin_runCredentials, credentials) != 0) {
+		oauth2plugin_freeCredentials(credentials);
+		return NULL;
+	}
+	credentials->threaded = true;
+	return credentials;
+}
+
+
+struct oauth2plugin_Credentials* oauth2plugin_retainCredentials(
+	struct oauth2plugin_Credentials* credentials
+) {
+	atomic_fetch_add(&credentials->references, 1);
+	return credentials;
+}
+
+
+void oauth2plugin_freeCredentials(
+	struct oauth2plugin_Credentials* credentials
+) {
+	if (!credentials) return;
+	if (atomic_fetch_sub(&credentials->references, 1) > 1) return;
+
+	// Stop thread
+	if (credentials->threaded) {
+		pthread_mutex_lock(&credentials->mutex);
+		credentials->stop = true;
+		pthread_cond_broadcast(&credentials->cond);
+		pthread_mutex_unlock(&credentials->mutex);
+		pthread_join(credentials->thread, NULL);
+	}
+
+	// Free
+	oauth2plugin_freeHTTPPool(credentials->http_pool);
+	EVP_PKEY_free(credentials->key);
+	free(credentials->value);
+	free(credentials->client_id);
+	free(credentials->client_secret);
+	free(credentials->token_endpoint);
+	free(credentials->scope);
+	free(credentials->audience);
+	free(credentials->key_id);
+	pthread_cond_destroy(&credentials->cond);
+	pthread_mutex_destroy(&credentials->mutex);
+	free(credentials);
+}
+
+
+int oauth2plugin_getCredentials(
+	struct oauth2plugin_Credentials* credentials,
+	char** value
+) {
+	// Validate
+	if (!credentials || !value) return MOSQ_ERR_INVAL;
+	*value = NULL;
+
+	pthread_mutex_lock(&credentials->mutex);
+	int64_t now = oauth2plugin_getMonotonicTime();
+	int error = MOSQ_ERR_SUCCESS;
+	if (credentials->method == client_authentication_PRIVATE_KEY_JWT) {
+		// Sign a new assertion when 80% of the lifetime of the current one passed
+		if (!credentials->value || now >= credentials->refresh_at) {
+			char* assertion = NULL;
+			error = oauth2plugin_signClientAssertion(credentials, &assertion);
+			if (!error) {
+				free(credentials->value);
+				credentials->value = assertion;
+				credentials->refresh_at = now + credentials->lifetime * 800000;
+				credentials->expires_at = now + credentials->lifetime * 1000000;
+			}
+		}
+	} else if (
+		!credentials->value
+		|| now >= credentials->expires_at
+	) {
+		// No valid access token (first use or background refresh failed): request one unless a request just failed
+		if (now >= credentials->refresh_at || credentials->fetching) error = oauth2plugin_refreshCredentials(credentials);
+		else error = MOSQ_ERR_AUTH;
+	}
+	if (!error) {
+		*value = credentials->value ? strdup(credentials->value) : NULL;
+		if (!*value) error = MOSQ_ERR_NOMEM;
+	}
+	pthread_mutex_unlock(&credentials->mutex);
+	return error;
+}
+
+
+void oauth2plugin_invalidateCredentials(
+	struct oauth2plugin_Credentials* credentials,
+	const char* value
+) {
+	if (!credentials || !value) return;
+
+	// Only drop the value if it was not renewed meanwhile
+	pthread_mutex_lock(&credentials->mutex);
+	if (oauth2plugin_strEqual(credentials->value, value)) {
+		OAUTH2PLUGIN_LOG_WARNING("Introspection endpoint rejected the client credentials, renewing them.");
+		free(credentials->value);
+		credentials->value = NULL;
+		credentials->refresh_at = 0;
+		credentials->expires_at = 0;
+		pthread_cond_broadcast(&credentials->cond);
+	}
+	pthread_mutex_unlock(&credentials->mutex);
+}
+
+
+static void* oauth2plugin_runCredentials(
+	void* userdata
+) {
+	struct oauth2plugin_Credentials* credentials = (struct oauth2plugin_Credentials*) userdata;
+
+	pthread_mutex_lock(&credentials->mutex);
+	while (!credentials->stop) {
+		// Sleep until the token is due
+		int64_t now = oauth2plugin_getMonotonicTime();
+		if (now < credentials->refresh_at) {
+			struct timespec deadline = {
+				.tv_sec = credentials->refresh_at / 1000000,
+				.tv_nsec = (credentials->refresh_at % 1000000) * 1000
+			};
+			pthread_cond_timedwait(&credentials->cond, &credentials->mutex, &deadline);
+			continue;
+		}
+
+		// Renew
+		oauth2plugin_refreshCredentials(credentials);
+	}
+	pthread_mutex_unlock(&credentials->mutex);
+	return NULL;
+}
+
+
+static int oauth2plugin_refreshCredentials(
+	struct oauth2plugin_Credentials* credentials
+) {
+	// Wait for the request of another caller
+	if (credentials->fetching) {
+		while (credentials->fetching && !credentials->stop) pthread_cond_wait(&credentials->cond, &credentials->mutex);
+		return credentials->value && oauth2plugin_getMonotonicTime() < credentials->expires_at ? MOSQ_ERR_SUCCESS : MOSQ_ERR_AUTH;
+	}
+
+	// Request a new token without holding the lock
+	credentials->fetching = true;
+	pthread_mutex_unlock(&credentials->mutex);
+	char* value = NULL;
+	long lifetime = 0;
+	int error = oauth2plugin_requestAccessToken(credentials, &value, &lifetime);
+	int64_t now = oauth2plugin_getMonotonicTime();
+	pthread_mutex_lock(&credentials->mutex);
+	credentials->fetching = false;
+	pthread_cond_broadcast(&credentials->cond);
+
+	// Store token (renewed at 80% of its lifetime), or retry later and keep the old one while it is valid
+	if (error) {
+		credentials->refresh_at = now + OAUTH2PLUGIN_CREDENTIALS_RETRY * 1000000L;
+		return credentials->value && now < credentials->expires_at ? MOSQ_ERR_SUCCESS : error;
+	}
+	free(credentials->value);
+	credentials->value = value;
+	credentials->refresh_at = now + lifetime * 800000L;
+	credentials->expires_at = now + lifetime * 1000000L;
+	OAUTH2PLUGIN_LOG_DEBUG("Received access token for introspection requests (Lifetime: %ld seconds).", lifetime);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int oauth2plugin_requestAccessToken(
+	struct oauth2plugin_Credentials* credentials,
+	char** value,
+	long* lifetime
+) {
+	// Init CURL (reuses a keep-alive connection from the pool)
+	CURL* curl = oauth2plugin_acquireHTTPHandle(credentials->http_pool);
+	if (!curl) return MOSQ_ERR_UNKNOWN;
+
+	// Create POST data
+	char* esc_client_id = curl_easy_escape(curl, credentials->client_id, 0);
+	char* esc_client_secret = curl_easy_escape(curl, credentials->client_secret, 0);
+	char* esc_scope = credentials->scope ? curl_easy_escape(curl, credentials->scope, 0) : NULL;
+	char postdata[1024];
+	int postdata_length = snprintf(postdata, sizeof(postdata), "grant_type=client_credentials%s%s", esc_scope ? "&scope=" : "", esc_scope ? esc_scope : "");
+	curl_free(esc_scope);
+	if (
+		!esc_client_id
+		|| !esc_client_secret
+		|| (credentials->scope && !esc_scope)
+		|| postdata_length < 0
+		|| (size_t) postdata_length >= sizeof(postdata)
+	) {
+		curl_free(esc_client_id);
+		curl_free(esc_client_secret);
+		oauth2plugin_releaseHTTPHandle(credentials->http_pool, curl);
+		return MOSQ_ERR_UNKNOWN;
+	}
+
+	// Setup CURL
+	struct oauth2plugin_CURLBuffer buffer = { .data = NULL, .size = 0 };
+	struct curl_slist* headers = NULL;
+	headers = curl_slist_append(headers, "Content-Type: application/x-www-form-urlencoded");
+	curl_easy_setopt(curl, CURLOPT_URL, credentials->token_endpoint);
+	curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+	curl_easy_setopt(curl, CURLOPT_USERNAME, esc_client_id);
+	curl_easy_setopt(curl, CURLOPT_PASSWORD, esc_client_secret);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postdata);
+	if (headers) curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, oauth2plugin_callback_curlWriteFunction);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffer);
+	if (!credentials->tls_verification) {
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+	}
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, credentials->timeout);
+
+	// Perform HTTP request
+	OAUTH2PLUGIN_LOG_DEBUG("Requesting access token from %s", credentials->token_endpoint);
+	OAUTH2PLUGIN_PROBE1(http__start, credentials->token_endpoint);
+	CURLcode curl_code = curl_easy_perform(curl);
+	long http_code = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+	OAUTH2PLUGIN_PROBE3(http__done, credentials->token_endpoint, (int64_t) curl_code, (int64_t) http_code);
+	oauth2plugin_releaseHTTPHandle(credentials->http_pool, curl);
+	curl_free(esc_client_id);
+	curl_free(esc_client_secret);
+	if (headers) curl_slist_free_all(headers);
+	if (curl_code != CURLE_OK) {
+		OAUTH2PLUGIN_LOG_WARNING("Failed to call token endpoint (Error: %s).", curl_easy_strerror(curl_code));
+		free(buffer.data);
+		return MOSQ_ERR_UNKNOWN;
+	}
+	if (http_code != 200 || !buffer.data) {
+		OAUTH2PLUGIN_LOG_WARNING("Failed to call token endpoint (HTTP Code: %ld).", http_code);
+		free(buffer.data);
+		return MOSQ_ERR_AUTH;
+	}
+
+	// Parse response
+	cJSON* cjson = cJSON_Parse(buffer.data);
+	free(buffer.data);
+	cJSON* access_token = cJSON_GetObjectItemCaseSensitive(cjson, "access_token");
+	cJSON* token_type = cJSON_GetObjectItemCaseSensitive(cjson, "token_type");
+	cJSON* expires_in = cJSON_GetObjectItemCaseSensitive(cjson, "expires_in");
+	if (
+		!cJSON_IsString(access_token)
+		|| !access_token->valuestring
+		|| (cJSON_IsString(token_type) && strcasecmp(token_type->valuestring, "Bearer") != 0)
+	) {
+		OAUTH2PLUGIN_LOG_WARNING("Token endpoint did not return a bearer access token.");
+		cJSON_Delete(cjson);
+		return MOSQ_ERR_AUTH;
+	}
+	*lifetime = cJSON_IsNumber(expires_in) && expires_in->valuedouble >= 1 ? (long) expires_in->valuedouble : OAUTH2PLUGIN_CREDENTIALS_DEFAULT_LIFETIME;
+	size_t value_length = strlen("Authorization: Bearer ") + strlen(access_token->valuestring) + 1;
+	*value = malloc(value_length);
+	if (*value) snprintf(*value, value_length, "Authorization: Bearer %s", access_token->valuestring);
+	cJSON_Delete(cjson);
+	return *value ? MOSQ_ERR_SUCCESS : MOSQ_ERR_NOMEM;
+}
+
+
+static int oauth2plugin_signClientAssertion(
+	struct oauth2plugin_Credentials* credentials,
+	char** value
+) {
+	// Header and claims
+	unsigned char jti[16];
+	char jti_hex[2 * sizeof(jti) + 1];
+	if (RAND_bytes(jti, sizeof(jti)) != 1) return MOSQ_ERR_UNKNOWN;
+	oauth2plugin_hexEncode(jti, sizeof(jti), jti_hex);
+	int64_t now = oauth2plugin_getRealTime() / 1000000;
+	cJSON* header = cJSON_CreateObject();
+	cJSON* claims = cJSON_CreateObject();
+	if (header) {
+		cJSON_AddStringToObject(header, "alg", credentials->algorithm);
+		cJSON_AddStringToObject(header, "typ", "JWT");
+		if (credentials->key_id) cJSON_AddStringToObject(header, "kid", credentials->key_id);
+	}
+	if (claims) {
+		cJSON_AddStringToObject(claims, "iss", credentials->client_id);
+		cJSON_AddStringToObject(claims, "sub", credentials->client_id);
+		cJSON_AddStringToObject(claims, "aud", credentials->audience);
+		cJSON_AddStringToObject(claims, "jti", jti_hex);
+		cJSON_AddNumberToObject(claims, "iat", (double) now);
+		cJSON_AddNumberToObject(claims, "exp", (double) (now + credentials->lifetime));
+	}
+	char* header_json = header ? cJSON_PrintUnformatted(header) : NULL;
+	char* claims_json = claims ? cJSON_PrintUnformatted(claims) : NULL;
+	cJSON_Delete(header);
+	cJSON_Delete(claims);
+	char* header_b64 = header_json ? oauth2plugin_base64urlEncode((const unsigned char*) header_json, strlen(header_json)) : NULL;
+	char* claims_b64 = claims_json ? oauth2plugin_base64urlEncode((const unsigned char*) claims_json, strlen(claims_json)) : NULL;
+	free(header_json);
+	free(claims_json);
+	size_t signing_input_length = header_b64 && claims_b64 ? strlen(header_b64) + 1 + strlen(claims_b64) : 0;
+	char* signing_input = signing_input_length ? malloc(signing_input_length + 1) : NULL;
+	if (signing_input) snprintf(signing_input, signing_input_length + 1, "%s.%s", header_b64, claims_b64);
+	free(header_b64);
+	free(claims_b64);
+	if (!signing_input) return MOSQ_ERR_NOMEM;
+
+	// Sign
+	unsigned char* signature = NULL;
+	size_t signature_length = 0;
+	EVP_MD_CTX* md = EVP_MD_CTX_new();
+	bool signed_input = md
+		&& EVP_DigestSignInit(md, NULL, EVP_sha256(), NULL, credentials->key) == 1
+		&& EVP_DigestSign(md, NULL, &signature_length, (const unsigned char*) signing_input, signing_input_length) == 1
+		&& (signature = malloc(signature_length))
+		&& EVP_DigestSign(md, signature, &signature_length, (const unsigned char*) signing_input, signing_input_length) == 1;
+	EVP_MD_CTX_free(md);
+
+	// ES256: convert the DER encoded signature to the raw R || S form of JWS
+	if (signed_input && strcmp(credentials->algorithm, "ES256") == 0) {
+		const unsigned char* der = signature;
+		ECDSA_SIG* ecdsa_signature = d2i_ECDSA_SIG(NULL, &der, (long) signature_length);
+		const BIGNUM* r = NULL;
+		const BIGNUM* s = NULL;
+		if (ecdsa_signature) ECDSA_SIG_get0(ecdsa_signature, &r, &s);
+		signed_input = ecdsa_signature
+			&& BN_bn2binpad(r, signature, 32) == 32
+			&& BN_bn2binpad(s, signature + 32, 32) == 32;
+		signature_length = 64;
+		ECDSA_SIG_free(ecdsa_signature);
+	}
+	char* signature_b64 = signed_input ? oauth2plugin_base64urlEncode(signature, signature_length) : NULL;
+	free(signature);
+	if (!signature_b64) {
+		OAUTH2PLUGIN_LOG_WARNING("Failed to sign client assertion.");
+		free(signing_input);
+		return MOSQ_ERR_UNKNOWN;
+	}
+
+	// POST parameters
+	char* esc_client_id = curl_easy_escape(NULL, credentials->client_id, 0);
+	size_t value_length = esc_client_id
+		? strlen("client_id=&client_assertion_type=&client_assertion=..") + strlen(esc_client_id) + strlen(OAUTH2PLUGIN_CLIENT_ASSERTION_TYPE) + signing_input_length + strlen(signature_b64) + 1
+		: 0;
+	*value = value_length ? malloc(value_length) : NULL;
+	if (*value) snprintf(
+		*value,
+		value_length,
+		"client_id=%s&client_assertion_type=%s&client_assertion=%s.%s",
+		esc_client_id,
+		OAUTH2PLUGIN_CLIENT_ASSERTION_TYPE,
+		signing_input,
+		signature_b64
+	);
+	curl_free(esc_client_id);
+	free(signing_input);
+	free(signature_b64);
+	return *value ? MOSQ_ERR_SUCCESS : MOSQ_ERR_NOMEM;
+}
+
+
+static EVP_PKEY* oauth2plugin_loadClientAssertionKey(
+	const char* path,
+	const char** algorithm
+) {
+	// Read key
+	if (!path) return NULL;
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		OAUTH2PLUGIN_LOG_ERROR("Cannot open client assertion key %s.", path);
+		return NULL;
+	}
+	EVP_PKEY* key = PEM_read_PrivateKey(file, NULL, NULL, NULL);
+	fclose(file);
+	if (!key) {
+		OAUTH2PLUGIN_LOG_ERROR("Cannot read client assertion key %s.", path);
+		return NULL;
+	}
+
+	// Pick algorithm
+	if (EVP_PKEY_base_id(key) == EVP_PKEY_RSA && EVP_PKEY_bits(key) >= 2048) *algorithm = "RS256";
+	else if (EVP_PKEY_base_id(key) == EVP_PKEY_EC && EVP_PKEY_bits(key) == 256) *algorithm = "ES256";
+	else {
+		OAUTH2PLUGIN_LOG_ERROR("Client assertion key %s is neither a RSA key (2048 bits or more) nor a P-256 key.", path);
+		EVP_PKEY_free(key);
+		return NULL;
+	}
+	return key;
+}
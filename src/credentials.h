@@ -0,0 +1,199 @@
+/**
+ * credentials.h
+ *
+ * Client authentication at the introspection endpoint with a cached access
+ * token (client credentials grant) or a signed client assertion (private_key_jwt)
+ */
+
+#ifndef OAUTH2PLUGIN_CREDENTIALS_H
+#define OAUTH2PLUGIN_CREDENTIALS_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include <curl/curl.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/ecdsa.h>
+#include "cJSON.h"
+
+#include "options.h"
+#include "http.h"
+#include "audit.h"
+#include "tools.h"
+#include "probes.h"
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_CREDENTIALS_RETRY 5					// Seconds between failed token requests.
+#define OAUTH2PLUGIN_CREDENTIALS_DEFAULT_LIFETIME 300		// Seconds an access token without "expires_in" is used.
+#define OAUTH2PLUGIN_CLIENT_ASSERTION_TYPE "urn%3Aietf%3Aparams%3Aoauth%3Aclient-assertion-type%3Ajwt-bearer"
+
+
+struct oauth2plugin_Credentials {
+	enum oauth2plugin_Options_client_authentication	method;			// "client_credentials", "private_key_jwt"
+	char*							client_id;			// OAuth2 Client ID.
+	char*							client_secret;		// OAuth2 Client Secret (client_credentials only).
+	char*							token_endpoint;		// Token Endpoint URL (client_credentials only).
+	char*							scope;				// Requested scope (NULL = none).
+	char*							audience;			// "aud" of client assertions.
+	char*							key_id;				// "kid" of client assertions (NULL = none).
+	EVP_PKEY*						key;				// Private key signing client assertions.
+	const char*						algorithm;			// "RS256" or "ES256".
+	long							lifetime;			// Lifetime of client assertions in seconds.
+	bool							tls_verification;	// Enable TLS verification.
+	long							timeout;			// Server timeout in seconds.
+	struct oauth2plugin_HTTPPool*	http_pool;			// Connections to the token endpoint.
+	pthread_mutex_t					mutex;				// Protects all fields below.
+	pthread_cond_t					cond;				// Signalled when a token request completes or the thread shall stop.
+	char*							value;				// Header line or POST parameters authenticating the client (NULL = none).
+	int64_t							refresh_at;			// Monotonic time in microseconds to renew @p value at (or to retry at).
+	int64_t							expires_at;			// Monotonic time in microseconds after which @p value must not be used.
+	bool							fetching;			// A token request is in flight.
+	bool							stop;				// Refresh thread shall exit.
+	bool							threaded;			// Refresh thread was started.
+	pthread_t						thread;				// Background refresh thread (client_credentials only).
+	atomic_long						references;			// Configurations using these credentials.
+};
+
+
+/**
+ * @brief Create the client credentials of a profile.
+ *
+ * For "client_credentials" a background thread requests an access token
+ * right away and renews it when 80% of its lifetime has passed, so
+ * introspection requests never wait for the token endpoint. For
+ * "private_key_jwt" the private key is loaded and assertions are signed on
+ * demand.
+ *
+ * @param options	Profile with client_authentication other than "client_secret_basic" and a prepared http_pool.
+ * @return			Pointer to new credentials or NULL on failure.
+ */
+struct oauth2plugin_Credentials* oauth2plugin_initCredentials(
+	const struct oauth2plugin_Options* options
+);
+
+
+/**
+ * @brief Take an additional reference to credentials.
+ *
+ * @param credentials	Credentials.
+ * @return				@p credentials.
+ */
+struct oauth2plugin_Credentials* oauth2plugin_retainCredentials(
+	struct oauth2plugin_Credentials* credentials
+);
+
+
+/**
+ * @brief Release a reference; the refresh thread is stopped with the last one.
+ *
+ * @param credentials	Credentials created by oauth2plugin_initCredentials(). May be NULL.
+ */
+void oauth2plugin_freeCredentials(
+	struct oauth2plugin_Credentials* credentials
+);
+
+
+/**
+ * @brief Get the current client authentication.
+ *
+ * Thread safe. Returns the cached access token or client assertion; a new
+ * one is only requested or signed if the cached one expired.
+ *
+ * @param credentials	Credentials.
+ * @param value			Output: "Authorization: Bearer <token>" header line (client_credentials) or "client_id=...&client_assertion_type=...&client_assertion=..." POST parameters (private_key_jwt). Caller is responsible for freeing it.
+ * @return				MOSQ_ERR_SUCCESS or a mosquitto error code if no valid credentials are available.
+ */
+int oauth2plugin_getCredentials(
+	struct oauth2plugin_Credentials* credentials,
+	char** value
+);
+
+
+/**
+ * @brief Discard a value rejected by the introspection endpoint, so the next call renews it.
+ *
+ * @param credentials	Credentials. May be NULL.
+ * @param value			Value returned by oauth2plugin_getCredentials().
+ */
+void oauth2plugin_invalidateCredentials(
+	struct oauth2plugin_Credentials* credentials,
+	const char* value
+);
+
+
+/**
+ * @brief Background thread: renew the access token before it expires.
+ *
+ * @param userdata	Credentials.
+ * @return			NULL.
+ */
+static void* oauth2plugin_runCredentials(
+	void* userdata
+);
+
+
+/**
+ * @brief Request a new access token, unless another caller is already doing so.
+ *
+ * @param credentials	Credentials (locked; the lock is released during the request).
+ * @return				MOSQ_ERR_SUCCESS if a valid access token is cached afterwards, otherwise a mosquitto error code.
+ */
+static int oauth2plugin_refreshCredentials(
+	struct oauth2plugin_Credentials* credentials
+);
+
+
+/**
+ * @brief Request an access token from the token endpoint with the client credentials grant.
+ *
+ * @param credentials	Credentials (not locked).
+ * @param value			Output: newly allocated "Authorization: Bearer <token>" header line.
+ * @param lifetime		Output: lifetime of the token in seconds.
+ * @return				MOSQ_ERR_SUCCESS or a mosquitto error code.
+ */
+static int oauth2plugin_requestAccessToken(
+	struct oauth2plugin_Credentials* credentials,
+	char** value,
+	long* lifetime
+);
+
+
+/**
+ * @brief Sign a new client assertion (RFC 7523).
+ *
+ * @param credentials	Credentials.
+ * @param value			Output: newly allocated POST parameters carrying the assertion.
+ * @return				MOSQ_ERR_SUCCESS or a mosquitto error code.
+ */
+static int oauth2plugin_signClientAssertion(
+	struct oauth2plugin_Credentials* credentials,
+	char** value
+);
+
+
+/**
+ * @brief Load a PEM private key and pick the matching JWS algorithm.
+ *
+ * @param path		Path of the PEM file.
+ * @param algorithm	Output: "RS256" for RSA keys, "ES256" for P-256 keys.
+ * @return			Key or NULL if the file cannot be read or the key type is not supported.
+ */
+static EVP_PKEY* oauth2plugin_loadClientAssertionKey(
+	const char* path,
+	const char** algorithm
+);
+
+#endif // OAUTH2PLUGIN_CREDENTIALS_H
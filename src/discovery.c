@@ -0,0 +1,187 @@
+/**
+ * discovery.c
+ *
+ * OpenID Connect discovery and preparation of provider endpoints
+ */
+
+#include "discovery.h"
+
+
+int oauth2plugin_discoverIssuer(
+	struct oauth2plugin_Options* options
+) {
+	// Validate
+	if (!options || !options->issuer) return MOSQ_ERR_INVAL;
+
+	// Create URL
+	const char* well_known_path = "/.well-known/openid-configuration";
+	size_t issuer_length = strlen(options->issuer);
+	while (issuer_length > 0 && options->issuer[issuer_length - 1] == '/') issuer_length--;
+	size_t url_length = issuer_length + strlen(well_known_path) + 1;
+	char* url = malloc(url_length);
+	if (!url) return MOSQ_ERR_NOMEM;
+	snprintf(url, url_length, "%.*s%s", (int) issuer_length, options->issuer, well_known_path);
+
+	// Perform HTTP request
+	struct oauth2plugin_CURLBuffer buffer = { .data = NULL, .size = 0 };
+	CURL* curl = oauth2plugin_acquireHTTPHandle(options->http_pool);
+	if (!curl) {
+		free(url);
+		return MOSQ_ERR_UNKNOWN;
+	}
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, oauth2plugin_callback_curlWriteFunction);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffer);
+	if (!options->tls_verification) {
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+	}
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, options->timeout);
+	OAUTH2PLUGIN_LOG_DEBUG("Fetching OpenID Connect discovery document from %s", url);
+	OAUTH2PLUGIN_PROBE1(http__start, url);
+	CURLcode curl_code = curl_easy_perform(curl);
+	long http_code = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+	OAUTH2PLUGIN_PROBE3(http__done, url, (int64_t) curl_code, (int64_t) http_code);
+	oauth2plugin_releaseHTTPHandle(options->http_pool, curl);
+	free(url);
+	if (curl_code != CURLE_OK) {
+		OAUTH2PLUGIN_LOG_WARNING("Failed to fetch discovery document (Error: %s).", curl_easy_strerror(curl_code));
+		free(buffer.data);
+		return MOSQ_ERR_UNKNOWN;
+	}
+	if (http_code != 200 || !buffer.data) {
+		OAUTH2PLUGIN_LOG_WARNING("Failed to fetch discovery document (HTTP Code: %ld).", http_code);
+		free(buffer.data);
+		return MOSQ_ERR_UNKNOWN;
+	}
+
+	// Parse JSON
+	cJSON* cjson = cJSON_Parse(buffer.data);
+	free(buffer.data);
+	if (!cjson) {
+		OAUTH2PLUGIN_LOG_WARNING("Failed to parse discovery document.");
+		return MOSQ_ERR_UNKNOWN;
+	}
+
+	// Check issuer (exact match except for trailing slashes, so the document cannot redirect to endpoints of another issuer)
+	cJSON* issuer = cJSON_GetObjectItemCaseSensitive(cjson, "issuer");
+	size_t document_issuer_length = cJSON_IsString(issuer) ? strlen(issuer->valuestring) : 0;
+	while (document_issuer_length > 0 && issuer->valuestring[document_issuer_length - 1] == '/') document_issuer_length--;
+	if (
+		!cJSON_IsString(issuer)
+		|| document_issuer_length != issuer_length
+		|| strncmp(issuer->valuestring, options->issuer, issuer_length) != 0
+	) {
+		OAUTH2PLUGIN_LOG_ERROR("Issuer in discovery document does not match configured issuer %s. Ignoring discovered endpoints.", options->issuer);
+		cJSON_Delete(cjson);
+		return MOSQ_ERR_INVAL;
+	}
+
+	// Store endpoints
+	if (!options->introspection_endpoint) {
+		options->introspection_endpoint = oauth2plugin_dupJSONString(cjson, "introspection_endpoint");
+		options->introspection_endpoint_discovered = options->introspection_endpoint != NULL;
+	}
+	if (!options->token_endpoint) {
+		options->token_endpoint = oauth2plugin_dupJSONString(cjson, "token_endpoint");
+		options->token_endpoint_discovered = options->token_endpoint != NULL;
+	}
+	free(options->jwks_uri);
+	options->jwks_uri = oauth2plugin_dupJSONString(cjson, "jwks_uri");
+	cJSON_Delete(cjson);
+
+	// Return
+	if (!options->introspection_endpoint) {
+		OAUTH2PLUGIN_LOG_WARNING("Discovery document does not contain an introspection endpoint.");
+		return MOSQ_ERR_NOT_FOUND;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int oauth2plugin_prepareEndpoint(
+	struct oauth2plugin_Options* options,
+	struct oauth2plugin_Resolver* resolver,
+	const struct oauth2plugin_Options* previous
+) {
+	// Validate
+	if (!options) return MOSQ_ERR_INVAL;
+
+	// Carry over endpoints discovered for the same issuer
+	if (
+		previous
+		&& previous->introspection_endpoint_discovered
+		&& !options->introspection_endpoint
+		&& oauth2plugin_strEqual(options->issuer, previous->issuer)
+	) {
+		options->introspection_endpoint = strdup(previous->introspection_endpoint);
+		options->introspection_endpoint_discovered = options->introspection_endpoint != NULL;
+		if (previous->jwks_uri) options->jwks_uri = strdup(previous->jwks_uri);
+	}
+
+	if (
+		previous
+		&& previous->token_endpoint_discovered
+		&& !options->token_endpoint
+		&& oauth2plugin_strEqual(options->issuer, previous->issuer)
+	) {
+		options->token_endpoint = strdup(previous->token_endpoint);
+		options->token_endpoint_discovered = options->token_endpoint != NULL;
+	}
+
+	// Keep warm connections if the endpoint did not change
+	if (
+		previous
+		&& previous->http_pool
+		&& options->introspection_endpoint
+		&& oauth2plugin_strEqual(options->introspection_endpoint, previous->introspection_endpoint)
+		&& options->tls_verification == previous->tls_verification
+		&& options->prewarm_connections == previous->prewarm_connections
+	) {
+		options->http_pool = oauth2plugin_retainHTTPPool(previous->http_pool);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	// Create connection pool
+	options->http_pool = oauth2plugin_initHTTPPool(options->prewarm_connections, resolver);
+	if (!options->http_pool) return MOSQ_ERR_NOMEM;
+
+	// Discover endpoints
+	if (
+		options->issuer
+		&& !options->introspection_endpoint_discovered
+	) {
+		int discover_issuer_error = oauth2plugin_discoverIssuer(options);
+		if (discover_issuer_error && !options->introspection_endpoint) return discover_issuer_error;
+	}
+
+	// Resolve endpoint addresses (refreshed in background afterwards)
+	oauth2plugin_addResolverHost(resolver, options->introspection_endpoint);
+
+	// Open warm connections
+	if (options->prewarm_connections > 0) {
+		size_t prewarmed_connections = oauth2plugin_prewarmHTTPPool(
+			options->http_pool,
+			options->introspection_endpoint,
+			options->prewarm_connections,
+			options->tls_verification,
+			options->timeout
+		);
+		OAUTH2PLUGIN_LOG_DEBUG("Opened %zu of %ld warm connections to %s.", prewarmed_connections, options->prewarm_connections, options->introspection_endpoint);
+	}
+
+	// Return
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static char* oauth2plugin_dupJSONString(
+	const cJSON* object,
+	const char* key
+) {
+	cJSON* item = cJSON_GetObjectItemCaseSensitive(object, key);
+	if (!cJSON_IsString(item) || !item->valuestring) return NULL;
+	return strdup(item->valuestring);
+}
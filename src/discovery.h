@@ -0,0 +1,81 @@
+/**
+ * discovery.h
+ *
+ * OpenID Connect discovery and preparation of provider endpoints
+ */
+
+#ifndef OAUTH2PLUGIN_DISCOVERY_H
+#define OAUTH2PLUGIN_DISCOVERY_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include <curl/curl.h>
+#include "cJSON.h"
+
+#include "options.h"
+#include "http.h"
+#include "resolver.h"
+#include "tools.h"
+#include "probes.h"
+#include "log.h"
+
+
+/**
+ * @brief Fetch the OpenID Connect discovery document of the configured issuer.
+ *
+ * Requests "<issuer>/.well-known/openid-configuration" and stores the
+ * discovered "introspection_endpoint" and "token_endpoint" (unless already
+ * configured) and "jwks_uri" in @p options. The request is sent through @p options->http_pool,
+ * so the connection to the issuer stays warm afterwards. Nothing is stored if
+ * the "issuer" of the document differs from the configured one (trailing
+ * slashes aside).
+ *
+ * @param options	Options with the issuer set.
+ * @return			MOSQ_ERR_SUCCESS on success, MOSQ_ERR_INVAL if the issuer does not match or another mosquitto error code on failure.
+ */
+int oauth2plugin_discoverIssuer(
+	struct oauth2plugin_Options* options
+);
+
+
+/**
+ * @brief Prepare the introspection endpoint of a profile.
+ *
+ * Creates the connection pool of @p options, discovers the endpoints if an
+ * issuer is configured, registers the endpoint host with @p resolver and opens
+ * the configured number of warm connections.
+ *
+ * If @p previous uses the same issuer and endpoint (e.g. after a configuration
+ * reload), its discovered endpoints and its connection pool are reused.
+ *
+ * @param options	Default profile or named profile.
+ * @param resolver	Resolver shared by all profiles.
+ * @param previous	Same profile of the previous configuration. May be NULL.
+ * @return			MOSQ_ERR_SUCCESS on success or a mosquitto error code if no usable endpoint is available.
+ */
+int oauth2plugin_prepareEndpoint(
+	struct oauth2plugin_Options* options,
+	struct oauth2plugin_Resolver* resolver,
+	const struct oauth2plugin_Options* previous
+);
+
+
+/**
+ * @brief Copy a string member of a JSON object.
+ *
+ * @param object	JSON object.
+ * @param key		Member name.
+ * @return			Newly allocated copy of the value or NULL if the member is missing or not a string.
+ */
+static char* oauth2plugin_dupJSONString(
+	const cJSON* object,
+	const char* key
+);
+
+#endif // OAUTH2PLUGIN_DISCOVERY_H
@@ -0,0 +1,229 @@
+/**
+ * http.c
+ *
+ * Pool of reusable CURL handles with keep-alive connections
+ */
+
+#include "http.h"
+
+
+size_t oauth2plugin_callback_curlWriteFunction(
+	void* contents,
+	size_t size,
+	size_t nmemb,
+	void* userp
+) {
+	size_t contents_size = size * nmemb;
+	struct oauth2plugin_CURLBuffer* buffer = (struct oauth2plugin_CURLBuffer*) userp;
+
+	char* data = realloc(buffer->data, buffer->size + contents_size + 1);
+	if (!data) return 0;
+
+	buffer->data = data;
+
+	memcpy(&(buffer->data[buffer->size]), contents, contents_size);
+
+	buffer->size += contents_size;
+	buffer->data[buffer->size] = '\0';
+	
+	return contents_size;
+}
+
+
+static size_t oauth2plugin_callback_curlDiscardFunction(
+	void* contents,
+	size_t size,
+	size_t nmemb,
+	void* userp
+) {
+	(void) contents; (void) userp;
+	return size * nmemb;
+}
+
+
+struct oauth2plugin_HTTPPool* oauth2plugin_initHTTPPool(
+	long size,
+	struct oauth2plugin_Resolver* resolver
+) {
+	struct oauth2plugin_HTTPPool* pool = calloc(1, sizeof(*pool));
+	if (!pool) return NULL;
+
+	pool->size = size > 0 ? (size_t) size : 1;
+	pool->resolver = resolver;
+	pool->references = 1;
+	pool->handles = calloc(pool->size, sizeof(*pool->handles));
+	if (!pool->handles) {
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_mutex_init(&pool->share_mutex, NULL);
+
+	// Share DNS cache and TLS sessions between all handles
+	pool->share = curl_share_init();
+	if (pool->share) {
+		curl_share_setopt(pool->share, CURLSHOPT_LOCKFUNC, oauth2plugin_callback_curlShareLock);
+		curl_share_setopt(pool->share, CURLSHOPT_UNLOCKFUNC, oauth2plugin_callback_curlShareUnlock);
+		curl_share_setopt(pool->share, CURLSHOPT_USERDATA, pool);
+		curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	}
+
+	return pool;
+}
+
+
+struct oauth2plugin_HTTPPool* oauth2plugin_retainHTTPPool(
+	struct oauth2plugin_HTTPPool* pool
+) {
+	pthread_mutex_lock(&pool->mutex);
+	pool->references++;
+	pthread_mutex_unlock(&pool->mutex);
+	return pool;
+}
+
+
+void oauth2plugin_freeHTTPPool(
+	struct oauth2plugin_HTTPPool* pool
+) {
+	if (!pool) return;
+
+	// Still in use by another configuration?
+	pthread_mutex_lock(&pool->mutex);
+	long references = --pool->references;
+	pthread_mutex_unlock(&pool->mutex);
+	if (references > 0) return;
+
+	for (size_t i = 0; i < pool->handles_count; i++)
+		curl_easy_cleanup(pool->handles[i]);
+	free(pool->handles);
+	if (pool->share) curl_share_cleanup(pool->share);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_mutex_destroy(&pool->share_mutex);
+	free(pool);
+}
+
+
+CURL* oauth2plugin_acquireHTTPHandle(
+	struct oauth2plugin_HTTPPool* pool
+) {
+	if (!pool) return curl_easy_init();
+
+	// Take idle handle (most recently used first, its connection is the warmest)
+	CURL* curl = NULL;
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->handles_count > 0)
+		curl = pool->handles[--pool->handles_count];
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (!curl) curl = curl_easy_init();
+	if (!curl) return NULL;
+
+	// Apply pool wide settings
+	if (pool->share) curl_easy_setopt(curl, CURLOPT_SHARE, pool->share);
+	struct curl_slist* resolve = oauth2plugin_getResolverList(pool->resolver);
+	if (resolve) {
+		// Freed in oauth2plugin_releaseHTTPHandle()
+		curl_easy_setopt(curl, CURLOPT_RESOLVE, resolve);
+		curl_easy_setopt(curl, CURLOPT_PRIVATE, resolve);
+	}
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+
+	return curl;
+}
+
+
+void oauth2plugin_releaseHTTPHandle(
+	struct oauth2plugin_HTTPPool* pool,
+	CURL* curl
+) {
+	if (!curl) return;
+	if (!pool) {
+		curl_easy_cleanup(curl);
+		return;
+	}
+
+	// Free address list of this request
+	struct curl_slist* resolve = NULL;
+	curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**) &resolve);
+	if (resolve) curl_slist_free_all(resolve);
+
+	// Reset request options, keeps the connection open
+	curl_easy_reset(curl);
+
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->handles_count < pool->size) {
+		pool->handles[pool->handles_count++] = curl;
+		curl = NULL;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	// Pool is full
+	if (curl) curl_easy_cleanup(curl);
+}
+
+
+size_t oauth2plugin_prewarmHTTPPool(
+	struct oauth2plugin_HTTPPool* pool,
+	const char* url,
+	long count,
+	const bool tls_verification,
+	const long timeout
+) {
+	// Validate
+	if (!pool || !url || count < 1) return 0;
+	if ((size_t) count > pool->size) count = (long) pool->size;
+
+	// Acquire all handles first, so that every request opens its own connection
+	CURL* handles[count];
+	for (long i = 0; i < count; i++)
+		handles[i] = oauth2plugin_acquireHTTPHandle(pool);
+
+	// Connect
+	size_t connected = 0;
+	for (long i = 0; i < count; i++) {
+		if (!handles[i]) continue;
+		curl_easy_setopt(handles[i], CURLOPT_URL, url);
+		curl_easy_setopt(handles[i], CURLOPT_NOBODY, 1L);
+		curl_easy_setopt(handles[i], CURLOPT_WRITEFUNCTION, oauth2plugin_callback_curlDiscardFunction);
+		if (!tls_verification) {
+			curl_easy_setopt(handles[i], CURLOPT_SSL_VERIFYPEER, 0L);
+			curl_easy_setopt(handles[i], CURLOPT_SSL_VERIFYHOST, 0L);
+		}
+		curl_easy_setopt(handles[i], CURLOPT_TIMEOUT, timeout);
+		CURLcode curl_code = curl_easy_perform(handles[i]);
+		if (curl_code == CURLE_OK) connected++;
+		else OAUTH2PLUGIN_LOG_WARNING("Failed to open warm connection to %s (Error: %s).", url, curl_easy_strerror(curl_code));
+	}
+
+	// Return handles to pool
+	for (long i = 0; i < count; i++)
+		oauth2plugin_releaseHTTPHandle(pool, handles[i]);
+
+	// Return
+	return connected;
+}
+
+
+static void oauth2plugin_callback_curlShareLock(
+	CURL* handle,
+	curl_lock_data data,
+	curl_lock_access access,
+	void* userptr
+) {
+	(void) handle; (void) data; (void) access;
+	struct oauth2plugin_HTTPPool* pool = (struct oauth2plugin_HTTPPool*) userptr;
+	pthread_mutex_lock(&pool->share_mutex);
+}
+
+
+static void oauth2plugin_callback_curlShareUnlock(
+	CURL* handle,
+	curl_lock_data data,
+	void* userptr
+) {
+	(void) handle; (void) data;
+	struct oauth2plugin_HTTPPool* pool = (struct oauth2plugin_HTTPPool*) userptr;
+	pthread_mutex_unlock(&pool->share_mutex);
+}
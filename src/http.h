@@ -0,0 +1,180 @@
+/**
+ * http.h
+ *
+ * Pool of reusable CURL handles with keep-alive connections
+ */
+
+#ifndef OAUTH2PLUGIN_HTTP_H
+#define OAUTH2PLUGIN_HTTP_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include <curl/curl.h>
+
+#include "resolver.h"
+#include "log.h"
+
+
+struct oauth2plugin_CURLBuffer {
+	char* data;
+	size_t size;
+};
+
+
+struct oauth2plugin_HTTPPool {
+	pthread_mutex_t		mutex;				// Protects handles, handles_count and references.
+	pthread_mutex_t		share_mutex;		// Lock used by the CURL share object.
+	CURLSH*				share;				// Shared DNS and TLS session cache.
+	CURL**				handles;			// Idle CURL handles (each keeps its own connection cache).
+	size_t				handles_count;		// Number of idle handles in @p handles.
+	size_t				size;				// Maximum number of idle handles kept in the pool.
+	long				references;			// Number of configurations using the pool.
+	struct oauth2plugin_Resolver*	resolver;	// Address cache fed to CURL via CURLOPT_RESOLVE (not owned).
+};
+
+
+/**
+ * @brief Allocate and initialize a HTTP connection pool.
+ *
+ * The pool keeps up to @p size idle CURL handles. Every handle holds its own
+ * keep-alive connection, so a handle returned to the pool can be reused
+ * without a new TCP/TLS handshake. DNS results and TLS sessions are shared
+ * between all handles of the pool.
+ *
+ * If @p resolver is given, every request uses the addresses cached by the
+ * resolver instead of querying DNS.
+ *
+ * @param size		Maximum number of idle handles. Values below 1 are raised to 1.
+ * @param resolver	Resolver providing the endpoint addresses. May be NULL. Must outlive the pool.
+ * @return			Pointer to a new pool or NULL if allocation fails.
+ */
+struct oauth2plugin_HTTPPool* oauth2plugin_initHTTPPool(
+	long size,
+	struct oauth2plugin_Resolver* resolver
+);
+
+
+/**
+ * @brief Add a reference to a HTTP connection pool.
+ *
+ * Used to keep warm connections when a reloaded configuration uses the same
+ * endpoint as the previous one.
+ *
+ * @param pool	Pool created by oauth2plugin_initHTTPPool().
+ * @return		@p pool.
+ */
+struct oauth2plugin_HTTPPool* oauth2plugin_retainHTTPPool(
+	struct oauth2plugin_HTTPPool* pool
+);
+
+
+/**
+ * @brief Release a reference to a HTTP connection pool.
+ *
+ * When the last reference is released, all kept connections are closed and
+ * the pool is freed.
+ *
+ * @param pool	Pool created by oauth2plugin_initHTTPPool(). May be NULL.
+ */
+void oauth2plugin_freeHTTPPool(
+	struct oauth2plugin_HTTPPool* pool
+);
+
+
+/**
+ * @brief Take a CURL handle from the pool.
+ *
+ * Returns an idle handle with a warm connection if one is available, otherwise
+ * a new handle. Shared caches and the addresses of the resolver are already
+ * applied. The
+ * handle must be handed back with oauth2plugin_releaseHTTPHandle().
+ *
+ * @param pool	Pool to take the handle from. If NULL, a plain CURL handle is returned.
+ * @return		CURL handle or NULL on failure.
+ */
+CURL* oauth2plugin_acquireHTTPHandle(
+	struct oauth2plugin_HTTPPool* pool
+);
+
+
+/**
+ * @brief Return a CURL handle to the pool.
+ *
+ * All request specific options are reset; the connection is kept open. If the
+ * pool is full (or @p pool is NULL) the handle is closed.
+ *
+ * @param pool	Pool the handle was taken from.
+ * @param curl	Handle returned by oauth2plugin_acquireHTTPHandle(). May be NULL.
+ */
+void oauth2plugin_releaseHTTPHandle(
+	struct oauth2plugin_HTTPPool* pool,
+	CURL* curl
+);
+
+
+/**
+ * @brief Open up to @p count keep-alive connections to @p url.
+ *
+ * Each connection is opened on its own pool handle using a HEAD request; the
+ * HTTP status code is ignored. Handles are returned to the pool afterwards.
+ *
+ * @param pool				Target pool.
+ * @param url				URL of the server to connect to.
+ * @param count				Number of connections to open (limited to the pool size).
+ * @param tls_verification	Whether to verify TLS certificates.
+ * @param timeout			Request timeout in seconds.
+ * @return					Number of successfully opened connections.
+ */
+size_t oauth2plugin_prewarmHTTPPool(
+	struct oauth2plugin_HTTPPool* pool,
+	const char* url,
+	long count,
+	const bool tls_verification,
+	const long timeout
+);
+
+
+/**
+ * @brief CURL write callback used to collect HTTP response data.
+ *
+ * @param contents	Pointer to the received data chunk.
+ * @param size		Size of one element in bytes.
+ * @param nmemb		Number of elements pointed to by @p contents.
+ * @param userp		Pointer to an oauth2plugin_CURLBuffer used as destination.
+ * @return 			Number of bytes processed. Returning a different value will abort the transfer.
+ */
+size_t oauth2plugin_callback_curlWriteFunction(
+	void* contents,
+	size_t size,
+	size_t nmemb,
+	void* userp
+);
+
+
+/**
+ * @brief CURL share lock callback.
+ */
+static void oauth2plugin_callback_curlShareLock(
+	CURL* handle,
+	curl_lock_data data,
+	curl_lock_access access,
+	void* userptr
+);
+
+
+/**
+ * @brief CURL share unlock callback.
+ */
+static void oauth2plugin_callback_curlShareUnlock(
+	CURL* handle,
+	curl_lock_data data,
+	void* userptr
+);
+
+#endif // OAUTH2PLUGIN_HTTP_H
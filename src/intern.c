@@ -0,0 +1,196 @@
+/**
+ * intern.c
+ *
+ * Reference counted pool of deduplicated strings (claim values, profile names)
+ */
+
+#include "intern.h"
+
+
+struct oauth2plugin_StringPool* oauth2plugin_initStringPool() {
+	struct oauth2plugin_StringPool* pool = calloc(1, sizeof(*pool));
+	if (!pool) return NULL;
+	pool->capacity = OAUTH2PLUGIN_INTERN_INITIAL_CAPACITY;
+	pool->buckets = calloc(pool->capacity, sizeof(*pool->buckets));
+	if (!pool->buckets) {
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->mutex, NULL);
+	return pool;
+}
+
+
+void oauth2plugin_freeStringPool(
+	struct oauth2plugin_StringPool* pool
+) {
+	if (!pool) return;
+	if (pool->count > 0) OAUTH2PLUGIN_LOG_DEBUG("%zu interned strings still referenced at shutdown.", pool->count);
+	for (size_t i = 0; i < pool->capacity; i++) {
+		struct oauth2plugin_InternedString* entry = pool->buckets[i];
+		while (entry) {
+			struct oauth2plugin_InternedString* next = entry->next;
+			free(entry);
+			entry = next;
+		}
+	}
+	free(pool->buckets);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+
+const char* oauth2plugin_internString(
+	struct oauth2plugin_StringPool* pool,
+	const char* string
+) {
+	if (!pool || !string) return NULL;
+	size_t length = strlen(string);
+	uint64_t hash = oauth2plugin_hashString(string, length);
+
+	pthread_mutex_lock(&pool->mutex);
+
+	// Existing string
+	for (
+		struct oauth2plugin_InternedString* entry = pool->buckets[hash & (pool->capacity - 1)];
+		entry;
+		entry = entry->next
+	) {
+		if (
+			entry->hash == hash
+			&& entry->length == length
+			&& memcmp(entry->data, string, length) == 0
+		) {
+			atomic_fetch_add(&entry->references, 1);
+			pthread_mutex_unlock(&pool->mutex);
+			return entry->data;
+		}
+	}
+
+	// New string
+	struct oauth2plugin_InternedString* entry = malloc(sizeof(*entry) + length + 1);
+	if (!entry) {
+		pthread_mutex_unlock(&pool->mutex);
+		return NULL;
+	}
+	entry->hash = hash;
+	entry->length = length;
+	atomic_init(&entry->references, 1);
+	memcpy(entry->data, string, length + 1);
+	if (pool->count >= pool->capacity) oauth2plugin_growStringPool(pool);
+	size_t bucket = hash & (pool->capacity - 1);
+	entry->next = pool->buckets[bucket];
+	pool->buckets[bucket] = entry;
+	pool->count++;
+	pool->bytes += sizeof(*entry) + length + 1;
+
+	pthread_mutex_unlock(&pool->mutex);
+	return entry->data;
+}
+
+
+const char* oauth2plugin_findString(
+	struct oauth2plugin_StringPool* pool,
+	const char* string
+) {
+	if (!pool || !string) return NULL;
+	size_t length = strlen(string);
+	uint64_t hash = oauth2plugin_hashString(string, length);
+
+	pthread_mutex_lock(&pool->mutex);
+	for (
+		struct oauth2plugin_InternedString* entry = pool->buckets[hash & (pool->capacity - 1)];
+		entry;
+		entry = entry->next
+	) {
+		if (
+			entry->hash == hash
+			&& entry->length == length
+			&& memcmp(entry->data, string, length) == 0
+		) {
+			atomic_fetch_add(&entry->references, 1);
+			pthread_mutex_unlock(&pool->mutex);
+			return entry->data;
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+
+const char* oauth2plugin_retainString(
+	const char* string
+) {
+	if (string) atomic_fetch_add(&oauth2plugin_getInternedString(string)->references, 1);
+	return string;
+}
+
+
+void oauth2plugin_releaseString(
+	struct oauth2plugin_StringPool* pool,
+	const char* string
+) {
+	if (!pool || !string) return;
+	struct oauth2plugin_InternedString* entry = oauth2plugin_getInternedString(string);
+
+	// Not the last reference: lock-free
+	long references = atomic_load(&entry->references);
+	while (references > 1) {
+		if (atomic_compare_exchange_weak(&entry->references, &references, references - 1)) return;
+	}
+
+	// Possibly the last reference: decrement under the lock, so the string cannot be interned again meanwhile
+	pthread_mutex_lock(&pool->mutex);
+	if (atomic_fetch_sub(&entry->references, 1) == 1) {
+		struct oauth2plugin_InternedString** link = &pool->buckets[entry->hash & (pool->capacity - 1)];
+		while (*link && *link != entry) link = &(*link)->next;
+		if (*link) *link = entry->next;
+		pool->count--;
+		pool->bytes -= sizeof(*entry) + entry->length + 1;
+		free(entry);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+
+static struct oauth2plugin_InternedString* oauth2plugin_getInternedString(
+	const char* string
+) {
+	return (struct oauth2plugin_InternedString*) (string - offsetof(struct oauth2plugin_InternedString, data));
+}
+
+
+static void oauth2plugin_growStringPool(
+	struct oauth2plugin_StringPool* pool
+) {
+	size_t capacity = pool->capacity * 2;
+	struct oauth2plugin_InternedString** buckets = calloc(capacity, sizeof(*buckets));
+	if (!buckets) return; // Keep longer chains
+
+	// Rehash
+	for (size_t i = 0; i < pool->capacity; i++) {
+		struct oauth2plugin_InternedString* entry = pool->buckets[i];
+		while (entry) {
+			struct oauth2plugin_InternedString* next = entry->next;
+			entry->next = buckets[entry->hash & (capacity - 1)];
+			buckets[entry->hash & (capacity - 1)] = entry;
+			entry = next;
+		}
+	}
+	free(pool->buckets);
+	pool->buckets = buckets;
+	pool->capacity = capacity;
+}
+
+
+static uint64_t oauth2plugin_hashString(
+	const char* string,
+	size_t length
+) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char) string[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
@@ -0,0 +1,155 @@
+/**
+ * intern.h
+ *
+ * Reference counted pool of deduplicated strings (claim values, profile names)
+ */
+
+#ifndef OAUTH2PLUGIN_INTERN_H
+#define OAUTH2PLUGIN_INTERN_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_INTERN_INITIAL_CAPACITY 256
+
+
+struct oauth2plugin_InternedString {
+	struct oauth2plugin_InternedString*	next;			// Next entry in the same bucket.
+	uint64_t							hash;			// FNV-1a hash of @p data.
+	atomic_long							references;		// Holders of this string.
+	size_t								length;			// Length of @p data.
+	char								data[];			// Null terminated string (the handle points here).
+};
+
+
+struct oauth2plugin_StringPool {
+	pthread_mutex_t							mutex;		// Protects the buckets.
+	struct oauth2plugin_InternedString**	buckets;	// Chained hash table, capacity is a power of two.
+	size_t									capacity;	// Number of buckets.
+	size_t									count;		// Number of distinct strings.
+	size_t									bytes;		// Memory used by the strings (including entry headers).
+};
+
+
+/**
+ * @brief Create an empty string pool.
+ *
+ * @return	Pointer to a new pool or NULL if allocation fails.
+ */
+struct oauth2plugin_StringPool* oauth2plugin_initStringPool();
+
+
+/**
+ * @brief Release a string pool.
+ *
+ * All strings must have been released before.
+ *
+ * @param pool	Pool created by oauth2plugin_initStringPool(). May be NULL.
+ */
+void oauth2plugin_freeStringPool(
+	struct oauth2plugin_StringPool* pool
+);
+
+
+/**
+ * @brief Get the shared copy of a string and take a reference to it.
+ *
+ * Equal strings return the same pointer, so interned strings can be compared
+ * by pointer. The returned string must not be modified or freed; release it
+ * with oauth2plugin_releaseString().
+ *
+ * @param pool		Pool.
+ * @param string	String to intern. May be NULL.
+ * @return			Interned string or NULL if @p string is NULL or allocation fails.
+ */
+const char* oauth2plugin_internString(
+	struct oauth2plugin_StringPool* pool,
+	const char* string
+);
+
+
+/**
+ * @brief Get the shared copy of a string and take a reference to it, without interning it.
+ *
+ * Used to match interned strings by pointer: if the string is not in the pool,
+ * no interned string can be equal to it.
+ *
+ * @param pool		Pool.
+ * @param string	String to look up. May be NULL.
+ * @return			Interned string (release it with oauth2plugin_releaseString()) or NULL if it is not in the pool.
+ */
+const char* oauth2plugin_findString(
+	struct oauth2plugin_StringPool* pool,
+	const char* string
+);
+
+
+/**
+ * @brief Take an additional reference to an interned string.
+ *
+ * @param string	Interned string. May be NULL.
+ * @return			@p string.
+ */
+const char* oauth2plugin_retainString(
+	const char* string
+);
+
+
+/**
+ * @brief Release a reference to an interned string; the string is freed with the last one.
+ *
+ * @param pool		Pool the string was interned in.
+ * @param string	Interned string. May be NULL.
+ */
+void oauth2plugin_releaseString(
+	struct oauth2plugin_StringPool* pool,
+	const char* string
+);
+
+
+/**
+ * @brief Get the entry of an interned string.
+ *
+ * @param string	Interned string.
+ * @return			Entry containing @p string.
+ */
+static struct oauth2plugin_InternedString* oauth2plugin_getInternedString(
+	const char* string
+);
+
+
+/**
+ * @brief Double the number of buckets.
+ *
+ * @param pool	Pool (locked).
+ */
+static void oauth2plugin_growStringPool(
+	struct oauth2plugin_StringPool* pool
+);
+
+
+/**
+ * @brief Hash a string with FNV-1a.
+ *
+ * @param string	String.
+ * @param length	Length of @p string.
+ * @return			Hash value.
+ */
+static uint64_t oauth2plugin_hashString(
+	const char* string,
+	size_t length
+);
+
+#endif // OAUTH2PLUGIN_INTERN_H
@@ -0,0 +1,50 @@
+/**
+ * jwt.c
+ *
+ * Inspect JSON Web Tokens without verifying their signature
+ */
+
+#include "jwt.h"
+
+
+bool oauth2plugin_isJWT(
+	const char* token
+) {
+	// Validate
+	if (!token) return false;
+
+	// Find dots
+	const char* first_dot = strchr(token, '.');
+	if (!first_dot || first_dot == token) return false;
+	const char* second_dot = strchr(first_dot + 1, '.');
+	if (!second_dot || second_dot == first_dot + 1) return false;
+
+	// Signature must be non-empty and must not contain further dots
+	return second_dot[1] != '\0' && strchr(second_dot + 1, '.') == NULL;
+}
+
+
+cJSON* oauth2plugin_parseJWTPayload(
+	const char* token
+) {
+	// Validate
+	if (!oauth2plugin_isJWT(token)) return NULL;
+
+	// Decode payload
+	const char* payload = strchr(token, '.') + 1;
+	size_t payload_length = (size_t) (strchr(payload, '.') - payload);
+	size_t json_length = 0;
+	unsigned char* json = oauth2plugin_base64urlDecode(payload, payload_length, &json_length);
+	if (!json) return NULL;
+
+	// Parse JSON
+	cJSON* claims = cJSON_Parse((const char*) json);
+	free(json);
+	if (claims && !cJSON_IsObject(claims)) {
+		cJSON_Delete(claims);
+		return NULL;
+	}
+
+	// Return
+	return claims;
+}
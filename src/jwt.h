@@ -0,0 +1,43 @@
+/**
+ * jwt.h
+ *
+ * Inspect JSON Web Tokens without verifying their signature
+ */
+
+#ifndef OAUTH2PLUGIN_JWT_H
+#define OAUTH2PLUGIN_JWT_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cJSON.h"
+
+#include "tools.h"
+
+
+/**
+ * @brief Check whether a token has the compact JWS structure "header.payload.signature".
+ *
+ * @param token		Token supplied by the MQTT client.
+ * @return			true if @p token consists of three non-empty, dot separated parts.
+ */
+bool oauth2plugin_isJWT(
+	const char* token
+);
+
+
+/**
+ * @brief Decode the payload (claims) of a JWT.
+ *
+ * The signature is NOT verified. The claims may only be used for routing and
+ * plausibility checks, never for granting access.
+ *
+ * @param token		Token supplied by the MQTT client.
+ * @return			Parsed claims or NULL if @p token is not a JWT. Caller is responsible for freeing it with cJSON_Delete().
+ */
+cJSON* oauth2plugin_parseJWTPayload(
+	const char* token
+);
+
+#endif // OAUTH2PLUGIN_JWT_H
@@ -0,0 +1,136 @@
+/**
+ * log.c
+ *
+ * Level gated logging
+ */
+
+#include "log.h"
+
+
+atomic_int oauth2plugin_log_level = OAUTH2PLUGIN_LOG_LEVEL_INFO;
+atomic_bool oauth2plugin_log_sensitive = false;
+static struct oauth2plugin_LogQueue oauth2plugin_log_queue = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+
+void oauth2plugin_setLogSettings(
+	int level,
+	bool sensitive
+) {
+	atomic_store_explicit(&oauth2plugin_log_level, level, memory_order_relaxed);
+	atomic_store_explicit(&oauth2plugin_log_sensitive, sensitive, memory_order_relaxed);
+}
+
+
+void oauth2plugin_setLogBrokerThread(void) {
+	pthread_mutex_lock(&oauth2plugin_log_queue.mutex);
+	oauth2plugin_log_queue.broker_thread = pthread_self();
+	oauth2plugin_log_queue.broker_thread_set = true;
+	pthread_mutex_unlock(&oauth2plugin_log_queue.mutex);
+}
+
+
+void oauth2plugin_logPrintf(
+	int level,
+	const char* format,
+	...
+) {
+	// Format
+	va_list arguments;
+	va_start(arguments, format);
+	int length = vsnprintf(NULL, 0, format, arguments);
+	va_end(arguments);
+	if (length < 0) return;
+	struct oauth2plugin_LogMessage* message = malloc(sizeof(*message) + (size_t) length + 1);
+	if (message) {
+		message->level = level;
+		message->next = NULL;
+		va_start(arguments, format);
+		vsnprintf(message->text, (size_t) length + 1, format, arguments);
+		va_end(arguments);
+	}
+
+	// Broker thread (or no broker, e.g. in tools) -> pass on directly
+	struct oauth2plugin_LogQueue* queue = &oauth2plugin_log_queue;
+	pthread_mutex_lock(&queue->mutex);
+	bool direct = !queue->broker_thread_set || pthread_equal(queue->broker_thread, pthread_self());
+	if (direct) {
+		pthread_mutex_unlock(&queue->mutex);
+		if (message) mosquitto_log_printf(level, "%s", message->text);
+		free(message);
+		return;
+	}
+
+	// Queue for the next tick
+	if (!message || queue->count >= OAUTH2PLUGIN_LOG_QUEUE_SIZE) {
+		queue->dropped++;
+		pthread_mutex_unlock(&queue->mutex);
+		free(message);
+		return;
+	}
+	if (queue->tail) queue->tail->next = message;
+	else queue->head = message;
+	queue->tail = message;
+	queue->count++;
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+
+void oauth2plugin_flushLog(void) {
+	// Take queued messages
+	struct oauth2plugin_LogQueue* queue = &oauth2plugin_log_queue;
+	pthread_mutex_lock(&queue->mutex);
+	struct oauth2plugin_LogMessage* message = queue->head;
+	unsigned long dropped = queue->dropped;
+	queue->head = NULL;
+	queue->tail = NULL;
+	queue->count = 0;
+	queue->dropped = 0;
+	pthread_mutex_unlock(&queue->mutex);
+
+	// Log
+	while (message) {
+		struct oauth2plugin_LogMessage* next = message->next;
+		mosquitto_log_printf(message->level, "%s", message->text);
+		free(message);
+		message = next;
+	}
+	if (dropped > 0) mosquitto_log_printf(MOSQ_LOG_WARNING, "[OAuth2 Plugin][W] %lu log messages of background threads dropped.", dropped);
+}
+
+
+bool oauth2plugin_parseLogLevel(
+	const char* value,
+	int* level
+) {
+	if (!value) return false;
+	if (strcmp(value, "debug") == 0) *level = OAUTH2PLUGIN_LOG_LEVEL_DEBUG;
+	else if (strcmp(value, "info") == 0) *level = OAUTH2PLUGIN_LOG_LEVEL_INFO;
+	else if (strcmp(value, "warning") == 0) *level = OAUTH2PLUGIN_LOG_LEVEL_WARNING;
+	else if (strcmp(value, "error") == 0) *level = OAUTH2PLUGIN_LOG_LEVEL_ERROR;
+	else if (strcmp(value, "none") == 0) *level = OAUTH2PLUGIN_LOG_LEVEL_NONE;
+	else return false;
+	return true;
+}
+
+
+const char* oauth2plugin_logLevel_toString(
+	int level
+) {
+	switch (level) {
+		case OAUTH2PLUGIN_LOG_LEVEL_DEBUG: return "debug";
+		case OAUTH2PLUGIN_LOG_LEVEL_INFO: return "info";
+		case OAUTH2PLUGIN_LOG_LEVEL_WARNING: return "warning";
+		case OAUTH2PLUGIN_LOG_LEVEL_ERROR: return "error";
+		case OAUTH2PLUGIN_LOG_LEVEL_NONE: return "none";
+		default: return "unknown";
+	}
+}
+
+
+const char* oauth2plugin_logRedact(
+	const char* value
+) {
+	if (!value) return "<none>";
+	if (atomic_load_explicit(&oauth2plugin_log_sensitive, memory_order_relaxed)) return value;
+	return "<redacted>";
+}
@@ -0,0 +1,164 @@
+/**
+ * log.h
+ *
+ * Level gated logging
+ *
+ * All plugin messages go through the OAUTH2PLUGIN_LOG_* macros. A message is
+ * only formatted if its level passes two checks, both made before any argument
+ * is evaluated:
+ *  - OAUTH2PLUGIN_LOG_MIN_LEVEL (compile time): statements below this level are
+ *    removed by the compiler, e.g. -DOAUTH2PLUGIN_LOG_MIN_LEVEL=1 drops all
+ *    debug statements from release builds.
+ *  - plugin_opt_log_level (run time).
+ *
+ * Mosquitto's logging is only safe on the broker thread (with log_dest topic a
+ * message becomes a $SYS publish). Messages of background threads (resolver,
+ * audit writer, revalidation, ...) are therefore queued and passed to
+ * Mosquitto by oauth2plugin_flushLog() on the next tick.
+ */
+
+#ifndef OAUTH2PLUGIN_LOG_H
+#define OAUTH2PLUGIN_LOG_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+
+
+#define OAUTH2PLUGIN_LOG_LEVEL_DEBUG	0
+#define OAUTH2PLUGIN_LOG_LEVEL_INFO		1
+#define OAUTH2PLUGIN_LOG_LEVEL_WARNING	2
+#define OAUTH2PLUGIN_LOG_LEVEL_ERROR	3
+#define OAUTH2PLUGIN_LOG_LEVEL_NONE		4
+
+#ifndef OAUTH2PLUGIN_LOG_MIN_LEVEL
+#define OAUTH2PLUGIN_LOG_MIN_LEVEL OAUTH2PLUGIN_LOG_LEVEL_DEBUG
+#endif
+
+#define OAUTH2PLUGIN_LOG_QUEUE_SIZE 1000		// Queued messages of background threads; further ones are counted as dropped.
+
+
+extern atomic_int oauth2plugin_log_level;		// Runtime level (plugin_opt_log_level).
+extern atomic_bool oauth2plugin_log_sensitive;	// Log tokens and responses unredacted (plugin_opt_log_sensitive).
+
+
+struct oauth2plugin_LogMessage {
+	int								level;		// MOSQ_LOG_* level.
+	struct oauth2plugin_LogMessage*	next;
+	char							text[];		// Formatted message.
+};
+
+
+struct oauth2plugin_LogQueue {
+	pthread_mutex_t					mutex;				// Protects all other fields.
+	pthread_t						broker_thread;		// Thread allowed to call mosquitto_log_printf().
+	bool							broker_thread_set;	// Whether @p broker_thread is known (otherwise messages are passed on directly).
+	struct oauth2plugin_LogMessage*	head;				// Oldest queued message.
+	struct oauth2plugin_LogMessage*	tail;				// Newest queued message.
+	size_t							count;				// Number of queued messages.
+	unsigned long					dropped;			// Messages dropped since the last flush because the queue was full.
+};
+
+
+#define OAUTH2PLUGIN_LOG_ENABLED(level) ( \
+	(level) >= OAUTH2PLUGIN_LOG_MIN_LEVEL \
+	&& (level) >= atomic_load_explicit(&oauth2plugin_log_level, memory_order_relaxed) \
+)
+
+#define OAUTH2PLUGIN_LOG(level, mosquitto_level, tag, ...) do { \
+	if (OAUTH2PLUGIN_LOG_ENABLED(level)) \
+		oauth2plugin_logPrintf(mosquitto_level, "[OAuth2 Plugin][" tag "] " __VA_ARGS__); \
+} while (0)
+
+#define OAUTH2PLUGIN_LOG_DEBUG(...)		OAUTH2PLUGIN_LOG(OAUTH2PLUGIN_LOG_LEVEL_DEBUG, MOSQ_LOG_DEBUG, "D", __VA_ARGS__)
+#define OAUTH2PLUGIN_LOG_INFO(...)		OAUTH2PLUGIN_LOG(OAUTH2PLUGIN_LOG_LEVEL_INFO, MOSQ_LOG_INFO, "I", __VA_ARGS__)
+#define OAUTH2PLUGIN_LOG_WARNING(...)	OAUTH2PLUGIN_LOG(OAUTH2PLUGIN_LOG_LEVEL_WARNING, MOSQ_LOG_WARNING, "W", __VA_ARGS__)
+#define OAUTH2PLUGIN_LOG_ERROR(...)		OAUTH2PLUGIN_LOG(OAUTH2PLUGIN_LOG_LEVEL_ERROR, MOSQ_LOG_ERR, "E", __VA_ARGS__)
+
+
+/**
+ * @brief Set the runtime log settings.
+ *
+ * @param level		Minimum level (OAUTH2PLUGIN_LOG_LEVEL_*) of messages passed to Mosquitto.
+ * @param sensitive	Whether tokens and introspection responses are logged unredacted.
+ */
+void oauth2plugin_setLogSettings(
+	int level,
+	bool sensitive
+);
+
+
+/**
+ * @brief Remember the calling thread as the broker thread.
+ *
+ * Called on plugin init. Until then, messages are passed on directly.
+ */
+void oauth2plugin_setLogBrokerThread(void);
+
+
+/**
+ * @brief Pass a message to Mosquitto, or queue it when called off the broker thread.
+ *
+ * Used by the OAUTH2PLUGIN_LOG_* macros, which check the level before.
+ *
+ * @param level		MOSQ_LOG_* level.
+ * @param format	printf format.
+ */
+void oauth2plugin_logPrintf(
+	int level,
+	const char* format,
+	...
+) __attribute__((format(printf, 2, 3)));
+
+
+/**
+ * @brief Pass the messages queued by background threads to Mosquitto.
+ *
+ * Must be called on the broker thread (MOSQ_EVT_TICK and plugin cleanup).
+ */
+void oauth2plugin_flushLog(void);
+
+
+/**
+ * @brief Parse a log level name.
+ *
+ * @param value		"debug", "info", "warning", "error" or "none".
+ * @param level		Output: OAUTH2PLUGIN_LOG_LEVEL_* value.
+ * @return			true if @p value is a valid level.
+ */
+bool oauth2plugin_parseLogLevel(
+	const char* value,
+	int* level
+);
+
+
+/**
+ * @brief Get the name of a log level.
+ *
+ * @param level		OAUTH2PLUGIN_LOG_LEVEL_* value.
+ * @return			Level name.
+ */
+const char* oauth2plugin_logLevel_toString(
+	int level
+);
+
+
+/**
+ * @brief Redact a secret value for logging.
+ *
+ * @param value		Token, POST body or response body. May be NULL.
+ * @return			@p value if plugin_opt_log_sensitive is enabled, otherwise a placeholder.
+ */
+const char* oauth2plugin_logRedact(
+	const char* value
+);
+
+#endif // OAUTH2PLUGIN_LOG_H
@@ -0,0 +1,344 @@
+/**
+ * mappedindex.c
+ *
+ * Source files compiled into memory-mapped index files that are rebuilt in
+ * background when the source changes (revocation list, token store)
+ */
+
+#include "mappedindex.h"
+
+
+struct oauth2plugin_IndexWatcher* oauth2plugin_initIndexWatcher(
+	const struct oauth2plugin_IndexFormat* format,
+	const char* file_path,
+	const char* index_path,
+	long check_interval
+) {
+	if (!file_path) return NULL;
+
+	// Init
+	struct oauth2plugin_IndexWatcher* watcher = calloc(1, sizeof(*watcher));
+	if (!watcher) return NULL;
+	watcher->format = format;
+	watcher->file_path = strdup(file_path);
+	if (index_path) {
+		watcher->index_path = strdup(index_path);
+	} else {
+		size_t index_path_size = strlen(file_path) + 5;
+		watcher->index_path = malloc(index_path_size);
+		if (watcher->index_path) snprintf(watcher->index_path, index_path_size, "%s.idx", file_path);
+	}
+	watcher->check_interval = check_interval;
+	pthread_mutex_init(&watcher->mutex, NULL);
+	pthread_cond_init(&watcher->cond, NULL);
+	watcher->running = true;
+	if (!watcher->file_path || !watcher->index_path) {
+		oauth2plugin_freeIndexWatcher(watcher);
+		return NULL;
+	}
+
+	// Load initial index synchronously
+	watcher->current = oauth2plugin_loadIndex(format, watcher->file_path, watcher->index_path);
+	if (!watcher->current) {
+		oauth2plugin_freeIndexWatcher(watcher);
+		return NULL;
+	}
+	OAUTH2PLUGIN_LOG_INFO("Loaded %llu %s from %s.", (unsigned long long) watcher->current->entry_count, format->entries_name, watcher->file_path);
+
+	// Watch for changes
+	if (check_interval > 0) {
+		if (pthread_create(&watcher->thread, NULL, oauth2plugin_runIndexWatcher, watcher) != 0) {
+			oauth2plugin_freeIndexWatcher(watcher);
+			return NULL;
+		}
+		watcher->thread_started = true;
+	}
+
+	return watcher;
+}
+
+
+void oauth2plugin_freeIndexWatcher(
+	struct oauth2plugin_IndexWatcher* watcher
+) {
+	if (!watcher) return;
+
+	// Stop watcher thread
+	pthread_mutex_lock(&watcher->mutex);
+	watcher->running = false;
+	pthread_cond_signal(&watcher->cond);
+	pthread_mutex_unlock(&watcher->mutex);
+	if (watcher->thread_started) pthread_join(watcher->thread, NULL);
+
+	// Free
+	oauth2plugin_freeIndex(oauth2plugin_dropIndex(watcher->current));
+	oauth2plugin_freeIndex(oauth2plugin_dropIndex(watcher->pending));
+	pthread_cond_destroy(&watcher->cond);
+	pthread_mutex_destroy(&watcher->mutex);
+	free(watcher->file_path);
+	free(watcher->index_path);
+	free(watcher);
+}
+
+
+struct oauth2plugin_MappedIndex* oauth2plugin_acquireIndex(
+	struct oauth2plugin_IndexWatcher* watcher
+) {
+	pthread_mutex_lock(&watcher->mutex);
+	struct oauth2plugin_MappedIndex* index = watcher->current;
+	index->references++;
+	pthread_mutex_unlock(&watcher->mutex);
+	return index;
+}
+
+
+void oauth2plugin_releaseIndex(
+	struct oauth2plugin_IndexWatcher* watcher,
+	struct oauth2plugin_MappedIndex* index
+) {
+	pthread_mutex_lock(&watcher->mutex);
+	struct oauth2plugin_MappedIndex* unused = oauth2plugin_dropIndex(index);
+	pthread_mutex_unlock(&watcher->mutex);
+	oauth2plugin_freeIndex(unused);
+}
+
+
+void oauth2plugin_publishIndex(
+	struct oauth2plugin_IndexWatcher* watcher
+) {
+	if (!watcher) return;
+	pthread_mutex_lock(&watcher->mutex);
+	struct oauth2plugin_MappedIndex* index = watcher->pending;
+	struct oauth2plugin_MappedIndex* unused = NULL;
+	if (index) {
+		unused = oauth2plugin_dropIndex(watcher->current);
+		watcher->current = index;
+		watcher->pending = NULL;
+	}
+	pthread_mutex_unlock(&watcher->mutex);
+	if (!index) return;
+
+	oauth2plugin_freeIndex(unused);
+	OAUTH2PLUGIN_LOG_INFO("Reloaded %llu %s from %s.", (unsigned long long) index->entry_count, watcher->format->entries_name, watcher->file_path);
+}
+
+
+void oauth2plugin_writeIndexHeader(
+	uint8_t* index,
+	const struct oauth2plugin_IndexFormat* format,
+	uint32_t flags,
+	const struct stat* source_stat
+) {
+	uint64_t header[4] = {
+		0,
+		(uint64_t) format->version | ((uint64_t) flags << 32),
+		(uint64_t) source_stat->st_size,
+		oauth2plugin_getIndexMtime(source_stat)
+	};
+	memcpy(header, format->magic, 8);
+	memcpy(index, header, sizeof(header));
+}
+
+
+static void* oauth2plugin_runIndexWatcher(
+	void* arg
+) {
+	struct oauth2plugin_IndexWatcher* watcher = (struct oauth2plugin_IndexWatcher*) arg;
+
+	// Remember which source the newest index was built from
+	uint64_t source_size = watcher->current->source_size;
+	uint64_t source_mtime = watcher->current->source_mtime;
+
+	pthread_mutex_lock(&watcher->mutex);
+	while (watcher->running) {
+		// Wait for next check
+		struct timespec wakeup;
+		clock_gettime(CLOCK_REALTIME, &wakeup);
+		wakeup.tv_sec += watcher->check_interval;
+		pthread_cond_timedwait(&watcher->cond, &watcher->mutex, &wakeup);
+		if (!watcher->running) break;
+		pthread_mutex_unlock(&watcher->mutex);
+
+		// Rebuild if the source file changed
+		struct stat source_stat;
+		if (
+			stat(watcher->file_path, &source_stat) == 0
+			&& (
+				(uint64_t) source_stat.st_size != source_size
+				|| oauth2plugin_getIndexMtime(&source_stat) != source_mtime
+			)
+		) {
+			struct oauth2plugin_MappedIndex* index = oauth2plugin_loadIndex(watcher->format, watcher->file_path, watcher->index_path);
+			if (index) {
+				source_size = index->source_size;
+				source_mtime = index->source_mtime;
+
+				// Hand over to the broker thread; drop a rebuilt index that was never published
+				pthread_mutex_lock(&watcher->mutex);
+				struct oauth2plugin_MappedIndex* unused = oauth2plugin_dropIndex(watcher->pending);
+				watcher->pending = index;
+				pthread_mutex_unlock(&watcher->mutex);
+				oauth2plugin_freeIndex(unused);
+			} else {
+				OAUTH2PLUGIN_LOG_WARNING("Failed to reload %s %s. Keeping current %s.", watcher->format->name, watcher->file_path, watcher->format->name);
+				source_size = (uint64_t) source_stat.st_size;
+				source_mtime = oauth2plugin_getIndexMtime(&source_stat);
+			}
+		}
+
+		pthread_mutex_lock(&watcher->mutex);
+	}
+	pthread_mutex_unlock(&watcher->mutex);
+
+	return NULL;
+}
+
+
+static struct oauth2plugin_MappedIndex* oauth2plugin_loadIndex(
+	const struct oauth2plugin_IndexFormat* format,
+	const char* file_path,
+	const char* index_path
+) {
+	struct stat source_stat;
+	if (stat(file_path, &source_stat) != 0) {
+		OAUTH2PLUGIN_LOG_ERROR("Cannot read %s %s.", format->name, file_path);
+		return NULL;
+	}
+
+	// Reuse an up to date index (fast restart with large sources)
+	struct oauth2plugin_MappedIndex* index = oauth2plugin_mapIndex(format, index_path, &source_stat);
+	if (index) return index;
+
+	// Compile
+	size_t index_size = 0;
+	uint8_t* data = format->build(file_path, &source_stat, &index_size);
+	if (!data) {
+		OAUTH2PLUGIN_LOG_ERROR("Cannot read %s %s.", format->name, file_path);
+		return NULL;
+	}
+
+	// Write index next to its final name and rename atomically, then map it
+	size_t temporary_path_size = strlen(index_path) + 5;
+	char* temporary_path = malloc(temporary_path_size);
+	if (temporary_path) {
+		snprintf(temporary_path, temporary_path_size, "%s.tmp", index_path);
+		int fd = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC, format->mode);
+		FILE* file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+		if (fd >= 0 && !file) close(fd);
+		bool written = file && fwrite(data, 1, index_size, file) == index_size;
+		if (file) written = fclose(file) == 0 && written;
+		if (written && rename(temporary_path, index_path) == 0) {
+			index = oauth2plugin_mapIndex(format, index_path, &source_stat);
+		} else {
+			remove(temporary_path);
+		}
+		free(temporary_path);
+	}
+
+	// Fall back to anonymous memory
+	if (!index) {
+		OAUTH2PLUGIN_LOG_DEBUG("Cannot write index %s, keeping it in memory.", index_path);
+		void* map = mmap(NULL, index_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (map != MAP_FAILED) {
+			memcpy(map, data, index_size);
+			mprotect(map, index_size, PROT_READ);
+			index = oauth2plugin_attachIndex(format, map, index_size);
+		}
+	}
+
+	free(data);
+	return index;
+}
+
+
+static struct oauth2plugin_MappedIndex* oauth2plugin_mapIndex(
+	const struct oauth2plugin_IndexFormat* format,
+	const char* index_path,
+	const struct stat* source_stat
+) {
+	// Map file
+	int fd = open(index_path, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat index_stat;
+	if (fstat(fd, &index_stat) != 0 || index_stat.st_size < OAUTH2PLUGIN_MAPPEDINDEX_HEADER_SIZE) {
+		close(fd);
+		return NULL;
+	}
+	void* map = mmap(NULL, (size_t) index_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return NULL;
+
+	// Check header and source
+	struct oauth2plugin_MappedIndex* index = oauth2plugin_attachIndex(format, map, (size_t) index_stat.st_size);
+	if (!index) return NULL;
+	if (
+		index->source_size != (uint64_t) source_stat->st_size
+		|| index->source_mtime != oauth2plugin_getIndexMtime(source_stat)
+	) {
+		oauth2plugin_freeIndex(index);
+		return NULL;
+	}
+
+	// Entries are looked up randomly
+	madvise(map, index->map_size, MADV_RANDOM);
+	return index;
+}
+
+
+static struct oauth2plugin_MappedIndex* oauth2plugin_attachIndex(
+	const struct oauth2plugin_IndexFormat* format,
+	void* map,
+	size_t map_size
+) {
+	struct oauth2plugin_MappedIndex* index = calloc(1, format->size);
+	if (!index) {
+		munmap(map, map_size);
+		return NULL;
+	}
+	index->map = map;
+	index->map_size = map_size;
+	index->references = 1;
+
+	// Common header, then the format's sections
+	uint64_t header[4];
+	bool valid = map_size >= OAUTH2PLUGIN_MAPPEDINDEX_HEADER_SIZE && memcmp(map, format->magic, 8) == 0;
+	if (valid) {
+		memcpy(header, map, sizeof(header));
+		valid = (uint32_t) header[1] == format->version;
+	}
+	if (valid) {
+		index->flags = (uint32_t) (header[1] >> 32);
+		index->source_size = header[2];
+		index->source_mtime = header[3];
+		valid = format->attach(index);
+	}
+	if (!valid) {
+		oauth2plugin_freeIndex(index);
+		return NULL;
+	}
+	return index;
+}
+
+
+static struct oauth2plugin_MappedIndex* oauth2plugin_dropIndex(
+	struct oauth2plugin_MappedIndex* index
+) {
+	if (!index) return NULL;
+	return --index->references == 0 ? index : NULL;
+}
+
+
+static void oauth2plugin_freeIndex(
+	struct oauth2plugin_MappedIndex* index
+) {
+	if (!index) return;
+	if (index->map) munmap(index->map, index->map_size);
+	free(index);
+}
+
+
+static uint64_t oauth2plugin_getIndexMtime(
+	const struct stat* file_stat
+) {
+	return (uint64_t) file_stat->st_mtim.tv_sec * 1000000000ull + (uint64_t) file_stat->st_mtim.tv_nsec;
+}
@@ -0,0 +1,255 @@
+/**
+ * mappedindex.h
+ *
+ * Source files compiled into memory-mapped index files that are rebuilt in
+ * background when the source changes (revocation list, token store)
+ *
+ * Every index starts with a common header (all integers little endian):
+ *   "<8 byte magic>", u32 version, u32 flags, u64 source size,
+ *   u64 source mtime (nanoseconds), format specific fields, padding to 64 bytes
+ *
+ * The compiled index is written next to its final name and renamed, so a
+ * crashed build never leaves a truncated index behind. It is reused without
+ * recompiling if it was compiled from a source file of the same size and
+ * modification time. If it cannot be written, it is kept in anonymous memory.
+ */
+
+#ifndef OAUTH2PLUGIN_MAPPEDINDEX_H
+#define OAUTH2PLUGIN_MAPPEDINDEX_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_MAPPEDINDEX_HEADER_SIZE 64		// Padded so the first section starts on a cache line.
+
+
+struct oauth2plugin_MappedIndex {
+	void*		map;			// Mapping of the compiled index.
+	size_t		map_size;		// Size of the mapping.
+	uint32_t	flags;			// Format specific flags from the header.
+	uint64_t	source_size;	// Size of the source file the index was compiled from.
+	uint64_t	source_mtime;	// Modification time (ns) of the source file.
+	uint64_t	entry_count;	// Number of entries (set by the format's attach function).
+	long		references;		// Readers plus the current slot of the watcher (protected by its mutex).
+};
+
+
+struct oauth2plugin_IndexFormat {
+	const char*	name;			// Name of the source file in log messages ("revocation list").
+	const char*	entries_name;	// Name of the entries in log messages ("revoked tokens").
+	const char*	magic;			// 8 byte magic at the start of the header.
+	uint32_t	version;		// Format version in the header.
+	mode_t		mode;			// Permissions of the written index file.
+	size_t		size;			// Size of the format's index struct, which starts with a struct oauth2plugin_MappedIndex.
+	uint8_t*	(*build)(const char*, const struct stat*, size_t*);		// Compile a source file into a newly allocated index (see oauth2plugin_writeIndexHeader()).
+	bool		(*attach)(struct oauth2plugin_MappedIndex*);			// Check the format specific header and sections and set the format's fields.
+};
+
+
+struct oauth2plugin_IndexWatcher {
+	const struct oauth2plugin_IndexFormat*	format;			// Index format.
+	char*									file_path;		// Source file.
+	char*									index_path;		// Compiled index file.
+	long									check_interval;	// Seconds between checks for changes (0 = never).
+	struct oauth2plugin_MappedIndex*		current;		// Index used by lookups.
+	struct oauth2plugin_MappedIndex*		pending;		// Rebuilt index waiting for oauth2plugin_publishIndex().
+	pthread_mutex_t							mutex;			// Protects current, pending, running and the references of the indexes.
+	pthread_cond_t							cond;			// Wakes the watcher thread.
+	pthread_t								thread;			// Watcher thread.
+	bool									thread_started;	// Whether @p thread has to be joined.
+	bool									running;		// Cleared to stop the watcher thread.
+};
+
+
+/**
+ * @brief Load an index and start watching its source file.
+ *
+ * @param format			Index format.
+ * @param file_path			Source file.
+ * @param index_path		Compiled index file or NULL for "<file_path>.idx".
+ * @param check_interval	Seconds between checks for changes of the source file (0 = never).
+ * @return					Pointer to a new watcher or NULL on failure (logged).
+ */
+struct oauth2plugin_IndexWatcher* oauth2plugin_initIndexWatcher(
+	const struct oauth2plugin_IndexFormat* format,
+	const char* file_path,
+	const char* index_path,
+	long check_interval
+);
+
+
+/**
+ * @brief Stop the watcher thread and unmap the indexes.
+ *
+ * Indexes still acquired by readers must have been released before.
+ *
+ * @param watcher	Watcher created by oauth2plugin_initIndexWatcher(). May be NULL.
+ */
+void oauth2plugin_freeIndexWatcher(
+	struct oauth2plugin_IndexWatcher* watcher
+);
+
+
+/**
+ * @brief Take a reference to the current index.
+ *
+ * Thread safe. The index stays mapped until oauth2plugin_releaseIndex(), even
+ * if a rebuilt index is published meanwhile.
+ *
+ * @param watcher	Watcher.
+ * @return			Current index.
+ */
+struct oauth2plugin_MappedIndex* oauth2plugin_acquireIndex(
+	struct oauth2plugin_IndexWatcher* watcher
+);
+
+
+/**
+ * @brief Release a reference taken by oauth2plugin_acquireIndex(); the last one unmaps a replaced index.
+ *
+ * @param watcher	Watcher.
+ * @param index		Acquired index.
+ */
+void oauth2plugin_releaseIndex(
+	struct oauth2plugin_IndexWatcher* watcher,
+	struct oauth2plugin_MappedIndex* index
+);
+
+
+/**
+ * @brief Make a rebuilt index current, if any.
+ *
+ * Must be called from the broker thread (MOSQ_EVT_TICK). Readers on the broker
+ * thread may therefore use watcher->current without acquiring it; the old
+ * index is unmapped once readers on other threads released it.
+ *
+ * @param watcher	Watcher. May be NULL.
+ */
+void oauth2plugin_publishIndex(
+	struct oauth2plugin_IndexWatcher* watcher
+);
+
+
+/**
+ * @brief Write the common header at the start of a newly built index.
+ *
+ * @param index			Index of at least OAUTH2PLUGIN_MAPPEDINDEX_HEADER_SIZE bytes.
+ * @param format		Index format.
+ * @param flags			Format specific flags.
+ * @param source_stat	Status of the source file.
+ */
+void oauth2plugin_writeIndexHeader(
+	uint8_t* index,
+	const struct oauth2plugin_IndexFormat* format,
+	uint32_t flags,
+	const struct stat* source_stat
+);
+
+
+/**
+ * @brief Watcher thread: rebuild the index when the source file changes.
+ *
+ * @param arg	Pointer to the oauth2plugin_IndexWatcher.
+ * @return		Always NULL.
+ */
+static void* oauth2plugin_runIndexWatcher(
+	void* arg
+);
+
+
+/**
+ * @brief Compile a source file into an index and map it.
+ *
+ * @param format		Index format.
+ * @param file_path		Source file.
+ * @param index_path	Compiled index file.
+ * @return				Newly mapped index (one reference) or NULL on failure.
+ */
+static struct oauth2plugin_MappedIndex* oauth2plugin_loadIndex(
+	const struct oauth2plugin_IndexFormat* format,
+	const char* file_path,
+	const char* index_path
+);
+
+
+/**
+ * @brief Map an existing index file if it was compiled from the current source file.
+ *
+ * @param format		Index format.
+ * @param index_path	Compiled index file.
+ * @param source_stat	Status of the source file.
+ * @return				Mapped index or NULL if the index is missing, invalid or outdated.
+ */
+static struct oauth2plugin_MappedIndex* oauth2plugin_mapIndex(
+	const struct oauth2plugin_IndexFormat* format,
+	const char* index_path,
+	const struct stat* source_stat
+);
+
+
+/**
+ * @brief Wrap a mapping into an index after checking its headers.
+ *
+ * @param format	Index format.
+ * @param map		Mapping. Unmapped on failure.
+ * @param map_size	Size of the mapping.
+ * @return			New index (one reference) or NULL if the mapping is not a valid index.
+ */
+static struct oauth2plugin_MappedIndex* oauth2plugin_attachIndex(
+	const struct oauth2plugin_IndexFormat* format,
+	void* map,
+	size_t map_size
+);
+
+
+/**
+ * @brief Drop a reference to an index; the last one unmaps and frees it.
+ *
+ * Caller must hold the watcher's mutex (or be the only user of @p index).
+ *
+ * @param index		Index. May be NULL.
+ * @return			@p index if it has to be freed with oauth2plugin_freeIndex(), otherwise NULL.
+ */
+static struct oauth2plugin_MappedIndex* oauth2plugin_dropIndex(
+	struct oauth2plugin_MappedIndex* index
+);
+
+
+/**
+ * @brief Unmap and free an index.
+ *
+ * @param index		Index. May be NULL.
+ */
+static void oauth2plugin_freeIndex(
+	struct oauth2plugin_MappedIndex* index
+);
+
+
+/**
+ * @brief Get the modification time of a file in nanoseconds.
+ *
+ * @param file_stat		File status.
+ * @return				Modification time in nanoseconds since the epoch.
+ */
+static uint64_t oauth2plugin_getIndexMtime(
+	const struct stat* file_stat
+);
+
+#endif // OAUTH2PLUGIN_MAPPEDINDEX_H
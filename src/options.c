@@ -5,6 +5,17 @@
  */
 
 #include "options.h"
+#include "http.h"
+#include "router.h"
+#include "audit.h"
+#include "capture.h"
+#include "revocation.h"
+#include "tokenstore.h"
+#include "verifier.h"
+#include "prescreen.h"
+#include "sidecar.h"
+#include "credentials.h"
+#include "template.h"
 
 
 const struct oauth2plugin_template_placeholder oauth2plugin_template_placeholders[] = {
@@ -18,10 +29,55 @@ const size_t oauth2plugin_oidc_template_placeholders_count =
 	sizeof(oauth2plugin_template_placeholders) /
 	sizeof(oauth2plugin_template_placeholders[0]);
 
+// Options of the whole plugin, read from the default profile only (not inherited by named profiles)
+static const char* const oauth2plugin_root_options[] = {
+	"dns_min_ttl", "dns_max_ttl",
+	"log_level", "log_sensitive",
+	"audit_log_file", "audit_log_max_size", "audit_log_rotate_count", "audit_log_buffer_size",
+	"capture_file",
+	"revocation_file", "revocation_index_file", "revocation_check_interval",
+	"revalidation_rate", "revalidation_interval",
+	"invalidation_topic", "invalidation_publishers", "invalidation_ttl"
+};
+
 
 struct oauth2plugin_Options* oauth2plugin_initOptions() {
 	struct oauth2plugin_Options* _options = calloc(1, sizeof(*_options));
 	if (!_options) return NULL;
+
+	// Set default options
+	_options->tls_verification = true;
+	_options->timeout = 5;
+	_options->prewarm_connections = 0;
+	_options->dns_min_ttl = 5;
+	_options->dns_max_ttl = 300;
+	_options->verifier = verifier_INTROSPECTION;
+	_options->client_authentication = client_authentication_CLIENT_SECRET_BASIC;
+	_options->client_assertion_lifetime = 60;
+	_options->prescreen_min_length = 1;
+	_options->prescreen_max_length = 0;
+	_options->prescreen_charset = prescreen_charset_ANY;
+	_options->prescreen_format = prescreen_format_ANY;
+	_options->prescreen_check_exp = false;
+	_options->prescreen_exp_leeway = 60;
+	_options->log_level = OAUTH2PLUGIN_LOG_LEVEL_INFO;
+	_options->log_sensitive = false;
+	_options->audit_log_max_size = 10 * 1024 * 1024;
+	_options->audit_log_rotate_count = 5;
+	_options->audit_log_buffer_size = 4096;
+	_options->revocation_check_interval = 5;
+	_options->token_store_check_interval = 5;
+	_options->revalidation_rate = 0;
+	_options->revalidation_interval = 300;
+	_options->optimistic_admission = false;
+	_options->optimistic_max_pending = 1000;
+	_options->invalidation_ttl = 3600;
+	_options->username_validation = false;
+	_options->username_validation_error = verification_error_DEFER;
+	_options->username_replacement = false;
+	_options->username_replacement_error = verification_error_DENY;
+	_options->token_verification_error = verification_error_DENY;
+
 	return _options;
 }
 
@@ -38,105 +94,72 @@ int oauth2plugin_applyOptions(
 		|| mosquitto_options_count < 1
 	) return MOSQ_ERR_UNKNOWN;
 
-	// Iterate through mosquitto_options
+	// Apply options of the default profile
 	for (int i = 0; i < mosquitto_options_count; i++) {
-		// introspection_endpoint
-		if (
-			strcmp(mosquitto_options[i].key, "introspection_endpoint") == 0 
-			&& mosquitto_options[i].value
-		) {
-			options->introspection_endpoint = strdup(mosquitto_options[i].value);
-		}
-		// tls_verification
-		else if (
-			strcmp(mosquitto_options[i].key, "tls_verification") == 0
-			&& mosquitto_options[i].value
-		) {
-			if (strcmp(mosquitto_options[i].value, "false") == 0) options->tls_verification = false;
-			else if (strcmp(mosquitto_options[i].value, "true") == 0) options->tls_verification = true;
-		}
-		// timeout
-		else if (
-			strcmp(mosquitto_options[i].key, "timeout") == 0
-		) {
-			options->timeout = strtol(mosquitto_options[i].value, NULL, 10);
-		}
-		// client_id
-		else if (
-			strcmp(mosquitto_options[i].key, "client_id") == 0 
-			&& mosquitto_options[i].value
-		) {
-			options->client_id = strdup(mosquitto_options[i].value);
-		}
-		// client_secret
-		else if (
-			strcmp(mosquitto_options[i].key, "client_secret") == 0 
-			&& mosquitto_options[i].value
-		) {
-			options->client_secret = strdup(mosquitto_options[i].value);
-		}
-		// username_validation
-		else if (
-			strcmp(mosquitto_options[i].key, "username_validation") == 0
-			&& mosquitto_options[i].value
-		) {
-			if (strcmp(mosquitto_options[i].value, "false") == 0) options->username_validation = false;
-			else if (strcmp(mosquitto_options[i].value, "true") == 0) options->username_validation = true;
-		}
-		// username_validation_template
-		else if (
-			strcmp(mosquitto_options[i].key, "username_validation_template") == 0 
-			&& mosquitto_options[i].value
-		) {
-			options->username_validation_template = strdup(mosquitto_options[i].value);
-		}
-		// username_validation_error
-		else if (
-			strcmp(mosquitto_options[i].key, "username_validation_error") == 0 
-			&& mosquitto_options[i].value
-		) {
-			if (strcmp(mosquitto_options[i].value, "deny") == 0 ) options->username_validation_error = verification_error_DENY;
-			else if (strcmp(mosquitto_options[i].value, "defer") == 0 ) options->username_validation_error = verification_error_DEFER;
-		}
-		// username_replacement
-		else if (
-			strcmp(mosquitto_options[i].key, "username_replacement") == 0
-			&& mosquitto_options[i].value
-		) {
-			if (strcmp(mosquitto_options[i].value, "false") == 0) options->username_replacement = false;
-			else if (strcmp(mosquitto_options[i].value, "true") == 0) options->username_replacement = true;
-		}
-		// username_replacement_template
-		else if (
-			strcmp(mosquitto_options[i].key, "username_replacement_template") == 0 
-			&& mosquitto_options[i].value
-		) {
-			options->username_replacement_template = strdup(mosquitto_options[i].value);
-		}
-		// username_replacement_error
-		else if (
-			strcmp(mosquitto_options[i].key, "username_replacement_error") == 0 
-			&& mosquitto_options[i].value
-		) {
-			if (strcmp(mosquitto_options[i].value, "deny") == 0 ) options->username_replacement_error = verification_error_DENY;
-			else if (strcmp(mosquitto_options[i].value, "defer") == 0 ) options->username_replacement_error = verification_error_DEFER;
-		}
-		// token_verification_error
-		else if (
-			strcmp(mosquitto_options[i].key, "token_verification_error") == 0 
-			&& mosquitto_options[i].value
-		) {
-			if (strcmp(mosquitto_options[i].value, "deny") == 0 ) options->token_verification_error = verification_error_DENY;
-			else if (strcmp(mosquitto_options[i].value, "defer") == 0 ) options->token_verification_error = verification_error_DEFER;
+		if (strchr(mosquitto_options[i].key, '.')) continue;
+		oauth2plugin_applyOption(options, mosquitto_options[i].key, mosquitto_options[i].value);
+	}
+
+	// Apply options of named profiles ("<profile>.<option>")
+	for (int i = 0; i < mosquitto_options_count; i++) {
+		const char* dot = strchr(mosquitto_options[i].key, '.');
+		if (!dot || dot == mosquitto_options[i].key) continue;
+		if (oauth2plugin_isRootOption(dot + 1)) {
+			OAUTH2PLUGIN_LOG_WARNING("Option 'plugin_opt_%s' applies to the whole plugin and cannot be set per profile, ignoring it.", mosquitto_options[i].key);
+			continue;
 		}
+		struct oauth2plugin_Options* profile = oauth2plugin_getProfile(
+			options,
+			mosquitto_options[i].key,
+			(size_t) (dot - mosquitto_options[i].key),
+			mosquitto_options,
+			mosquitto_options_count
+		);
+		if (!profile) return MOSQ_ERR_NOMEM;
+		oauth2plugin_applyOption(profile, dot + 1, mosquitto_options[i].value);
 	}
 
-	// Check for mandatory options
-	if(
-		!options->introspection_endpoint 
-		|| !options->client_id 
-		|| !options->client_secret
+	// Compile verifier chains of all profiles
+	for (size_t i = 0; i <= options->profiles_count; i++) {
+		struct oauth2plugin_Options* profile = i == 0 ? options : options->profiles[i - 1];
+		int verifier_chain_error = oauth2plugin_initVerifierChain(profile);
+		if (verifier_chain_error) return verifier_chain_error;
+	}
+
+	// Check for mandatory options (the default profile may be left without endpoint if named profiles exist)
+	if (
+		options->profiles_count == 0
+		&& !oauth2plugin_hasMandatoryOptions(options)
 	) return MOSQ_ERR_INVAL;
+	for (size_t i = 0; i < options->profiles_count; i++) {
+		if (!oauth2plugin_hasMandatoryOptions(options->profiles[i])) return MOSQ_ERR_INVAL;
+	}
+
+	// Reject listener routing the broker cannot provide
+#if !OAUTH2PLUGIN_ROUTER_LISTENER_SUPPORTED
+	for (size_t i = 0; i < options->profiles_count; i++) {
+		if (!options->profiles[i]->match_listener) continue;
+		OAUTH2PLUGIN_LOG_ERROR("Option 'plugin_opt_%s.match_listener' requires Mosquitto 2.1 or newer (mosquitto_client_port()).", options->profiles[i]->name);
+		return MOSQ_ERR_NOT_SUPPORTED;
+	}
+#endif
+
+	// Compile profile routing
+	if (options->profiles_count > 0) {
+		options->router = oauth2plugin_initRouter(options->profiles, options->profiles_count);
+		if (!options->router) return MOSQ_ERR_NOMEM;
+	}
+
+	// Compile token pre-screening rules and username templates of all profiles
+	for (size_t i = 0; i <= options->profiles_count; i++) {
+		struct oauth2plugin_Options* profile = i == 0 ? options : options->profiles[i - 1];
+		profile->prescreen = oauth2plugin_initPrescreen(profile);
+		if (!profile->prescreen) return MOSQ_ERR_NOMEM;
+		if (profile->username_validation_template) {
+			profile->username_validation_compiled = oauth2plugin_initTemplate(profile->username_validation_template);
+			if (!profile->username_validation_compiled) return MOSQ_ERR_NOMEM;
+		}
+	}
 
 	// Return
 	return MOSQ_ERR_SUCCESS;
@@ -147,11 +170,46 @@ void oauth2plugin_freeOptions(
 	struct oauth2plugin_Options *options
 ) {
 	if(!options) return;
+	for (size_t i = 0; i < options->profiles_count; i++)
+		oauth2plugin_freeOptions(options->profiles[i]);
+	free(options->profiles);
+	oauth2plugin_freeRouter(options->router);
+	oauth2plugin_freePrescreen(options->prescreen);
+	free(options->prescreen_issuers);
+	oauth2plugin_freeHTTPPool(options->http_pool);
+	oauth2plugin_freeSidecar(options->sidecar);
+	free(options->sidecar_socket);
+	free(options->verifier_chain);
+	oauth2plugin_freeAuditLog(options->audit_log);
+	free(options->audit_log_file);
+	oauth2plugin_freeCapture(options->capture);
+	free(options->capture_file);
+	oauth2plugin_freeRevocationList(options->revocation_list);
+	free(options->revocation_file);
+	free(options->revocation_index_file);
+	oauth2plugin_freeTokenStore(options->token_store);
+	free(options->token_store_file);
+	free(options->token_store_index_file);
+	free(options->invalidation_topic);
+	free(options->invalidation_publishers);
+	free(options->issuer);
 	free(options->introspection_endpoint);
+	free(options->jwks_uri);
 	free(options->client_id);
 	free(options->client_secret);
+	oauth2plugin_freeCredentials(options->credentials);
+	free(options->token_endpoint);
+	free(options->token_scope);
+	free(options->client_assertion_key);
+	free(options->client_assertion_key_id);
+	free(options->client_assertion_audience);
 	free(options->username_validation_template);
+	oauth2plugin_freeTemplate(options->username_validation_compiled);
 	free(options->username_replacement_template);
+	free(options->name);
+	free(options->match_issuer);
+	free(options->match_listener);
+	free(options->match_username_prefix);
 	free(options);
 }
 
@@ -165,3 +223,572 @@ const char* oauth2plugin_Options_verification_error_toString(
 		default: return "unknown";
 	}
 }
+
+
+const char* oauth2plugin_Options_verifier_toString(
+	enum oauth2plugin_Options_verifier value
+) {
+	switch (value) {
+		case verifier_INTROSPECTION: return "introspection";
+		case verifier_SIDECAR: return "sidecar";
+		case verifier_STORE: return "store";
+		default: return "unknown";
+	}
+}
+
+
+const char* oauth2plugin_Options_client_authentication_toString(
+	enum oauth2plugin_Options_client_authentication value
+) {
+	switch (value) {
+		case client_authentication_CLIENT_SECRET_BASIC: return "client_secret_basic";
+		case client_authentication_CLIENT_CREDENTIALS: return "client_credentials";
+		case client_authentication_PRIVATE_KEY_JWT: return "private_key_jwt";
+		default: return "unknown";
+	}
+}
+
+
+const char* oauth2plugin_Options_prescreen_charset_toString(
+	enum oauth2plugin_Options_prescreen_charset value
+) {
+	switch (value) {
+		case prescreen_charset_ANY: return "any";
+		case prescreen_charset_PRINTABLE: return "printable";
+		case prescreen_charset_B64TOKEN: return "b64token";
+		case prescreen_charset_BASE64URL: return "base64url";
+		default: return "unknown";
+	}
+}
+
+
+const char* oauth2plugin_Options_prescreen_format_toString(
+	enum oauth2plugin_Options_prescreen_format value
+) {
+	switch (value) {
+		case prescreen_format_ANY: return "any";
+		case prescreen_format_JWT: return "jwt";
+		case prescreen_format_OPAQUE: return "opaque";
+		default: return "unknown";
+	}
+}
+
+
+static bool oauth2plugin_applyOption(
+	struct oauth2plugin_Options* options,
+	const char* key,
+	const char* value
+) {
+	// issuer
+	if (
+		strcmp(key, "issuer") == 0
+		&& value
+	) {
+		free(options->issuer);
+		options->issuer = strdup(value);
+	}
+	// introspection_endpoint
+	else if (
+		strcmp(key, "introspection_endpoint") == 0 
+		&& value
+	) {
+		free(options->introspection_endpoint);
+		options->introspection_endpoint = strdup(value);
+	}
+	// tls_verification
+	else if (
+		strcmp(key, "tls_verification") == 0
+		&& value
+	) {
+		if (strcmp(value, "false") == 0) options->tls_verification = false;
+		else if (strcmp(value, "true") == 0) options->tls_verification = true;
+	}
+	// timeout
+	else if (
+		strcmp(key, "timeout") == 0
+	) {
+		options->timeout = strtol(value, NULL, 10);
+	}
+	// verifier
+	else if (
+		strcmp(key, "verifier") == 0
+		&& value
+	) {
+		if (strcmp(value, "introspection") == 0) options->verifier = verifier_INTROSPECTION;
+		else if (strcmp(value, "sidecar") == 0) options->verifier = verifier_SIDECAR;
+	}
+	// verifier_chain
+	else if (
+		strcmp(key, "verifier_chain") == 0
+		&& value
+	) {
+		free(options->verifier_chain);
+		options->verifier_chain = strdup(value);
+	}
+	// sidecar_socket
+	else if (
+		strcmp(key, "sidecar_socket") == 0
+		&& value
+	) {
+		free(options->sidecar_socket);
+		options->sidecar_socket = strdup(value);
+	}
+	// client_authentication
+	else if (
+		strcmp(key, "client_authentication") == 0
+		&& value
+	) {
+		if (strcmp(value, "client_secret_basic") == 0) options->client_authentication = client_authentication_CLIENT_SECRET_BASIC;
+		else if (strcmp(value, "client_credentials") == 0) options->client_authentication = client_authentication_CLIENT_CREDENTIALS;
+		else if (strcmp(value, "private_key_jwt") == 0) options->client_authentication = client_authentication_PRIVATE_KEY_JWT;
+	}
+	// token_endpoint
+	else if (
+		strcmp(key, "token_endpoint") == 0
+		&& value
+	) {
+		free(options->token_endpoint);
+		options->token_endpoint = strdup(value);
+	}
+	// token_scope
+	else if (
+		strcmp(key, "token_scope") == 0
+		&& value
+	) {
+		free(options->token_scope);
+		options->token_scope = strdup(value);
+	}
+	// client_assertion_key
+	else if (
+		strcmp(key, "client_assertion_key") == 0
+		&& value
+	) {
+		free(options->client_assertion_key);
+		options->client_assertion_key = strdup(value);
+	}
+	// client_assertion_key_id
+	else if (
+		strcmp(key, "client_assertion_key_id") == 0
+		&& value
+	) {
+		free(options->client_assertion_key_id);
+		options->client_assertion_key_id = strdup(value);
+	}
+	// client_assertion_audience
+	else if (
+		strcmp(key, "client_assertion_audience") == 0
+		&& value
+	) {
+		free(options->client_assertion_audience);
+		options->client_assertion_audience = strdup(value);
+	}
+	// client_assertion_lifetime
+	else if (
+		strcmp(key, "client_assertion_lifetime") == 0
+		&& value
+	) {
+		options->client_assertion_lifetime = strtol(value, NULL, 10);
+	}
+	// prewarm_connections
+	else if (
+		strcmp(key, "prewarm_connections") == 0
+		&& value
+	) {
+		options->prewarm_connections = strtol(value, NULL, 10);
+	}
+	// dns_min_ttl
+	else if (
+		strcmp(key, "dns_min_ttl") == 0
+		&& value
+	) {
+		options->dns_min_ttl = strtol(value, NULL, 10);
+	}
+	// dns_max_ttl
+	else if (
+		strcmp(key, "dns_max_ttl") == 0
+		&& value
+	) {
+		options->dns_max_ttl = strtol(value, NULL, 10);
+	}
+	// client_id
+	else if (
+		strcmp(key, "client_id") == 0 
+		&& value
+	) {
+		free(options->client_id);
+		options->client_id = strdup(value);
+	}
+	// client_secret
+	else if (
+		strcmp(key, "client_secret") == 0 
+		&& value
+	) {
+		free(options->client_secret);
+		options->client_secret = strdup(value);
+	}
+	// username_validation
+	else if (
+		strcmp(key, "username_validation") == 0
+		&& value
+	) {
+		if (strcmp(value, "false") == 0) options->username_validation = false;
+		else if (strcmp(value, "true") == 0) options->username_validation = true;
+	}
+	// username_validation_template
+	else if (
+		strcmp(key, "username_validation_template") == 0 
+		&& value
+	) {
+		free(options->username_validation_template);
+		options->username_validation_template = strdup(value);
+	}
+	// username_validation_error
+	else if (
+		strcmp(key, "username_validation_error") == 0 
+		&& value
+	) {
+		if (strcmp(value, "deny") == 0 ) options->username_validation_error = verification_error_DENY;
+		else if (strcmp(value, "defer") == 0 ) options->username_validation_error = verification_error_DEFER;
+	}
+	// username_replacement
+	else if (
+		strcmp(key, "username_replacement") == 0
+		&& value
+	) {
+		if (strcmp(value, "false") == 0) options->username_replacement = false;
+		else if (strcmp(value, "true") == 0) options->username_replacement = true;
+	}
+	// username_replacement_template
+	else if (
+		strcmp(key, "username_replacement_template") == 0 
+		&& value
+	) {
+		free(options->username_replacement_template);
+		options->username_replacement_template = strdup(value);
+	}
+	// username_replacement_error
+	else if (
+		strcmp(key, "username_replacement_error") == 0 
+		&& value
+	) {
+		if (strcmp(value, "deny") == 0 ) options->username_replacement_error = verification_error_DENY;
+		else if (strcmp(value, "defer") == 0 ) options->username_replacement_error = verification_error_DEFER;
+	}
+	// token_verification_error
+	else if (
+		strcmp(key, "token_verification_error") == 0 
+		&& value
+	) {
+		if (strcmp(value, "deny") == 0 ) options->token_verification_error = verification_error_DENY;
+		else if (strcmp(value, "defer") == 0 ) options->token_verification_error = verification_error_DEFER;
+	}
+	// prescreen_min_length
+	else if (
+		strcmp(key, "prescreen_min_length") == 0
+		&& value
+	) {
+		options->prescreen_min_length = strtol(value, NULL, 10);
+	}
+	// prescreen_max_length
+	else if (
+		strcmp(key, "prescreen_max_length") == 0
+		&& value
+	) {
+		options->prescreen_max_length = strtol(value, NULL, 10);
+	}
+	// prescreen_charset
+	else if (
+		strcmp(key, "prescreen_charset") == 0
+		&& value
+	) {
+		if (strcmp(value, "any") == 0) options->prescreen_charset = prescreen_charset_ANY;
+		else if (strcmp(value, "printable") == 0) options->prescreen_charset = prescreen_charset_PRINTABLE;
+		else if (strcmp(value, "b64token") == 0) options->prescreen_charset = prescreen_charset_B64TOKEN;
+		else if (strcmp(value, "base64url") == 0) options->prescreen_charset = prescreen_charset_BASE64URL;
+	}
+	// prescreen_format
+	else if (
+		strcmp(key, "prescreen_format") == 0
+		&& value
+	) {
+		if (strcmp(value, "any") == 0) options->prescreen_format = prescreen_format_ANY;
+		else if (strcmp(value, "jwt") == 0) options->prescreen_format = prescreen_format_JWT;
+		else if (strcmp(value, "opaque") == 0) options->prescreen_format = prescreen_format_OPAQUE;
+	}
+	// prescreen_check_exp
+	else if (
+		strcmp(key, "prescreen_check_exp") == 0
+		&& value
+	) {
+		if (strcmp(value, "false") == 0) options->prescreen_check_exp = false;
+		else if (strcmp(value, "true") == 0) options->prescreen_check_exp = true;
+	}
+	// prescreen_exp_leeway
+	else if (
+		strcmp(key, "prescreen_exp_leeway") == 0
+		&& value
+	) {
+		options->prescreen_exp_leeway = strtol(value, NULL, 10);
+	}
+	// prescreen_issuers
+	else if (
+		strcmp(key, "prescreen_issuers") == 0
+		&& value
+	) {
+		free(options->prescreen_issuers);
+		options->prescreen_issuers = strdup(value);
+	}
+	// match_issuer
+	else if (
+		strcmp(key, "match_issuer") == 0
+		&& value
+	) {
+		free(options->match_issuer);
+		options->match_issuer = strdup(value);
+	}
+	// match_listener
+	else if (
+		strcmp(key, "match_listener") == 0
+		&& value
+	) {
+		free(options->match_listener);
+		options->match_listener = strdup(value);
+	}
+	// match_username_prefix
+	else if (
+		strcmp(key, "match_username_prefix") == 0
+		&& value
+	) {
+		free(options->match_username_prefix);
+		options->match_username_prefix = strdup(value);
+	}
+	// log_level
+	else if (
+		strcmp(key, "log_level") == 0
+		&& value
+	) {
+		oauth2plugin_parseLogLevel(value, &options->log_level);
+	}
+	// log_sensitive
+	else if (
+		strcmp(key, "log_sensitive") == 0
+		&& value
+	) {
+		if (strcmp(value, "false") == 0) options->log_sensitive = false;
+		else if (strcmp(value, "true") == 0) options->log_sensitive = true;
+	}
+	// audit_log_file
+	else if (
+		strcmp(key, "audit_log_file") == 0
+		&& value
+	) {
+		free(options->audit_log_file);
+		options->audit_log_file = strdup(value);
+	}
+	// audit_log_max_size
+	else if (
+		strcmp(key, "audit_log_max_size") == 0
+		&& value
+	) {
+		options->audit_log_max_size = strtol(value, NULL, 10);
+	}
+	// audit_log_rotate_count
+	else if (
+		strcmp(key, "audit_log_rotate_count") == 0
+		&& value
+	) {
+		options->audit_log_rotate_count = strtol(value, NULL, 10);
+	}
+	// audit_log_buffer_size
+	else if (
+		strcmp(key, "audit_log_buffer_size") == 0
+		&& value
+	) {
+		options->audit_log_buffer_size = strtol(value, NULL, 10);
+	}
+	// capture_file
+	else if (
+		strcmp(key, "capture_file") == 0
+		&& value
+	) {
+		free(options->capture_file);
+		options->capture_file = strdup(value);
+	}
+	// revocation_file
+	else if (
+		strcmp(key, "revocation_file") == 0
+		&& value
+	) {
+		free(options->revocation_file);
+		options->revocation_file = strdup(value);
+	}
+	// revocation_index_file
+	else if (
+		strcmp(key, "revocation_index_file") == 0
+		&& value
+	) {
+		free(options->revocation_index_file);
+		options->revocation_index_file = strdup(value);
+	}
+	// revocation_check_interval
+	else if (
+		strcmp(key, "revocation_check_interval") == 0
+		&& value
+	) {
+		options->revocation_check_interval = strtol(value, NULL, 10);
+	}
+	// token_store_file
+	else if (
+		strcmp(key, "token_store_file") == 0
+		&& value
+	) {
+		free(options->token_store_file);
+		options->token_store_file = strdup(value);
+	}
+	// token_store_index_file
+	else if (
+		strcmp(key, "token_store_index_file") == 0
+		&& value
+	) {
+		free(options->token_store_index_file);
+		options->token_store_index_file = strdup(value);
+	}
+	// token_store_check_interval
+	else if (
+		strcmp(key, "token_store_check_interval") == 0
+		&& value
+	) {
+		options->token_store_check_interval = strtol(value, NULL, 10);
+	}
+	// revalidation_rate
+	else if (
+		strcmp(key, "revalidation_rate") == 0
+		&& value
+	) {
+		options->revalidation_rate = strtol(value, NULL, 10);
+	}
+	// revalidation_interval
+	else if (
+		strcmp(key, "revalidation_interval") == 0
+		&& value
+	) {
+		options->revalidation_interval = strtol(value, NULL, 10);
+	}
+	// optimistic_admission
+	else if (
+		strcmp(key, "optimistic_admission") == 0
+		&& value
+	) {
+		if (strcmp(value, "false") == 0) options->optimistic_admission = false;
+		else if (strcmp(value, "true") == 0) options->optimistic_admission = true;
+	}
+	// optimistic_max_pending
+	else if (
+		strcmp(key, "optimistic_max_pending") == 0
+		&& value
+	) {
+		options->optimistic_max_pending = strtol(value, NULL, 10);
+	}
+	// invalidation_topic
+	else if (
+		strcmp(key, "invalidation_topic") == 0
+		&& value
+	) {
+		free(options->invalidation_topic);
+		options->invalidation_topic = strdup(value);
+	}
+	// invalidation_publishers
+	else if (
+		strcmp(key, "invalidation_publishers") == 0
+		&& value
+	) {
+		free(options->invalidation_publishers);
+		options->invalidation_publishers = strdup(value);
+	}
+	// invalidation_ttl
+	else if (
+		strcmp(key, "invalidation_ttl") == 0
+		&& value
+	) {
+		options->invalidation_ttl = strtol(value, NULL, 10);
+	}
+	// unknown option
+	else return false;
+
+	return true;
+}
+
+
+static struct oauth2plugin_Options* oauth2plugin_getProfile(
+	struct oauth2plugin_Options* options,
+	const char* name,
+	size_t name_length,
+	const struct mosquitto_opt* mosquitto_options,
+	const int mosquitto_options_count
+) {
+	// Existing profile
+	for (size_t i = 0; i < options->profiles_count; i++) {
+		if (
+			strlen(options->profiles[i]->name) == name_length
+			&& strncmp(options->profiles[i]->name, name, name_length) == 0
+		) return options->profiles[i];
+	}
+
+	// New profile: inherits the per-profile options of the default profile
+	struct oauth2plugin_Options** profiles = realloc(options->profiles, (options->profiles_count + 1) * sizeof(*profiles));
+	if (!profiles) return NULL;
+	options->profiles = profiles;
+	struct oauth2plugin_Options* profile = oauth2plugin_initOptions();
+	if (!profile) return NULL;
+	profile->id = options->id;
+	profile->name = strndup(name, name_length);
+	if (!profile->name) {
+		oauth2plugin_freeOptions(profile);
+		return NULL;
+	}
+	for (int i = 0; i < mosquitto_options_count; i++) {
+		if (strchr(mosquitto_options[i].key, '.') || oauth2plugin_isRootOption(mosquitto_options[i].key)) continue;
+		oauth2plugin_applyOption(profile, mosquitto_options[i].key, mosquitto_options[i].value);
+	}
+	options->profiles[options->profiles_count++] = profile;
+
+	return profile;
+}
+
+
+static bool oauth2plugin_isRootOption(
+	const char* key
+) {
+	for (size_t i = 0; i < sizeof(oauth2plugin_root_options) / sizeof(oauth2plugin_root_options[0]); i++) {
+		if (strcmp(key, oauth2plugin_root_options[i]) == 0) return true;
+	}
+	return false;
+}
+
+
+static bool oauth2plugin_hasMandatoryOptions(
+	const struct oauth2plugin_Options* options
+) {
+	if (
+		(
+			oauth2plugin_hasVerifierStage(options, verifier_SIDECAR)
+			&& !options->sidecar_socket
+		)
+		|| (
+			oauth2plugin_hasVerifierStage(options, verifier_INTROSPECTION)
+			&& (
+				(!options->introspection_endpoint && !options->issuer)
+				|| !options->client_id
+				|| (
+					options->client_authentication == client_authentication_PRIVATE_KEY_JWT
+					? !options->client_assertion_key
+					: !options->client_secret
+				)
+			)
+		)
+	) {
+		if (options->name) OAUTH2PLUGIN_LOG_ERROR("Profile '%s' is incomplete.", options->name);
+		return false;
+	}
+	return true;
+}
@@ -14,6 +14,21 @@
 #include <mosquitto_broker.h>
 #include <mosquitto_plugin.h>
 
+#include "log.h"
+
+
+struct oauth2plugin_HTTPPool;
+struct oauth2plugin_Router;
+struct oauth2plugin_AuditLog;
+struct oauth2plugin_Capture;
+struct oauth2plugin_RevocationList;
+struct oauth2plugin_TokenStore;
+struct oauth2plugin_VerifierStats;
+struct oauth2plugin_Prescreen;
+struct oauth2plugin_Template;
+struct oauth2plugin_Sidecar;
+struct oauth2plugin_Credentials;
+
 
 enum oauth2plugin_Options_verification_error {
 	verification_error_DENY,
@@ -21,20 +36,114 @@ enum oauth2plugin_Options_verification_error {
 }; 
 
 
+enum oauth2plugin_Options_verifier {
+	verifier_INTROSPECTION,
+	verifier_SIDECAR,
+	verifier_STORE,		// Verifier chain stage only.
+	verifier_COUNT
+};
+
+
+enum oauth2plugin_Options_client_authentication {
+	client_authentication_CLIENT_SECRET_BASIC,
+	client_authentication_CLIENT_CREDENTIALS,
+	client_authentication_PRIVATE_KEY_JWT
+};
+
+
+enum oauth2plugin_Options_prescreen_charset {
+	prescreen_charset_ANY,
+	prescreen_charset_PRINTABLE,
+	prescreen_charset_B64TOKEN,
+	prescreen_charset_BASE64URL
+};
+
+
+enum oauth2plugin_Options_prescreen_format {
+	prescreen_format_ANY,
+	prescreen_format_JWT,
+	prescreen_format_OPAQUE
+};
+
+
 struct oauth2plugin_Options {	
 	mosquitto_plugin_id_t* 							id;										// Plugin ID from MQTT Broker.
+	long 											references;								// Readers of this configuration (see oauth2plugin_acquireOptions()).
+	char* 											name;									// Profile name (NULL for the default profile).
+	char* 											issuer;									// OpenID Connect issuer URL used for discovery.
 	char* 											introspection_endpoint;					// Introspection Endpoint URL.
+	bool 											introspection_endpoint_discovered;		// Introspection Endpoint URL was discovered from issuer.
+	char* 											jwks_uri;								// JWKS URL (discovered from issuer).
 	char* 											client_id;								// OAuth2 Client ID.
 	char* 											client_secret;							// OAuth2 Client Secret.
+	enum oauth2plugin_Options_client_authentication	client_authentication;					// "client_secret_basic", "client_credentials", "private_key_jwt"
+	char*											token_endpoint;							// Token Endpoint URL (client_credentials).
+	bool											token_endpoint_discovered;				// Token Endpoint URL was discovered from issuer.
+	char*											token_scope;							// Scope requested with the client credentials grant (NULL = none).
+	char*											client_assertion_key;					// Path of the PEM private key signing client assertions (private_key_jwt).
+	char*											client_assertion_key_id;				// "kid" header of client assertions (NULL = none).
+	char*											client_assertion_audience;				// "aud" of client assertions (NULL = token endpoint or issuer).
+	long											client_assertion_lifetime;				// Lifetime of client assertions in seconds.
+	struct oauth2plugin_Credentials*				credentials;							// Cached access token or client assertion (NULL = client_secret_basic).
 	bool 											tls_verification;						// Enable TLS verification.
 	long 											timeout;								// Server timeout in seconds.
+	long 											prewarm_connections;					// Number of keep-alive connections opened at startup.
+	long 											dns_min_ttl;							// Lower bound for cached DNS record TTLs in seconds.
+	long 											dns_max_ttl;							// Upper bound for cached DNS record TTLs in seconds.
+	struct oauth2plugin_HTTPPool*					http_pool;								// Pool of keep-alive connections to the endpoint.
+	enum oauth2plugin_Options_verifier				verifier;								// "introspection", "sidecar"
+	char*											sidecar_socket;							// Path of the sidecar's Unix domain socket.
+	struct oauth2plugin_Sidecar*					sidecar;								// Sidecar client (verifier "sidecar" only).
+	char*											verifier_chain;							// Comma separated verifier stages, cheapest first (NULL = "store" if configured, then verifier).
+	enum oauth2plugin_Options_verifier				verifier_stages[verifier_COUNT];		// Compiled verifier_chain.
+	size_t											verifier_stages_count;					// Number of entries in verifier_stages.
+	struct oauth2plugin_VerifierStats*				verifier_stats;							// Latency and hit counts per stage, indexed by verifier (owned by the plugin).
  	bool											username_validation;					// Validate username to match username_validation_template
 	char* 											username_validation_template;			// "token-%oidc-username%"
+	struct oauth2plugin_Template*					username_validation_compiled;			// Literal segments and placeholders of username_validation_template.
  	enum oauth2plugin_Options_verification_error	username_validation_error;				// "defer", "deny"
  	bool										 	username_replacement;					// Replace username after successful authentification
  	char* 											username_replacement_template;			// "%username%-%rolescope%"
  	enum oauth2plugin_Options_verification_error 	username_replacement_error;				// "defer", "deny"
  	enum oauth2plugin_Options_verification_error 	token_verification_error;				// "defer", "deny"
+	char* 											match_issuer;							// Profile: comma separated JWT "iss" values routed to this profile.
+	char* 											match_listener;							// Profile: comma separated listener ports routed to this profile.
+	char* 											match_username_prefix;					// Profile: comma separated username prefixes routed to this profile.
+	struct oauth2plugin_Options**					profiles;								// Named issuer profiles ("plugin_opt_<profile>.<option>").
+	size_t											profiles_count;							// Number of entries in profiles.
+	struct oauth2plugin_Router*						router;									// Compiled profile matchers.
+	long											prescreen_min_length;					// Reject shorter tokens without introspection.
+	long											prescreen_max_length;					// Reject longer tokens without introspection (0 = unlimited).
+	enum oauth2plugin_Options_prescreen_charset		prescreen_charset;						// "any", "printable", "b64token", "base64url"
+	enum oauth2plugin_Options_prescreen_format		prescreen_format;						// "any", "jwt", "opaque"
+	bool											prescreen_check_exp;					// Reject JWTs whose unverified "exp" claim is in the past.
+	long											prescreen_exp_leeway;					// Seconds an expired JWT is still introspected.
+	char*											prescreen_issuers;						// Comma separated accepted "iss" values of JWTs (NULL = any).
+	struct oauth2plugin_Prescreen*					prescreen;								// Compiled pre-screening rules.
+	int												log_level;								// Minimum level of plugin log messages (OAUTH2PLUGIN_LOG_LEVEL_*).
+	bool											log_sensitive;							// Log tokens and introspection responses unredacted.
+	char*											audit_log_file;							// Path of the JSON Lines audit log (NULL = disabled).
+	long											audit_log_max_size;						// Rotate the audit log at this size in bytes (0 = never).
+	long											audit_log_rotate_count;					// Number of rotated audit log files to keep.
+	long											audit_log_buffer_size;					// Capacity of the audit record ring buffer.
+	struct oauth2plugin_AuditLog*					audit_log;								// Audit log writer (default profile only).
+	char*											capture_file;							// Path of the binary auth trace (NULL = disabled).
+	struct oauth2plugin_Capture*					capture;								// Trace writer (default profile only).
+	char*											revocation_file;						// Path of the revoked tokens list (NULL = disabled).
+	char*											revocation_index_file;					// Path of the compiled index (NULL = "<revocation_file>.idx").
+	long											revocation_check_interval;				// Seconds between checks of the revoked tokens list (0 = never).
+	struct oauth2plugin_RevocationList*				revocation_list;						// Revocation filter (default profile only).
+	char*											token_store_file;						// Path of the static token store (NULL = disabled).
+	char*											token_store_index_file;					// Path of the compiled index (NULL = "<token_store_file>.idx").
+	long											token_store_check_interval;				// Seconds between checks of the static token store (0 = never).
+	struct oauth2plugin_TokenStore*					token_store;							// Static token store (shared with the default profile if unchanged).
+	long											revalidation_rate;						// Tokens of connected clients revalidated per second (0 = disabled).
+	long											revalidation_interval;					// Minimum seconds between two revalidations of the same client.
+	bool											optimistic_admission;					// Admit clients with plausible JWTs before the introspection response.
+	long											optimistic_max_pending;					// Maximum number of admitted clients waiting for their verdict.
+	char*											invalidation_topic;						// MQTT control topic for cluster-wide invalidation (NULL = disabled).
+	char*											invalidation_publishers;				// Comma separated usernames allowed to publish on invalidation_topic.
+	long											invalidation_ttl;						// Seconds an invalidated token is denied without introspection.
 };
 
 
@@ -49,8 +158,8 @@ extern const size_t oauth2plugin_oidc_template_placeholders_count;
 /**
  * @brief Allocate and initialize an options structure.
  *
- * All fields of the returned structure are set to zero. The caller is
- * responsible for releasing the object with oauth2plugin_freeOptions().
+ * All fields of the returned structure are set to their default values. The
+ * caller is responsible for releasing the object with oauth2plugin_freeOptions().
  *
  * @return Pointer to a new options structure or NULL if allocation fails.
  */
@@ -61,12 +170,15 @@ struct oauth2plugin_Options* oauth2plugin_initOptions();
  * @brief Apply plugin configuration options to an options structure.
  *
  * The key/value pairs supplied by the broker are parsed and copied into
- * the given options structure.
+ * the given options structure. Keys of the form "<profile>.<option>" create
+ * named issuer profiles in @p options->profiles; a profile inherits all
+ * options of the default profile and overrides the ones given for it. The
+ * profile matchers are compiled into @p options->router.
  *
  * @param options					Target options object to fill.
  * @param mosquitto_options			Array of options supplied by the broker.
  * @param mosquitto_options_count	Number of entries in @p mosquitto_options.
- * @return							MOSQ_ERR_SUCCESS on success, MOSQ_ERR_INVAL if mandatory options are missing or MOSQ_ERR_UNKNOWN on other failures.
+ * @return							MOSQ_ERR_SUCCESS on success, MOSQ_ERR_INVAL if mandatory options are missing (either 'issuer' or 'introspection_endpoint', 'client_id' and 'client_secret' (or 'client_assertion_key' with client_authentication 'private_key_jwt'), or 'sidecar_socket' with verifier 'sidecar') or MOSQ_ERR_UNKNOWN on other failures.
  */
 int oauth2plugin_applyOptions(
 	struct oauth2plugin_Options* options,
@@ -99,4 +211,111 @@ const char* oauth2plugin_Options_verification_error_toString(
 	enum oauth2plugin_Options_verification_error value
 );
 
+
+
+/**
+ * @brief Convert a verifier enum value to a human readable string.
+ *
+ * @param value						Enumeration value to convert.
+ * @return							Constant string representation of @p value.
+ */
+const char* oauth2plugin_Options_verifier_toString(
+	enum oauth2plugin_Options_verifier value
+);
+
+
+/**
+ * @brief Convert a client_authentication enum value to a human readable string.
+ *
+ * @param value						Enumeration value to convert.
+ * @return							Constant string representation of @p value.
+ */
+const char* oauth2plugin_Options_client_authentication_toString(
+	enum oauth2plugin_Options_client_authentication value
+);
+
+
+/**
+ * @brief Convert a prescreen_charset enum value to a human readable string.
+ *
+ * @param value						Enumeration value to convert.
+ * @return							Constant string representation of @p value.
+ */
+const char* oauth2plugin_Options_prescreen_charset_toString(
+	enum oauth2plugin_Options_prescreen_charset value
+);
+
+
+/**
+ * @brief Convert a prescreen_format enum value to a human readable string.
+ *
+ * @param value						Enumeration value to convert.
+ * @return							Constant string representation of @p value.
+ */
+const char* oauth2plugin_Options_prescreen_format_toString(
+	enum oauth2plugin_Options_prescreen_format value
+);
+
+
+/**
+ * @brief Apply a single option.
+ *
+ * @param options	Target options object.
+ * @param key		Option name without "plugin_opt_" and profile prefix.
+ * @param value		Option value.
+ * @return			true if the option is known, otherwise false.
+ */
+static bool oauth2plugin_applyOption(
+	struct oauth2plugin_Options* options,
+	const char* key,
+	const char* value
+);
+
+
+/**
+ * @brief Find or create the named profile.
+ *
+ * A new profile is initialized with the options of the default profile,
+ * except for the options of the whole plugin (see oauth2plugin_isRootOption()).
+ *
+ * @param options					Default profile.
+ * @param name						Profile name (not null terminated).
+ * @param name_length				Length of @p name.
+ * @param mosquitto_options			Array of options supplied by the broker.
+ * @param mosquitto_options_count	Number of entries in @p mosquitto_options.
+ * @return							Profile or NULL if allocation fails.
+ */
+static struct oauth2plugin_Options* oauth2plugin_getProfile(
+	struct oauth2plugin_Options* options,
+	const char* name,
+	size_t name_length,
+	const struct mosquitto_opt* mosquitto_options,
+	const int mosquitto_options_count
+);
+
+
+/**
+ * @brief Check whether an option applies to the whole plugin rather than a profile.
+ *
+ * Such options (logging, DNS, audit log, capture, revocation, revalidation and
+ * cluster invalidation) are only read from the default profile.
+ *
+ * @param key	Option name without "plugin_opt_" and profile prefix.
+ * @return		true if named profiles neither inherit nor set the option.
+ */
+static bool oauth2plugin_isRootOption(
+	const char* key
+);
+
+
+/**
+ * @brief Check that the endpoint and client credentials are configured.
+ *
+ * @param options	Options or profile to check.
+ * @return			true if all mandatory options are set.
+ */
+static bool oauth2plugin_hasMandatoryOptions(
+	const struct oauth2plugin_Options* options
+);
+
 #endif // OAUTH2PLUGIN_OPTIONS_H
\ No newline at end of file
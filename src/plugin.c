@@ -26,14 +26,22 @@
 
 #include "options.h"
 #include "auth.h"
+#include "config.h"
+#include "log.h"
 
 
 /**
  * @brief Initialize the Mosquitto OAuth2 plugin.
  *
  * This function is called by the broker when the plugin is loaded.
- * It parses the configuration options, registers the authentication 
- * callback and initializes the CURL library used for HTTP requests.
+ * It parses the configuration options, registers the authentication,
+ * reload, tick, disconnect and message callbacks and initializes the CURL
+ * library used for HTTP requests.
+ * For the default profile and every named issuer profile, the endpoints are
+ * discovered if an issuer is configured. The endpoint
+ * addresses are resolved and kept fresh by a background resolver, and warm
+ * keep-alive connections are opened, so authentications never pay for DNS,
+ * TCP and TLS setup.
  *
  * @param identifier	Plugin identifier provided by Mosquitto.
  * @param userdata		Pointer that will receive plugin specific data and is passed back to mosquitto_plugin_cleanup().
@@ -48,7 +56,7 @@ int mosquitto_plugin_init(
 	int option_count
 ) {
 	// Log
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D] Initializing Plugin...");
+	OAUTH2PLUGIN_LOG_DEBUG("Initializing Plugin...");
 	
 	// Validation
 	if(!identifier) return MOSQ_ERR_INVAL;
@@ -56,60 +64,94 @@ int mosquitto_plugin_init(
 	// Initialize CURL
 	CURLcode curl_global_init_error = curl_global_init(CURL_GLOBAL_DEFAULT);
 	if (curl_global_init_error) {
-		mosquitto_log_printf(MOSQ_LOG_ERR, "[OAuth2 Plugin][E] Failed to initialize Plugin: Initialization of CURL failed.");
+		OAUTH2PLUGIN_LOG_ERROR("Failed to initialize Plugin: Initialization of CURL failed.");
 		return MOSQ_ERR_UNKNOWN;
 	}
 
 	// Handle plugin_opt_* options from mosquitto.conf file
-	struct oauth2plugin_Options* _options = oauth2plugin_initOptions();
-	if (!_options) return MOSQ_ERR_NOMEM;
-	
-	// Set default options
-	_options->id = identifier;
-	_options->tls_verification = true;
-	_options->timeout = 5;
-	_options->username_validation = false;
-	_options->username_validation_error = verification_error_DEFER;
-	_options->username_replacement = false;
-	_options->username_replacement_error = verification_error_DENY;
-	_options->token_verification_error = verification_error_DENY;
-
-	// Apply options from mosquitto.conf	
-	int apply_options_error = oauth2plugin_applyOptions(_options, options, option_count);
-	if (apply_options_error) {
-		if (apply_options_error == MOSQ_ERR_INVAL) 
-			mosquitto_log_printf(MOSQ_LOG_ERR, "[OAuth2 Plugin][E] Failed to initialize Plugin: Options 'plugin_opt_introspection_endpoint', 'plugin_opt_client_id' and 'plugin_opt_client_secret' are mandatory.");
-		else
-			mosquitto_log_printf(MOSQ_LOG_ERR, "[OAuth2 Plugin][E] Failed to initialize Plugin.");
-		oauth2plugin_freeOptions(_options);
-		return apply_options_error;
+	int init_plugin_error = MOSQ_ERR_SUCCESS;
+	struct oauth2plugin_Plugin* plugin = oauth2plugin_initPlugin(identifier, options, option_count, &init_plugin_error);
+	if (!plugin) {
+		OAUTH2PLUGIN_LOG_ERROR("Failed to initialize Plugin.");
+		return init_plugin_error;
 	}
+	struct oauth2plugin_Options* _options = plugin->options;
 
 	// Register Callbacks
-	int register_callback_error = mosquitto_callback_register(identifier, MOSQ_EVT_BASIC_AUTH, oauth2plugin_callback_mosquittoBasicAuthentication, NULL, _options);
+	int register_callback_error = mosquitto_callback_register(identifier, MOSQ_EVT_BASIC_AUTH, oauth2plugin_callback_mosquittoBasicAuthentication, NULL, plugin);
 	if (register_callback_error != MOSQ_ERR_SUCCESS) {
-		mosquitto_log_printf(MOSQ_LOG_ERR, "[OAuth2 Plugin][E] Failed to initialize Plugin: Cannot register authentication callback function (Error: %s).", mosquitto_strerror(register_callback_error));
-		oauth2plugin_freeOptions(_options);
+		OAUTH2PLUGIN_LOG_ERROR("Failed to initialize Plugin: Cannot register authentication callback function (Error: %s).", mosquitto_strerror(register_callback_error));
+		oauth2plugin_freePlugin(plugin);
+		return register_callback_error;
+	}
+	register_callback_error = mosquitto_callback_register(identifier, MOSQ_EVT_RELOAD, oauth2plugin_callback_mosquittoReload, NULL, plugin);
+	if (register_callback_error != MOSQ_ERR_SUCCESS) {
+		OAUTH2PLUGIN_LOG_ERROR("Failed to initialize Plugin: Cannot register reload callback function (Error: %s).", mosquitto_strerror(register_callback_error));
+		mosquitto_callback_unregister(identifier, MOSQ_EVT_BASIC_AUTH, oauth2plugin_callback_mosquittoBasicAuthentication, NULL);
+		oauth2plugin_freePlugin(plugin);
+		return register_callback_error;
+	}
+	register_callback_error = mosquitto_callback_register(identifier, MOSQ_EVT_TICK, oauth2plugin_callback_mosquittoTick, NULL, plugin);
+	if (register_callback_error != MOSQ_ERR_SUCCESS) {
+		OAUTH2PLUGIN_LOG_ERROR("Failed to initialize Plugin: Cannot register tick callback function (Error: %s).", mosquitto_strerror(register_callback_error));
+		mosquitto_callback_unregister(identifier, MOSQ_EVT_BASIC_AUTH, oauth2plugin_callback_mosquittoBasicAuthentication, NULL);
+		mosquitto_callback_unregister(identifier, MOSQ_EVT_RELOAD, oauth2plugin_callback_mosquittoReload, NULL);
+		oauth2plugin_freePlugin(plugin);
+		return register_callback_error;
+	}
+	register_callback_error = mosquitto_callback_register(identifier, MOSQ_EVT_DISCONNECT, oauth2plugin_callback_mosquittoDisconnect, NULL, plugin);
+	if (register_callback_error != MOSQ_ERR_SUCCESS) {
+		OAUTH2PLUGIN_LOG_ERROR("Failed to initialize Plugin: Cannot register disconnect callback function (Error: %s).", mosquitto_strerror(register_callback_error));
+		mosquitto_callback_unregister(identifier, MOSQ_EVT_BASIC_AUTH, oauth2plugin_callback_mosquittoBasicAuthentication, NULL);
+		mosquitto_callback_unregister(identifier, MOSQ_EVT_RELOAD, oauth2plugin_callback_mosquittoReload, NULL);
+		mosquitto_callback_unregister(identifier, MOSQ_EVT_TICK, oauth2plugin_callback_mosquittoTick, NULL);
+		oauth2plugin_freePlugin(plugin);
 		return register_callback_error;
 	}
-
 	// Log
-	mosquitto_log_printf(MOSQ_LOG_INFO,  "[OAuth2 Plugin][I] Plugin successfully initialized.");
-	mosquitto_log_printf(MOSQ_LOG_INFO,  "[OAuth2 Plugin][I]  - Introspection Endpoint: %s", _options->introspection_endpoint);
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - TLS Verification: %s", _options->tls_verification ? "<Enabled>" : "<Disabled>");
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Timeout: %ld seconds", _options->timeout);
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - OAuth2 Client ID: %s", _options->client_id);
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - OAuth2 Client Secret: %zu chars", strlen(_options->client_secret));
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Username Verification: %s", _options->username_validation ? "<Enabled>" : "<Disabled>");
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Username Verification Template: %s", _options->username_validation_template ? _options->username_validation_template : "<None>");
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Username Verification Error: <%s>", oauth2plugin_Options_verification_error_toString(_options->username_validation_error));
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Username Replacement: %s", _options->username_replacement ? "<Enabled>" : "<Disabled>");
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Username Replacement Template: %s", _options->username_replacement_template ? _options->username_replacement_template : "<None>");
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Username Replacement Error: <%s>", oauth2plugin_Options_verification_error_toString(_options->username_replacement_error));
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D]  - Token Verification Error: <%s>", oauth2plugin_Options_verification_error_toString(_options->token_verification_error));
+	OAUTH2PLUGIN_LOG_INFO("Plugin successfully initialized.");
+	char verifier_chain[64];
+	OAUTH2PLUGIN_LOG_INFO(" - Verifier Chain: %s", oauth2plugin_formatVerifierChain(_options, verifier_chain, sizeof(verifier_chain)));
+	if (oauth2plugin_hasVerifierStage(_options, verifier_SIDECAR)) OAUTH2PLUGIN_LOG_INFO(" - Sidecar Socket: %s", _options->sidecar_socket);
+	if (oauth2plugin_hasVerifierStage(_options, verifier_INTROSPECTION)) OAUTH2PLUGIN_LOG_INFO(" - Introspection Endpoint: %s", _options->introspection_endpoint ? _options->introspection_endpoint : "<None>");
+	for (size_t i = 0; i < _options->profiles_count; i++)
+		OAUTH2PLUGIN_LOG_INFO(" - Profile '%s': %s (%s)", _options->profiles[i]->name, oauth2plugin_formatVerifierChain(_options->profiles[i], verifier_chain, sizeof(verifier_chain)), oauth2plugin_hasVerifierStage(_options->profiles[i], verifier_INTROSPECTION) ? _options->profiles[i]->introspection_endpoint : oauth2plugin_hasVerifierStage(_options->profiles[i], verifier_SIDECAR) ? _options->profiles[i]->sidecar_socket : _options->profiles[i]->token_store_file);
+	OAUTH2PLUGIN_LOG_DEBUG(" - Issuer: %s", _options->issuer ? _options->issuer : "<None>");
+	OAUTH2PLUGIN_LOG_DEBUG(" - JWKS URI: %s", _options->jwks_uri ? _options->jwks_uri : "<None>");
+	OAUTH2PLUGIN_LOG_DEBUG(" - Client Authentication: %s", oauth2plugin_Options_client_authentication_toString(_options->client_authentication));
+	if (_options->client_authentication == client_authentication_CLIENT_CREDENTIALS) OAUTH2PLUGIN_LOG_DEBUG(" - Token Endpoint: %s", _options->token_endpoint ? _options->token_endpoint : "<None>");
+	OAUTH2PLUGIN_LOG_DEBUG(" - TLS Verification: %s", _options->tls_verification ? "<Enabled>" : "<Disabled>");
+	OAUTH2PLUGIN_LOG_DEBUG(" - Timeout: %ld seconds", _options->timeout);
+	OAUTH2PLUGIN_LOG_DEBUG(" - Prewarm Connections: %ld", _options->prewarm_connections);
+	OAUTH2PLUGIN_LOG_DEBUG(" - DNS TTL: %ld - %ld seconds", _options->dns_min_ttl, _options->dns_max_ttl);
+	OAUTH2PLUGIN_LOG_DEBUG(" - Log Level: %s%s", oauth2plugin_logLevel_toString(_options->log_level), _options->log_sensitive ? " (sensitive)" : "");
+	OAUTH2PLUGIN_LOG_DEBUG(" - Capture File: %s", _options->capture_file ? _options->capture_file : "<Disabled>");
+	OAUTH2PLUGIN_LOG_DEBUG(" - Audit Log: %s", _options->audit_log_file ? _options->audit_log_file : "<Disabled>");
+	OAUTH2PLUGIN_LOG_DEBUG(" - Revocation List: %s (checked every %ld seconds)", _options->revocation_file ? _options->revocation_file : "<Disabled>", _options->revocation_check_interval);
+	OAUTH2PLUGIN_LOG_DEBUG(" - Token Store: %s (checked every %ld seconds)", _options->token_store_file ? _options->token_store_file : "<Disabled>", _options->token_store_check_interval);
+	OAUTH2PLUGIN_LOG_DEBUG(" - Revalidation: %ld tokens per second, every %ld seconds per client", _options->revalidation_rate, _options->revalidation_interval);
+	OAUTH2PLUGIN_LOG_DEBUG(" - Optimistic Admission: %s (at most %ld pending)", _options->optimistic_admission ? "<Enabled>" : "<Disabled>", _options->optimistic_max_pending);
+	OAUTH2PLUGIN_LOG_DEBUG(" - Cluster Invalidation: %s (publishers %s, denied for %ld seconds)", _options->invalidation_topic ? _options->invalidation_topic : "<Disabled>", _options->invalidation_publishers ? _options->invalidation_publishers : "<None>", _options->invalidation_ttl);
+	OAUTH2PLUGIN_LOG_DEBUG(" - OAuth2 Client ID: %s", _options->client_id ? _options->client_id : "<None>");
+	OAUTH2PLUGIN_LOG_DEBUG(" - OAuth2 Client Secret: %zu chars", _options->client_secret ? strlen(_options->client_secret) : 0);
+	OAUTH2PLUGIN_LOG_DEBUG(" - Username Verification: %s", _options->username_validation ? "<Enabled>" : "<Disabled>");
+	OAUTH2PLUGIN_LOG_DEBUG(" - Username Verification Template: %s", _options->username_validation_template ? _options->username_validation_template : "<None>");
+	OAUTH2PLUGIN_LOG_DEBUG(" - Username Verification Error: <%s>", oauth2plugin_Options_verification_error_toString(_options->username_validation_error));
+	OAUTH2PLUGIN_LOG_DEBUG(" - Username Replacement: %s", _options->username_replacement ? "<Enabled>" : "<Disabled>");
+	OAUTH2PLUGIN_LOG_DEBUG(" - Username Replacement Template: %s", _options->username_replacement_template ? _options->username_replacement_template : "<None>");
+	OAUTH2PLUGIN_LOG_DEBUG(" - Username Replacement Error: <%s>", oauth2plugin_Options_verification_error_toString(_options->username_replacement_error));
+	OAUTH2PLUGIN_LOG_DEBUG(" - Token Verification Error: <%s>", oauth2plugin_Options_verification_error_toString(_options->token_verification_error));
+	OAUTH2PLUGIN_LOG_DEBUG(" - Token Pre-Screening: length %ld - %ld, charset <%s>, format <%s>, exp check %s, issuers %s",
+		_options->prescreen_min_length,
+		_options->prescreen_max_length,
+		oauth2plugin_Options_prescreen_charset_toString(_options->prescreen_charset),
+		oauth2plugin_Options_prescreen_format_toString(_options->prescreen_format),
+		_options->prescreen_check_exp ? "<Enabled>" : "<Disabled>",
+		_options->prescreen_issuers ? _options->prescreen_issuers : "<Any>"
+	);
 	
 	// Return
-	*userdata = _options; // Returned to Mosquitto for mosquitto_plugin_cleanup
+	*userdata = plugin; // Returned to Mosquitto for mosquitto_plugin_cleanup
 	return MOSQ_ERR_SUCCESS;
 }
 
@@ -142,7 +184,7 @@ int mosquitto_plugin_version(
  * @brief Cleanup function called when the plugin is unloaded.
  *
  * Releases resources created during mosquitto_plugin_init() such as the
- * CURL library state and the options structure.
+ * CURL library state and the plugin state with its current configuration.
  *
  * @param userdata		Pointer to plugin specific data returned from mosquitto_plugin_init().
  * @param options		Unused parameter from the broker.
@@ -159,16 +201,19 @@ int mosquitto_plugin_cleanup(
 
 	// Clean Options
 	if (userdata) {
-		struct oauth2plugin_Options* _options = (struct oauth2plugin_Options*) userdata;
-		mosquitto_callback_unregister(_options->id, MOSQ_EVT_BASIC_AUTH, oauth2plugin_callback_mosquittoBasicAuthentication, _options);
-		oauth2plugin_freeOptions(_options);
+		struct oauth2plugin_Plugin* plugin = (struct oauth2plugin_Plugin*) userdata;
+		mosquitto_callback_unregister(plugin->id, MOSQ_EVT_BASIC_AUTH, oauth2plugin_callback_mosquittoBasicAuthentication, NULL);
+		mosquitto_callback_unregister(plugin->id, MOSQ_EVT_RELOAD, oauth2plugin_callback_mosquittoReload, NULL);
+		mosquitto_callback_unregister(plugin->id, MOSQ_EVT_TICK, oauth2plugin_callback_mosquittoTick, NULL);
+		mosquitto_callback_unregister(plugin->id, MOSQ_EVT_DISCONNECT, oauth2plugin_callback_mosquittoDisconnect, NULL);
+		oauth2plugin_freePlugin(plugin);
 	}
 
 	// Clean CURL
 	curl_global_cleanup();
 
 	// Log
-	mosquitto_log_printf(MOSQ_LOG_DEBUG, "[OAuth2 Plugin][D] Cleanup successful.");
+	OAUTH2PLUGIN_LOG_DEBUG("Cleanup successful.");
 
 	// Return
 	return MOSQ_ERR_SUCCESS;
@@ -0,0 +1,224 @@
+/**
+ * prescreen.c
+ *
+ * Reject tokens that cannot be valid before calling the introspection endpoint
+ */
+
+#include "prescreen.h"
+
+
+struct oauth2plugin_Prescreen* oauth2plugin_initPrescreen(
+	const struct oauth2plugin_Options* options
+) {
+	struct oauth2plugin_Prescreen* prescreen = calloc(1, sizeof(*prescreen));
+	if (!prescreen) return NULL;
+
+	// Length and structure
+	prescreen->min_length = options->prescreen_min_length > 0 ? (size_t) options->prescreen_min_length : 0;
+	prescreen->max_length = options->prescreen_max_length > 0 ? (size_t) options->prescreen_max_length : 0;
+	prescreen->format = options->prescreen_format;
+	prescreen->check_exp = options->prescreen_check_exp;
+	prescreen->exp_leeway = options->prescreen_exp_leeway;
+
+	// Alphabet
+	prescreen->charset = options->prescreen_charset;
+	switch (options->prescreen_charset) {
+		case prescreen_charset_PRINTABLE:
+			oauth2plugin_addPrescreenRange(prescreen, 0x21, 0x7E);
+			break;
+		case prescreen_charset_B64TOKEN: // RFC 6750
+			oauth2plugin_addPrescreenRange(prescreen, '+', '+');
+			oauth2plugin_addPrescreenRange(prescreen, '/', '/');
+			oauth2plugin_addPrescreenRange(prescreen, '=', '=');
+			oauth2plugin_addPrescreenRange(prescreen, '~', '~');
+			// fallthrough
+		case prescreen_charset_BASE64URL: // base64url and the dots of JWTs
+			oauth2plugin_addPrescreenRange(prescreen, 'A', 'Z');
+			oauth2plugin_addPrescreenRange(prescreen, 'a', 'z');
+			oauth2plugin_addPrescreenRange(prescreen, '0', '9');
+			oauth2plugin_addPrescreenRange(prescreen, '-', '.');
+			oauth2plugin_addPrescreenRange(prescreen, '_', '_');
+			break;
+		default:
+			break;
+	}
+
+	// Issuers (comma separated)
+	const char* item = options->prescreen_issuers;
+	while (item && *item) {
+		size_t item_length = strcspn(item, ",");
+		const char* next = item[item_length] ? item + item_length + 1 : item + item_length;
+		while (item_length > 0 && *item == ' ') { item++; item_length--; }
+		while (item_length > 0 && item[item_length - 1] == ' ') item_length--;
+		if (item_length > 0) {
+			char** issuers = realloc(prescreen->issuers, (prescreen->issuers_count + 1) * sizeof(*issuers));
+			if (!issuers) {
+				oauth2plugin_freePrescreen(prescreen);
+				return NULL;
+			}
+			prescreen->issuers = issuers;
+			prescreen->issuers[prescreen->issuers_count] = strndup(item, item_length);
+			if (!prescreen->issuers[prescreen->issuers_count]) {
+				oauth2plugin_freePrescreen(prescreen);
+				return NULL;
+			}
+			prescreen->issuers_count++;
+		}
+		item = next;
+	}
+
+	return prescreen;
+}
+
+
+void oauth2plugin_freePrescreen(
+	struct oauth2plugin_Prescreen* prescreen
+) {
+	if (!prescreen) return;
+	for (size_t i = 0; i < prescreen->issuers_count; i++)
+		free(prescreen->issuers[i]);
+	free(prescreen->issuers);
+	free(prescreen);
+}
+
+
+enum oauth2plugin_PrescreenResult oauth2plugin_prescreenToken(
+	const struct oauth2plugin_Prescreen* prescreen,
+	const char* token
+) {
+	if (!prescreen || !token) return prescreen_result_OK;
+
+	// Length (never scans further than max_length + 1)
+	size_t length = prescreen->max_length > 0 ? strnlen(token, prescreen->max_length + 1) : strlen(token);
+	if (
+		length < prescreen->min_length
+		|| (prescreen->max_length > 0 && length > prescreen->max_length)
+	) return prescreen_result_LENGTH;
+
+	// Alphabet
+	if (
+		prescreen->ranges_count > 0
+		&& !oauth2plugin_isCharsetValid(prescreen, token, length)
+	) return prescreen_result_CHARSET;
+
+	// Structure
+	bool jwt = oauth2plugin_isJWT(token);
+	if (prescreen->format == prescreen_format_JWT && !jwt) return prescreen_result_FORMAT;
+	if (prescreen->format == prescreen_format_OPAQUE && jwt) return prescreen_result_FORMAT;
+
+	// Unverified JWT header and claims
+	if (
+		jwt
+		&& (
+			prescreen->format == prescreen_format_JWT
+			|| prescreen->check_exp
+			|| prescreen->issuers_count > 0
+		)
+	) return oauth2plugin_prescreenJWT(prescreen, token);
+
+	return prescreen_result_OK;
+}
+
+
+const char* oauth2plugin_PrescreenResult_toString(
+	enum oauth2plugin_PrescreenResult result
+) {
+	switch (result) {
+		case prescreen_result_OK: return "ok";
+		case prescreen_result_LENGTH: return "invalid length";
+		case prescreen_result_CHARSET: return "invalid character";
+		case prescreen_result_FORMAT: return "unexpected format";
+		case prescreen_result_EXPIRED: return "expired";
+		case prescreen_result_ISSUER: return "unexpected issuer";
+		default: return "unknown";
+	}
+}
+
+
+static bool oauth2plugin_isCharsetValid(
+	const struct oauth2plugin_Prescreen* prescreen,
+	const char* token,
+	size_t length
+) {
+	size_t position = 0;
+
+#if defined(__SSE2__)
+	// 16 characters at a time: a character is allowed if it is inside any range.
+	// Signed comparison is fine since all ranges are below 0x80 and bytes >= 0x80 compare as negative.
+	for (; position + 16 <= length; position += 16) {
+		__m128i characters = _mm_loadu_si128((const __m128i*) (token + position));
+		__m128i allowed = _mm_setzero_si128();
+		for (size_t i = 0; i < prescreen->ranges_count; i++) {
+			__m128i above_low = _mm_cmpgt_epi8(characters, _mm_set1_epi8((char) (prescreen->range_lows[i] - 1)));
+			__m128i below_high = _mm_cmplt_epi8(characters, _mm_set1_epi8((char) (prescreen->range_highs[i] + 1)));
+			allowed = _mm_or_si128(allowed, _mm_and_si128(above_low, below_high));
+		}
+		if (_mm_movemask_epi8(allowed) != 0xFFFF) return false;
+	}
+#endif
+
+	// Remaining characters (all characters without SSE2)
+	bool valid = true;
+	for (; position < length; position++)
+		valid &= prescreen->allowed[(unsigned char) token[position]];
+	return valid;
+}
+
+
+static void oauth2plugin_addPrescreenRange(
+	struct oauth2plugin_Prescreen* prescreen,
+	uint8_t low,
+	uint8_t high
+) {
+	if (prescreen->ranges_count >= OAUTH2PLUGIN_PRESCREEN_MAX_RANGES) return;
+	prescreen->range_lows[prescreen->ranges_count] = low;
+	prescreen->range_highs[prescreen->ranges_count] = high;
+	prescreen->ranges_count++;
+	for (unsigned int c = low; c <= high; c++) prescreen->allowed[c] = true;
+}
+
+
+static enum oauth2plugin_PrescreenResult oauth2plugin_prescreenJWT(
+	const struct oauth2plugin_Prescreen* prescreen,
+	const char* token
+) {
+	// Header must be a JSON object with an algorithm
+	if (prescreen->format == prescreen_format_JWT) {
+		size_t header_json_length = 0;
+		unsigned char* header_json = oauth2plugin_base64urlDecode(token, (size_t) (strchr(token, '.') - token), &header_json_length);
+		if (!header_json) return prescreen_result_FORMAT;
+		cJSON* header = cJSON_Parse((const char*) header_json);
+		free(header_json);
+		bool valid = cJSON_IsString(cJSON_GetObjectItemCaseSensitive(header, "alg"));
+		cJSON_Delete(header);
+		if (!valid) return prescreen_result_FORMAT;
+	}
+
+	// Payload must be a JSON object
+	cJSON* claims = oauth2plugin_parseJWTPayload(token);
+	if (!claims) return prescreen->format == prescreen_format_JWT ? prescreen_result_FORMAT : prescreen_result_OK;
+
+	// Expiration
+	enum oauth2plugin_PrescreenResult result = prescreen_result_OK;
+	cJSON* exp = cJSON_GetObjectItemCaseSensitive(claims, "exp");
+	if (
+		prescreen->check_exp
+		&& cJSON_IsNumber(exp)
+		&& exp->valuedouble + (double) prescreen->exp_leeway < (double) time(NULL)
+	) result = prescreen_result_EXPIRED;
+
+	// Issuer
+	if (result == prescreen_result_OK && prescreen->issuers_count > 0) {
+		cJSON* iss = cJSON_GetObjectItemCaseSensitive(claims, "iss");
+		result = prescreen_result_ISSUER;
+		for (size_t i = 0; cJSON_IsString(iss) && i < prescreen->issuers_count; i++) {
+			if (strcmp(iss->valuestring, prescreen->issuers[i]) == 0) {
+				result = prescreen_result_OK;
+				break;
+			}
+		}
+	}
+
+	cJSON_Delete(claims);
+	return result;
+}
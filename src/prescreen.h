@@ -0,0 +1,148 @@
+/**
+ * prescreen.h
+ *
+ * Reject tokens that cannot be valid before calling the introspection endpoint
+ */
+
+#ifndef OAUTH2PLUGIN_PRESCREEN_H
+#define OAUTH2PLUGIN_PRESCREEN_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include "cJSON.h"
+
+#include "options.h"
+#include "jwt.h"
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_PRESCREEN_MAX_RANGES 16
+
+
+enum oauth2plugin_PrescreenResult {
+	prescreen_result_OK,
+	prescreen_result_LENGTH,		// Token is shorter or longer than allowed.
+	prescreen_result_CHARSET,		// Token contains a character outside the allowed alphabet.
+	prescreen_result_FORMAT,		// Token does not have the expected (JWT or opaque) structure.
+	prescreen_result_EXPIRED,		// Unverified "exp" claim is in the past.
+	prescreen_result_ISSUER			// Unverified "iss" claim is not an expected issuer.
+};
+
+
+struct oauth2plugin_Prescreen {
+	size_t										min_length;												// Minimum token length.
+	size_t										max_length;												// Maximum token length (0 = unlimited).
+	enum oauth2plugin_Options_prescreen_charset	charset;												// Allowed alphabet.
+	uint8_t										range_lows[OAUTH2PLUGIN_PRESCREEN_MAX_RANGES];			// First characters of the allowed ranges.
+	uint8_t										range_highs[OAUTH2PLUGIN_PRESCREEN_MAX_RANGES];			// Last characters of the allowed ranges.
+	size_t										ranges_count;											// Number of ranges.
+	bool										allowed[256];											// Same ranges as lookup table (scalar path).
+	enum oauth2plugin_Options_prescreen_format	format;													// Expected token structure.
+	bool										check_exp;												// Reject JWTs with an expired "exp" claim.
+	long										exp_leeway;												// Seconds an expired JWT is still accepted.
+	char**										issuers;												// Accepted "iss" values of JWTs (NULL = any).
+	size_t										issuers_count;											// Number of entries in issuers.
+};
+
+
+/**
+ * @brief Compile the pre-screening rules of a profile.
+ *
+ * @param options	Profile with prescreen_* options.
+ * @return			Pointer to new rules or NULL if allocation fails.
+ */
+struct oauth2plugin_Prescreen* oauth2plugin_initPrescreen(
+	const struct oauth2plugin_Options* options
+);
+
+
+/**
+ * @brief Release pre-screening rules.
+ *
+ * @param prescreen		Rules created by oauth2plugin_initPrescreen(). May be NULL.
+ */
+void oauth2plugin_freePrescreen(
+	struct oauth2plugin_Prescreen* prescreen
+);
+
+
+/**
+ * @brief Check a token against the pre-screening rules.
+ *
+ * Length and alphabet are checked first (the alphabet 16 bytes at a time with
+ * SSE2 where available). The unverified JWT header and payload are only decoded
+ * if the structure, "exp" or "iss" have to be checked.
+ *
+ * @param prescreen		Rules. May be NULL (every token passes).
+ * @param token			Token supplied by the MQTT client.
+ * @return				prescreen_result_OK if the token may be valid, otherwise the failed rule.
+ */
+enum oauth2plugin_PrescreenResult oauth2plugin_prescreenToken(
+	const struct oauth2plugin_Prescreen* prescreen,
+	const char* token
+);
+
+
+/**
+ * @brief Convert a pre-screening result to a human readable string.
+ *
+ * @param result	Result to convert.
+ * @return			Constant string representation of @p result.
+ */
+const char* oauth2plugin_PrescreenResult_toString(
+	enum oauth2plugin_PrescreenResult result
+);
+
+
+/**
+ * @brief Check that all characters of a token are in the allowed ranges.
+ *
+ * @param prescreen		Rules.
+ * @param token			Token.
+ * @param length		Length of @p token.
+ * @return				true if all characters are allowed.
+ */
+static bool oauth2plugin_isCharsetValid(
+	const struct oauth2plugin_Prescreen* prescreen,
+	const char* token,
+	size_t length
+);
+
+
+/**
+ * @brief Add an allowed character range.
+ *
+ * @param prescreen		Rules.
+ * @param low			First allowed character.
+ * @param high			Last allowed character.
+ */
+static void oauth2plugin_addPrescreenRange(
+	struct oauth2plugin_Prescreen* prescreen,
+	uint8_t low,
+	uint8_t high
+);
+
+
+/**
+ * @brief Check the unverified header and claims of a JWT.
+ *
+ * @param prescreen		Rules.
+ * @param token			Token with JWT structure.
+ * @return				prescreen_result_OK or the failed rule.
+ */
+static enum oauth2plugin_PrescreenResult oauth2plugin_prescreenJWT(
+	const struct oauth2plugin_Prescreen* prescreen,
+	const char* token
+);
+
+#endif // OAUTH2PLUGIN_PRESCREEN_H
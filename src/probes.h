@@ -0,0 +1,59 @@
+/**
+ * probes.h
+ *
+ * USDT (user-level statically defined tracing) probes of the authentication
+ * pipeline for bpftrace, perf and SystemTap
+ *
+ * Probes are compiled in if <sys/sdt.h> is available (e.g. package
+ * systemtap-sdt-dev) and can be compiled out with -DOAUTH2PLUGIN_PROBES=0.
+ * An unattached probe is a single nop; its arguments are values the pipeline
+ * computes anyway. Provider "oauth2plugin", probes:
+ *   auth__start(client_id)									Basic auth callback entered
+ *   auth__done(client_id, result, reason, total_us)			Basic auth callback returns (reason as in the audit log)
+ *   stage(stage, duration_us)								Audit stage finished ("prevalidation", "introspection", ...)
+ *   verifier__done(stage, outcome, duration_us)			Verifier chain stage finished (outcome "hit", "miss" or "failure")
+ *   http__start(url)										curl_easy_perform() starts
+ *   http__done(url, curl_code, http_code)					curl_easy_perform() returned (http_code 0 on transport errors)
+ *   parse__start(length)									Introspection response is parsed
+ *   parse__done(ok)											JSON parsed (ok = 1) or malformed (ok = 0)
+ *   claims__start()											Claims are extracted and interned
+ *   claims__done(count)										Number of claims found
+ *   template__start(template)								Username template is matched or rendered
+ *   template__done(template, ok)							Template matched or rendered (ok = 1)
+ *   username__start(client_id)								Username replacement starts
+ *   username__done(client_id, username, ok)					Username replaced (username NULL if rendering failed)
+ *
+ * Strings are char pointers (bpftrace: str(argN)), numbers are 64 bit signed.
+ */
+
+#ifndef OAUTH2PLUGIN_PROBES_H
+#define OAUTH2PLUGIN_PROBES_H
+
+#if !defined(OAUTH2PLUGIN_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define OAUTH2PLUGIN_PROBES 1
+#endif
+#endif
+
+#if defined(OAUTH2PLUGIN_PROBES) && OAUTH2PLUGIN_PROBES
+
+#include <sys/sdt.h>
+
+#define OAUTH2PLUGIN_PROBE0(name)				DTRACE_PROBE(oauth2plugin, name)
+#define OAUTH2PLUGIN_PROBE1(name, a)			DTRACE_PROBE1(oauth2plugin, name, a)
+#define OAUTH2PLUGIN_PROBE2(name, a, b)			DTRACE_PROBE2(oauth2plugin, name, a, b)
+#define OAUTH2PLUGIN_PROBE3(name, a, b, c)		DTRACE_PROBE3(oauth2plugin, name, a, b, c)
+#define OAUTH2PLUGIN_PROBE4(name, a, b, c, d)	DTRACE_PROBE4(oauth2plugin, name, a, b, c, d)
+
+#else
+
+// Compiled out: arguments are type checked but never evaluated
+#define OAUTH2PLUGIN_PROBE0(name)				do { } while (0)
+#define OAUTH2PLUGIN_PROBE1(name, a)			do { if (0) { (void) (a); } } while (0)
+#define OAUTH2PLUGIN_PROBE2(name, a, b)			do { if (0) { (void) (a); (void) (b); } } while (0)
+#define OAUTH2PLUGIN_PROBE3(name, a, b, c)		do { if (0) { (void) (a); (void) (b); (void) (c); } } while (0)
+#define OAUTH2PLUGIN_PROBE4(name, a, b, c, d)	do { if (0) { (void) (a); (void) (b); (void) (c); (void) (d); } } while (0)
+
+#endif
+
+#endif // OAUTH2PLUGIN_PROBES_H
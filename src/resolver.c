@@ -0,0 +1,416 @@
+/**
+ * resolver.c
+ *
+ * Background DNS resolution with a TTL based address cache for CURL
+ */
+
+#include "resolver.h"
+
+
+struct oauth2plugin_Resolver* oauth2plugin_initResolver(
+	long min_ttl,
+	long max_ttl
+) {
+	struct oauth2plugin_Resolver* resolver = calloc(1, sizeof(*resolver));
+	if (!resolver) return NULL;
+
+	resolver->running = true;
+	pthread_mutex_init(&resolver->mutex, NULL);
+	pthread_cond_init(&resolver->cond, NULL);
+	oauth2plugin_setResolverTTL(resolver, min_ttl, max_ttl);
+
+	// Start background thread
+	if (pthread_create(&resolver->thread, NULL, oauth2plugin_runResolver, resolver) != 0) {
+		oauth2plugin_freeResolver(resolver);
+		return NULL;
+	}
+	resolver->thread_started = true;
+
+	return resolver;
+}
+
+
+void oauth2plugin_freeResolver(
+	struct oauth2plugin_Resolver* resolver
+) {
+	if (!resolver) return;
+
+	// Stop background thread
+	pthread_mutex_lock(&resolver->mutex);
+	resolver->running = false;
+	pthread_cond_signal(&resolver->cond);
+	pthread_mutex_unlock(&resolver->mutex);
+	if (resolver->thread_started) pthread_join(resolver->thread, NULL);
+
+	// Free entries
+	struct oauth2plugin_ResolverEntry* entry = resolver->entries;
+	while (entry) {
+		struct oauth2plugin_ResolverEntry* next = entry->next;
+		free(entry->host);
+		free(entry);
+		entry = next;
+	}
+	pthread_cond_destroy(&resolver->cond);
+	pthread_mutex_destroy(&resolver->mutex);
+	free(resolver);
+}
+
+
+void oauth2plugin_setResolverTTL(
+	struct oauth2plugin_Resolver* resolver,
+	long min_ttl,
+	long max_ttl
+) {
+	if (!resolver) return;
+	pthread_mutex_lock(&resolver->mutex);
+	resolver->min_ttl = min_ttl > 0 ? min_ttl : 1;
+	resolver->max_ttl = max_ttl > resolver->min_ttl ? max_ttl : resolver->min_ttl;
+	pthread_mutex_unlock(&resolver->mutex);
+}
+
+
+int oauth2plugin_addResolverHost(
+	struct oauth2plugin_Resolver* resolver,
+	const char* url
+) {
+	// Validate
+	if (!resolver || !url) return MOSQ_ERR_INVAL;
+
+	// Get host
+	char* host = NULL;
+	long port = 0;
+	int parse_error = oauth2plugin_parseURLHost(url, &host, &port);
+	if (parse_error) return parse_error;
+
+	// Literal IP addresses do not need to be resolved
+	unsigned char ip_literal[sizeof(struct in6_addr)];
+	if (
+		host[0] == '['
+		|| inet_pton(AF_INET, host, ip_literal) == 1
+	) {
+		curl_free(host);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	// Create entry
+	struct oauth2plugin_ResolverEntry* entry = calloc(1, sizeof(*entry));
+	if (!entry) {
+		curl_free(host);
+		return MOSQ_ERR_NOMEM;
+	}
+	entry->host = strdup(host);
+	entry->port = port;
+	curl_free(host);
+	if (!entry->host) {
+		free(entry);
+		return MOSQ_ERR_NOMEM;
+	}
+
+	// Register unless already registered (unresolved entries are skipped by oauth2plugin_getResolverList())
+	pthread_mutex_lock(&resolver->mutex);
+	for (struct oauth2plugin_ResolverEntry* registered = resolver->entries; registered; registered = registered->next) {
+		if (strcmp(registered->host, entry->host) == 0 && registered->port == entry->port) {
+			pthread_mutex_unlock(&resolver->mutex);
+			free(entry->host);
+			free(entry);
+			return MOSQ_ERR_SUCCESS;
+		}
+	}
+	long min_ttl = resolver->min_ttl;
+	long max_ttl = resolver->max_ttl;
+	time_t now = time(NULL);
+	entry->refresh = now + max_ttl; // Not due for the background thread before the initial resolution below
+	entry->next = resolver->entries;
+	resolver->entries = entry;
+	pthread_mutex_unlock(&resolver->mutex);
+
+	// Initial resolution without holding the lock (entries are only removed on the broker thread, like this one)
+	char addresses[OAUTH2PLUGIN_RESOLVER_ADDRESSES_SIZE] = "";
+	long ttl = max_ttl;
+	int resolve_error = oauth2plugin_resolveHost(entry->host, max_ttl, addresses, sizeof(addresses), &ttl);
+	if (resolve_error == MOSQ_ERR_SUCCESS) {
+		if (ttl < min_ttl) ttl = min_ttl;
+		OAUTH2PLUGIN_LOG_DEBUG("Resolved %s: %s (TTL: %ld seconds)", entry->host, addresses, ttl);
+	} else {
+		OAUTH2PLUGIN_LOG_WARNING("Failed to resolve %s. Retrying in background.", entry->host);
+	}
+
+	// Store addresses
+	pthread_mutex_lock(&resolver->mutex);
+	now = time(NULL);
+	if (resolve_error == MOSQ_ERR_SUCCESS) {
+		memcpy(entry->addresses, addresses, sizeof(addresses));
+		entry->expires = now + ttl;
+		entry->refresh = now + (ttl * 3) / 4;
+	} else {
+		entry->refresh = now + min_ttl;
+	}
+	pthread_cond_signal(&resolver->cond);
+	pthread_mutex_unlock(&resolver->mutex);
+
+	// Return
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void oauth2plugin_retainResolverHosts(
+	struct oauth2plugin_Resolver* resolver,
+	const char* const* urls,
+	size_t urls_count
+) {
+	if (!resolver) return;
+
+	// Get hosts (unparsable URLs were never registered)
+	char** hosts = calloc(urls_count ? urls_count : 1, sizeof(*hosts));
+	long* ports = calloc(urls_count ? urls_count : 1, sizeof(*ports));
+	if (!hosts || !ports) {
+		free(hosts);
+		free(ports);
+		return;
+	}
+	for (size_t i = 0; i < urls_count; i++) {
+		if (urls[i]) oauth2plugin_parseURLHost(urls[i], &hosts[i], &ports[i]);
+	}
+
+	// Unlink entries that are no longer referenced
+	struct oauth2plugin_ResolverEntry* removed = NULL;
+	pthread_mutex_lock(&resolver->mutex);
+	struct oauth2plugin_ResolverEntry** link = &resolver->entries;
+	while (*link) {
+		struct oauth2plugin_ResolverEntry* entry = *link;
+		bool referenced = false;
+		for (size_t i = 0; i < urls_count && !referenced; i++)
+			referenced = hosts[i] && strcmp(entry->host, hosts[i]) == 0 && entry->port == ports[i];
+		if (referenced) {
+			link = &entry->next;
+			continue;
+		}
+		*link = entry->next;
+		if (entry == resolver->resolving) {
+			entry->removed = true;
+		} else {
+			entry->next = removed;
+			removed = entry;
+		}
+	}
+	pthread_mutex_unlock(&resolver->mutex);
+
+	// Free
+	while (removed) {
+		struct oauth2plugin_ResolverEntry* next = removed->next;
+		OAUTH2PLUGIN_LOG_DEBUG("Stopped resolving %s.", removed->host);
+		free(removed->host);
+		free(removed);
+		removed = next;
+	}
+	for (size_t i = 0; i < urls_count; i++) curl_free(hosts[i]);
+	free(hosts);
+	free(ports);
+}
+
+
+struct curl_slist* oauth2plugin_getResolverList(
+	struct oauth2plugin_Resolver* resolver
+) {
+	if (!resolver) return NULL;
+
+	struct curl_slist* resolve = NULL;
+	pthread_mutex_lock(&resolver->mutex);
+	for (struct oauth2plugin_ResolverEntry* entry = resolver->entries; entry; entry = entry->next) {
+		if (entry->addresses[0] == '\0') continue;
+		char line[OAUTH2PLUGIN_RESOLVER_ADDRESSES_SIZE + 300];
+		snprintf(line, sizeof(line), "%s:%ld:%s", entry->host, entry->port, entry->addresses);
+		struct curl_slist* new_resolve = curl_slist_append(resolve, line);
+		if (!new_resolve) break;
+		resolve = new_resolve;
+	}
+	pthread_mutex_unlock(&resolver->mutex);
+
+	return resolve;
+}
+
+
+int oauth2plugin_parseURLHost(
+	const char* url,
+	char** host,
+	long* port
+) {
+	// Validate
+	if (!url || !host || !port) return MOSQ_ERR_INVAL;
+
+	// Parse URL
+	CURLU* curl_url_handle = curl_url();
+	if (!curl_url_handle) return MOSQ_ERR_NOMEM;
+	char* port_string = NULL;
+	if (
+		curl_url_set(curl_url_handle, CURLUPART_URL, url, 0) != CURLUE_OK
+		|| curl_url_get(curl_url_handle, CURLUPART_HOST, host, 0) != CURLUE_OK
+		|| curl_url_get(curl_url_handle, CURLUPART_PORT, &port_string, CURLU_DEFAULT_PORT) != CURLUE_OK
+	) {
+		curl_url_cleanup(curl_url_handle);
+		return MOSQ_ERR_INVAL;
+	}
+	*port = strtol(port_string, NULL, 10);
+	curl_free(port_string);
+	curl_url_cleanup(curl_url_handle);
+
+	// Return
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void* oauth2plugin_runResolver(
+	void* arg
+) {
+	struct oauth2plugin_Resolver* resolver = (struct oauth2plugin_Resolver*) arg;
+
+	pthread_mutex_lock(&resolver->mutex);
+	while (resolver->running) {
+		// Find next due entry
+		time_t now = time(NULL);
+		time_t next_refresh = now + resolver->max_ttl;
+		struct oauth2plugin_ResolverEntry* due_entry = NULL;
+		for (struct oauth2plugin_ResolverEntry* entry = resolver->entries; entry; entry = entry->next) {
+			if (entry->refresh <= now) {
+				due_entry = entry;
+				break;
+			}
+			if (entry->refresh < next_refresh) next_refresh = entry->refresh;
+		}
+
+		// Nothing to do -> sleep until the next refresh or until woken up
+		if (!due_entry) {
+			struct timespec wakeup = { .tv_sec = next_refresh, .tv_nsec = 0 };
+			pthread_cond_timedwait(&resolver->cond, &resolver->mutex, &wakeup);
+			continue;
+		}
+
+		// Resolve without holding the lock (a removed entry is only marked meanwhile)
+		char addresses[OAUTH2PLUGIN_RESOLVER_ADDRESSES_SIZE] = "";
+		long min_ttl = resolver->min_ttl;
+		long max_ttl = resolver->max_ttl;
+		long ttl = max_ttl;
+		resolver->resolving = due_entry;
+		pthread_mutex_unlock(&resolver->mutex);
+		int resolve_error = oauth2plugin_resolveHost(due_entry->host, max_ttl, addresses, sizeof(addresses), &ttl);
+		pthread_mutex_lock(&resolver->mutex);
+		resolver->resolving = NULL;
+		if (due_entry->removed) {
+			free(due_entry->host);
+			free(due_entry);
+			continue;
+		}
+
+		// Update entry
+		now = time(NULL);
+		if (resolve_error == MOSQ_ERR_SUCCESS) {
+			if (ttl < min_ttl) ttl = min_ttl;
+			if (strcmp(due_entry->addresses, addresses) != 0)
+				OAUTH2PLUGIN_LOG_DEBUG("Addresses of %s changed: %s", due_entry->host, addresses);
+			memcpy(due_entry->addresses, addresses, sizeof(addresses));
+			due_entry->expires = now + ttl;
+			due_entry->refresh = now + (ttl * 3) / 4;
+		} else {
+			// Keep stale addresses, retry soon
+			if (due_entry->addresses[0] != '\0' && due_entry->expires <= now)
+				OAUTH2PLUGIN_LOG_WARNING("Failed to refresh addresses of %s. Using stale addresses.", due_entry->host);
+			due_entry->refresh = now + min_ttl;
+		}
+	}
+	pthread_mutex_unlock(&resolver->mutex);
+
+	return NULL;
+}
+
+
+static int oauth2plugin_resolveHost(
+	const char* host,
+	long max_ttl,
+	char* addresses,
+	size_t addresses_size,
+	long* ttl
+) {
+	// Query DNS for records with TTL
+	addresses[0] = '\0';
+	*ttl = max_ttl;
+	size_t address_count = 0;
+	address_count += oauth2plugin_queryHostRecords(host, ns_t_a, addresses, addresses_size, ttl);
+	address_count += oauth2plugin_queryHostRecords(host, ns_t_aaaa, addresses, addresses_size, ttl);
+	if (address_count > 0) return MOSQ_ERR_SUCCESS;
+
+	// Fall back to the system resolver (hosts file, mDNS, ...)
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+	struct addrinfo* addrinfo = NULL;
+	if (getaddrinfo(host, NULL, &hints, &addrinfo) != 0) return MOSQ_ERR_EAI;
+	for (struct addrinfo* item = addrinfo; item; item = item->ai_next) {
+		const void* address = NULL;
+		if (item->ai_family == AF_INET)
+			address = &((struct sockaddr_in*) item->ai_addr)->sin_addr;
+		else if (item->ai_family == AF_INET6)
+			address = &((struct sockaddr_in6*) item->ai_addr)->sin6_addr;
+		if (address && oauth2plugin_appendAddress(item->ai_family, address, addresses, addresses_size))
+			address_count++;
+	}
+	freeaddrinfo(addrinfo);
+	*ttl = max_ttl;
+
+	return address_count > 0 ? MOSQ_ERR_SUCCESS : MOSQ_ERR_NOT_FOUND;
+}
+
+
+static size_t oauth2plugin_queryHostRecords(
+	const char* host,
+	int type,
+	char* addresses,
+	size_t addresses_size,
+	long* ttl
+) {
+	// Query (res_search applies the search domains, e.g. for container names)
+	unsigned char answer[NS_PACKETSZ * 4];
+	int answer_length = res_search(host, ns_c_in, type, answer, sizeof(answer));
+	if (answer_length <= 0) return 0;
+
+	// Parse answer section
+	ns_msg message;
+	if (ns_initparse(answer, answer_length, &message) < 0) return 0;
+	size_t address_count = 0;
+	for (int i = 0; i < ns_msg_count(message, ns_s_an); i++) {
+		ns_rr record;
+		if (ns_parserr(&message, ns_s_an, i, &record) < 0) continue;
+		if ((int) ns_rr_type(record) != type) continue; // e.g. CNAME
+		if (
+			(type == ns_t_a && ns_rr_rdlen(record) != sizeof(struct in_addr))
+			|| (type == ns_t_aaaa && ns_rr_rdlen(record) != sizeof(struct in6_addr))
+		) continue;
+		if (!oauth2plugin_appendAddress(type == ns_t_a ? AF_INET : AF_INET6, ns_rr_rdata(record), addresses, addresses_size)) continue;
+		if ((long) ns_rr_ttl(record) < *ttl) *ttl = (long) ns_rr_ttl(record);
+		address_count++;
+	}
+
+	return address_count;
+}
+
+
+static bool oauth2plugin_appendAddress(
+	int family,
+	const void* address,
+	char* addresses,
+	size_t addresses_size
+) {
+	char address_string[INET6_ADDRSTRLEN];
+	if (!inet_ntop(family, address, address_string, sizeof(address_string))) return false;
+
+	size_t length = strlen(addresses);
+	int written = snprintf(
+		addresses + length,
+		addresses_size - length,
+		family == AF_INET6 ? "%s[%s]" : "%s%s",
+		length ? "," : "",
+		address_string
+	);
+	if (written < 0 || (size_t) written >= addresses_size - length) {
+		addresses[length] = '\0';
+		return false;
+	}
+	return true;
+}
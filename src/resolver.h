@@ -0,0 +1,235 @@
+/**
+ * resolver.h
+ *
+ * Background DNS resolution with a TTL based address cache for CURL
+ */
+
+#ifndef OAUTH2PLUGIN_RESOLVER_H
+#define OAUTH2PLUGIN_RESOLVER_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+#include <netdb.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include <curl/curl.h>
+
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_RESOLVER_ADDRESSES_SIZE 1024
+
+
+struct oauth2plugin_ResolverEntry {
+	char*								host;										// Host name.
+	long								port;										// Port used in the CURLOPT_RESOLVE entry.
+	char								addresses[OAUTH2PLUGIN_RESOLVER_ADDRESSES_SIZE];	// "addr1,[addr2],..." or empty if never resolved.
+	time_t								expires;									// Time at which the records expire (TTL).
+	time_t								refresh;									// Time of the next background refresh.
+	bool								removed;									// Dropped while being resolved, freed by the background thread.
+	struct oauth2plugin_ResolverEntry*	next;
+};
+
+
+struct oauth2plugin_Resolver {
+	pthread_mutex_t						mutex;				// Protects entries and running.
+	pthread_cond_t						cond;				// Wakes the background thread.
+	pthread_t							thread;				// Background refresh thread.
+	bool								thread_started;		// Whether @p thread has to be joined.
+	bool								running;			// Cleared to stop the background thread.
+	long								min_ttl;			// Lower bound for record TTLs in seconds.
+	long								max_ttl;			// Upper bound for record TTLs in seconds.
+	struct oauth2plugin_ResolverEntry*	entries;			// Cached hosts.
+	struct oauth2plugin_ResolverEntry*	resolving;			// Entry being resolved by the background thread without the lock.
+};
+
+
+/**
+ * @brief Allocate a resolver and start its background refresh thread.
+ *
+ * The resolver caches all A and AAAA records of the registered hosts together
+ * with their TTL and refreshes them in the background before they expire. If a
+ * refresh fails, the previous addresses are kept (serve stale) and the refresh
+ * is retried after @p min_ttl seconds.
+ *
+ * @param min_ttl	Lower bound for record TTLs in seconds.
+ * @param max_ttl	Upper bound for record TTLs in seconds (also used if no TTL is known).
+ * @return			Pointer to a new resolver or NULL on failure.
+ */
+struct oauth2plugin_Resolver* oauth2plugin_initResolver(
+	long min_ttl,
+	long max_ttl
+);
+
+
+/**
+ * @brief Stop the background thread and release the resolver.
+ *
+ * @param resolver	Resolver created by oauth2plugin_initResolver(). May be NULL.
+ */
+void oauth2plugin_freeResolver(
+	struct oauth2plugin_Resolver* resolver
+);
+
+
+/**
+ * @brief Change the TTL bounds of a running resolver.
+ *
+ * @param resolver	Target resolver.
+ * @param min_ttl	Lower bound for record TTLs in seconds.
+ * @param max_ttl	Upper bound for record TTLs in seconds.
+ */
+void oauth2plugin_setResolverTTL(
+	struct oauth2plugin_Resolver* resolver,
+	long min_ttl,
+	long max_ttl
+);
+
+
+/**
+ * @brief Register the host of @p url with the resolver.
+ *
+ * The host is resolved once synchronously (at startup), afterwards it is only
+ * refreshed by the background thread. Literal IP addresses and already
+ * registered hosts are ignored. Must be called on the broker thread, like
+ * oauth2plugin_retainResolverHosts().
+ *
+ * @param resolver	Target resolver.
+ * @param url		URL whose host should be resolved.
+ * @return			MOSQ_ERR_SUCCESS on success or a mosquitto error code on failure.
+ */
+int oauth2plugin_addResolverHost(
+	struct oauth2plugin_Resolver* resolver,
+	const char* url
+);
+
+
+/**
+ * @brief Drop all hosts except the ones of @p urls.
+ *
+ * Called after a reload was applied, so hosts the configuration no longer uses
+ * are neither refreshed nor added to requests any more. Must be called on the
+ * broker thread.
+ *
+ * @param resolver		Target resolver.
+ * @param urls			URLs whose hosts are kept. NULL entries are skipped.
+ * @param urls_count	Number of entries in @p urls.
+ */
+void oauth2plugin_retainResolverHosts(
+	struct oauth2plugin_Resolver* resolver,
+	const char* const* urls,
+	size_t urls_count
+);
+
+
+/**
+ * @brief Create a CURLOPT_RESOLVE list with the cached addresses of all hosts.
+ *
+ * @param resolver	Resolver. May be NULL.
+ * @return			Newly allocated list ("host:port:addr1,addr2,...") or NULL if no addresses are cached. Caller is responsible for freeing it with curl_slist_free_all().
+ */
+struct curl_slist* oauth2plugin_getResolverList(
+	struct oauth2plugin_Resolver* resolver
+);
+
+
+/**
+ * @brief Split a URL into host name and port.
+ *
+ * If the URL does not contain a port, the default port of its scheme is used.
+ *
+ * @param url		URL to parse.
+ * @param host		Output: newly allocated host name. Caller is responsible for freeing it with curl_free().
+ * @param port		Output: port number.
+ * @return			MOSQ_ERR_SUCCESS on success, MOSQ_ERR_INVAL if the URL cannot be parsed.
+ */
+int oauth2plugin_parseURLHost(
+	const char* url,
+	char** host,
+	long* port
+);
+
+
+/**
+ * @brief Background thread refreshing cached entries before they expire.
+ *
+ * @param arg	Pointer to the oauth2plugin_Resolver.
+ * @return		Always NULL.
+ */
+static void* oauth2plugin_runResolver(
+	void* arg
+);
+
+
+/**
+ * @brief Resolve all A and AAAA records of a host.
+ *
+ * Queries DNS directly to learn the record TTLs. If that fails (e.g. for names
+ * from /etc/hosts) the system resolver is used and @p max_ttl is assumed.
+ *
+ * @param host				Host name.
+ * @param max_ttl			TTL used if no TTL is known.
+ * @param addresses			Output buffer for "addr1,[addr2],...".
+ * @param addresses_size	Size of @p addresses.
+ * @param ttl				Output: lowest TTL of all records.
+ * @return					MOSQ_ERR_SUCCESS if at least one address was found, otherwise a mosquitto error code.
+ */
+static int oauth2plugin_resolveHost(
+	const char* host,
+	long max_ttl,
+	char* addresses,
+	size_t addresses_size,
+	long* ttl
+);
+
+
+/**
+ * @brief Query one record type and append the addresses to @p addresses.
+ *
+ * @param host				Host name.
+ * @param type				ns_t_a or ns_t_aaaa.
+ * @param addresses			Output buffer for "addr1,[addr2],...".
+ * @param addresses_size	Size of @p addresses.
+ * @param ttl				Input/Output: lowered to the smallest TTL found.
+ * @return					Number of appended addresses.
+ */
+static size_t oauth2plugin_queryHostRecords(
+	const char* host,
+	int type,
+	char* addresses,
+	size_t addresses_size,
+	long* ttl
+);
+
+
+/**
+ * @brief Append an address to a comma separated address list.
+ *
+ * IPv6 addresses are enclosed in brackets as required by CURLOPT_RESOLVE.
+ *
+ * @param family			AF_INET or AF_INET6.
+ * @param address			Pointer to struct in_addr or struct in6_addr.
+ * @param addresses			Address list.
+ * @param addresses_size	Size of @p addresses.
+ * @return					true if the address was appended.
+ */
+static bool oauth2plugin_appendAddress(
+	int family,
+	const void* address,
+	char* addresses,
+	size_t addresses_size
+);
+
+#endif // OAUTH2PLUGIN_RESOLVER_H
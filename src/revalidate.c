@@ -0,0 +1,221 @@
+/**
+ * revalidate.c
+ *
+ * Rate limited background revalidation of the tokens of connected clients
+ */
+
+#include "revalidate.h"
+#include "config.h"
+#include "auth.h"
+
+
+struct oauth2plugin_Revalidator* oauth2plugin_initRevalidator(
+	struct oauth2plugin_Plugin* plugin
+) {
+	struct oauth2plugin_Revalidator* revalidator = calloc(1, sizeof(*revalidator));
+	if (!revalidator) return NULL;
+	revalidator->plugin = plugin;
+	atomic_init(&revalidator->revalidated, 0);
+	atomic_init(&revalidator->disconnected, 0);
+	pthread_mutex_init(&revalidator->mutex, NULL);
+	pthread_condattr_t cond_attributes;
+	pthread_condattr_init(&cond_attributes);
+	pthread_condattr_setclock(&cond_attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&revalidator->cond, &cond_attributes);
+	pthread_condattr_destroy(&cond_attributes);
+	return revalidator;
+}
+
+
+int oauth2plugin_configureRevalidator(
+	struct oauth2plugin_Revalidator* revalidator,
+	const struct oauth2plugin_Options* options
+) {
+	// Running: let the thread pick up the new rate
+	if (revalidator->thread_started) {
+		pthread_mutex_lock(&revalidator->mutex);
+		revalidator->reconfigured = true;
+		pthread_cond_signal(&revalidator->cond);
+		pthread_mutex_unlock(&revalidator->mutex);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	// Start with the first configuration that enables revalidation
+	if (options->revalidation_rate <= 0) return MOSQ_ERR_SUCCESS;
+	if (pthread_create(&revalidator->thread, NULL, oauth2plugin_runRevalidator, revalidator) != 0) {
+		OAUTH2PLUGIN_LOG_ERROR("Cannot start revalidation thread.");
+		return MOSQ_ERR_UNKNOWN;
+	}
+	revalidator->thread_started = true;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void oauth2plugin_freeRevalidator(
+	struct oauth2plugin_Revalidator* revalidator
+) {
+	if (!revalidator) return;
+
+	// Stop thread
+	pthread_mutex_lock(&revalidator->mutex);
+	revalidator->stop = true;
+	pthread_cond_signal(&revalidator->cond);
+	pthread_mutex_unlock(&revalidator->mutex);
+	if (revalidator->thread_started) pthread_join(revalidator->thread, NULL);
+
+	// Drop pending disconnects
+	while (revalidator->kicks) {
+		struct oauth2plugin_RevalidationKick* next = revalidator->kicks->next;
+		free(revalidator->kicks);
+		revalidator->kicks = next;
+	}
+	pthread_cond_destroy(&revalidator->cond);
+	pthread_mutex_destroy(&revalidator->mutex);
+	free(revalidator);
+}
+
+
+void oauth2plugin_applyRevalidation(
+	struct oauth2plugin_Revalidator* revalidator
+) {
+	if (!revalidator) return;
+
+	// Take pending disconnects
+	pthread_mutex_lock(&revalidator->mutex);
+	struct oauth2plugin_RevalidationKick* kicks = revalidator->kicks;
+	revalidator->kicks = NULL;
+	pthread_mutex_unlock(&revalidator->mutex);
+
+	// Disconnect
+	while (kicks) {
+		struct oauth2plugin_RevalidationKick* next = kicks->next;
+		OAUTH2PLUGIN_LOG_INFO("Token is no longer valid, disconnecting client (MQTT Client ID: %s).", kicks->client_id);
+		mosquitto_kick_client_by_clientid(kicks->client_id, false);
+		atomic_fetch_add(&revalidator->disconnected, 1);
+		free(kicks);
+		kicks = next;
+	}
+}
+
+
+static void* oauth2plugin_runRevalidator(
+	void* userdata
+) {
+	struct oauth2plugin_Revalidator* revalidator = (struct oauth2plugin_Revalidator*) userdata;
+	struct oauth2plugin_Plugin* plugin = revalidator->plugin;
+	struct oauth2plugin_SessionToken sessions[OAUTH2PLUGIN_REVALIDATION_BATCH];
+	double allowance = 0;
+	int64_t last = oauth2plugin_getMonotonicTime();
+	bool idle = false;
+
+	pthread_mutex_lock(&revalidator->mutex);
+	while (!revalidator->stop) {
+		// Wake up ten times per second, so the budget is spread over the second;
+		// while disabled, sleep until the next reload
+		if (idle) {
+			while (!revalidator->stop && !revalidator->reconfigured) pthread_cond_wait(&revalidator->cond, &revalidator->mutex);
+			last = oauth2plugin_getMonotonicTime();
+		} else {
+			int64_t wake_up = oauth2plugin_getMonotonicTime() + 100000;
+			struct timespec deadline = { .tv_sec = wake_up / 1000000, .tv_nsec = (wake_up % 1000000) * 1000 };
+			pthread_cond_timedwait(&revalidator->cond, &revalidator->mutex, &deadline);
+		}
+		if (revalidator->stop) break;
+		revalidator->reconfigured = false;
+		pthread_mutex_unlock(&revalidator->mutex);
+
+		// Refill budget (token bucket holding at most one second of budget)
+		struct oauth2plugin_Options* options = oauth2plugin_acquireOptions(plugin);
+		idle = options->revalidation_rate <= 0;
+		int64_t now = oauth2plugin_getMonotonicTime();
+		if (options->revalidation_rate > 0) {
+			allowance += options->revalidation_rate * (now - last) / 1000000.0;
+			if (allowance > options->revalidation_rate) allowance = (double) options->revalidation_rate;
+		} else {
+			allowance = 0;
+		}
+		last = now;
+
+		// Revalidate due sessions
+		size_t budget = allowance < OAUTH2PLUGIN_REVALIDATION_BATCH ? (size_t) allowance : OAUTH2PLUGIN_REVALIDATION_BATCH;
+		if (budget > 0) {
+			int64_t real_now = oauth2plugin_getRealTime() / 1000000;
+			size_t count = oauth2plugin_collectSessionTokens(
+				plugin->sessions,
+				&revalidator->cursor,
+				real_now - options->revalidation_interval,
+				real_now,
+				sessions,
+				budget
+			);
+			allowance -= (double) count;
+			for (size_t i = 0; i < count; i++) oauth2plugin_revalidateSession(revalidator, options, &sessions[i], real_now);
+			oauth2plugin_freeSessionTokens(plugin->sessions, sessions, count);
+		}
+		oauth2plugin_releaseOptions(plugin, options);
+
+		pthread_mutex_lock(&revalidator->mutex);
+	}
+	pthread_mutex_unlock(&revalidator->mutex);
+	return NULL;
+}
+
+
+static void oauth2plugin_revalidateSession(
+	struct oauth2plugin_Revalidator* revalidator,
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_SessionToken* session,
+	int64_t now
+) {
+	// Expired: no need to ask the endpoint
+	bool active = true;
+	if (session->expires_at > 0 && session->expires_at <= now) {
+		active = false;
+	} else {
+		// Profile of the session (removed profiles are checked again after a reload re-adds them)
+		struct oauth2plugin_Options* profile = session->profile ? NULL : options;
+		for (size_t i = 0; i < options->profiles_count && !profile; i++) {
+			if (oauth2plugin_strEqual(options->profiles[i]->name, session->profile)) profile = options->profiles[i];
+		}
+		if (!profile) return;
+		if (oauth2plugin_introspectSessionToken(profile, session->client_id, session->token, &active) != MOSQ_ERR_SUCCESS) {
+			OAUTH2PLUGIN_LOG_DEBUG("Cannot revalidate token, keeping client (MQTT Client ID: %s).", session->client_id);
+			return;
+		}
+	}
+	atomic_fetch_add(&revalidator->revalidated, 1);
+	if (active) return;
+
+	// Tell the other nodes, clients may use the same token there
+	if (session->expires_at <= 0 || session->expires_at > now) oauth2plugin_announceInvalidToken(revalidator->plugin->cluster, session->token);
+
+	// Disconnect on the broker thread, unless the client is gone or reconnected with another token meanwhile
+	if (!oauth2plugin_dropSessionToken(revalidator->plugin->sessions, session->client, session->token)) return;
+	size_t length = strlen(session->client_id);
+	struct oauth2plugin_RevalidationKick* kick = malloc(sizeof(*kick) + length + 1);
+	if (!kick) return;
+	memcpy(kick->client_id, session->client_id, length + 1);
+	pthread_mutex_lock(&revalidator->mutex);
+	kick->next = revalidator->kicks;
+	revalidator->kicks = kick;
+	pthread_mutex_unlock(&revalidator->mutex);
+}
+
+
+static int oauth2plugin_introspectSessionToken(
+	struct oauth2plugin_Options* profile,
+	const char* client_id,
+	const char* token,
+	bool* active
+) {
+	struct oauth2plugin_VerifierRequest request = {
+		.token = token,
+		.client_id = client_id
+	};
+	struct oauth2plugin_VerifierResponse response = { .claims = NULL };
+	int error = oauth2plugin_runVerifierChain(profile, &request, &response);
+	if (error) return error;
+	*active = oauth2plugin_isTokenActive(response.claims);
+	cJSON_Delete(response.claims);
+	return MOSQ_ERR_SUCCESS;
+}
@@ -0,0 +1,157 @@
+/**
+ * revalidate.h
+ *
+ * Rate limited background revalidation of the tokens of connected clients
+ */
+
+#ifndef OAUTH2PLUGIN_REVALIDATE_H
+#define OAUTH2PLUGIN_REVALIDATE_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include "cJSON.h"
+
+#include "options.h"
+#include "session.h"
+#include "cluster.h"
+#include "verifier.h"
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_REVALIDATION_BATCH 64
+
+
+struct oauth2plugin_Plugin;
+
+
+struct oauth2plugin_RevalidationKick {
+	struct oauth2plugin_RevalidationKick*	next;			// Next client to disconnect.
+	char									client_id[];	// MQTT client id.
+};
+
+
+struct oauth2plugin_Revalidator {
+	struct oauth2plugin_Plugin*				plugin;			// Plugin state with sessions and configuration.
+	pthread_t								thread;			// Background thread.
+	bool									thread_started;	// Whether @p thread runs (broker thread only).
+	pthread_mutex_t							mutex;			// Protects stop, reconfigured and kicks.
+	pthread_cond_t							cond;			// Wakes the thread up to stop or to follow a reload.
+	bool									stop;			// Thread shall exit.
+	bool									reconfigured;	// A configuration was loaded since the thread last read it.
+	struct oauth2plugin_RevalidationKick*	kicks;			// Clients to disconnect on the next tick.
+	size_t									cursor;			// Next session bucket to walk (thread only).
+	atomic_ulong							revalidated;	// Tokens checked.
+	atomic_ulong							disconnected;	// Clients disconnected.
+};
+
+
+/**
+ * @brief Create the revalidator (no thread until oauth2plugin_configureRevalidator() enables it).
+ *
+ * @param plugin	Plugin state. Must outlive the revalidator.
+ * @return			Pointer to a new revalidator or NULL if allocation fails.
+ */
+struct oauth2plugin_Revalidator* oauth2plugin_initRevalidator(
+	struct oauth2plugin_Plugin* plugin
+);
+
+
+/**
+ * @brief Follow a newly published configuration.
+ *
+ * Starts the background thread the first time plugin_opt_revalidation_rate is
+ * set and wakes it up on later calls. The thread reads the rate and interval
+ * from the current configuration on every round and sleeps without waking up
+ * while revalidation is disabled. Must be called on the broker thread (plugin
+ * init and MOSQ_EVT_RELOAD).
+ *
+ * @param revalidator	Revalidator.
+ * @param options		Published configuration (default profile).
+ * @return				MOSQ_ERR_SUCCESS or MOSQ_ERR_UNKNOWN if the thread cannot be started.
+ */
+int oauth2plugin_configureRevalidator(
+	struct oauth2plugin_Revalidator* revalidator,
+	const struct oauth2plugin_Options* options
+);
+
+
+/**
+ * @brief Stop the background thread and release the revalidator.
+ *
+ * @param revalidator	Revalidator created by oauth2plugin_initRevalidator(). May be NULL.
+ */
+void oauth2plugin_freeRevalidator(
+	struct oauth2plugin_Revalidator* revalidator
+);
+
+
+/**
+ * @brief Disconnect clients whose tokens were found inactive.
+ *
+ * Must be called on the broker thread (MOSQ_EVT_TICK).
+ *
+ * @param revalidator	Revalidator. May be NULL.
+ */
+void oauth2plugin_applyRevalidation(
+	struct oauth2plugin_Revalidator* revalidator
+);
+
+
+/**
+ * @brief Background thread: revalidate due sessions within the budget.
+ *
+ * @param userdata	Revalidator.
+ * @return			NULL.
+ */
+static void* oauth2plugin_runRevalidator(
+	void* userdata
+);
+
+
+/**
+ * @brief Check one session and queue its client for disconnection if the token is no longer valid.
+ *
+ * Tokens past their "exp" or reported inactive are invalid; tokens reported
+ * inactive are announced to the other nodes of the cluster. If the endpoint
+ * cannot be reached the client is kept and checked again after the next
+ * interval.
+ *
+ * @param revalidator	Revalidator.
+ * @param options		Current configuration.
+ * @param session		Copy of the session.
+ * @param now			Current Unix time in seconds.
+ */
+static void oauth2plugin_revalidateSession(
+	struct oauth2plugin_Revalidator* revalidator,
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_SessionToken* session,
+	int64_t now
+);
+
+
+/**
+ * @brief Ask the verifier chain of a profile whether a token is still active.
+ *
+ * @param profile	Issuer profile.
+ * @param client_id	MQTT client id (for logging).
+ * @param token		Token.
+ * @param active	Output: true if the token is active.
+ * @return			MOSQ_ERR_SUCCESS or a mosquitto error code if the token could not be checked.
+ */
+static int oauth2plugin_introspectSessionToken(
+	struct oauth2plugin_Options* profile,
+	const char* client_id,
+	const char* token,
+	bool* active
+);
+
+#endif // OAUTH2PLUGIN_REVALIDATE_H
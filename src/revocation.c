@@ -0,0 +1,308 @@
+/**
+ * revocation.c
+ *
+ * Memory-mapped revocation filter for token hashes and JWT "jti" values
+ */
+
+#include "revocation.h"
+
+
+static const struct oauth2plugin_IndexFormat oauth2plugin_revocation_format = {
+	.name = "revocation list",
+	.entries_name = "revoked tokens",
+	.magic = OAUTH2PLUGIN_REVOCATION_MAGIC,
+	.version = OAUTH2PLUGIN_REVOCATION_VERSION,
+	.mode = 0644,
+	.size = sizeof(struct oauth2plugin_RevocationFilter),
+	.build = oauth2plugin_buildRevocationIndex,
+	.attach = oauth2plugin_attachRevocationIndex
+};
+
+
+struct oauth2plugin_RevocationList* oauth2plugin_initRevocationList(
+	const char* file_path,
+	const char* index_path,
+	long check_interval
+) {
+	if (!file_path) return NULL;
+
+	// Init
+	struct oauth2plugin_RevocationList* list = calloc(1, sizeof(*list));
+	if (!list) return NULL;
+	atomic_init(&list->references, 1);
+
+	// Load index and watch for changes
+	list->watcher = oauth2plugin_initIndexWatcher(&oauth2plugin_revocation_format, file_path, index_path, check_interval);
+	if (!list->watcher) {
+		free(list);
+		return NULL;
+	}
+
+	return list;
+}
+
+
+struct oauth2plugin_RevocationList* oauth2plugin_retainRevocationList(
+	struct oauth2plugin_RevocationList* list
+) {
+	atomic_fetch_add(&list->references, 1);
+	return list;
+}
+
+
+void oauth2plugin_freeRevocationList(
+	struct oauth2plugin_RevocationList* list
+) {
+	if (!list) return;
+	if (atomic_fetch_sub(&list->references, 1) != 1) return;
+	oauth2plugin_freeIndexWatcher(list->watcher);
+	free(list);
+}
+
+
+bool oauth2plugin_isTokenRevoked(
+	struct oauth2plugin_RevocationList* list,
+	const unsigned char token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE],
+	const char* token
+) {
+	if (!list || !token) return false;
+	const struct oauth2plugin_RevocationFilter* filter = (const struct oauth2plugin_RevocationFilter*) list->watcher->current;
+	if (filter->index.entry_count == 0) return false;
+
+	// Token hash
+	if (oauth2plugin_containsRevocationKey(filter, token_hash)) return true;
+
+	// jti of a JWT (only if the list contains jti entries)
+	if (!(filter->index.flags & OAUTH2PLUGIN_REVOCATION_FLAG_JTI)) return false;
+	cJSON* claims = oauth2plugin_parseJWTPayload(token);
+	if (!claims) return false;
+	cJSON* jti = cJSON_GetObjectItemCaseSensitive(claims, "jti");
+	bool revoked = false;
+	if (cJSON_IsString(jti) && jti->valuestring) {
+		size_t key_source_size = strlen(jti->valuestring) + 5;
+		char* key_source = malloc(key_source_size);
+		unsigned char key[OAUTH2PLUGIN_TOKEN_HASH_SIZE];
+		if (key_source) {
+			snprintf(key_source, key_source_size, "jti:%s", jti->valuestring);
+			revoked = oauth2plugin_hashToken(key_source, key) && oauth2plugin_containsRevocationKey(filter, key);
+			free(key_source);
+		}
+	}
+	cJSON_Delete(claims);
+	return revoked;
+}
+
+
+void oauth2plugin_publishRevocationFilter(
+	struct oauth2plugin_RevocationList* list
+) {
+	if (!list) return;
+	oauth2plugin_publishIndex(list->watcher);
+}
+
+
+static int oauth2plugin_parseRevocationFile(
+	const char* file_path,
+	unsigned char** keys,
+	size_t* keys_count,
+	uint32_t* flags
+) {
+	FILE* file = fopen(file_path, "r");
+	if (!file) return MOSQ_ERR_ERRNO;
+
+	size_t size = 1024;
+	size_t count = 0;
+	unsigned char* array = malloc(size * OAUTH2PLUGIN_TOKEN_HASH_SIZE);
+	char* line = NULL;
+	size_t line_size = 0;
+	ssize_t line_length;
+	while (array && (line_length = getline(&line, &line_size, file)) >= 0) {
+		// Trim whitespace and comments
+		char* start = line;
+		while (isspace((unsigned char) *start)) start++;
+		char* comment = strchr(start, '#');
+		if (comment) *comment = '\0';
+		char* end = start + strlen(start);
+		while (end > start && isspace((unsigned char) end[-1])) end--;
+		*end = '\0';
+		if (start == end) continue;
+
+		// Grow
+		if (count == size) {
+			size *= 2;
+			unsigned char* resized = realloc(array, size * OAUTH2PLUGIN_TOKEN_HASH_SIZE);
+			if (!resized) {
+				free(array);
+				array = NULL;
+				break;
+			}
+			array = resized;
+		}
+		unsigned char* key = array + count * OAUTH2PLUGIN_TOKEN_HASH_SIZE;
+
+		// Token hash (64 hex digits)
+		bool hash = (size_t) (end - start) == 2 * OAUTH2PLUGIN_TOKEN_HASH_SIZE;
+		for (char* c = start; hash && c < end; c++) hash = isxdigit((unsigned char) *c);
+		if (hash) {
+			for (size_t i = 0; i < OAUTH2PLUGIN_TOKEN_HASH_SIZE; i++) {
+				char byte[3] = { start[2 * i], start[2 * i + 1], '\0' };
+				key[i] = (unsigned char) strtoul(byte, NULL, 16);
+			}
+			count++;
+			continue;
+		}
+
+		// jti
+		const char* jti = strncmp(start, "jti:", 4) == 0 ? start + 4 : start;
+		size_t key_source_size = strlen(jti) + 5;
+		char* key_source = malloc(key_source_size);
+		if (!key_source) continue;
+		snprintf(key_source, key_source_size, "jti:%s", jti);
+		if (oauth2plugin_hashToken(key_source, key)) {
+			*flags |= OAUTH2PLUGIN_REVOCATION_FLAG_JTI;
+			count++;
+		}
+		free(key_source);
+	}
+	free(line);
+	fclose(file);
+	if (!array) return MOSQ_ERR_NOMEM;
+
+	// Sort and remove duplicates
+	qsort(array, count, OAUTH2PLUGIN_TOKEN_HASH_SIZE, oauth2plugin_compareRevocationKeys);
+	size_t unique = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (
+			unique > 0
+			&& memcmp(array + (unique - 1) * OAUTH2PLUGIN_TOKEN_HASH_SIZE, array + i * OAUTH2PLUGIN_TOKEN_HASH_SIZE, OAUTH2PLUGIN_TOKEN_HASH_SIZE) == 0
+		) continue;
+		if (unique != i) memcpy(array + unique * OAUTH2PLUGIN_TOKEN_HASH_SIZE, array + i * OAUTH2PLUGIN_TOKEN_HASH_SIZE, OAUTH2PLUGIN_TOKEN_HASH_SIZE);
+		unique++;
+	}
+
+	*keys = array;
+	*keys_count = unique;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static uint8_t* oauth2plugin_buildRevocationIndex(
+	const char* file_path,
+	const struct stat* source_stat,
+	size_t* index_size
+) {
+	unsigned char* keys = NULL;
+	size_t keys_count = 0;
+	uint32_t flags = 0;
+	if (oauth2plugin_parseRevocationFile(file_path, &keys, &keys_count, &flags) != MOSQ_ERR_SUCCESS) return NULL;
+
+	// Size
+	uint64_t block_count = (keys_count * OAUTH2PLUGIN_REVOCATION_BITS_PER_ENTRY + OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE * 8 - 1) / (OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE * 8);
+	if (block_count == 0) block_count = 1;
+	size_t size = OAUTH2PLUGIN_MAPPEDINDEX_HEADER_SIZE
+		+ block_count * OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE
+		+ keys_count * OAUTH2PLUGIN_TOKEN_HASH_SIZE;
+	uint8_t* index = calloc(1, size);
+	if (!index) {
+		free(keys);
+		return NULL;
+	}
+
+	// Header
+	oauth2plugin_writeIndexHeader(index, &oauth2plugin_revocation_format, flags, source_stat);
+	uint64_t counts[2] = { block_count, keys_count };
+	memcpy(index + 32, counts, sizeof(counts));
+
+	// Bloom filter
+	uint8_t* blocks = index + OAUTH2PLUGIN_MAPPEDINDEX_HEADER_SIZE;
+	for (size_t i = 0; i < keys_count; i++) {
+		uint64_t block = 0;
+		uint8_t mask[OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE];
+		oauth2plugin_getRevocationBits(keys + i * OAUTH2PLUGIN_TOKEN_HASH_SIZE, block_count, &block, mask);
+		for (size_t j = 0; j < OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE; j++)
+			blocks[block * OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE + j] |= mask[j];
+	}
+
+	// Backing table
+	if (keys_count > 0)
+		memcpy(blocks + block_count * OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE, keys, keys_count * OAUTH2PLUGIN_TOKEN_HASH_SIZE);
+	free(keys);
+
+	*index_size = size;
+	return index;
+}
+
+
+static bool oauth2plugin_attachRevocationIndex(
+	struct oauth2plugin_MappedIndex* index
+) {
+	struct oauth2plugin_RevocationFilter* filter = (struct oauth2plugin_RevocationFilter*) index;
+	uint64_t counts[2];
+	memcpy(counts, (const uint8_t*) index->map + 32, sizeof(counts));
+	filter->block_count = counts[0];
+	index->entry_count = counts[1];
+	if (
+		filter->block_count == 0
+		|| index->map_size != OAUTH2PLUGIN_MAPPEDINDEX_HEADER_SIZE
+			+ filter->block_count * OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE
+			+ index->entry_count * OAUTH2PLUGIN_TOKEN_HASH_SIZE
+	) return false;
+	filter->blocks = (const uint8_t*) index->map + OAUTH2PLUGIN_MAPPEDINDEX_HEADER_SIZE;
+	filter->entries = filter->blocks + filter->block_count * OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE;
+	return true;
+}
+
+
+static bool oauth2plugin_containsRevocationKey(
+	const struct oauth2plugin_RevocationFilter* filter,
+	const unsigned char* key
+) {
+	// Bloom filter: all bits of the key are in one cache line
+	uint64_t block = 0;
+	uint8_t mask[OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE];
+	oauth2plugin_getRevocationBits(key, filter->block_count, &block, mask);
+	const uint8_t* bits = filter->blocks + block * OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE;
+	for (size_t i = 0; i < OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE; i++) {
+		if ((bits[i] & mask[i]) != mask[i]) return false;
+	}
+
+	// Backing table: binary search
+	size_t low = 0;
+	size_t high = filter->index.entry_count;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		int comparison = memcmp(filter->entries + middle * OAUTH2PLUGIN_TOKEN_HASH_SIZE, key, OAUTH2PLUGIN_TOKEN_HASH_SIZE);
+		if (comparison == 0) return true;
+		if (comparison < 0) low = middle + 1;
+		else high = middle;
+	}
+	return false;
+}
+
+
+static void oauth2plugin_getRevocationBits(
+	const unsigned char* key,
+	uint64_t block_count,
+	uint64_t* block,
+	uint8_t mask[OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE]
+) {
+	// Keys are SHA-256 outputs, so their bytes can be used as independent hashes
+	uint64_t h1, h2, h3;
+	memcpy(&h1, key, 8);
+	memcpy(&h2, key + 8, 8);
+	memcpy(&h3, key + 16, 8);
+	*block = h1 % block_count;
+	memset(mask, 0, OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE);
+	for (uint64_t i = 0; i < OAUTH2PLUGIN_REVOCATION_HASHES; i++) {
+		uint64_t bit = (h2 + i * (h3 | 1)) % (OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE * 8);
+		mask[bit / 8] |= (uint8_t) (1u << (bit % 8));
+	}
+}
+
+
+static int oauth2plugin_compareRevocationKeys(
+	const void* a,
+	const void* b
+) {
+	return memcmp(a, b, OAUTH2PLUGIN_TOKEN_HASH_SIZE);
+}
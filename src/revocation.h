@@ -0,0 +1,222 @@
+/**
+ * revocation.h
+ *
+ * Memory-mapped revocation filter for token hashes and JWT "jti" values
+ *
+ * Source file (one entry per line, '#' starts a comment):
+ *   <64 hex digits>		SHA-256 of a revoked token (e.g. "printf %s "$TOKEN" | sha256sum")
+ *   jti:<value>			"jti" claim of a revoked JWT
+ *   <other value>			Same as jti:<value>
+ *
+ * Compiled index (mapped read-only, all integers little endian):
+ *   Header:	"O2PREVOK", u32 version, u32 flags, u64 source size,
+ *				u64 source mtime (nanoseconds), u64 block count, u64 entry count,
+ *				padding to 64 bytes
+ *   Blocks:	Blocked Bloom filter, one 64 byte cache line per key
+ *   Entries:	Sorted 32 byte keys (exact backing table)
+ *
+ * Keys are SHA-256(token) or SHA-256("jti:" + jti).
+ */
+
+#ifndef OAUTH2PLUGIN_REVOCATION_H
+#define OAUTH2PLUGIN_REVOCATION_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include "cJSON.h"
+
+#include "mappedindex.h"
+#include "tools.h"
+#include "jwt.h"
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_REVOCATION_MAGIC "O2PREVOK"
+#define OAUTH2PLUGIN_REVOCATION_VERSION 1
+#define OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE 64			// Bytes per Bloom block (one cache line).
+#define OAUTH2PLUGIN_REVOCATION_BITS_PER_ENTRY 16		// Bloom filter size per entry (false positive rate < 0.1%).
+#define OAUTH2PLUGIN_REVOCATION_HASHES 8				// Bits set per key within its block.
+#define OAUTH2PLUGIN_REVOCATION_FLAG_JTI 0x01			// Index contains jti entries.
+
+
+struct oauth2plugin_RevocationFilter {
+	struct oauth2plugin_MappedIndex	index;			// Mapped index (flags are OAUTH2PLUGIN_REVOCATION_FLAG_*).
+	const uint8_t*					blocks;			// Bloom filter blocks.
+	uint64_t						block_count;	// Number of blocks.
+	const uint8_t*					entries;		// Sorted keys.
+};
+
+
+struct oauth2plugin_RevocationList {
+	struct oauth2plugin_IndexWatcher*	watcher;	// Compiled index and watcher of the source file.
+	atomic_long							references;	// Configurations using this list.
+};
+
+
+/**
+ * @brief Load a revocation list and start watching its file.
+ *
+ * The source file is compiled into @p index_path and mapped read-only (see
+ * mappedindex.h).
+ *
+ * @param file_path			Source file.
+ * @param index_path		Compiled index file or NULL for "<file_path>.idx".
+ * @param check_interval	Seconds between checks for changes of the source file (0 = never).
+ * @return					Pointer to a new revocation list or NULL on failure.
+ */
+struct oauth2plugin_RevocationList* oauth2plugin_initRevocationList(
+	const char* file_path,
+	const char* index_path,
+	long check_interval
+);
+
+
+/**
+ * @brief Take an additional reference to a revocation list.
+ *
+ * @param list	Revocation list.
+ * @return		@p list.
+ */
+struct oauth2plugin_RevocationList* oauth2plugin_retainRevocationList(
+	struct oauth2plugin_RevocationList* list
+);
+
+
+/**
+ * @brief Release a reference; the watcher is stopped and the filters are unmapped with the last one.
+ *
+ * @param list	Revocation list created by oauth2plugin_initRevocationList(). May be NULL.
+ */
+void oauth2plugin_freeRevocationList(
+	struct oauth2plugin_RevocationList* list
+);
+
+
+/**
+ * @brief Check whether a token is revoked.
+ *
+ * A negative answer costs one Bloom block (one cache line); the sorted backing
+ * table is only searched if the Bloom filter matches. The unverified JWT payload
+ * is only parsed if the list contains jti entries. Must be called from the
+ * broker thread (the filter is replaced there, see oauth2plugin_publishIndex()).
+ *
+ * @param list			Revocation list. May be NULL.
+ * @param token_hash	SHA-256 of @p token (see oauth2plugin_hashToken()).
+ * @param token			Token.
+ * @return				true if the token or its jti is on the list.
+ */
+bool oauth2plugin_isTokenRevoked(
+	struct oauth2plugin_RevocationList* list,
+	const unsigned char token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE],
+	const char* token
+);
+
+
+/**
+ * @brief Replace the current filter with a rebuilt one, if any.
+ *
+ * Must be called from the broker thread (MOSQ_EVT_TICK), so no authentication
+ * can still be reading the old filter when it is unmapped.
+ *
+ * @param list	Revocation list. May be NULL.
+ */
+void oauth2plugin_publishRevocationFilter(
+	struct oauth2plugin_RevocationList* list
+);
+
+
+/**
+ * @brief Parse a source file into sorted, unique keys.
+ *
+ * @param file_path		Source file.
+ * @param keys			Output: newly allocated array of 32 byte keys. Caller is responsible for freeing it.
+ * @param keys_count	Output: number of keys.
+ * @param flags			Output: OAUTH2PLUGIN_REVOCATION_FLAG_* describing the keys.
+ * @return				MOSQ_ERR_SUCCESS on success or a mosquitto error code on failure.
+ */
+static int oauth2plugin_parseRevocationFile(
+	const char* file_path,
+	unsigned char** keys,
+	size_t* keys_count,
+	uint32_t* flags
+);
+
+
+/**
+ * @brief Compile a source file into an index in memory (format callback, see mappedindex.h).
+ *
+ * @param file_path		Source file.
+ * @param source_stat	Status of the source file.
+ * @param index_size	Output: size of the index in bytes.
+ * @return				Newly allocated index or NULL on failure. Caller is responsible for freeing it.
+ */
+static uint8_t* oauth2plugin_buildRevocationIndex(
+	const char* file_path,
+	const struct stat* source_stat,
+	size_t* index_size
+);
+
+
+/**
+ * @brief Point the fields of a filter into its mapped index after checking the header (format callback).
+ *
+ * @param index		Filter with the common header fields set.
+ * @return			true if the index is valid.
+ */
+static bool oauth2plugin_attachRevocationIndex(
+	struct oauth2plugin_MappedIndex* index
+);
+
+
+/**
+ * @brief Check a key against the Bloom filter and the backing table.
+ *
+ * @param filter	Filter.
+ * @param key		32 byte key.
+ * @return			true if the key is in the filter.
+ */
+static bool oauth2plugin_containsRevocationKey(
+	const struct oauth2plugin_RevocationFilter* filter,
+	const unsigned char* key
+);
+
+
+/**
+ * @brief Compute the Bloom block and bit mask of a key.
+ *
+ * @param key			32 byte key (uniformly distributed SHA-256 output).
+ * @param block_count	Number of blocks.
+ * @param block			Output: block index.
+ * @param mask			Output: 64 byte bit mask to test or set within the block.
+ */
+static void oauth2plugin_getRevocationBits(
+	const unsigned char* key,
+	uint64_t block_count,
+	uint64_t* block,
+	uint8_t mask[OAUTH2PLUGIN_REVOCATION_BLOCK_SIZE]
+);
+
+
+/**
+ * @brief qsort() comparator for 32 byte keys.
+ *
+ * @param a		First key.
+ * @param b		Second key.
+ * @return		memcmp() result.
+ */
+static int oauth2plugin_compareRevocationKeys(
+	const void* a,
+	const void* b
+);
+
+#endif // OAUTH2PLUGIN_REVOCATION_H
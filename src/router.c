@@ -0,0 +1,232 @@
+/**
+ * router.c
+ *
+ * Route clients to issuer profiles using precompiled hash tables
+ */
+
+#include "router.h"
+
+
+struct oauth2plugin_Router* oauth2plugin_initRouter(
+	struct oauth2plugin_Options* const* profiles,
+	size_t profiles_count
+) {
+	struct oauth2plugin_Router* router = calloc(1, sizeof(*router));
+	if (!router) return NULL;
+
+	// Fill tables
+	for (size_t i = 0; i < profiles_count; i++) {
+		if (
+			oauth2plugin_insertRouterList(&router->issuers, profiles[i]->match_issuer, profiles[i], "issuer")
+			|| oauth2plugin_insertRouterList(&router->listeners, profiles[i]->match_listener, profiles[i], "listener")
+			|| oauth2plugin_insertRouterList(&router->username_prefixes, profiles[i]->match_username_prefix, profiles[i], "username prefix")
+		) {
+			oauth2plugin_freeRouter(router);
+			return NULL;
+		}
+	}
+
+	// Collect distinct username prefix lengths (longest first)
+	if (router->username_prefixes.count > 0) {
+		router->username_prefix_lengths = calloc(router->username_prefixes.count, sizeof(size_t));
+		if (!router->username_prefix_lengths) {
+			oauth2plugin_freeRouter(router);
+			return NULL;
+		}
+		for (size_t i = 0; i < router->username_prefixes.capacity; i++) {
+			const struct oauth2plugin_RouterEntry* entry = &router->username_prefixes.entries[i];
+			if (!entry->key) continue;
+			size_t position = 0;
+			while (
+				position < router->username_prefix_lengths_count
+				&& router->username_prefix_lengths[position] > entry->key_length
+			) position++;
+			if (
+				position < router->username_prefix_lengths_count
+				&& router->username_prefix_lengths[position] == entry->key_length
+			) continue;
+			memmove(
+				&router->username_prefix_lengths[position + 1],
+				&router->username_prefix_lengths[position],
+				(router->username_prefix_lengths_count - position) * sizeof(size_t)
+			);
+			router->username_prefix_lengths[position] = entry->key_length;
+			router->username_prefix_lengths_count++;
+		}
+	}
+
+	return router;
+}
+
+
+void oauth2plugin_freeRouter(
+	struct oauth2plugin_Router* router
+) {
+	if (!router) return;
+	oauth2plugin_freeRouterTable(&router->issuers);
+	oauth2plugin_freeRouterTable(&router->listeners);
+	oauth2plugin_freeRouterTable(&router->username_prefixes);
+	free(router->username_prefix_lengths);
+	free(router);
+}
+
+
+struct oauth2plugin_Options* oauth2plugin_routeClient(
+	const struct oauth2plugin_Router* router,
+	int listener_port,
+	const char* username,
+	const char* token
+) {
+	if (!router) return NULL;
+	struct oauth2plugin_Options* profile = NULL;
+
+	// 1. JWT "iss" claim (only decoded if any profile matches on it)
+	if (router->issuers.count > 0 && token) {
+		cJSON* claims = oauth2plugin_parseJWTPayload(token);
+		cJSON* issuer = cJSON_GetObjectItemCaseSensitive(claims, "iss");
+		if (cJSON_IsString(issuer))
+			profile = oauth2plugin_findRouterEntry(&router->issuers, issuer->valuestring, strlen(issuer->valuestring));
+		cJSON_Delete(claims);
+		if (profile) return profile;
+	}
+
+	// 2. Listener port
+	if (router->listeners.count > 0 && listener_port > 0) {
+		char port[16];
+		int port_length = snprintf(port, sizeof(port), "%d", listener_port);
+		profile = oauth2plugin_findRouterEntry(&router->listeners, port, (size_t) port_length);
+		if (profile) return profile;
+	}
+
+	// 3. Longest username prefix (one lookup per distinct prefix length)
+	if (router->username_prefix_lengths_count > 0 && username) {
+		size_t username_length = strlen(username);
+		for (size_t i = 0; i < router->username_prefix_lengths_count; i++) {
+			if (router->username_prefix_lengths[i] > username_length) continue;
+			profile = oauth2plugin_findRouterEntry(&router->username_prefixes, username, router->username_prefix_lengths[i]);
+			if (profile) return profile;
+		}
+	}
+
+	return NULL;
+}
+
+
+static uint64_t oauth2plugin_hashRouterKey(
+	const char* key,
+	size_t key_length
+) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < key_length; i++) {
+		hash ^= (unsigned char) key[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+
+static int oauth2plugin_insertRouterEntry(
+	struct oauth2plugin_RouterTable* table,
+	const char* key,
+	size_t key_length,
+	struct oauth2plugin_Options* profile
+) {
+	// Duplicate?
+	if (oauth2plugin_findRouterEntry(table, key, key_length)) return MOSQ_ERR_INVAL;
+
+	// Grow table (load factor <= 0.5)
+	if ((table->count + 1) * 2 > table->capacity) {
+		size_t new_capacity = table->capacity ? table->capacity * 2 : 16;
+		struct oauth2plugin_RouterEntry* new_entries = calloc(new_capacity, sizeof(*new_entries));
+		if (!new_entries) return MOSQ_ERR_NOMEM;
+		for (size_t i = 0; i < table->capacity; i++) {
+			if (!table->entries[i].key) continue;
+			size_t slot = table->entries[i].hash & (new_capacity - 1);
+			while (new_entries[slot].key) slot = (slot + 1) & (new_capacity - 1);
+			new_entries[slot] = table->entries[i];
+		}
+		free(table->entries);
+		table->entries = new_entries;
+		table->capacity = new_capacity;
+	}
+
+	// Insert
+	uint64_t hash = oauth2plugin_hashRouterKey(key, key_length);
+	size_t slot = hash & (table->capacity - 1);
+	while (table->entries[slot].key) slot = (slot + 1) & (table->capacity - 1);
+	table->entries[slot].key = strndup(key, key_length);
+	if (!table->entries[slot].key) return MOSQ_ERR_NOMEM;
+	table->entries[slot].key_length = key_length;
+	table->entries[slot].hash = hash;
+	table->entries[slot].profile = profile;
+	table->count++;
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static struct oauth2plugin_Options* oauth2plugin_findRouterEntry(
+	const struct oauth2plugin_RouterTable* table,
+	const char* key,
+	size_t key_length
+) {
+	if (table->count == 0) return NULL;
+
+	uint64_t hash = oauth2plugin_hashRouterKey(key, key_length);
+	for (
+		size_t slot = hash & (table->capacity - 1);
+		table->entries[slot].key;
+		slot = (slot + 1) & (table->capacity - 1)
+	) {
+		const struct oauth2plugin_RouterEntry* entry = &table->entries[slot];
+		if (
+			entry->hash == hash
+			&& entry->key_length == key_length
+			&& memcmp(entry->key, key, key_length) == 0
+		) return entry->profile;
+	}
+
+	return NULL;
+}
+
+
+static int oauth2plugin_insertRouterList(
+	struct oauth2plugin_RouterTable* table,
+	const char* list,
+	struct oauth2plugin_Options* profile,
+	const char* matcher_name
+) {
+	if (!list) return MOSQ_ERR_SUCCESS;
+
+	const char* item = list;
+	while (*item) {
+		// Get next item, trim spaces
+		size_t item_length = strcspn(item, ",");
+		const char* next = item[item_length] ? item + item_length + 1 : item + item_length;
+		while (item_length > 0 && *item == ' ') { item++; item_length--; }
+		while (item_length > 0 && item[item_length - 1] == ' ') item_length--;
+
+		// Insert
+		if (item_length > 0) {
+			int insert_error = oauth2plugin_insertRouterEntry(table, item, item_length, profile);
+			if (insert_error == MOSQ_ERR_NOMEM) return insert_error;
+			if (insert_error == MOSQ_ERR_INVAL)
+				OAUTH2PLUGIN_LOG_WARNING("Profile '%s': %s '%.*s' is already used by another profile. Ignoring.", profile->name, matcher_name, (int) item_length, item);
+		}
+		item = next;
+	}
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void oauth2plugin_freeRouterTable(
+	struct oauth2plugin_RouterTable* table
+) {
+	for (size_t i = 0; i < table->capacity; i++)
+		free(table->entries[i].key);
+	free(table->entries);
+	table->entries = NULL;
+	table->capacity = 0;
+	table->count = 0;
+}
@@ -0,0 +1,156 @@
+/**
+ * router.h
+ *
+ * Route clients to issuer profiles using precompiled hash tables
+ */
+
+#ifndef OAUTH2PLUGIN_ROUTER_H
+#define OAUTH2PLUGIN_ROUTER_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include "cJSON.h"
+
+#include "options.h"
+#include "jwt.h"
+#include "log.h"
+
+
+// Listener routing needs mosquitto_client_port(), which was added in Mosquitto 2.1
+#define OAUTH2PLUGIN_ROUTER_LISTENER_SUPPORTED (LIBMOSQUITTO_MAJOR > 2 || (LIBMOSQUITTO_MAJOR == 2 && LIBMOSQUITTO_MINOR >= 1))
+
+
+struct oauth2plugin_RouterEntry {
+	char*							key;			// Matched value (NULL for empty slots).
+	size_t							key_length;		// Length of @p key.
+	uint64_t						hash;			// FNV-1a hash of @p key.
+	struct oauth2plugin_Options*	profile;		// Profile selected by this entry.
+};
+
+
+struct oauth2plugin_RouterTable {
+	struct oauth2plugin_RouterEntry*	entries;	// Open addressing table, capacity is a power of two.
+	size_t								capacity;	// Number of slots.
+	size_t								count;		// Number of used slots.
+};
+
+
+struct oauth2plugin_Router {
+	struct oauth2plugin_RouterTable		issuers;					// JWT "iss" claim -> profile.
+	struct oauth2plugin_RouterTable		listeners;					// Listener port -> profile.
+	struct oauth2plugin_RouterTable		username_prefixes;			// Username prefix -> profile.
+	size_t*								username_prefix_lengths;	// Distinct prefix lengths, longest first.
+	size_t								username_prefix_lengths_count;
+};
+
+
+/**
+ * @brief Compile the matchers of all profiles into lookup tables.
+ *
+ * Each profile may define comma separated lists in "match_issuer",
+ * "match_listener" and "match_username_prefix". A value used by more than one
+ * profile is assigned to the first profile only.
+ *
+ * @param profiles			Array of profiles.
+ * @param profiles_count	Number of entries in @p profiles.
+ * @return					Pointer to a new router or NULL if allocation fails.
+ */
+struct oauth2plugin_Router* oauth2plugin_initRouter(
+	struct oauth2plugin_Options* const* profiles,
+	size_t profiles_count
+);
+
+
+/**
+ * @brief Release a router.
+ *
+ * @param router	Router created by oauth2plugin_initRouter(). May be NULL.
+ */
+void oauth2plugin_freeRouter(
+	struct oauth2plugin_Router* router
+);
+
+
+/**
+ * @brief Select the profile for a connecting client.
+ *
+ * Matchers are evaluated in the order JWT "iss" claim, listener port and
+ * longest username prefix. Each step is a constant number of hash lookups, so
+ * the cost does not grow with the number of profiles.
+ *
+ * @param router		Router. May be NULL.
+ * @param listener_port	Port of the listener the client connected to or 0 if unknown.
+ * @param username		MQTT username. May be NULL.
+ * @param token			MQTT password (token). May be NULL.
+ * @return				Matching profile or NULL if no profile matches.
+ */
+struct oauth2plugin_Options* oauth2plugin_routeClient(
+	const struct oauth2plugin_Router* router,
+	int listener_port,
+	const char* username,
+	const char* token
+);
+
+
+/**
+ * @brief Calculate the 64 bit FNV-1a hash of a byte string.
+ */
+static uint64_t oauth2plugin_hashRouterKey(
+	const char* key,
+	size_t key_length
+);
+
+
+/**
+ * @brief Insert a key into a router table, growing the table if required.
+ *
+ * @return	MOSQ_ERR_SUCCESS on success, MOSQ_ERR_INVAL if the key already exists or MOSQ_ERR_NOMEM.
+ */
+static int oauth2plugin_insertRouterEntry(
+	struct oauth2plugin_RouterTable* table,
+	const char* key,
+	size_t key_length,
+	struct oauth2plugin_Options* profile
+);
+
+
+/**
+ * @brief Look up a key in a router table.
+ *
+ * @return	Profile stored for @p key or NULL.
+ */
+static struct oauth2plugin_Options* oauth2plugin_findRouterEntry(
+	const struct oauth2plugin_RouterTable* table,
+	const char* key,
+	size_t key_length
+);
+
+
+/**
+ * @brief Insert every element of a comma separated list into a router table.
+ *
+ * @return	MOSQ_ERR_SUCCESS or MOSQ_ERR_NOMEM.
+ */
+static int oauth2plugin_insertRouterList(
+	struct oauth2plugin_RouterTable* table,
+	const char* list,
+	struct oauth2plugin_Options* profile,
+	const char* matcher_name
+);
+
+
+/**
+ * @brief Release the entries of a router table.
+ */
+static void oauth2plugin_freeRouterTable(
+	struct oauth2plugin_RouterTable* table
+);
+
+#endif // OAUTH2PLUGIN_ROUTER_H
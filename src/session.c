@@ -0,0 +1,290 @@
+/**
+ * session.c
+ *
+ * Records of authenticated clients with interned claim values
+ */
+
+#include "session.h"
+
+
+struct oauth2plugin_SessionTable* oauth2plugin_initSessionTable(
+	struct oauth2plugin_StringPool* strings
+) {
+	struct oauth2plugin_SessionTable* table = calloc(1, sizeof(*table));
+	if (!table) return NULL;
+	table->strings = strings;
+	table->capacity = OAUTH2PLUGIN_SESSION_INITIAL_CAPACITY;
+	table->buckets = calloc(table->capacity, sizeof(*table->buckets));
+	if (!table->buckets) {
+		free(table);
+		return NULL;
+	}
+	pthread_mutex_init(&table->mutex, NULL);
+	return table;
+}
+
+
+void oauth2plugin_freeSessionTable(
+	struct oauth2plugin_SessionTable* table
+) {
+	if (!table) return;
+	for (size_t i = 0; i < table->capacity; i++) {
+		struct oauth2plugin_Session* session = table->buckets[i];
+		while (session) {
+			struct oauth2plugin_Session* next = session->next;
+			oauth2plugin_freeSession(table, session);
+			session = next;
+		}
+	}
+	free(table->buckets);
+	pthread_mutex_destroy(&table->mutex);
+	free(table);
+}
+
+
+struct oauth2plugin_Session* oauth2plugin_createSession(
+	const struct mosquitto* client,
+	const char* client_id
+) {
+	struct oauth2plugin_Session* session = calloc(1, sizeof(*session) + oauth2plugin_oidc_template_placeholders_count * sizeof(session->claims[0]));
+	if (!session) return NULL;
+	session->client = client;
+	if (client_id) {
+		session->client_id = strdup(client_id);
+		if (!session->client_id) {
+			free(session);
+			return NULL;
+		}
+	}
+	return session;
+}
+
+
+void oauth2plugin_putSession(
+	struct oauth2plugin_SessionTable* table,
+	struct oauth2plugin_Session* session
+) {
+	pthread_mutex_lock(&table->mutex);
+
+	// Replace session of the same client
+	struct oauth2plugin_Session* previous = NULL;
+	struct oauth2plugin_Session** link = &table->buckets[oauth2plugin_getSessionBucket(table, session->client)];
+	while (*link && (*link)->client != session->client) link = &(*link)->next;
+	if (*link) {
+		previous = *link;
+		*link = previous->next;
+		table->count--;
+	}
+
+	// Insert
+	if (table->count >= table->capacity) oauth2plugin_growSessionTable(table);
+	link = &table->buckets[oauth2plugin_getSessionBucket(table, session->client)];
+	session->next = *link;
+	*link = session;
+	table->count++;
+
+	pthread_mutex_unlock(&table->mutex);
+	oauth2plugin_freeSession(table, previous);
+}
+
+
+bool oauth2plugin_removeSession(
+	struct oauth2plugin_SessionTable* table,
+	const struct mosquitto* client
+) {
+	pthread_mutex_lock(&table->mutex);
+	struct oauth2plugin_Session* session = NULL;
+	struct oauth2plugin_Session** link = &table->buckets[oauth2plugin_getSessionBucket(table, client)];
+	while (*link && (*link)->client != client) link = &(*link)->next;
+	if (*link) {
+		session = *link;
+		*link = session->next;
+		table->count--;
+	}
+	pthread_mutex_unlock(&table->mutex);
+
+	oauth2plugin_freeSession(table, session);
+	return session != NULL;
+}
+
+
+void oauth2plugin_freeSession(
+	struct oauth2plugin_SessionTable* table,
+	struct oauth2plugin_Session* session
+) {
+	if (!session) return;
+	for (size_t i = 0; i < oauth2plugin_oidc_template_placeholders_count; i++)
+		oauth2plugin_releaseString(table->strings, session->claims[i]);
+	oauth2plugin_releaseString(table->strings, session->profile);
+	free(session->client_id);
+	free(session->token);
+	free(session);
+}
+
+
+size_t oauth2plugin_collectSessionTokens(
+	struct oauth2plugin_SessionTable* table,
+	size_t* cursor,
+	int64_t validated_before,
+	int64_t now,
+	struct oauth2plugin_SessionToken* tokens,
+	size_t count
+) {
+	size_t collected = 0;
+	pthread_mutex_lock(&table->mutex);
+	for (size_t visited = 0; visited < table->capacity && collected < count; visited++) {
+		size_t bucket = *cursor & (table->capacity - 1);
+		for (
+			struct oauth2plugin_Session* session = table->buckets[bucket];
+			session && collected < count;
+			session = session->next
+		) {
+			if (!session->token || !session->client_id || session->validated_at > validated_before) continue;
+			struct oauth2plugin_SessionToken* copy = &tokens[collected];
+			copy->client_id = strdup(session->client_id);
+			copy->token = strdup(session->token);
+			if (!copy->client_id || !copy->token) {
+				free(copy->client_id);
+				free(copy->token);
+				continue;
+			}
+			copy->client = session->client;
+			copy->profile = oauth2plugin_retainString(session->profile);
+			copy->expires_at = session->expires_at;
+			session->validated_at = now;
+			collected++;
+		}
+
+		// Stay at a bucket that was not finished
+		if (collected < count) *cursor = bucket + 1;
+	}
+	pthread_mutex_unlock(&table->mutex);
+	return collected;
+}
+
+
+void oauth2plugin_freeSessionTokens(
+	struct oauth2plugin_SessionTable* table,
+	struct oauth2plugin_SessionToken* tokens,
+	size_t count
+) {
+	for (size_t i = 0; i < count; i++) {
+		free(tokens[i].client_id);
+		free(tokens[i].token);
+		oauth2plugin_releaseString(table->strings, tokens[i].profile);
+	}
+}
+
+
+bool oauth2plugin_dropSessionToken(
+	struct oauth2plugin_SessionTable* table,
+	const struct mosquitto* client,
+	const char* token
+) {
+	pthread_mutex_lock(&table->mutex);
+	struct oauth2plugin_Session* session = table->buckets[oauth2plugin_getSessionBucket(table, client)];
+	while (session && session->client != client) session = session->next;
+	bool found = session && session->token && strcmp(session->token, token) == 0;
+	if (found) {
+		free(session->token);
+		session->token = NULL;
+	}
+	pthread_mutex_unlock(&table->mutex);
+	return found;
+}
+
+
+char** oauth2plugin_findSessionClients(
+	struct oauth2plugin_SessionTable* table,
+	const unsigned char* token_hash,
+	size_t claim,
+	const char* value,
+	size_t* count
+) {
+	*count = 0;
+	if (!token_hash && (!value || claim >= oauth2plugin_oidc_template_placeholders_count)) return NULL;
+
+	// Claim values of sessions are interned: a value missing in the pool matches no session, otherwise compare pointers
+	const char* interned_value = NULL;
+	if (!token_hash) {
+		interned_value = oauth2plugin_findString(table->strings, value);
+		if (!interned_value) return NULL;
+	}
+
+	char** client_ids = NULL;
+	size_t capacity = 0;
+	pthread_mutex_lock(&table->mutex);
+	for (size_t i = 0; i < table->capacity; i++) {
+		for (struct oauth2plugin_Session* session = table->buckets[i]; session; session = session->next) {
+			bool match = token_hash
+				? session->hashed && memcmp(session->token_hash, token_hash, OAUTH2PLUGIN_TOKEN_HASH_SIZE) == 0
+				: session->claims[claim] == interned_value;
+			if (!match || !session->client_id) continue;
+			if (*count == capacity) {
+				capacity = capacity ? capacity * 2 : 8;
+				char** resized = realloc(client_ids, capacity * sizeof(*client_ids));
+				if (!resized) break;
+				client_ids = resized;
+			}
+			client_ids[*count] = strdup(session->client_id);
+			if (!client_ids[*count]) continue;
+			(*count)++;
+			free(session->token);
+			session->token = NULL;
+		}
+	}
+	pthread_mutex_unlock(&table->mutex);
+	oauth2plugin_releaseString(table->strings, interned_value);
+	return client_ids;
+}
+
+
+void oauth2plugin_resetSessionValidation(
+	struct oauth2plugin_SessionTable* table
+) {
+	pthread_mutex_lock(&table->mutex);
+	for (size_t i = 0; i < table->capacity; i++) {
+		for (struct oauth2plugin_Session* session = table->buckets[i]; session; session = session->next)
+			session->validated_at = 0;
+	}
+	pthread_mutex_unlock(&table->mutex);
+}
+
+
+static size_t oauth2plugin_getSessionBucket(
+	const struct oauth2plugin_SessionTable* table,
+	const struct mosquitto* client
+) {
+	// Mix the pointer bits (allocations are aligned, the low bits are always zero)
+	uint64_t hash = (uint64_t) (uintptr_t) client;
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	return (size_t) (hash & (table->capacity - 1));
+}
+
+
+static void oauth2plugin_growSessionTable(
+	struct oauth2plugin_SessionTable* table
+) {
+	size_t capacity = table->capacity * 2;
+	struct oauth2plugin_Session** buckets = calloc(capacity, sizeof(*buckets));
+	if (!buckets) return; // Keep longer chains
+
+	// Rehash
+	struct oauth2plugin_Session** previous_buckets = table->buckets;
+	size_t previous_capacity = table->capacity;
+	table->buckets = buckets;
+	table->capacity = capacity;
+	for (size_t i = 0; i < previous_capacity; i++) {
+		struct oauth2plugin_Session* session = previous_buckets[i];
+		while (session) {
+			struct oauth2plugin_Session* next = session->next;
+			size_t bucket = oauth2plugin_getSessionBucket(table, session->client);
+			session->next = buckets[bucket];
+			buckets[bucket] = session;
+			session = next;
+		}
+	}
+	free(previous_buckets);
+}
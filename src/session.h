@@ -0,0 +1,247 @@
+/**
+ * session.h
+ *
+ * Records of authenticated clients with interned claim values
+ */
+
+#ifndef OAUTH2PLUGIN_SESSION_H
+#define OAUTH2PLUGIN_SESSION_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+
+#include "options.h"
+#include "intern.h"
+#include "tools.h"
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_SESSION_INITIAL_CAPACITY 1024
+
+
+struct oauth2plugin_Session {
+	struct oauth2plugin_Session*	next;				// Next session in the same bucket.
+	const struct mosquitto*			client;				// Key: broker client (valid until MOSQ_EVT_DISCONNECT).
+	char*							client_id;			// MQTT client id.
+	const char*						profile;			// Interned name of the issuer profile (NULL = default profile).
+	int64_t							authenticated_at;	// Unix time of the authentication in seconds.
+	int64_t							expires_at;			// "exp" of the introspection response (0 = unknown).
+	int64_t							validated_at;		// Unix time of the last (re)validation in seconds.
+	char*							token;				// Token for background revalidation (NULL = not kept).
+	bool							hashed;				// token_hash is set.
+	unsigned char					token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE];	// SHA-256 of the token (cluster invalidation).
+	const char*						claims[];			// Interned claim values indexed like oauth2plugin_template_placeholders (NULL = missing).
+};
+
+
+struct oauth2plugin_SessionTable {
+	pthread_mutex_t						mutex;			// Protects the buckets.
+	struct oauth2plugin_StringPool*		strings;		// Pool of the interned strings of all sessions.
+	struct oauth2plugin_Session**		buckets;		// Chained hash table, capacity is a power of two.
+	size_t								capacity;		// Number of buckets.
+	size_t								count;			// Number of sessions.
+};
+
+
+struct oauth2plugin_SessionToken {
+	const struct mosquitto*			client;				// Broker client.
+	char*							client_id;			// MQTT client id (used to disconnect the client).
+	char*							token;				// Token of the session.
+	const char*						profile;			// Interned name of the issuer profile (retained).
+	int64_t							expires_at;			// "exp" of the introspection response (0 = unknown).
+};
+
+
+/**
+ * @brief Create an empty session table.
+ *
+ * @param strings	Pool for interned claim values and profile names.
+ * @return			Pointer to a new table or NULL if allocation fails.
+ */
+struct oauth2plugin_SessionTable* oauth2plugin_initSessionTable(
+	struct oauth2plugin_StringPool* strings
+);
+
+
+/**
+ * @brief Release a session table and all of its sessions.
+ *
+ * @param table	Table created by oauth2plugin_initSessionTable(). May be NULL.
+ */
+void oauth2plugin_freeSessionTable(
+	struct oauth2plugin_SessionTable* table
+);
+
+
+/**
+ * @brief Allocate an empty session for a client.
+ *
+ * The session is not added to the table; fill it and pass it to
+ * oauth2plugin_putSession() or release it with oauth2plugin_freeSession().
+ *
+ * @param client	Broker client.
+ * @param client_id	MQTT client id. May be NULL.
+ * @return			Newly allocated session or NULL if allocation fails.
+ */
+struct oauth2plugin_Session* oauth2plugin_createSession(
+	const struct mosquitto* client,
+	const char* client_id
+);
+
+
+/**
+ * @brief Add a session, replacing a previous session of the same client.
+ *
+ * @param table		Session table.
+ * @param session	Session created by oauth2plugin_createSession(). Owned by the table afterwards.
+ */
+void oauth2plugin_putSession(
+	struct oauth2plugin_SessionTable* table,
+	struct oauth2plugin_Session* session
+);
+
+
+/**
+ * @brief Remove and free the session of a client.
+ *
+ * @param table		Session table.
+ * @param client	Broker client.
+ * @return			true if the client had a session.
+ */
+bool oauth2plugin_removeSession(
+	struct oauth2plugin_SessionTable* table,
+	const struct mosquitto* client
+);
+
+
+/**
+ * @brief Release a session that is not in a table.
+ *
+ * @param table		Session table whose string pool holds the interned strings.
+ * @param session	Session. May be NULL.
+ */
+void oauth2plugin_freeSession(
+	struct oauth2plugin_SessionTable* table,
+	struct oauth2plugin_Session* session
+);
+
+
+/**
+ * @brief Copy the tokens of sessions due for revalidation.
+ *
+ * Walks the buckets round-robin starting at @p cursor and marks every copied
+ * session as validated at @p now, so successive calls spread over all
+ * sessions.
+ *
+ * @param table				Session table.
+ * @param cursor			In/Out: bucket to continue at.
+ * @param validated_before	Only sessions last validated at or before this Unix time are due.
+ * @param now				Current Unix time in seconds.
+ * @param tokens			Output: copies. Release them with oauth2plugin_freeSessionTokens().
+ * @param count				Capacity of @p tokens.
+ * @return					Number of copied sessions.
+ */
+size_t oauth2plugin_collectSessionTokens(
+	struct oauth2plugin_SessionTable* table,
+	size_t* cursor,
+	int64_t validated_before,
+	int64_t now,
+	struct oauth2plugin_SessionToken* tokens,
+	size_t count
+);
+
+
+/**
+ * @brief Release copies made by oauth2plugin_collectSessionTokens().
+ *
+ * @param table		Session table.
+ * @param tokens	Copies.
+ * @param count		Number of entries in @p tokens.
+ */
+void oauth2plugin_freeSessionTokens(
+	struct oauth2plugin_SessionTable* table,
+	struct oauth2plugin_SessionToken* tokens,
+	size_t count
+);
+
+
+/**
+ * @brief Forget the token of a session if the client is still connected with it.
+ *
+ * Used before disconnecting a client whose token became invalid, so the
+ * session is not revalidated again until the broker reports the disconnect.
+ *
+ * @param table		Session table.
+ * @param client	Broker client.
+ * @param token		Token.
+ * @return			true if the session of @p client used @p token.
+ */
+bool oauth2plugin_dropSessionToken(
+	struct oauth2plugin_SessionTable* table,
+	const struct mosquitto* client,
+	const char* token
+);
+
+
+/**
+ * @brief Collect the clients of sessions matching a token hash or a claim value.
+ *
+ * The tokens of matching sessions are dropped, so they are not revalidated
+ * again until the broker reports the disconnect.
+ *
+ * @param table			Session table.
+ * @param token_hash	SHA-256 of the token to match. NULL to match @p claim instead.
+ * @param claim			Index in oauth2plugin_template_placeholders of the claim to match.
+ * @param value			Claim value to match (ignored if @p token_hash is given).
+ * @param count			Output: number of returned client ids.
+ * @return				Newly allocated array of newly allocated MQTT client ids or NULL if none matches. Caller is responsible for freeing it.
+ */
+char** oauth2plugin_findSessionClients(
+	struct oauth2plugin_SessionTable* table,
+	const unsigned char* token_hash,
+	size_t claim,
+	const char* value,
+	size_t* count
+);
+
+
+/**
+ * @brief Mark all sessions as due for revalidation.
+ *
+ * @param table	Session table.
+ */
+void oauth2plugin_resetSessionValidation(
+	struct oauth2plugin_SessionTable* table
+);
+
+
+/**
+ * @brief Get the bucket of a client.
+ *
+ * @param table		Session table.
+ * @param client	Broker client.
+ * @return			Bucket index.
+ */
+static size_t oauth2plugin_getSessionBucket(
+	const struct oauth2plugin_SessionTable* table,
+	const struct mosquitto* client
+);
+
+
+/**
+ * @brief Double the number of buckets.
+ *
+ * @param table	Session table (locked).
+ */
+static void oauth2plugin_growSessionTable(
+	struct oauth2plugin_SessionTable* table
+);
+
+#endif // OAUTH2PLUGIN_SESSION_H
@@ -0,0 +1,403 @@
+/**
+ * sidecar.c
+ *
+ * Token verification by a local sidecar over a Unix domain socket
+ */
+
+#include "sidecar.h"
+
+
+struct oauth2plugin_Sidecar* oauth2plugin_initSidecar(
+	const char* socket_path,
+	long timeout
+) {
+	struct oauth2plugin_Sidecar* sidecar = calloc(1, sizeof(*sidecar));
+	if (!sidecar) return NULL;
+	sidecar->socket_path = strdup(socket_path);
+	if (!sidecar->socket_path) {
+		free(sidecar);
+		return NULL;
+	}
+	sidecar->timeout = timeout;
+	sidecar->socket = -1;
+	sidecar->next_id = 1;
+	atomic_init(&sidecar->references, 1);
+	pthread_mutex_init(&sidecar->mutex, NULL);
+
+	// Time out on the monotonic clock, like the deadlines
+	pthread_condattr_t cond_attributes;
+	pthread_condattr_init(&cond_attributes);
+	pthread_condattr_setclock(&cond_attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&sidecar->cond, &cond_attributes);
+	pthread_condattr_destroy(&cond_attributes);
+	return sidecar;
+}
+
+
+struct oauth2plugin_Sidecar* oauth2plugin_retainSidecar(
+	struct oauth2plugin_Sidecar* sidecar
+) {
+	atomic_fetch_add(&sidecar->references, 1);
+	return sidecar;
+}
+
+
+void oauth2plugin_freeSidecar(
+	struct oauth2plugin_Sidecar* sidecar
+) {
+	if (!sidecar) return;
+	if (atomic_fetch_sub(&sidecar->references, 1) > 1) return;
+
+	// No caller can be waiting anymore: the last reference is held by the options
+	if (sidecar->socket >= 0) close(sidecar->socket);
+	pthread_cond_destroy(&sidecar->cond);
+	pthread_mutex_destroy(&sidecar->mutex);
+	free(sidecar->socket_path);
+	free(sidecar);
+}
+
+
+int oauth2plugin_verifySidecarToken(
+	struct oauth2plugin_Sidecar* sidecar,
+	const char* token,
+	const char* const* claim_names,
+	size_t claim_count,
+	cJSON** response
+) {
+	*response = NULL;
+
+	// Encode request
+	size_t token_length = strlen(token);
+	if (token_length > UINT16_MAX || claim_count > UINT8_MAX) return MOSQ_ERR_INVAL;
+	size_t request_length = 4 + 1 + 2 + token_length + 1;
+	for (size_t i = 0; i < claim_count; i++) {
+		size_t name_length = strlen(claim_names[i]);
+		if (name_length > UINT8_MAX) return MOSQ_ERR_INVAL;
+		request_length += 1 + name_length;
+	}
+	if (request_length > OAUTH2PLUGIN_SIDECAR_MAX_FRAME) return MOSQ_ERR_INVAL;
+	uint8_t request[request_length];
+	uint8_t* cursor = request + 4; // Request id is set under the lock
+	*cursor++ = OAUTH2PLUGIN_SIDECAR_TYPE_VERIFY;
+	*cursor++ = (uint8_t) (token_length >> 8);
+	*cursor++ = (uint8_t) token_length;
+	memcpy(cursor, token, token_length);
+	cursor += token_length;
+	*cursor++ = (uint8_t) claim_count;
+	for (size_t i = 0; i < claim_count; i++) {
+		size_t name_length = strlen(claim_names[i]);
+		*cursor++ = (uint8_t) name_length;
+		memcpy(cursor, claim_names[i], name_length);
+		cursor += name_length;
+	}
+
+	int64_t deadline = oauth2plugin_getSidecarTime() + sidecar->timeout * 1000000;
+	struct oauth2plugin_SidecarCall call = { 0 };
+
+	pthread_mutex_lock(&sidecar->mutex);
+
+	// Connect lazily, after a failure on the next request
+	if (sidecar->socket < 0 && oauth2plugin_connectSidecar(sidecar) != MOSQ_ERR_SUCCESS) {
+		pthread_mutex_unlock(&sidecar->mutex);
+		return MOSQ_ERR_NO_CONN;
+	}
+
+	// Send request (frames are small, so writing under the lock keeps them whole)
+	call.id = sidecar->next_id++;
+	request[0] = (uint8_t) (call.id >> 24);
+	request[1] = (uint8_t) (call.id >> 16);
+	request[2] = (uint8_t) (call.id >> 8);
+	request[3] = (uint8_t) call.id;
+	if (oauth2plugin_writeSidecarFrame(sidecar->socket, request, request_length) != MOSQ_ERR_SUCCESS) {
+		OAUTH2PLUGIN_LOG_WARNING("Failed to send request to sidecar at %s.", sidecar->socket_path);
+		oauth2plugin_failSidecar(sidecar);
+		pthread_mutex_unlock(&sidecar->mutex);
+		return MOSQ_ERR_CONN_LOST;
+	}
+	call.next = sidecar->calls;
+	sidecar->calls = &call;
+
+	// Wait for the response, reading for everybody if nobody else does
+	int result = MOSQ_ERR_SUCCESS;
+	while (!call.done) {
+		if (!sidecar->reading) {
+			sidecar->reading = true;
+			int socket = sidecar->socket;
+			pthread_mutex_unlock(&sidecar->mutex);
+
+			uint8_t* body = NULL;
+			size_t body_length = 0;
+			int read_result = oauth2plugin_readSidecarFrame(socket, deadline, &body, &body_length);
+
+			pthread_mutex_lock(&sidecar->mutex);
+			sidecar->reading = false;
+			if (read_result == MOSQ_ERR_SUCCESS && body_length >= 4) {
+				uint32_t id = ((uint32_t) body[0] << 24) | ((uint32_t) body[1] << 16) | ((uint32_t) body[2] << 8) | body[3];
+				struct oauth2plugin_SidecarCall** link = &sidecar->calls;
+				while (*link && (*link)->id != id) link = &(*link)->next;
+				if (*link) {
+					(*link)->done = true;
+					(*link)->response = body;
+					(*link)->response_length = body_length;
+					*link = (*link)->next;
+				} else {
+					free(body); // Caller timed out
+				}
+			} else if (read_result != MOSQ_ERR_ERRNO) {
+				free(body);
+				OAUTH2PLUGIN_LOG_WARNING("Lost connection to sidecar at %s.", sidecar->socket_path);
+				oauth2plugin_failSidecar(sidecar);
+			}
+			pthread_cond_broadcast(&sidecar->cond);
+		} else {
+			struct timespec wake_up = {
+				.tv_sec = deadline / 1000000,
+				.tv_nsec = (deadline % 1000000) * 1000
+			};
+			pthread_cond_timedwait(&sidecar->cond, &sidecar->mutex, &wake_up);
+		}
+
+		// Give up
+		if (!call.done && oauth2plugin_getSidecarTime() >= deadline) {
+			struct oauth2plugin_SidecarCall** link = &sidecar->calls;
+			while (*link && *link != &call) link = &(*link)->next;
+			if (*link) *link = call.next;
+			result = MOSQ_ERR_ERRNO;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&sidecar->mutex);
+
+	if (result != MOSQ_ERR_SUCCESS) {
+		OAUTH2PLUGIN_LOG_WARNING("Sidecar at %s did not answer within %ld seconds.", sidecar->socket_path, sidecar->timeout);
+		return result;
+	}
+	if (!call.response) return MOSQ_ERR_CONN_LOST;
+
+	// Decode response
+	enum oauth2plugin_SidecarStatus status;
+	*response = oauth2plugin_decodeSidecarResponse(call.response, call.response_length, &status);
+	free(call.response);
+	if (!*response) {
+		OAUTH2PLUGIN_LOG_WARNING("Malformed response from sidecar at %s.", sidecar->socket_path);
+		return MOSQ_ERR_PROTOCOL;
+	}
+	if (status == sidecar_status_ERROR) {
+		OAUTH2PLUGIN_LOG_WARNING("Sidecar at %s could not verify the token.", sidecar->socket_path);
+		cJSON_Delete(*response);
+		*response = NULL;
+		return MOSQ_ERR_UNKNOWN;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int oauth2plugin_readSidecarFrame(
+	int socket,
+	int64_t deadline,
+	uint8_t** body,
+	size_t* body_length
+) {
+	*body = NULL;
+	*body_length = 0;
+
+	// Header
+	uint8_t header[4];
+	ssize_t count = oauth2plugin_readSidecarBytes(socket, header, sizeof(header), deadline);
+	if (count == 0) {
+		errno = ETIMEDOUT;
+		return MOSQ_ERR_ERRNO;
+	}
+	if (count != sizeof(header)) return MOSQ_ERR_CONN_LOST;
+	uint32_t length = ((uint32_t) header[0] << 24) | ((uint32_t) header[1] << 16) | ((uint32_t) header[2] << 8) | header[3];
+	if (length > OAUTH2PLUGIN_SIDECAR_MAX_FRAME) return MOSQ_ERR_CONN_LOST;
+
+	// Body (once started, a frame must be read completely to stay in sync)
+	uint8_t* buffer = malloc(length ? length : 1);
+	if (!buffer) return MOSQ_ERR_NOMEM;
+	if (oauth2plugin_readSidecarBytes(socket, buffer, length, deadline) != (ssize_t) length) {
+		free(buffer);
+		return MOSQ_ERR_CONN_LOST;
+	}
+	*body = buffer;
+	*body_length = length;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int oauth2plugin_writeSidecarFrame(
+	int socket,
+	const uint8_t* body,
+	size_t body_length
+) {
+	uint8_t header[4] = {
+		(uint8_t) (body_length >> 24),
+		(uint8_t) (body_length >> 16),
+		(uint8_t) (body_length >> 8),
+		(uint8_t) body_length
+	};
+	struct iovec parts[2] = {
+		{ .iov_base = header, .iov_len = sizeof(header) },
+		{ .iov_base = (void*) body, .iov_len = body_length }
+	};
+	struct msghdr message = { .msg_iov = parts, .msg_iovlen = 2 };
+	size_t remaining = sizeof(header) + body_length;
+	while (remaining > 0) {
+		ssize_t count = sendmsg(socket, &message, MSG_NOSIGNAL);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			return MOSQ_ERR_CONN_LOST;
+		}
+		remaining -= count;
+
+		// Skip what was sent
+		while (message.msg_iovlen > 0 && (size_t) count >= message.msg_iov->iov_len) {
+			count -= message.msg_iov->iov_len;
+			message.msg_iov++;
+			message.msg_iovlen--;
+		}
+		if (message.msg_iovlen > 0) {
+			message.msg_iov->iov_base = (uint8_t*) message.msg_iov->iov_base + count;
+			message.msg_iov->iov_len -= count;
+		}
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int oauth2plugin_connectSidecar(
+	struct oauth2plugin_Sidecar* sidecar
+) {
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(sidecar->socket_path) >= sizeof(address.sun_path)) {
+		OAUTH2PLUGIN_LOG_ERROR("Sidecar socket path %s is too long.", sidecar->socket_path);
+		return MOSQ_ERR_NO_CONN;
+	}
+	strcpy(address.sun_path, sidecar->socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) return MOSQ_ERR_NO_CONN;
+	if (connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0) {
+		OAUTH2PLUGIN_LOG_WARNING("Failed to connect to sidecar at %s: %s", sidecar->socket_path, strerror(errno));
+		close(fd);
+		return MOSQ_ERR_NO_CONN;
+	}
+
+	// A stalled sidecar must not block the broker forever on a full socket buffer
+	struct timeval send_timeout = { .tv_sec = sidecar->timeout };
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+	OAUTH2PLUGIN_LOG_DEBUG("Connected to sidecar at %s.", sidecar->socket_path);
+	sidecar->socket = fd;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void oauth2plugin_failSidecar(
+	struct oauth2plugin_Sidecar* sidecar
+) {
+	if (sidecar->socket < 0) return;
+
+	// The reader owns the descriptor: wake it up, it fails the calls when it returns
+	if (sidecar->reading) {
+		shutdown(sidecar->socket, SHUT_RDWR);
+		return;
+	}
+
+	close(sidecar->socket);
+	sidecar->socket = -1;
+	for (struct oauth2plugin_SidecarCall* call = sidecar->calls; call; call = call->next) call->done = true;
+	sidecar->calls = NULL;
+	pthread_cond_broadcast(&sidecar->cond);
+}
+
+
+static cJSON* oauth2plugin_decodeSidecarResponse(
+	const uint8_t* body,
+	size_t body_length,
+	enum oauth2plugin_SidecarStatus* status
+) {
+	// Fixed part
+	if (body_length < 4 + 1 + 8 + 1) return NULL;
+	const uint8_t* cursor = body + 4;
+	const uint8_t* end = body + body_length;
+	*status = (enum oauth2plugin_SidecarStatus) *cursor++;
+	if (*status > sidecar_status_ERROR) return NULL;
+	int64_t exp = 0;
+	for (int i = 0; i < 8; i++) exp = (int64_t) (((uint64_t) exp << 8) | *cursor++);
+	uint8_t claim_count = *cursor++;
+
+	cJSON* response = cJSON_CreateObject();
+	if (!response) return NULL;
+	cJSON_AddBoolToObject(response, "active", *status == sidecar_status_ACTIVE);
+	if (exp != 0) cJSON_AddNumberToObject(response, "exp", (double) exp);
+
+	// Claims
+	for (uint8_t i = 0; i < claim_count; i++) {
+		if (end - cursor < 1) goto malformed;
+		size_t name_length = *cursor++;
+		if ((size_t) (end - cursor) < name_length + 2) goto malformed;
+		char name[name_length + 1];
+		memcpy(name, cursor, name_length);
+		name[name_length] = '\0';
+		cursor += name_length;
+		size_t value_length = ((size_t) cursor[0] << 8) | cursor[1];
+		cursor += 2;
+		if ((size_t) (end - cursor) < value_length) goto malformed;
+		char* value = malloc(value_length + 1);
+		if (!value) goto malformed;
+		memcpy(value, cursor, value_length);
+		value[value_length] = '\0';
+		cursor += value_length;
+		cJSON_AddStringToObject(response, name, value);
+		free(value);
+	}
+	return response;
+
+malformed:
+	cJSON_Delete(response);
+	return NULL;
+}
+
+
+static ssize_t oauth2plugin_readSidecarBytes(
+	int socket,
+	uint8_t* buffer,
+	size_t length,
+	int64_t deadline
+) {
+	size_t received = 0;
+	while (received < length) {
+		// Wait for data
+		int wait = -1;
+		if (deadline > 0) {
+			int64_t remaining = deadline - oauth2plugin_getSidecarTime();
+			if (remaining <= 0) return received;
+			wait = (int) ((remaining + 999) / 1000);
+		}
+		struct pollfd descriptor = { .fd = socket, .events = POLLIN };
+		int ready = poll(&descriptor, 1, wait);
+		if (ready < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (ready == 0) continue;
+
+		ssize_t count = recv(socket, buffer + received, length - received, 0);
+		if (count < 0) {
+			if (errno == EINTR || errno == EAGAIN) continue;
+			return -1;
+		}
+		if (count == 0) return -1; // Closed
+		received += count;
+	}
+	return received;
+}
+
+
+static int64_t oauth2plugin_getSidecarTime() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
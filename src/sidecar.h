@@ -0,0 +1,231 @@
+/**
+ * sidecar.h
+ *
+ * Token verification by a local sidecar over a Unix domain socket
+ *
+ * Frames (all integers big endian):
+ *   u32 length of the frame body, followed by the body
+ *
+ * Request body:
+ *   u32 request id, u8 type (1 = verify), u16 token length, token,
+ *   u8 claim count, per claim: u8 name length, name
+ *
+ * Response body:
+ *   u32 request id, u8 status (enum oauth2plugin_SidecarStatus),
+ *   i64 exp (0 = unknown), u8 claim count,
+ *   per claim: u8 name length, name, u16 value length, value
+ *
+ * Requests are pipelined: any number of requests may be in flight on one
+ * connection and the sidecar may answer them in any order.
+ */
+
+#ifndef OAUTH2PLUGIN_SIDECAR_H
+#define OAUTH2PLUGIN_SIDECAR_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include "cJSON.h"
+
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_SIDECAR_MAX_FRAME 65536
+#define OAUTH2PLUGIN_SIDECAR_TYPE_VERIFY 1
+
+
+enum oauth2plugin_SidecarStatus {
+	sidecar_status_ACTIVE = 0,		// Token is valid.
+	sidecar_status_INACTIVE = 1,	// Token is not valid.
+	sidecar_status_ERROR = 2		// Sidecar could not verify the token.
+};
+
+
+struct oauth2plugin_SidecarCall {
+	struct oauth2plugin_SidecarCall*	next;				// Next call waiting for a response.
+	uint32_t							id;					// Request id.
+	bool								done;				// Response received or connection failed.
+	uint8_t*							response;			// Response body (NULL if the connection failed).
+	size_t								response_length;	// Length of @p response.
+};
+
+
+struct oauth2plugin_Sidecar {
+	char*								socket_path;	// Path of the Unix domain socket.
+	long								timeout;		// Request timeout in seconds.
+	pthread_mutex_t						mutex;			// Protects all fields below.
+	pthread_cond_t						cond;			// Signalled when calls are completed.
+	int									socket;			// Connection (-1 = not connected).
+	bool								reading;		// A caller is reading responses for all callers.
+	uint32_t							next_id;		// Id of the next request.
+	struct oauth2plugin_SidecarCall*	calls;			// Calls waiting for a response.
+	atomic_long							references;		// Configurations using this sidecar.
+};
+
+
+/**
+ * @brief Create a sidecar client. The connection is opened with the first request.
+ *
+ * @param socket_path	Path of the Unix domain socket.
+ * @param timeout		Request timeout in seconds.
+ * @return				Pointer to a new sidecar client or NULL if allocation fails.
+ */
+struct oauth2plugin_Sidecar* oauth2plugin_initSidecar(
+	const char* socket_path,
+	long timeout
+);
+
+
+/**
+ * @brief Take an additional reference to a sidecar client.
+ *
+ * @param sidecar	Sidecar client.
+ * @return			@p sidecar.
+ */
+struct oauth2plugin_Sidecar* oauth2plugin_retainSidecar(
+	struct oauth2plugin_Sidecar* sidecar
+);
+
+
+/**
+ * @brief Release a reference; the connection is closed with the last one.
+ *
+ * @param sidecar	Sidecar client created by oauth2plugin_initSidecar(). May be NULL.
+ */
+void oauth2plugin_freeSidecar(
+	struct oauth2plugin_Sidecar* sidecar
+);
+
+
+/**
+ * @brief Verify a token with the sidecar.
+ *
+ * Thread safe. Concurrent callers share one connection; whichever caller is
+ * waiting reads the responses and hands them to their callers.
+ *
+ * @param sidecar		Sidecar client.
+ * @param token			Token supplied by the MQTT client.
+ * @param claim_names	Names of the claims to return.
+ * @param claim_count	Number of entries in @p claim_names.
+ * @param response		Output: introspection-like object {"active": bool, "exp": number, <claim>: string, ...}. Caller is responsible for freeing it with cJSON_Delete().
+ * @return				MOSQ_ERR_SUCCESS on success or a mosquitto error code if the sidecar failed or did not answer in time.
+ */
+int oauth2plugin_verifySidecarToken(
+	struct oauth2plugin_Sidecar* sidecar,
+	const char* token,
+	const char* const* claim_names,
+	size_t claim_count,
+	cJSON** response
+);
+
+
+/**
+ * @brief Read one frame.
+ *
+ * @param socket		Connected socket.
+ * @param deadline		Monotonic time in microseconds to give up at (0 = wait forever).
+ * @param body			Output: newly allocated frame body. Caller is responsible for freeing it.
+ * @param body_length	Output: length of @p body.
+ * @return				MOSQ_ERR_SUCCESS, MOSQ_ERR_ERRNO (ETIMEDOUT) if the deadline passed before the frame started, or MOSQ_ERR_CONN_LOST if the connection failed (or timed out within a frame).
+ */
+int oauth2plugin_readSidecarFrame(
+	int socket,
+	int64_t deadline,
+	uint8_t** body,
+	size_t* body_length
+);
+
+
+/**
+ * @brief Write one frame.
+ *
+ * @param socket		Connected socket.
+ * @param body			Frame body.
+ * @param body_length	Length of @p body.
+ * @return				MOSQ_ERR_SUCCESS or MOSQ_ERR_CONN_LOST.
+ */
+int oauth2plugin_writeSidecarFrame(
+	int socket,
+	const uint8_t* body,
+	size_t body_length
+);
+
+
+/**
+ * @brief Connect to the sidecar.
+ *
+ * @param sidecar	Sidecar client (locked).
+ * @return			MOSQ_ERR_SUCCESS or MOSQ_ERR_NO_CONN.
+ */
+static int oauth2plugin_connectSidecar(
+	struct oauth2plugin_Sidecar* sidecar
+);
+
+
+/**
+ * @brief Drop the connection and complete all waiting calls without response.
+ *
+ * If another caller is reading, the socket is only shut down and closed by
+ * the reader, so the descriptor is never reused under it.
+ *
+ * @param sidecar	Sidecar client (locked).
+ */
+static void oauth2plugin_failSidecar(
+	struct oauth2plugin_Sidecar* sidecar
+);
+
+
+/**
+ * @brief Decode a response body into an introspection-like object.
+ *
+ * @param body			Response body.
+ * @param body_length	Length of @p body.
+ * @param status		Output: status of the response.
+ * @return				New object or NULL if the body is malformed.
+ */
+static cJSON* oauth2plugin_decodeSidecarResponse(
+	const uint8_t* body,
+	size_t body_length,
+	enum oauth2plugin_SidecarStatus* status
+);
+
+
+/**
+ * @brief Read exactly @p length bytes before a deadline.
+ *
+ * @param socket	Connected socket.
+ * @param buffer	Output buffer.
+ * @param length	Number of bytes to read.
+ * @param deadline	Monotonic time in microseconds to give up at (0 = wait forever).
+ * @return			Number of bytes read (less than @p length on timeout) or -1 on error.
+ */
+static ssize_t oauth2plugin_readSidecarBytes(
+	int socket,
+	uint8_t* buffer,
+	size_t length,
+	int64_t deadline
+);
+
+
+/**
+ * @brief Get the monotonic time in microseconds.
+ *
+ * @return	Monotonic time.
+ */
+static int64_t oauth2plugin_getSidecarTime();
+
+#endif // OAUTH2PLUGIN_SIDECAR_H
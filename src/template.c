@@ -0,0 +1,175 @@
+/**
+ * template.c
+ *
+ * Precompiled username templates with literal segments and placeholders
+ */
+
+#include "template.h"
+
+
+struct oauth2plugin_Template* oauth2plugin_initTemplate(
+	const char* source
+) {
+	if (!source) return NULL;
+	struct oauth2plugin_Template* template = calloc(1, sizeof(*template));
+	if (!template) return NULL;
+	template->source = strdup(source);
+	if (!template->source) {
+		oauth2plugin_freeTemplate(template);
+		return NULL;
+	}
+	template->source_length = strlen(source);
+
+	// Split into literals and placeholders
+	const char* literal = template->source;
+	const char* position = template->source;
+	while (*position) {
+		size_t placeholder = oauth2plugin_oidc_template_placeholders_count;
+		size_t placeholder_length = 0;
+		for (size_t i = 0; i < oauth2plugin_oidc_template_placeholders_count; i++) {
+			placeholder_length = strlen(oauth2plugin_template_placeholders[i].placeholder);
+			if (strncmp(position, oauth2plugin_template_placeholders[i].placeholder, placeholder_length) == 0) {
+				placeholder = i;
+				break;
+			}
+		}
+		if (placeholder == oauth2plugin_oidc_template_placeholders_count) {
+			position++;
+			continue;
+		}
+		if (
+			(position > literal && !oauth2plugin_addTemplateSegment(template, literal, (size_t) (position - literal), 0))
+			|| !oauth2plugin_addTemplateSegment(template, NULL, placeholder_length, placeholder)
+		) {
+			oauth2plugin_freeTemplate(template);
+			return NULL;
+		}
+		position += placeholder_length;
+		literal = position;
+	}
+	if (position > literal && !oauth2plugin_addTemplateSegment(template, literal, (size_t) (position - literal), 0)) {
+		oauth2plugin_freeTemplate(template);
+		return NULL;
+	}
+
+	// Fixed prefix and suffix
+	if (template->has_placeholders) {
+		if (template->segments[0].literal) template->prefix_length = template->segments[0].length;
+		if (template->segments[template->segments_count - 1].literal) template->suffix_length = template->segments[template->segments_count - 1].length;
+	}
+
+	return template;
+}
+
+
+void oauth2plugin_freeTemplate(
+	struct oauth2plugin_Template* template
+) {
+	if (!template) return;
+	free(template->segments);
+	free(template->source);
+	free(template);
+}
+
+
+bool oauth2plugin_canMatchTemplate(
+	const struct oauth2plugin_Template* template,
+	const char* username
+) {
+	if (!template || !username || !*username) return false;
+	size_t username_length = strlen(username);
+
+	// Without placeholders the template is the username
+	if (!template->has_placeholders)
+		return username_length == template->source_length && memcmp(username, template->source, username_length) == 0;
+
+	// Length, prefix and suffix
+	if (username_length < template->literal_length) return false;
+	if (memcmp(username, template->segments[0].literal ? template->segments[0].literal : "", template->prefix_length) != 0) return false;
+	const struct oauth2plugin_TemplateSegment* last = &template->segments[template->segments_count - 1];
+	if (memcmp(username + username_length - template->suffix_length, last->literal ? last->literal : "", template->suffix_length) != 0) return false;
+
+	// Fixed segments in between must appear in order (leftmost match is sufficient)
+	const char* position = username + template->prefix_length;
+	const char* end = username + username_length - template->suffix_length;
+	size_t first = template->prefix_length > 0 ? 1 : 0;
+	size_t count = template->segments_count - (template->suffix_length > 0 ? 1 : 0);
+	for (size_t i = first; i < count; i++) {
+		const struct oauth2plugin_TemplateSegment* segment = &template->segments[i];
+		if (!segment->literal) continue;
+		const char* found = oauth2plugin_findTemplateLiteral(position, (size_t) (end - position), segment->literal, segment->length);
+		if (!found) return false;
+		position = found + segment->length;
+	}
+
+	return true;
+}
+
+
+bool oauth2plugin_matchTemplate(
+	const struct oauth2plugin_Template* template,
+	const char* username,
+	const struct oauth2plugin_strReplacementMap* replacement_map,
+	size_t replacement_map_count
+) {
+	if (!template || !username) return false;
+
+	// Compare segment by segment
+	const char* position = username;
+	for (size_t i = 0; i < template->segments_count; i++) {
+		const struct oauth2plugin_TemplateSegment* segment = &template->segments[i];
+		const char* value = segment->literal;
+		size_t value_length = segment->length;
+		if (!value) {
+			value = oauth2plugin_template_placeholders[segment->placeholder].placeholder;
+			if (
+				replacement_map
+				&& segment->placeholder < replacement_map_count
+				&& replacement_map[segment->placeholder].replacement
+			) {
+				value = replacement_map[segment->placeholder].replacement;
+				value_length = strlen(value);
+			}
+		}
+		if (strncmp(position, value, value_length) != 0) return false;
+		position += value_length;
+	}
+
+	return *position == '\0';
+}
+
+
+static bool oauth2plugin_addTemplateSegment(
+	struct oauth2plugin_Template* template,
+	const char* literal,
+	size_t length,
+	size_t placeholder
+) {
+	struct oauth2plugin_TemplateSegment* segments = realloc(template->segments, (template->segments_count + 1) * sizeof(*segments));
+	if (!segments) return false;
+	template->segments = segments;
+	template->segments[template->segments_count].literal = literal;
+	template->segments[template->segments_count].length = length;
+	template->segments[template->segments_count].placeholder = placeholder;
+	template->segments_count++;
+	if (literal) template->literal_length += length;
+	else template->has_placeholders = true;
+	return true;
+}
+
+
+static const char* oauth2plugin_findTemplateLiteral(
+	const char* haystack,
+	size_t haystack_length,
+	const char* needle,
+	size_t needle_length
+) {
+	if (needle_length > haystack_length) return NULL;
+	const char* last = haystack + haystack_length - needle_length;
+	for (const char* position = haystack; position <= last; position++) {
+		position = memchr(position, needle[0], (size_t) (last - position) + 1);
+		if (!position) return NULL;
+		if (memcmp(position, needle, needle_length) == 0) return position;
+	}
+	return NULL;
+}
@@ -0,0 +1,136 @@
+/**
+ * template.h
+ *
+ * Precompiled username templates with literal segments and placeholders
+ */
+
+#ifndef OAUTH2PLUGIN_TEMPLATE_H
+#define OAUTH2PLUGIN_TEMPLATE_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+
+#include "options.h"
+#include "tools.h"
+#include "log.h"
+
+
+struct oauth2plugin_TemplateSegment {
+	const char*		literal;		// Literal text (points into the template source, NULL for placeholders).
+	size_t			length;			// Length of the literal or of the placeholder text.
+	size_t			placeholder;	// Index in oauth2plugin_template_placeholders (placeholders only).
+};
+
+
+struct oauth2plugin_Template {
+	char*									source;				// Template string.
+	size_t									source_length;		// Length of @p source.
+	struct oauth2plugin_TemplateSegment*	segments;			// Literals and placeholders in template order.
+	size_t									segments_count;		// Number of segments.
+	size_t									prefix_length;		// Length of the literal before the first placeholder.
+	size_t									suffix_length;		// Length of the literal after the last placeholder.
+	size_t									literal_length;		// Total length of all literals (minimum username length).
+	bool									has_placeholders;	// Whether any placeholder was found.
+};
+
+
+/**
+ * @brief Split a template into literal segments and known placeholders.
+ *
+ * Unknown placeholders are kept as literal text, like
+ * oauth2plugin_strReplaceMap() does.
+ *
+ * @param source	Template string, e.g. "user-%%oidc-username%%".
+ * @return			Pointer to a new template or NULL if @p source is NULL or allocation fails.
+ */
+struct oauth2plugin_Template* oauth2plugin_initTemplate(
+	const char* source
+);
+
+
+/**
+ * @brief Release a template.
+ *
+ * @param template	Template created by oauth2plugin_initTemplate(). May be NULL.
+ */
+void oauth2plugin_freeTemplate(
+	struct oauth2plugin_Template* template
+);
+
+
+/**
+ * @brief Check whether a username can match a template for any claim values.
+ *
+ * Placeholders match any text, so only the length, the literal prefix and
+ * suffix and the fixed segments in between (in order) are checked. Used
+ * before introspection; a username rejected here can never be valid.
+ *
+ * @param template	Template. May be NULL (nothing matches).
+ * @param username	MQTT username.
+ * @return			false if @p username can never match.
+ */
+bool oauth2plugin_canMatchTemplate(
+	const struct oauth2plugin_Template* template,
+	const char* username
+);
+
+
+/**
+ * @brief Check whether a username matches a template with the given claim values.
+ *
+ * Compares segment by segment without building the expanded template.
+ * Placeholders without a value match their literal placeholder text.
+ *
+ * @param template					Template. May be NULL (nothing matches).
+ * @param username					MQTT username.
+ * @param replacement_map			Claim values, indexed like oauth2plugin_template_placeholders.
+ * @param replacement_map_count		Number of entries in @p replacement_map.
+ * @return							true if @p username equals the expanded template.
+ */
+bool oauth2plugin_matchTemplate(
+	const struct oauth2plugin_Template* template,
+	const char* username,
+	const struct oauth2plugin_strReplacementMap* replacement_map,
+	size_t replacement_map_count
+);
+
+
+/**
+ * @brief Append a segment to a template.
+ *
+ * @param template		Template.
+ * @param literal		Literal text or NULL for a placeholder.
+ * @param length		Length of the literal or placeholder text.
+ * @param placeholder	Placeholder index (ignored for literals).
+ * @return				true on success, false if allocation fails.
+ */
+static bool oauth2plugin_addTemplateSegment(
+	struct oauth2plugin_Template* template,
+	const char* literal,
+	size_t length,
+	size_t placeholder
+);
+
+
+/**
+ * @brief Find a literal inside a range of a string.
+ *
+ * @param haystack			Start of the range.
+ * @param haystack_length	Length of the range.
+ * @param needle			Literal to find.
+ * @param needle_length		Length of @p needle.
+ * @return					First occurrence or NULL.
+ */
+static const char* oauth2plugin_findTemplateLiteral(
+	const char* haystack,
+	size_t haystack_length,
+	const char* needle,
+	size_t needle_length
+);
+
+#endif // OAUTH2PLUGIN_TEMPLATE_H
@@ -0,0 +1,282 @@
+/**
+ * tokenstore.c
+ *
+ * Memory-mapped static token store for long-lived service credentials
+ */
+
+#include "tokenstore.h"
+
+
+static const struct oauth2plugin_IndexFormat oauth2plugin_tokenstore_format = {
+	.name = "token store",
+	.entries_name = "stored tokens",
+	.magic = OAUTH2PLUGIN_TOKENSTORE_MAGIC,
+	.version = OAUTH2PLUGIN_TOKENSTORE_VERSION,
+	.mode = 0600,		// The index contains the claims, so it is readable by the broker only
+	.size = sizeof(struct oauth2plugin_TokenStoreIndex),
+	.build = oauth2plugin_buildTokenStoreIndex,
+	.attach = oauth2plugin_attachTokenStoreIndex
+};
+
+
+struct oauth2plugin_TokenStore* oauth2plugin_initTokenStore(
+	const char* file_path,
+	const char* index_path,
+	long check_interval
+) {
+	if (!file_path) return NULL;
+
+	// Init
+	struct oauth2plugin_TokenStore* store = calloc(1, sizeof(*store));
+	if (!store) return NULL;
+	atomic_init(&store->hits, 0);
+	atomic_init(&store->misses, 0);
+	atomic_init(&store->references, 1);
+
+	// Load index and watch for changes
+	store->watcher = oauth2plugin_initIndexWatcher(&oauth2plugin_tokenstore_format, file_path, index_path, check_interval);
+	if (!store->watcher) {
+		free(store);
+		return NULL;
+	}
+
+	return store;
+}
+
+
+struct oauth2plugin_TokenStore* oauth2plugin_retainTokenStore(
+	struct oauth2plugin_TokenStore* store
+) {
+	atomic_fetch_add(&store->references, 1);
+	return store;
+}
+
+
+void oauth2plugin_freeTokenStore(
+	struct oauth2plugin_TokenStore* store
+) {
+	if (!store) return;
+	if (atomic_fetch_sub(&store->references, 1) != 1) return;
+	oauth2plugin_freeIndexWatcher(store->watcher);
+	free(store);
+}
+
+
+cJSON* oauth2plugin_lookupStoredToken(
+	struct oauth2plugin_TokenStore* store,
+	const unsigned char token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE]
+) {
+	if (!store) return NULL;
+	cJSON* claims = NULL;
+
+	struct oauth2plugin_MappedIndex* mapped = oauth2plugin_acquireIndex(store->watcher);
+	const struct oauth2plugin_TokenStoreIndex* index = (const struct oauth2plugin_TokenStoreIndex*) mapped;
+
+	// Binary search
+	size_t low = 0;
+	size_t high = index->index.entry_count;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		const struct oauth2plugin_TokenStoreEntry* entry = &index->entries[middle];
+		int comparison = memcmp(entry->key, token_hash, OAUTH2PLUGIN_TOKEN_HASH_SIZE);
+		if (comparison < 0) {
+			low = middle + 1;
+		} else if (comparison > 0) {
+			high = middle;
+		} else {
+			// Expired entries fall through to the verifier
+			if (entry->expires_at == 0 || entry->expires_at > (int64_t) time(NULL))
+				claims = cJSON_ParseWithLength(index->claims + entry->claims_offset, entry->claims_length);
+			break;
+		}
+	}
+	oauth2plugin_releaseIndex(store->watcher, mapped);
+
+	atomic_fetch_add_explicit(claims ? &store->hits : &store->misses, 1, memory_order_relaxed);
+	return claims;
+}
+
+
+void oauth2plugin_publishTokenStore(
+	struct oauth2plugin_TokenStore* store
+) {
+	if (!store) return;
+	oauth2plugin_publishIndex(store->watcher);
+}
+
+
+static uint8_t* oauth2plugin_buildTokenStoreIndex(
+	const char* file_path,
+	const struct stat* source_stat,
+	size_t* index_size
+) {
+	FILE* file = fopen(file_path, "r");
+	if (!file) return NULL;
+
+	size_t entries_size = 256;
+	size_t count = 0;
+	struct oauth2plugin_TokenStoreSourceEntry* entries = malloc(entries_size * sizeof(*entries));
+	size_t claims_size = 0;
+	size_t claims_capacity = 4096;
+	char* claims = malloc(claims_capacity);
+	bool failed = !entries || !claims;
+	char* line = NULL;
+	size_t line_size = 0;
+	size_t line_number = 0;
+	while (!failed && getline(&line, &line_size, file) >= 0) {
+		line_number++;
+
+		// Skip blank lines and comments ('#' may appear inside the claims)
+		char* start = line;
+		while (isspace((unsigned char) *start)) start++;
+		if (*start == '\0' || *start == '#') continue;
+
+		// Token hash (64 hex digits)
+		bool hash = strlen(start) > 2 * OAUTH2PLUGIN_TOKEN_HASH_SIZE && isspace((unsigned char) start[2 * OAUTH2PLUGIN_TOKEN_HASH_SIZE]);
+		for (size_t i = 0; hash && i < 2 * OAUTH2PLUGIN_TOKEN_HASH_SIZE; i++) hash = isxdigit((unsigned char) start[i]);
+		int64_t expires_at = 0;
+		char* compact = hash ? oauth2plugin_parseStoredClaims(start + 2 * OAUTH2PLUGIN_TOKEN_HASH_SIZE, &expires_at) : NULL;
+		if (!compact) {
+			OAUTH2PLUGIN_LOG_WARNING("Ignoring line %zu of token store %s: expected a token hash and a JSON object.", line_number, file_path);
+			continue;
+		}
+		size_t compact_length = strlen(compact);
+
+		// Grow
+		if (count == entries_size) {
+			entries_size *= 2;
+			struct oauth2plugin_TokenStoreSourceEntry* resized = realloc(entries, entries_size * sizeof(*entries));
+			if (!resized) failed = true;
+			else entries = resized;
+		}
+		while (!failed && claims_size + compact_length + 1 > claims_capacity) {
+			claims_capacity *= 2;
+			char* resized = claims_capacity <= UINT32_MAX ? realloc(claims, claims_capacity) : NULL;
+			if (!resized) failed = true;
+			else claims = resized;
+		}
+		if (failed) {
+			free(compact);
+			break;
+		}
+
+		// Append
+		struct oauth2plugin_TokenStoreSourceEntry* entry = &entries[count++];
+		memset(entry, 0, sizeof(*entry));
+		for (size_t i = 0; i < OAUTH2PLUGIN_TOKEN_HASH_SIZE; i++) {
+			char byte[3] = { start[2 * i], start[2 * i + 1], '\0' };
+			entry->entry.key[i] = (unsigned char) strtoul(byte, NULL, 16);
+		}
+		entry->entry.expires_at = expires_at;
+		entry->entry.claims_offset = (uint32_t) claims_size;
+		entry->entry.claims_length = (uint32_t) compact_length;
+		entry->line = line_number;
+		memcpy(claims + claims_size, compact, compact_length + 1);
+		claims_size += compact_length + 1;
+		free(compact);
+	}
+	free(line);
+	fclose(file);
+	if (failed) {
+		free(entries);
+		free(claims);
+		return NULL;
+	}
+
+	// Sort and remove duplicates (the last line of each key wins)
+	qsort(entries, count, sizeof(*entries), oauth2plugin_compareTokenStoreEntries);
+	size_t unique = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (
+			i + 1 < count
+			&& memcmp(entries[i].entry.key, entries[i + 1].entry.key, OAUTH2PLUGIN_TOKEN_HASH_SIZE) == 0
+		) continue;
+		entries[unique++] = entries[i];
+	}
+
+	// Header
+	size_t size = OAUTH2PLUGIN_MAPPEDINDEX_HEADER_SIZE
+		+ unique * OAUTH2PLUGIN_TOKENSTORE_ENTRY_SIZE
+		+ claims_size;
+	uint8_t* index = calloc(1, size);
+	if (!index) {
+		free(entries);
+		free(claims);
+		return NULL;
+	}
+	oauth2plugin_writeIndexHeader(index, &oauth2plugin_tokenstore_format, 0, source_stat);
+	uint64_t counts[2] = { unique, claims_size };
+	memcpy(index + 32, counts, sizeof(counts));
+
+	// Entries and claims (claims of overridden lines are kept but unreferenced)
+	uint8_t* position = index + OAUTH2PLUGIN_MAPPEDINDEX_HEADER_SIZE;
+	for (size_t i = 0; i < unique; i++) {
+		memcpy(position, &entries[i].entry, OAUTH2PLUGIN_TOKENSTORE_ENTRY_SIZE);
+		position += OAUTH2PLUGIN_TOKENSTORE_ENTRY_SIZE;
+	}
+	if (claims_size > 0) memcpy(position, claims, claims_size);
+	free(entries);
+	free(claims);
+
+	*index_size = size;
+	return index;
+}
+
+
+static char* oauth2plugin_parseStoredClaims(
+	const char* text,
+	int64_t* expires_at
+) {
+	cJSON* claims = cJSON_Parse(text);
+	if (!cJSON_IsObject(claims)) {
+		cJSON_Delete(claims);
+		return NULL;
+	}
+
+	// Stored tokens are active unless stated otherwise
+	if (!cJSON_GetObjectItemCaseSensitive(claims, "active"))
+		cJSON_AddBoolToObject(claims, "active", true);
+	cJSON* exp = cJSON_GetObjectItemCaseSensitive(claims, "exp");
+	*expires_at = cJSON_IsNumber(exp) && exp->valuedouble > 0 ? (int64_t) exp->valuedouble : 0;
+
+	char* compact = cJSON_PrintUnformatted(claims);
+	cJSON_Delete(claims);
+	return compact;
+}
+
+
+static bool oauth2plugin_attachTokenStoreIndex(
+	struct oauth2plugin_MappedIndex* index
+) {
+	struct oauth2plugin_TokenStoreIndex* store_index = (struct oauth2plugin_TokenStoreIndex*) index;
+	uint64_t counts[2];
+	memcpy(counts, (const uint8_t*) index->map + 32, sizeof(counts));
+	index->entry_count = counts[0];
+	store_index->claims_size = counts[1];
+	if (
+		index->entry_count > (index->map_size - OAUTH2PLUGIN_MAPPEDINDEX_HEADER_SIZE) / OAUTH2PLUGIN_TOKENSTORE_ENTRY_SIZE
+		|| index->map_size != OAUTH2PLUGIN_MAPPEDINDEX_HEADER_SIZE
+			+ index->entry_count * OAUTH2PLUGIN_TOKENSTORE_ENTRY_SIZE
+			+ store_index->claims_size
+	) return false;
+	store_index->entries = (const struct oauth2plugin_TokenStoreEntry*) ((const uint8_t*) index->map + OAUTH2PLUGIN_MAPPEDINDEX_HEADER_SIZE);
+	store_index->claims = (const char*) (store_index->entries + index->entry_count);
+
+	// Claims must stay within the mapping
+	for (uint64_t i = 0; i < index->entry_count; i++) {
+		if ((uint64_t) store_index->entries[i].claims_offset + store_index->entries[i].claims_length >= store_index->claims_size) return false;
+	}
+	return true;
+}
+
+
+static int oauth2plugin_compareTokenStoreEntries(
+	const void* a,
+	const void* b
+) {
+	const struct oauth2plugin_TokenStoreSourceEntry* first = (const struct oauth2plugin_TokenStoreSourceEntry*) a;
+	const struct oauth2plugin_TokenStoreSourceEntry* second = (const struct oauth2plugin_TokenStoreSourceEntry*) b;
+	int comparison = memcmp(first->entry.key, second->entry.key, OAUTH2PLUGIN_TOKEN_HASH_SIZE);
+	if (comparison != 0) return comparison;
+	return (first->line > second->line) - (first->line < second->line);
+}
@@ -0,0 +1,200 @@
+/**
+ * tokenstore.h
+ *
+ * Memory-mapped static token store for long-lived service credentials
+ *
+ * Source file (one entry per line, '#' starts a comment):
+ *   <64 hex digits> <JSON object>	SHA-256 of the token (e.g. "printf %s "$TOKEN" | sha256sum")
+ *									followed by its claims, as an introspection endpoint would return them
+ *
+ * "active": true is added to claims without "active". A numeric "exp" claim
+ * limits the entry; expired entries are ignored and the token is introspected.
+ * If a hash is listed more than once, the last line wins.
+ *
+ * Compiled index (mapped read-only, all integers little endian):
+ *   Header:	"O2PTSTOR", u32 version, u32 flags, u64 source size,
+ *				u64 source mtime (nanoseconds), u64 entry count, u64 claims size,
+ *				padding to 64 bytes
+ *   Entries:	Sorted 48 byte entries: 32 byte key, i64 expiry (0 = never),
+ *				u32 claims offset, u32 claims length
+ *   Claims:	Null terminated JSON objects
+ */
+
+#ifndef OAUTH2PLUGIN_TOKENSTORE_H
+#define OAUTH2PLUGIN_TOKENSTORE_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include "cJSON.h"
+
+#include "mappedindex.h"
+#include "tools.h"
+#include "log.h"
+
+
+#define OAUTH2PLUGIN_TOKENSTORE_MAGIC "O2PTSTOR"
+#define OAUTH2PLUGIN_TOKENSTORE_VERSION 1
+#define OAUTH2PLUGIN_TOKENSTORE_ENTRY_SIZE 48
+
+
+struct oauth2plugin_TokenStoreEntry {
+	unsigned char	key[OAUTH2PLUGIN_TOKEN_HASH_SIZE];	// SHA-256 of the token.
+	int64_t			expires_at;							// "exp" claim (0 = never).
+	uint32_t		claims_offset;						// Offset of the claims within the claims section.
+	uint32_t		claims_length;						// Length of the claims without terminator.
+};
+
+
+struct oauth2plugin_TokenStoreSourceEntry {
+	struct oauth2plugin_TokenStoreEntry	entry;	// Entry as written to the index.
+	size_t								line;	// Source line (later lines win).
+};
+
+
+struct oauth2plugin_TokenStoreIndex {
+	struct oauth2plugin_MappedIndex				index;			// Mapped index.
+	const struct oauth2plugin_TokenStoreEntry*	entries;		// Sorted entries.
+	const char*									claims;			// Claims section.
+	uint64_t									claims_size;	// Size of the claims section.
+};
+
+
+struct oauth2plugin_TokenStore {
+	struct oauth2plugin_IndexWatcher*	watcher;	// Compiled index and watcher of the source file.
+	atomic_ulong						hits;		// Lookups answered from the store.
+	atomic_ulong						misses;		// Lookups of unknown or expired tokens.
+	atomic_long							references;	// Configurations using this store.
+};
+
+
+/**
+ * @brief Load a token store and start watching its file.
+ *
+ * The source file is compiled into @p index_path and mapped read-only (see
+ * mappedindex.h). The index is written readable by the broker only, as it
+ * contains the claims.
+ *
+ * @param file_path			Source file.
+ * @param index_path		Compiled index file or NULL for "<file_path>.idx".
+ * @param check_interval	Seconds between checks for changes of the source file (0 = never).
+ * @return					Pointer to a new token store or NULL on failure.
+ */
+struct oauth2plugin_TokenStore* oauth2plugin_initTokenStore(
+	const char* file_path,
+	const char* index_path,
+	long check_interval
+);
+
+
+/**
+ * @brief Take an additional reference to a token store.
+ *
+ * @param store	Token store.
+ * @return		@p store.
+ */
+struct oauth2plugin_TokenStore* oauth2plugin_retainTokenStore(
+	struct oauth2plugin_TokenStore* store
+);
+
+
+/**
+ * @brief Release a reference; the watcher is stopped and the index is unmapped with the last one.
+ *
+ * @param store	Token store created by oauth2plugin_initTokenStore(). May be NULL.
+ */
+void oauth2plugin_freeTokenStore(
+	struct oauth2plugin_TokenStore* store
+);
+
+
+/**
+ * @brief Look up the claims of a token.
+ *
+ * Thread safe: a lookup holds a reference to the current index, so a rebuilt
+ * index published meanwhile does not unmap it.
+ *
+ * @param store			Token store. May be NULL.
+ * @param token_hash	SHA-256 of the token (see oauth2plugin_hashToken()).
+ * @return				Claims (to be released with cJSON_Delete()) or NULL if the token is not in the store or expired.
+ */
+cJSON* oauth2plugin_lookupStoredToken(
+	struct oauth2plugin_TokenStore* store,
+	const unsigned char token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE]
+);
+
+
+/**
+ * @brief Replace the current index with a rebuilt one, if any.
+ *
+ * Must be called from the broker thread (MOSQ_EVT_TICK).
+ *
+ * @param store	Token store. May be NULL.
+ */
+void oauth2plugin_publishTokenStore(
+	struct oauth2plugin_TokenStore* store
+);
+
+
+/**
+ * @brief Parse a source file and build its index in memory (format callback, see mappedindex.h).
+ *
+ * @param file_path		Source file.
+ * @param source_stat	Status of the source file.
+ * @param index_size	Output: size of the index in bytes.
+ * @return				Newly allocated index or NULL on failure. Caller is responsible for freeing it.
+ */
+static uint8_t* oauth2plugin_buildTokenStoreIndex(
+	const char* file_path,
+	const struct stat* source_stat,
+	size_t* index_size
+);
+
+
+/**
+ * @brief Parse the claims of a source line.
+ *
+ * @param text			JSON object.
+ * @param expires_at	Output: "exp" claim or 0.
+ * @return				Newly allocated compact JSON with "active" or NULL if @p text is not a JSON object.
+ */
+static char* oauth2plugin_parseStoredClaims(
+	const char* text,
+	int64_t* expires_at
+);
+
+
+/**
+ * @brief Point the fields of an index into its mapping after checking the header (format callback).
+ *
+ * @param index		Index with the common header fields set.
+ * @return			true if the index is valid.
+ */
+static bool oauth2plugin_attachTokenStoreIndex(
+	struct oauth2plugin_MappedIndex* index
+);
+
+
+/**
+ * @brief qsort() comparator for entries being built: by key, then by source line.
+ *
+ * @param a		First entry.
+ * @param b		Second entry.
+ * @return		Negative, zero or positive.
+ */
+static int oauth2plugin_compareTokenStoreEntries(
+	const void* a,
+	const void* b
+);
+
+#endif // OAUTH2PLUGIN_TOKENSTORE_H
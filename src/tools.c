@@ -101,3 +101,111 @@ void oauth2plugin_freeReplacementMap(
 		map[i].replacement = NULL;
 	}
 }
+
+
+bool oauth2plugin_strEqual(
+	const char* a,
+	const char* b
+) {
+	if (!a || !b) return a == b;
+	return strcmp(a, b) == 0;
+}
+
+
+char* oauth2plugin_base64urlEncode(
+	const unsigned char* input,
+	size_t input_length
+) {
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+	if (!input && input_length > 0) return NULL;
+
+	// Encode
+	char* output = malloc((input_length * 4 + 2) / 3 + 1);
+	if (!output) return NULL;
+	size_t length = 0;
+	unsigned int bits = 0;
+	int bits_count = 0;
+	for (size_t i = 0; i < input_length; i++) {
+		bits = (bits << 8) | input[i];
+		bits_count += 8;
+		while (bits_count >= 6) {
+			bits_count -= 6;
+			output[length++] = alphabet[(bits >> bits_count) & 0x3F];
+		}
+	}
+	if (bits_count > 0) output[length++] = alphabet[(bits << (6 - bits_count)) & 0x3F];
+	output[length] = '\0';
+
+	// Return
+	return output;
+}
+
+
+unsigned char* oauth2plugin_base64urlDecode(
+	const char* input,
+	size_t input_length,
+	size_t* output_length
+) {
+	// Validation
+	if (!input || !output_length) return NULL;
+
+	// Strip padding
+	while (input_length > 0 && input[input_length - 1] == '=') input_length--;
+	if (input_length % 4 == 1) return NULL;
+
+	// Decode
+	unsigned char* output = malloc((input_length * 3) / 4 + 1);
+	if (!output) return NULL;
+	size_t length = 0;
+	unsigned int bits = 0;
+	int bits_count = 0;
+	for (size_t i = 0; i < input_length; i++) {
+		unsigned char c = (unsigned char) input[i];
+		unsigned int value;
+		if (c >= 'A' && c <= 'Z') value = c - 'A';
+		else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+		else if (c >= '0' && c <= '9') value = c - '0' + 52;
+		else if (c == '-' || c == '+') value = 62;
+		else if (c == '_' || c == '/') value = 63;
+		else {
+			free(output);
+			return NULL;
+		}
+		bits = (bits << 6) | value;
+		bits_count += 6;
+		if (bits_count >= 8) {
+			bits_count -= 8;
+			output[length++] = (unsigned char) ((bits >> bits_count) & 0xFF);
+		}
+	}
+	output[length] = '\0';
+
+	// Return
+	*output_length = length;
+	return output;
+}
+
+
+bool oauth2plugin_hashToken(
+	const char* token,
+	unsigned char hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE]
+) {
+	if (!token) return false;
+	unsigned int hash_length = 0;
+	return EVP_Digest(token, strlen(token), hash, &hash_length, EVP_sha256(), NULL) == 1
+		&& hash_length == OAUTH2PLUGIN_TOKEN_HASH_SIZE;
+}
+
+
+void oauth2plugin_hexEncode(
+	const unsigned char* data,
+	size_t length,
+	char* output
+) {
+	static const char digits[] = "0123456789abcdef";
+	for (size_t i = 0; i < length; i++) {
+		output[2 * i] = digits[data[i] >> 4];
+		output[2 * i + 1] = digits[data[i] & 0x0f];
+	}
+	output[2 * length] = '\0';
+}
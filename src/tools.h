@@ -11,6 +11,12 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include <openssl/evp.h>
+
+
+#define OAUTH2PLUGIN_TOKEN_HASH_SIZE 32				// SHA-256
+#define OAUTH2PLUGIN_TOKEN_HASH_HEX_SIZE 65			// Hex digits + null terminator
+
 
 struct oauth2plugin_strReplacementMap {
 	const char* needle;
@@ -62,4 +68,79 @@ void oauth2plugin_freeReplacementMap(
 	size_t map_count
 );
 
+
+
+/**
+ * @brief Compare two strings, treating NULL as a valid value.
+ *
+ * @param a		First string. May be NULL.
+ * @param b		Second string. May be NULL.
+ * @return		true if both are NULL or both are equal strings.
+ */
+bool oauth2plugin_strEqual(
+	const char* a,
+	const char* b
+);
+
+
+/**
+ * @brief Encode data as base64url (RFC 4648, section 5) without padding.
+ *
+ * @param input			Input data.
+ * @param input_length	Number of bytes in @p input.
+ * @return				Newly allocated, null terminated string or NULL if allocation fails. Caller is responsible for freeing it.
+ */
+char* oauth2plugin_base64urlEncode(
+	const unsigned char* input,
+	size_t input_length
+);
+
+
+/**
+ * @brief Decode a base64url (RFC 4648, section 5) string without padding.
+ *
+ * Standard base64 characters ('+', '/') and trailing '=' padding are accepted as well.
+ *
+ * @param input			Input string.
+ * @param input_length	Number of characters in @p input.
+ * @param output_length	Output: number of decoded bytes (without the terminating null byte).
+ * @return				Newly allocated, null terminated buffer or NULL if @p input is not valid base64url. Caller is responsible for freeing it.
+ */
+unsigned char* oauth2plugin_base64urlDecode(
+	const char* input,
+	size_t input_length,
+	size_t* output_length
+);
+
+
+
+/**
+ * @brief Hash a token with SHA-256.
+ *
+ * Used wherever tokens have to be identified without storing them (traces,
+ * revocation lists, caches).
+ *
+ * @param token		Token.
+ * @param hash		Output: OAUTH2PLUGIN_TOKEN_HASH_SIZE bytes.
+ * @return			true on success.
+ */
+bool oauth2plugin_hashToken(
+	const char* token,
+	unsigned char hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE]
+);
+
+
+/**
+ * @brief Encode bytes as lowercase hex string.
+ *
+ * @param data		Input bytes.
+ * @param length	Number of bytes in @p data.
+ * @param output	Output buffer with room for 2 * @p length + 1 characters.
+ */
+void oauth2plugin_hexEncode(
+	const unsigned char* data,
+	size_t length,
+	char* output
+);
+
 #endif // OAUTH2PLUGIN_TOOLS_H
\ No newline at end of file
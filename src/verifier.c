@@ -0,0 +1,233 @@
+/**
+ * verifier.c
+ *
+ * Chain of verifier stages ordered by cost: the first stage that knows a
+ * token decides, later (more expensive) stages are not asked
+ */
+
+#include "verifier.h"
+#include "auth.h"
+
+
+static const struct oauth2plugin_VerifierStage oauth2plugin_verifier_stages[verifier_COUNT] = {
+	[verifier_INTROSPECTION] = { "introspection", true, oauth2plugin_verifyWithIntrospection },
+	[verifier_SIDECAR] = { "sidecar", true, oauth2plugin_verifyWithSidecar },
+	[verifier_STORE] = { "store", false, oauth2plugin_verifyWithStore }
+};
+
+
+int oauth2plugin_initVerifierChain(
+	struct oauth2plugin_Options* options
+) {
+	const char* profile_name = options->name ? options->name : "<Default>";
+	options->verifier_stages_count = 0;
+
+	// Default: token store (if any), then the verifier
+	if (!options->verifier_chain) {
+		if (options->token_store_file) options->verifier_stages[options->verifier_stages_count++] = verifier_STORE;
+		options->verifier_stages[options->verifier_stages_count++] = options->verifier;
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	// Parse comma separated stage names
+	const char* position = options->verifier_chain;
+	while (*position) {
+		while (*position == ',' || isspace((unsigned char) *position)) position++;
+		if (!*position) break;
+		size_t length = 0;
+		while (position[length] && position[length] != ',' && !isspace((unsigned char) position[length])) length++;
+
+		// Look up stage
+		size_t stage = 0;
+		while (
+			stage < verifier_COUNT
+			&& (
+				strlen(oauth2plugin_verifier_stages[stage].name) != length
+				|| strncmp(oauth2plugin_verifier_stages[stage].name, position, length) != 0
+			)
+		) stage++;
+		if (stage == verifier_COUNT) {
+			OAUTH2PLUGIN_LOG_ERROR("Unknown verifier '%.*s' in verifier chain (Profile: %s).", (int) length, position, profile_name);
+			return MOSQ_ERR_UNKNOWN;
+		}
+		if (oauth2plugin_hasVerifierStage(options, (enum oauth2plugin_Options_verifier) stage)) {
+			OAUTH2PLUGIN_LOG_ERROR("Verifier '%s' appears twice in verifier chain (Profile: %s).", oauth2plugin_verifier_stages[stage].name, profile_name);
+			return MOSQ_ERR_UNKNOWN;
+		}
+		if (stage == verifier_STORE && !options->token_store_file) {
+			OAUTH2PLUGIN_LOG_ERROR("Verifier 'store' requires 'plugin_opt_token_store_file' (Profile: %s).", profile_name);
+			return MOSQ_ERR_UNKNOWN;
+		}
+		options->verifier_stages[options->verifier_stages_count++] = (enum oauth2plugin_Options_verifier) stage;
+		position += length;
+	}
+	if (options->verifier_stages_count == 0) {
+		OAUTH2PLUGIN_LOG_ERROR("Verifier chain is empty (Profile: %s).", profile_name);
+		return MOSQ_ERR_UNKNOWN;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+bool oauth2plugin_hasVerifierStage(
+	const struct oauth2plugin_Options* options,
+	enum oauth2plugin_Options_verifier stage
+) {
+	for (size_t i = 0; i < options->verifier_stages_count; i++) {
+		if (options->verifier_stages[i] == stage) return true;
+	}
+	return false;
+}
+
+
+char* oauth2plugin_formatVerifierChain(
+	const struct oauth2plugin_Options* options,
+	char* buffer,
+	size_t size
+) {
+	size_t length = 0;
+	buffer[0] = '\0';
+	for (size_t i = 0; i < options->verifier_stages_count && length < size; i++) {
+		int written = snprintf(buffer + length, size - length, "%s%s", i > 0 ? " -> " : "", oauth2plugin_verifier_stages[options->verifier_stages[i]].name);
+		if (written < 0) break;
+		length += (size_t) written;
+	}
+	return buffer;
+}
+
+
+int oauth2plugin_runVerifierChain(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_VerifierRequest* request,
+	struct oauth2plugin_VerifierResponse* response
+) {
+	int error = MOSQ_ERR_SUCCESS;
+	for (size_t i = 0; i < options->verifier_stages_count; i++) {
+		enum oauth2plugin_Options_verifier stage = options->verifier_stages[i];
+		const struct oauth2plugin_VerifierStage* verifier = &oauth2plugin_verifier_stages[stage];
+		response->stage = stage;
+		response->remote = response->remote || verifier->remote;
+		free(response->response);
+		response->response = NULL;
+
+		// Run stage
+		int64_t stage_start = oauth2plugin_getMonotonicTime();
+		int stage_error = verifier->verify(options, request, response);
+		int64_t duration = oauth2plugin_getMonotonicTime() - stage_start;
+		const char* outcome = stage_error ? "failure" : response->claims ? "hit" : "miss";
+		OAUTH2PLUGIN_PROBE3(verifier__done, verifier->name, outcome, duration);
+		if (options->verifier_stats) {
+			struct oauth2plugin_VerifierStats* stats = &options->verifier_stats[stage];
+			atomic_fetch_add_explicit(&stats->calls, 1, memory_order_relaxed);
+			atomic_fetch_add_explicit(&stats->latency, (unsigned long) duration, memory_order_relaxed);
+			atomic_fetch_add_explicit(stage_error ? &stats->failures : response->claims ? &stats->hits : &stats->misses, 1, memory_order_relaxed);
+		}
+
+		// The first stage that knows the token decides
+		if (!stage_error && response->claims) return MOSQ_ERR_SUCCESS;
+		if (stage_error) {
+			error = stage_error;
+			if (i + 1 < options->verifier_stages_count) OAUTH2PLUGIN_LOG_DEBUG("Verifier '%s' failed, falling back to '%s' (MQTT Client ID: %s).", verifier->name, oauth2plugin_verifier_stages[options->verifier_stages[i + 1]].name, request->client_id);
+		}
+	}
+	if (error) return error;
+
+	// No stage knows the token
+	response->claims = cJSON_CreateObject();
+	if (!response->claims || !cJSON_AddBoolToObject(response->claims, "active", false)) {
+		cJSON_Delete(response->claims);
+		response->claims = NULL;
+		response->reason = audit_reason_INTROSPECTION_FAILED;
+		return MOSQ_ERR_NOMEM;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int oauth2plugin_verifyWithStore(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_VerifierRequest* request,
+	struct oauth2plugin_VerifierResponse* response
+) {
+	// Reuse the hash of the revocation check
+	unsigned char token_hash[OAUTH2PLUGIN_TOKEN_HASH_SIZE];
+	if (request->token_hash) memcpy(token_hash, request->token_hash, OAUTH2PLUGIN_TOKEN_HASH_SIZE);
+	else if (!oauth2plugin_hashToken(request->token, token_hash)) return MOSQ_ERR_SUCCESS;
+
+	response->claims = oauth2plugin_lookupStoredToken(options->token_store, token_hash);
+	if (response->claims) {
+		OAUTH2PLUGIN_LOG_DEBUG("Token found in static token store (MQTT Client ID: %s).", request->client_id);
+		if (request->capture) response->response = cJSON_PrintUnformatted(response->claims);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int oauth2plugin_verifyWithSidecar(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_VerifierRequest* request,
+	struct oauth2plugin_VerifierResponse* response
+) {
+	response->reason = audit_reason_INTROSPECTION_FAILED;
+	if (!options->sidecar) return MOSQ_ERR_NOT_SUPPORTED;
+
+	// Ask the sidecar, requesting only the claims needed by the caller
+	int error = oauth2plugin_verifySidecarToken(
+		options->sidecar,
+		request->token,
+		request->claim_names,
+		request->claim_count,
+		&response->claims
+	);
+	if (request->capture && response->claims) response->response = cJSON_PrintUnformatted(response->claims);
+	if (error) {
+		cJSON_Delete(response->claims);
+		response->claims = NULL;
+	}
+	return error;
+}
+
+
+static int oauth2plugin_verifyWithIntrospection(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_VerifierRequest* request,
+	struct oauth2plugin_VerifierResponse* response
+) {
+	response->reason = audit_reason_INTROSPECTION_FAILED;
+	if (!options->introspection_endpoint) return MOSQ_ERR_NOT_SUPPORTED;
+
+	// Call introspection endpoint
+	struct oauth2plugin_CURLBuffer buffer = { .data = NULL, .size = 0 };
+	int error = oauth2plugin_callIntrospectionEndpoint(
+		options->http_pool,
+		options->introspection_endpoint,
+		options->client_id,
+		options->client_secret,
+		options->credentials,
+		request->token,
+		options->tls_verification,
+		options->timeout,
+		&buffer,
+		&response->http_code
+	);
+
+	// Check for error or empty response data
+	if (error || !buffer.data) {
+		if (request->capture) response->response = buffer.data;
+		else free(buffer.data);
+		return error ? error : MOSQ_ERR_UNKNOWN;
+	}
+
+	// Parse JSON
+	OAUTH2PLUGIN_PROBE1(parse__start, (int64_t) buffer.size);
+	response->claims = cJSON_Parse(buffer.data);
+	OAUTH2PLUGIN_PROBE1(parse__done, response->claims != NULL);
+	if (request->capture) response->response = buffer.data;
+	else free(buffer.data);
+	if (!response->claims) {
+		OAUTH2PLUGIN_LOG_WARNING("Failed to parse data from introspection endpoint (MQTT Client ID: %s).", request->client_id);
+		response->reason = audit_reason_PARSING_FAILED;
+		return MOSQ_ERR_UNKNOWN;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
@@ -0,0 +1,184 @@
+/**
+ * verifier.h
+ *
+ * Chain of verifier stages ordered by cost: the first stage that knows a
+ * token decides, later (more expensive) stages are not asked
+ *
+ * Stages ("plugin_opt_verifier_chain", comma separated):
+ *   store			Static token store (memory-mapped lookup, see tokenstore.h)
+ *   sidecar		Sidecar verification over a Unix domain socket
+ *   introspection	RFC 7662 introspection endpoint of the IdP
+ *
+ * Every stage answers with introspection-like claims ({"active": bool, ...}),
+ * passes the token on because it does not know it (miss) or fails. A failed
+ * stage passes the token on as well; the last failure decides if no later
+ * stage answers. A token that all stages miss is inactive.
+ */
+
+#ifndef OAUTH2PLUGIN_VERIFIER_H
+#define OAUTH2PLUGIN_VERIFIER_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include "cJSON.h"
+
+#include "options.h"
+#include "tools.h"
+#include "audit.h"
+#include "tokenstore.h"
+#include "sidecar.h"
+#include "probes.h"
+#include "log.h"
+
+
+struct oauth2plugin_VerifierStats {
+	atomic_ulong	calls;		// Tokens passed to the stage.
+	atomic_ulong	hits;		// Tokens the stage answered (active or not).
+	atomic_ulong	misses;		// Tokens passed on because the stage does not know them.
+	atomic_ulong	failures;	// Tokens passed on or denied because the stage failed.
+	atomic_ulong	latency;	// Total time spent in the stage in microseconds.
+};
+
+
+struct oauth2plugin_VerifierRequest {
+	const char*				token;			// Token supplied by the MQTT client.
+	const unsigned char*	token_hash;		// SHA-256 of @p token (NULL = computed when needed).
+	const char*				username;		// MQTT username. May be NULL.
+	const char*				client_id;		// MQTT client id (log messages only).
+	const char* const*		claim_names;	// Claims needed by the caller (the sidecar returns only these).
+	size_t					claim_count;	// Number of entries in claim_names.
+	bool					capture;		// Return the raw response of the deciding stage.
+};
+
+
+struct oauth2plugin_VerifierResponse {
+	cJSON*								claims;		// Introspection-like claims (NULL on failure).
+	enum oauth2plugin_Options_verifier	stage;		// Last stage asked (the one that answered, if any).
+	bool								remote;		// Whether a stage left the process (sidecar or endpoint).
+	long								http_code;	// HTTP status code of the introspection endpoint (0 if not called).
+	uint8_t								reason;		// enum oauth2plugin_AuditReason if verification failed.
+	char*								response;	// Raw response of @p stage (request->capture only). Caller is responsible for freeing it.
+};
+
+
+struct oauth2plugin_VerifierStage {
+	const char*	name;	// Name in verifier_chain.
+	bool		remote;	// Stage leaves the process.
+	int			(*verify)(struct oauth2plugin_Options*, const struct oauth2plugin_VerifierRequest*, struct oauth2plugin_VerifierResponse*);	// MOSQ_ERR_SUCCESS with claims (hit) or without (miss), or a mosquitto error code.
+};
+
+
+/**
+ * @brief Compile verifier_chain of a profile into verifier_stages.
+ *
+ * Without verifier_chain, the chain is "store" (if token_store_file is set)
+ * followed by verifier.
+ *
+ * @param options	Profile with all options applied.
+ * @return			MOSQ_ERR_SUCCESS on success or MOSQ_ERR_UNKNOWN if the chain is invalid (logged).
+ */
+int oauth2plugin_initVerifierChain(
+	struct oauth2plugin_Options* options
+);
+
+
+/**
+ * @brief Check whether a profile's chain contains a stage.
+ *
+ * @param options	Profile with a compiled chain.
+ * @param stage		Stage.
+ * @return			true if @p stage is part of the chain.
+ */
+bool oauth2plugin_hasVerifierStage(
+	const struct oauth2plugin_Options* options,
+	enum oauth2plugin_Options_verifier stage
+);
+
+
+/**
+ * @brief Format the chain of a profile for log output.
+ *
+ * @param options	Profile with a compiled chain.
+ * @param buffer	Output: stage names separated by " -> ".
+ * @param size		Size of @p buffer.
+ * @return			@p buffer.
+ */
+char* oauth2plugin_formatVerifierChain(
+	const struct oauth2plugin_Options* options,
+	char* buffer,
+	size_t size
+);
+
+
+/**
+ * @brief Verify a token with the stages of a profile in order.
+ *
+ * Thread safe. Latency and outcome of every stage are added to
+ * options->verifier_stats (if set) and reported by the verifier__done probe.
+ *
+ * @param options	Profile.
+ * @param request	Token and what the caller needs.
+ * @param response	Output: claims of the deciding stage, or the reason of the last failure.
+ * @return			MOSQ_ERR_SUCCESS if response->claims is set, otherwise the mosquitto error code of the last failed stage.
+ */
+int oauth2plugin_runVerifierChain(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_VerifierRequest* request,
+	struct oauth2plugin_VerifierResponse* response
+);
+
+
+/**
+ * @brief Stage "store": look the token up in the static token store.
+ *
+ * @param options	Profile.
+ * @param request	Token.
+ * @param response	Output: stored claims.
+ * @return			MOSQ_ERR_SUCCESS (miss if the token is not stored or expired).
+ */
+static int oauth2plugin_verifyWithStore(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_VerifierRequest* request,
+	struct oauth2plugin_VerifierResponse* response
+);
+
+
+/**
+ * @brief Stage "sidecar": ask the sidecar.
+ *
+ * @param options	Profile.
+ * @param request	Token and claim names.
+ * @param response	Output: claims returned by the sidecar.
+ * @return			MOSQ_ERR_SUCCESS or a mosquitto error code if the sidecar failed.
+ */
+static int oauth2plugin_verifyWithSidecar(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_VerifierRequest* request,
+	struct oauth2plugin_VerifierResponse* response
+);
+
+
+/**
+ * @brief Stage "introspection": call the introspection endpoint and parse its response.
+ *
+ * @param options	Profile.
+ * @param request	Token.
+ * @param response	Output: parsed response and HTTP status code.
+ * @return			MOSQ_ERR_SUCCESS or a mosquitto error code if the request failed or the response is not JSON.
+ */
+static int oauth2plugin_verifyWithIntrospection(
+	struct oauth2plugin_Options* options,
+	const struct oauth2plugin_VerifierRequest* request,
+	struct oauth2plugin_VerifierResponse* response
+);
+
+#endif // OAUTH2PLUGIN_VERIFIER_H
@@ -0,0 +1,157 @@
+/**
+ * broker_stub.c
+ *
+ * Minimal stand-in for the Mosquitto broker functions used by the plugin
+ */
+
+#include "broker_stub.h"
+
+
+bool brokerstub_verbose = false;
+unsigned long brokerstub_kicks = 0;
+unsigned long brokerstub_publishes = 0;
+
+
+struct mosquitto* brokerstub_createClient(
+	const char* id,
+	const char* username,
+	int port
+) {
+	struct mosquitto* client = calloc(1, sizeof(*client));
+	if (!client) return NULL;
+	client->id = strdup(id ? id : "");
+	client->username = username ? strdup(username) : NULL;
+	client->port = port;
+	if (!client->id || (username && !client->username)) {
+		brokerstub_freeClient(client);
+		return NULL;
+	}
+	return client;
+}
+
+
+void brokerstub_freeClient(
+	struct mosquitto* client
+) {
+	if (!client) return;
+	free(client->id);
+	free(client->username);
+	free(client);
+}
+
+
+void mosquitto_log_printf(
+	int level,
+	const char* fmt,
+	...
+) {
+	(void) level;
+	if (!brokerstub_verbose) return;
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+
+const char* mosquitto_client_id(
+	const struct mosquitto* client
+) {
+	return client ? client->id : NULL;
+}
+
+
+const char* mosquitto_client_username(
+	const struct mosquitto* client
+) {
+	return client ? client->username : NULL;
+}
+
+
+int mosquitto_set_username(
+	struct mosquitto* client,
+	const char* username
+) {
+	if (!client) return MOSQ_ERR_INVAL;
+	char* copy = username ? strdup(username) : NULL;
+	if (username && !copy) return MOSQ_ERR_NOMEM;
+	free(client->username);
+	client->username = copy;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+#if LIBMOSQUITTO_MAJOR > 2 || (LIBMOSQUITTO_MAJOR == 2 && LIBMOSQUITTO_MINOR >= 1)
+int mosquitto_client_port(
+	const struct mosquitto* client
+) {
+	return client ? client->port : 0;
+}
+#endif
+
+
+int mosquitto_kick_client_by_clientid(
+	const char* clientid,
+	bool with_will
+) {
+	(void) with_will;
+	if (!clientid) return MOSQ_ERR_INVAL;
+	brokerstub_kicks++;
+	if (brokerstub_verbose) fprintf(stderr, "Kicked client %s\n", clientid);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int mosquitto_broker_publish_copy(
+	const char* clientid,
+	const char* topic,
+	int payloadlen,
+	const void* payload,
+	int qos,
+	bool retain,
+	mosquitto_property* properties
+) {
+	(void) clientid; (void) qos; (void) retain; (void) properties;
+	if (!topic || payloadlen < 0) return MOSQ_ERR_INVAL;
+	brokerstub_publishes++;
+	if (brokerstub_verbose) fprintf(stderr, "Published to %s: %.*s\n", topic, payloadlen, (const char*) payload);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int mosquitto_callback_register(
+	mosquitto_plugin_id_t* identifier,
+	int event,
+	MOSQ_FUNC_generic_callback cb_func,
+	const void* event_data,
+	void* userdata
+) {
+	(void) identifier; (void) event; (void) event_data; (void) userdata;
+	return cb_func ? MOSQ_ERR_SUCCESS : MOSQ_ERR_INVAL;
+}
+
+
+int mosquitto_callback_unregister(
+	mosquitto_plugin_id_t* identifier,
+	int event,
+	MOSQ_FUNC_generic_callback cb_func,
+	const void* event_data
+) {
+	(void) identifier; (void) event; (void) event_data;
+	return cb_func ? MOSQ_ERR_SUCCESS : MOSQ_ERR_INVAL;
+}
+
+
+const char* mosquitto_strerror(
+	int mosq_errno
+) {
+	switch (mosq_errno) {
+		case MOSQ_ERR_SUCCESS: return "No error.";
+		case MOSQ_ERR_NOMEM: return "Out of memory.";
+		case MOSQ_ERR_INVAL: return "Invalid function arguments provided.";
+		case MOSQ_ERR_AUTH: return "Authentication failed.";
+		case MOSQ_ERR_PLUGIN_DEFER: return "Plugin deferred.";
+		default: return "Unknown error.";
+	}
+}
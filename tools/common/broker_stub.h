@@ -0,0 +1,59 @@
+/**
+ * broker_stub.h
+ *
+ * Minimal stand-in for the Mosquitto broker functions used by the plugin, so
+ * the plugin sources (all of src/ except plugin.c) can be linked into
+ * standalone tools.
+ */
+
+#ifndef OAUTH2PLUGIN_BROKER_STUB_H
+#define OAUTH2PLUGIN_BROKER_STUB_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+
+
+struct mosquitto {
+	char*	id;			// Client id.
+	char*	username;	// Username (replaced by mosquitto_set_username()).
+	int		port;		// Listener port.
+};
+
+
+extern bool brokerstub_verbose;			// Print plugin log messages to stderr.
+extern unsigned long brokerstub_kicks;	// Clients disconnected with mosquitto_kick_client_by_clientid().
+extern unsigned long brokerstub_publishes;	// Messages published with mosquitto_broker_publish_copy().
+
+
+/**
+ * @brief Create a fake client.
+ *
+ * @param id		Client id.
+ * @param username	Username. May be NULL.
+ * @param port		Listener port.
+ * @return			Newly allocated client or NULL on failure. Free it with brokerstub_freeClient().
+ */
+struct mosquitto* brokerstub_createClient(
+	const char* id,
+	const char* username,
+	int port
+);
+
+
+/**
+ * @brief Free a fake client.
+ *
+ * @param client	Client. May be NULL.
+ */
+void brokerstub_freeClient(
+	struct mosquitto* client
+);
+
+#endif // OAUTH2PLUGIN_BROKER_STUB_H
@@ -0,0 +1,749 @@
+/**
+ * loadtest.c
+ *
+ * Connect storm against a broker running the plugin: open many MQTT
+ * connections at a configurable rate with tokens minted by a bundled mock
+ * identity provider and report CONNACK latency, authentication failures and
+ * the publish round trip latency of steady-state probe clients.
+ *
+ * Build (from the repository root):
+ *   gcc -std=gnu2x -O2 -Itools/loadtest -I/usr/local/include -I/usr/include/cjson \
+ *       -o oauth2-loadtest tools/loadtest/loadtest.c tools/loadtest/mock_idp.c \
+ *       -lmosquitto -lcjson -lpthread -lcrypto
+ *
+ * Usage:
+ *   oauth2-loadtest [-h host] [-p port] [-n connections] [-r rate] [-t tokens] [-x revoked_rate]
+ *                   [-P probes] [-I probe_interval] [-q probe_qos] [-b baseline] [-H hold] [-T timeout]
+ *                   [-i idp_port] [-k key_file] [-l idp_latency] [-j idp_jitter] [-f idp_failure_rate]
+ *                   [-d idp_drop_rate] [-e token_lifetime] [-v]
+ *
+ *   -h host				Broker host (default 127.0.0.1).
+ *   -p port				Broker port (default 1883).
+ *   -n connections		Connections opened by the storm (default 1000).
+ *   -r rate				Connections opened per second (default 100, 0 = all at once).
+ *   -t tokens			Distinct tokens shared by the connections (default one per connection).
+ *   -x revoked_rate		Fraction of tokens the mock IdP reports inactive (default 0).
+ *   -P probes			Steady-state probe clients (default 4).
+ *   -I probe_interval	Milliseconds between probe publishes (default 100).
+ *   -q probe_qos			QoS of probe publishes (default 0).
+ *   -b baseline			Seconds probes run before the storm (default 3).
+ *   -H hold				Seconds connections are held after the storm (default 5).
+ *   -T timeout			Seconds to wait for a CONNACK (default 30).
+ *   -i idp_port			Port of the mock IdP on 127.0.0.1 (default 18080).
+ *   -k key_file			PEM RSA private key of the mock IdP (default: new key per run).
+ *   -l idp_latency		Milliseconds the mock IdP takes per introspection (default 0).
+ *   -j idp_jitter		Uniformly distributed extra milliseconds (default 0).
+ *   -f idp_failure_rate	Fraction of introspections answered with HTTP 500 (default 0).
+ *   -d idp_drop_rate		Fraction of introspections dropped without response (default 0).
+ *   -e token_lifetime	Seconds until minted tokens expire (default 3600).
+ *   -v					Print a line per second of the storm.
+ *
+ * The broker must verify tokens against the mock IdP, e.g. with
+ * plugin_opt_introspection_endpoint http://127.0.0.1:18080/introspect or
+ * plugin_opt_issuer http://127.0.0.1:18080. Clients connect with MQTT 3.1.1,
+ * the token as password and its subject as username.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include <mosquitto.h>
+
+#include "mock_idp.h"
+
+
+#define LOADTEST_KEEPALIVE 60
+#define LOADTEST_PROBE_READY_TIMEOUT 10000000		// Microseconds probes have to connect and subscribe.
+
+
+enum loadtest_State {
+	loadtest_state_IDLE,			// Not opened yet.
+	loadtest_state_CONNECTING,		// CONNECT sent, waiting for the CONNACK.
+	loadtest_state_CONNECTED,		// CONNACK accepted.
+	loadtest_state_REFUSED,			// CONNACK refused.
+	loadtest_state_FAILED,			// Connection failed or closed before the CONNACK.
+	loadtest_state_TIMEOUT,			// No CONNACK within the timeout.
+	loadtest_state_DROPPED			// Closed by the broker after an accepted CONNACK.
+};
+
+
+enum loadtest_Phase {
+	loadtest_phase_BASELINE,		// Probes only.
+	loadtest_phase_STORM,			// Connections are opened or wait for their CONNACK.
+	loadtest_phase_HOLD,			// All connections answered and are held open.
+	loadtest_phase_COUNT
+};
+
+
+struct loadtest_Group;
+
+
+struct loadtest_Client {
+	struct loadtest_Group*	group;			// Group the client belongs to.
+	struct mosquitto*		mosq;			// Client (NULL unless connecting or connected).
+	enum loadtest_State		state;			// Connection state.
+	int						rc;				// CONNACK return code.
+	bool					revoked;		// Token is expected to be refused.
+	bool					subscribe_sent;	// Probe: SUBSCRIBE sent.
+	bool					subscribed;		// Probe: SUBACK received.
+	bool					reported;		// Probe: counted as ready or failed.
+	const char*				username;		// MQTT username (token subject).
+	const char*				token;			// MQTT password.
+	int64_t					started_at;		// Monotonic time connecting started in microseconds.
+	int64_t					connack_at;		// Monotonic time of the CONNACK in microseconds.
+	char					id[40];			// MQTT client id.
+	char					topic[56];		// Probe: topic published to and subscribed.
+};
+
+
+struct loadtest_Samples {
+	int64_t*				values;			// Latencies in microseconds.
+	size_t					count;			// Number of values.
+	size_t					size;			// Allocated values.
+};
+
+
+struct loadtest_Group {
+	struct loadtest_Client*	clients;		// Clients.
+	size_t					count;			// Number of clients.
+	const char*				host;			// Broker host.
+	int						port;			// Broker port.
+	size_t					connecting;		// Clients waiting for their CONNACK.
+	size_t					dropped;		// Clients closed by the broker after their CONNACK.
+	struct pollfd*			fds;			// Poll set (one entry per client).
+	size_t*					indexes;		// Client index of each poll set entry.
+};
+
+
+struct loadtest_Probes {
+	struct loadtest_Group	group;			// Probe clients (first member: clients find their probes through it).
+	pthread_t				thread;			// Probe loop.
+	int64_t					interval;		// Microseconds between publishes.
+	int						qos;			// QoS of publishes.
+	atomic_int				phase;			// Current phase (set by the storm).
+	atomic_bool				stop;			// Probe loop shall exit.
+	atomic_size_t			ready;			// Probes connected and subscribed.
+	atomic_size_t			failed;			// Probes that could not connect.
+	struct loadtest_Samples	rtt[loadtest_phase_COUNT];		// Round trip latencies by phase of the publish.
+	unsigned long			sent[loadtest_phase_COUNT];		// Publishes by phase.
+	unsigned long			received[loadtest_phase_COUNT];	// Received publishes by phase of the publish.
+};
+
+
+/**
+ * @brief Monotonic time in microseconds.
+ */
+static int64_t loadtest_getMonotonicTime(
+	void
+) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+/**
+ * @brief Append a latency.
+ */
+static void loadtest_addSample(
+	struct loadtest_Samples* samples,
+	int64_t value
+) {
+	if (samples->count == samples->size) {
+		size_t size = samples->size ? samples->size * 2 : 1024;
+		int64_t* values = realloc(samples->values, size * sizeof(*values));
+		if (!values) return;
+		samples->values = values;
+		samples->size = size;
+	}
+	samples->values[samples->count++] = value;
+}
+
+
+/**
+ * @brief Sort helper for latencies.
+ */
+static int loadtest_compareLatency(
+	const void* a,
+	const void* b
+) {
+	int64_t x = *(const int64_t*) a;
+	int64_t y = *(const int64_t*) b;
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * @brief Print percentiles of a latency array (sorted in place).
+ */
+static void loadtest_printLatencies(
+	const char* label,
+	int64_t* latencies,
+	size_t count
+) {
+	if (count == 0) {
+		printf("%-26s no samples\n", label);
+		return;
+	}
+	qsort(latencies, count, sizeof(*latencies), loadtest_compareLatency);
+	printf(
+		"%-26s p50 %8.3f ms   p90 %8.3f ms   p99 %8.3f ms   p99.9 %8.3f ms   max %8.3f ms\n",
+		label,
+		latencies[count * 50 / 100] / 1000.0,
+		latencies[count * 90 / 100] / 1000.0,
+		latencies[count * 99 / 100] / 1000.0,
+		latencies[count * 999 / 1000] / 1000.0,
+		latencies[count - 1] / 1000.0
+	);
+}
+
+
+/**
+ * @brief libmosquitto CONNACK callback.
+ */
+static void loadtest_callback_connect(
+	struct mosquitto* mosq,
+	void* userdata,
+	int rc
+) {
+	struct loadtest_Client* client = (struct loadtest_Client*) userdata;
+	if (client->state != loadtest_state_CONNECTING) return;
+	client->connack_at = loadtest_getMonotonicTime();
+	client->rc = rc;
+	client->state = rc == 0 ? loadtest_state_CONNECTED : loadtest_state_REFUSED;
+	client->group->connecting--;
+}
+
+
+/**
+ * @brief libmosquitto SUBACK callback (probes).
+ */
+static void loadtest_callback_subscribe(
+	struct mosquitto* mosq,
+	void* userdata,
+	int mid,
+	int qos_count,
+	const int* granted_qos
+) {
+	struct loadtest_Client* client = (struct loadtest_Client*) userdata;
+	struct loadtest_Probes* probes = (struct loadtest_Probes*) client->group;
+	if (client->reported) return;
+	client->reported = true;
+	client->subscribed = qos_count > 0 && granted_qos[0] <= 2;
+	atomic_fetch_add(client->subscribed ? &probes->ready : &probes->failed, 1);
+}
+
+
+/**
+ * @brief libmosquitto message callback (probes): record the round trip latency.
+ */
+static void loadtest_callback_message(
+	struct mosquitto* mosq,
+	void* userdata,
+	const struct mosquitto_message* message
+) {
+	struct loadtest_Client* client = (struct loadtest_Client*) userdata;
+	struct loadtest_Probes* probes = (struct loadtest_Probes*) client->group;
+
+	// Payload "<phase> <monotonic time of publish>"
+	char payload[64];
+	if (message->payloadlen <= 0 || (size_t) message->payloadlen >= sizeof(payload)) return;
+	memcpy(payload, message->payload, (size_t) message->payloadlen);
+	payload[message->payloadlen] = '\0';
+	int phase;
+	long long published_at;
+	if (sscanf(payload, "%d %lld", &phase, &published_at) != 2 || phase < 0 || phase >= loadtest_phase_COUNT) return;
+	loadtest_addSample(&probes->rtt[phase], loadtest_getMonotonicTime() - (int64_t) published_at);
+	probes->received[phase]++;
+}
+
+
+/**
+ * @brief Create a client and start connecting without waiting for the TCP handshake or CONNACK.
+ */
+static void loadtest_openClient(
+	struct loadtest_Client* client
+) {
+	struct loadtest_Group* group = client->group;
+	client->started_at = loadtest_getMonotonicTime();
+	client->mosq = mosquitto_new(client->id, true, client);
+	if (!client->mosq) {
+		client->state = loadtest_state_FAILED;
+		return;
+	}
+	mosquitto_username_pw_set(client->mosq, client->username, client->token);
+	mosquitto_connect_callback_set(client->mosq, loadtest_callback_connect);
+	mosquitto_subscribe_callback_set(client->mosq, loadtest_callback_subscribe);
+	mosquitto_message_callback_set(client->mosq, loadtest_callback_message);
+	if (mosquitto_connect_async(client->mosq, group->host, group->port, LOADTEST_KEEPALIVE) != MOSQ_ERR_SUCCESS) {
+		mosquitto_destroy(client->mosq);
+		client->mosq = NULL;
+		client->state = loadtest_state_FAILED;
+		return;
+	}
+	client->state = loadtest_state_CONNECTING;
+	group->connecting++;
+}
+
+
+/**
+ * @brief Release a client.
+ *
+ * @param reason	loadtest_state_FAILED (connection lost), loadtest_state_TIMEOUT (no CONNACK)
+ *					or loadtest_state_IDLE (closed by the load test).
+ */
+static void loadtest_closeClient(
+	struct loadtest_Client* client,
+	enum loadtest_State reason
+) {
+	struct loadtest_Group* group = client->group;
+	if (client->state == loadtest_state_CONNECTING) {
+		client->state = reason == loadtest_state_IDLE ? loadtest_state_FAILED : reason;
+		group->connecting--;
+	} else if (client->state == loadtest_state_CONNECTED && reason != loadtest_state_IDLE) {
+		client->state = loadtest_state_DROPPED;
+		group->dropped++;
+	}
+	if (client->mosq) mosquitto_destroy(client->mosq);
+	client->mosq = NULL;
+}
+
+
+/**
+ * @brief Wait for socket events of the open clients of a group and process them.
+ */
+static void loadtest_serviceGroup(
+	struct loadtest_Group* group,
+	int timeout
+) {
+	// Poll set of open clients
+	nfds_t fds_count = 0;
+	for (size_t i = 0; i < group->count; i++) {
+		struct loadtest_Client* client = &group->clients[i];
+		if (!client->mosq) continue;
+		int socket = mosquitto_socket(client->mosq);
+		if (socket < 0) continue;
+		group->fds[fds_count].fd = socket;
+		group->fds[fds_count].events = POLLIN | (mosquitto_want_write(client->mosq) ? POLLOUT : 0);
+		group->fds[fds_count].revents = 0;
+		group->indexes[fds_count] = i;
+		fds_count++;
+	}
+	if (fds_count == 0) {
+		if (timeout > 0) usleep((useconds_t) timeout * 1000);
+		return;
+	}
+
+	// Read and write (callbacks update the client state)
+	if (poll(group->fds, fds_count, timeout) <= 0) return;
+	for (nfds_t i = 0; i < fds_count; i++) {
+		if (!group->fds[i].revents) continue;
+		struct loadtest_Client* client = &group->clients[group->indexes[i]];
+		int rc = MOSQ_ERR_SUCCESS;
+		if (group->fds[i].revents & (POLLIN | POLLERR | POLLHUP)) rc = mosquitto_loop_read(client->mosq, 1);
+		if (rc == MOSQ_ERR_SUCCESS && (group->fds[i].revents & POLLOUT)) rc = mosquitto_loop_write(client->mosq, 1);
+		if (rc != MOSQ_ERR_SUCCESS) loadtest_closeClient(client, loadtest_state_FAILED);
+	}
+}
+
+
+/**
+ * @brief Send keep-alives and time out clients without CONNACK.
+ */
+static void loadtest_maintainGroup(
+	struct loadtest_Group* group,
+	int64_t now,
+	int64_t timeout
+) {
+	for (size_t i = 0; i < group->count; i++) {
+		struct loadtest_Client* client = &group->clients[i];
+		if (!client->mosq) continue;
+		if (client->state == loadtest_state_CONNECTING && now - client->started_at > timeout) {
+			loadtest_closeClient(client, loadtest_state_TIMEOUT);
+			continue;
+		}
+		if (client->state == loadtest_state_CONNECTED) mosquitto_loop_misc(client->mosq);
+	}
+}
+
+
+/**
+ * @brief Disconnect all connected clients of a group and release them.
+ */
+static void loadtest_closeGroup(
+	struct loadtest_Group* group
+) {
+	for (size_t i = 0; i < group->count; i++) {
+		struct loadtest_Client* client = &group->clients[i];
+		if (!client->mosq) continue;
+		if (client->state == loadtest_state_CONNECTED) {
+			mosquitto_disconnect(client->mosq);
+			mosquitto_loop_write(client->mosq, 1);
+		}
+		loadtest_closeClient(client, loadtest_state_IDLE);
+	}
+}
+
+
+/**
+ * @brief Probe thread: connect, subscribe and publish to the own topic at a fixed interval.
+ */
+static void* loadtest_runProbes(
+	void* arg
+) {
+	struct loadtest_Probes* probes = (struct loadtest_Probes*) arg;
+	struct loadtest_Group* group = &probes->group;
+
+	// Connect
+	for (size_t i = 0; i < group->count; i++) loadtest_openClient(&group->clients[i]);
+
+	int64_t next_publish = loadtest_getMonotonicTime();
+	int64_t next_maintenance = next_publish;
+	while (!atomic_load(&probes->stop)) {
+		int64_t now = loadtest_getMonotonicTime();
+
+		// Subscribe after the CONNACK, count probes that failed before their SUBACK
+		for (size_t i = 0; i < group->count; i++) {
+			struct loadtest_Client* client = &group->clients[i];
+			if (client->state == loadtest_state_CONNECTED && !client->subscribe_sent) {
+				client->subscribe_sent = mosquitto_subscribe(client->mosq, NULL, client->topic, probes->qos) == MOSQ_ERR_SUCCESS;
+			} else if (!client->reported && client->state != loadtest_state_CONNECTING && client->state != loadtest_state_CONNECTED) {
+				client->reported = true;
+				atomic_fetch_add(&probes->failed, 1);
+			}
+		}
+
+		// Publish "<phase> <now>" on each probe's own topic
+		if (now >= next_publish) {
+			int phase = atomic_load(&probes->phase);
+			char payload[64];
+			int length = snprintf(payload, sizeof(payload), "%d %lld", phase, (long long) now);
+			for (size_t i = 0; i < group->count; i++) {
+				struct loadtest_Client* client = &group->clients[i];
+				if (client->state != loadtest_state_CONNECTED || !client->subscribed) continue;
+				if (mosquitto_publish(client->mosq, NULL, client->topic, length, payload, probes->qos, false) == MOSQ_ERR_SUCCESS) probes->sent[phase]++;
+			}
+			next_publish += probes->interval;
+			if (next_publish < now) next_publish = now + probes->interval;
+		}
+		if (now >= next_maintenance) {
+			loadtest_maintainGroup(group, now, LOADTEST_PROBE_READY_TIMEOUT);
+			next_maintenance = now + 1000000;
+		}
+
+		int64_t wait = next_publish - loadtest_getMonotonicTime();
+		loadtest_serviceGroup(group, wait > 0 ? (int) ((wait + 999) / 1000) : 0);
+	}
+
+	loadtest_closeGroup(group);
+	return NULL;
+}
+
+
+/**
+ * @brief Allocate the clients and poll set of a group.
+ */
+static bool loadtest_initGroup(
+	struct loadtest_Group* group,
+	size_t count,
+	const char* host,
+	int port
+) {
+	group->clients = calloc(count ? count : 1, sizeof(*group->clients));
+	group->fds = calloc(count ? count : 1, sizeof(*group->fds));
+	group->indexes = calloc(count ? count : 1, sizeof(*group->indexes));
+	group->count = count;
+	group->host = host;
+	group->port = port;
+	for (size_t i = 0; group->clients && i < count; i++) group->clients[i].group = group;
+	return group->clients && group->fds && group->indexes;
+}
+
+
+int main(
+	int argc,
+	char** argv
+) {
+	// Parse arguments
+	const char* host = "127.0.0.1";
+	int port = 1883;
+	long connections = 1000;
+	double rate = 100;
+	long tokens_count = 0;
+	double revoked_rate = 0;
+	long probes_count = 4;
+	long probe_interval = 100;
+	int probe_qos = 0;
+	double baseline = 3;
+	double hold = 5;
+	double timeout = 30;
+	long token_lifetime = 3600;
+	bool verbose = false;
+	struct mockidp_Settings idp_settings = { .port = 18080, .key_file = NULL, .latency = 0, .jitter = 0, .failure_rate = 0, .drop_rate = 0 };
+	const char* usage = "Usage: %s [-h host] [-p port] [-n connections] [-r rate] [-t tokens] [-x revoked_rate] "
+		"[-P probes] [-I probe_interval] [-q probe_qos] [-b baseline] [-H hold] [-T timeout] "
+		"[-i idp_port] [-k key_file] [-l idp_latency] [-j idp_jitter] [-f idp_failure_rate] [-d idp_drop_rate] "
+		"[-e token_lifetime] [-v]\n";
+	int opt;
+	while ((opt = getopt(argc, argv, "h:p:n:r:t:x:P:I:q:b:H:T:i:k:l:j:f:d:e:v")) != -1) {
+		switch (opt) {
+			case 'h': host = optarg; break;
+			case 'p': port = atoi(optarg); break;
+			case 'n': connections = strtol(optarg, NULL, 10); break;
+			case 'r': rate = strtod(optarg, NULL); break;
+			case 't': tokens_count = strtol(optarg, NULL, 10); break;
+			case 'x': revoked_rate = strtod(optarg, NULL); break;
+			case 'P': probes_count = strtol(optarg, NULL, 10); break;
+			case 'I': probe_interval = strtol(optarg, NULL, 10); break;
+			case 'q': probe_qos = atoi(optarg); break;
+			case 'b': baseline = strtod(optarg, NULL); break;
+			case 'H': hold = strtod(optarg, NULL); break;
+			case 'T': timeout = strtod(optarg, NULL); break;
+			case 'i': idp_settings.port = atoi(optarg); break;
+			case 'k': idp_settings.key_file = optarg; break;
+			case 'l': idp_settings.latency = (uint32_t) (strtod(optarg, NULL) * 1000); break;
+			case 'j': idp_settings.jitter = (uint32_t) (strtod(optarg, NULL) * 1000); break;
+			case 'f': idp_settings.failure_rate = strtod(optarg, NULL); break;
+			case 'd': idp_settings.drop_rate = strtod(optarg, NULL); break;
+			case 'e': token_lifetime = strtol(optarg, NULL, 10); break;
+			case 'v': verbose = true; break;
+			default:
+				fprintf(stderr, usage, argv[0]);
+				return 2;
+		}
+	}
+	if (optind != argc || connections < 0 || probes_count < 0 || probe_interval <= 0 || probe_qos < 0 || probe_qos > 2) {
+		fprintf(stderr, usage, argv[0]);
+		return 2;
+	}
+	if (tokens_count <= 0 || tokens_count > connections) tokens_count = connections > 0 ? connections : 1;
+
+	// Every connection needs a file descriptor
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	// Start mock IdP
+	struct mockidp_Server* idp = mockidp_start(&idp_settings);
+	if (!idp) {
+		fprintf(stderr, "Cannot start mock IdP on 127.0.0.1:%d.\n", idp_settings.port);
+		return 1;
+	}
+	printf("Mock IdP:                  %s (introspection %s/introspect)\n", idp->issuer, idp->issuer);
+
+	// Mint tokens (revoked ones spread evenly)
+	char** tokens = calloc((size_t) tokens_count, sizeof(*tokens));
+	char** subjects = calloc((size_t) tokens_count, sizeof(*subjects));
+	bool* revoked = calloc((size_t) tokens_count, sizeof(*revoked));
+	if (!tokens || !subjects || !revoked) return 1;
+	for (long i = 0; i < tokens_count; i++) {
+		char subject[32];
+		revoked[i] = (long) ((i + 1) * revoked_rate) != (long) (i * revoked_rate);
+		snprintf(subject, sizeof(subject), "%s%ld", revoked[i] ? MOCKIDP_REVOKED_PREFIX : "loadtest-", i);
+		subjects[i] = strdup(subject);
+		tokens[i] = mockidp_mintToken(idp, subject, token_lifetime);
+		if (!subjects[i] || !tokens[i]) {
+			fprintf(stderr, "Cannot mint tokens.\n");
+			return 1;
+		}
+	}
+	printf("Tokens:                    %ld minted (%ld connections each)\n", tokens_count, connections > 0 ? (connections + tokens_count - 1) / tokens_count : 0);
+
+	// Prepare clients
+	mosquitto_lib_init();
+	struct loadtest_Group storm = { 0 };
+	struct loadtest_Probes probes = { 0 };
+	if (!loadtest_initGroup(&storm, (size_t) connections, host, port) || !loadtest_initGroup(&probes.group, (size_t) probes_count, host, port)) return 1;
+	for (long i = 0; i < connections; i++) {
+		struct loadtest_Client* client = &storm.clients[i];
+		snprintf(client->id, sizeof(client->id), "loadtest-%ld", i);
+		client->username = subjects[i % tokens_count];
+		client->token = tokens[i % tokens_count];
+		client->revoked = revoked[i % tokens_count];
+	}
+	char** probe_tokens = calloc((size_t) probes_count + 1, sizeof(*probe_tokens));
+	char** probe_subjects = calloc((size_t) probes_count + 1, sizeof(*probe_subjects));
+	if (!probe_tokens || !probe_subjects) return 1;
+	for (long i = 0; i < probes_count; i++) {
+		struct loadtest_Client* client = &probes.group.clients[i];
+		char subject[32];
+		snprintf(subject, sizeof(subject), "probe-%ld", i);
+		probe_subjects[i] = strdup(subject);
+		probe_tokens[i] = mockidp_mintToken(idp, subject, token_lifetime);
+		if (!probe_subjects[i] || !probe_tokens[i]) return 1;
+		snprintf(client->id, sizeof(client->id), "loadtest-probe-%ld", i);
+		snprintf(client->topic, sizeof(client->topic), "loadtest/probe/%ld", i);
+		client->username = probe_subjects[i];
+		client->token = probe_tokens[i];
+	}
+
+	// Start probes and measure the baseline
+	probes.interval = probe_interval * 1000;
+	probes.qos = probe_qos;
+	atomic_init(&probes.phase, loadtest_phase_BASELINE);
+	atomic_init(&probes.stop, false);
+	atomic_init(&probes.ready, 0);
+	atomic_init(&probes.failed, 0);
+	if (probes_count > 0) {
+		if (pthread_create(&probes.thread, NULL, loadtest_runProbes, &probes) != 0) {
+			fprintf(stderr, "Cannot start probes.\n");
+			return 1;
+		}
+		int64_t deadline = loadtest_getMonotonicTime() + LOADTEST_PROBE_READY_TIMEOUT;
+		while (
+			atomic_load(&probes.ready) + atomic_load(&probes.failed) < (size_t) probes_count
+			&& loadtest_getMonotonicTime() < deadline
+		) usleep(10000);
+		printf("Probes:                    %zu of %ld subscribed\n", atomic_load(&probes.ready), probes_count);
+		usleep((useconds_t) (baseline * 1000000));
+	}
+
+	// Storm: open connections at the configured rate until all are answered
+	atomic_store(&probes.phase, loadtest_phase_STORM);
+	int64_t timeout_us = (int64_t) (timeout * 1000000);
+	int64_t storm_start = loadtest_getMonotonicTime();
+	int64_t storm_end = 0;
+	int64_t next_maintenance = storm_start;
+	int64_t next_report = storm_start + 1000000;
+	size_t opened = 0;
+	while (true) {
+		int64_t now = loadtest_getMonotonicTime();
+		while (opened < storm.count && (rate <= 0 || now >= storm_start + (int64_t) (opened * 1000000.0 / rate))) {
+			loadtest_openClient(&storm.clients[opened++]);
+		}
+		if (now >= next_maintenance) {
+			loadtest_maintainGroup(&storm, now, timeout_us);
+			next_maintenance = now + 100000;
+		}
+		if (verbose && now >= next_report) {
+			size_t accepted = 0;
+			for (size_t i = 0; i < opened; i++) accepted += storm.clients[i].state == loadtest_state_CONNECTED;
+			printf("%8.1f s   opened %8zu   waiting %8zu   connected %8zu\n", (now - storm_start) / 1000000.0, opened, storm.connecting, accepted);
+			next_report += 1000000;
+		}
+		if (opened == storm.count && storm.connecting == 0) {
+			storm_end = now;
+			break;
+		}
+
+		int poll_timeout = 100;
+		if (opened < storm.count && rate > 0) {
+			int64_t next_open = storm_start + (int64_t) (opened * 1000000.0 / rate);
+			poll_timeout = next_open > now ? (int) ((next_open - now + 999) / 1000) : 0;
+			if (poll_timeout > 100) poll_timeout = 100;
+		}
+		loadtest_serviceGroup(&storm, poll_timeout);
+	}
+
+	// Hold connections (optimistically admitted clients may be disconnected now)
+	atomic_store(&probes.phase, loadtest_phase_HOLD);
+	int64_t hold_end = storm_end + (int64_t) (hold * 1000000);
+	for (int64_t now = storm_end; now < hold_end; now = loadtest_getMonotonicTime()) {
+		if (now >= next_maintenance) {
+			loadtest_maintainGroup(&storm, now, timeout_us);
+			next_maintenance = now + 1000000;
+		}
+		loadtest_serviceGroup(&storm, 100);
+	}
+
+	// Stop
+	loadtest_closeGroup(&storm);
+	if (probes_count > 0) {
+		atomic_store(&probes.stop, true);
+		pthread_join(probes.thread, NULL);
+	}
+
+	// Outcomes
+	unsigned long states[loadtest_state_DROPPED + 1] = { 0 };
+	unsigned long refused_codes[256] = { 0 };
+	unsigned long expected_refusals = 0;
+	unsigned long unexpected = 0;
+	struct loadtest_Samples connack = { 0 };
+	for (size_t i = 0; i < storm.count; i++) {
+		struct loadtest_Client* client = &storm.clients[i];
+		states[client->state]++;
+		bool answered = client->state == loadtest_state_CONNECTED || client->state == loadtest_state_REFUSED || client->state == loadtest_state_DROPPED;
+		if (answered) loadtest_addSample(&connack, client->connack_at - client->started_at);
+		if (client->state == loadtest_state_REFUSED) {
+			refused_codes[client->rc & 255]++;
+			if (client->revoked) expected_refusals++;
+			else unexpected++;
+		} else if (answered && client->revoked) {
+			unexpected++;
+		}
+	}
+	states[loadtest_state_CONNECTED] += states[loadtest_state_DROPPED];
+
+	// Report
+	double storm_seconds = (storm_end - storm_start) / 1000000.0;
+	printf("Connections:               %zu in %.3f s (%.1f CONNECT/s)\n", storm.count, storm_seconds, storm_seconds > 0 ? storm.count / storm_seconds : 0.0);
+	printf(
+		"CONNACK:                   %lu accepted, %lu refused (%lu revoked tokens), %lu timed out, %lu failed\n",
+		states[loadtest_state_CONNECTED],
+		states[loadtest_state_REFUSED],
+		expected_refusals,
+		states[loadtest_state_TIMEOUT],
+		states[loadtest_state_FAILED]
+	);
+	for (int code = 1; code < 256; code++) {
+		if (refused_codes[code] > 0) printf("  refused with code %-3d    %lu (%s)\n", code, refused_codes[code], mosquitto_connack_string(code));
+	}
+	printf("Unexpected outcomes:       %lu (revoked tokens accepted or valid tokens refused)\n", unexpected);
+	printf("Disconnected after accept: %zu\n", storm.dropped);
+	loadtest_printLatencies("CONNACK latency:", connack.values, connack.count);
+	const char* phase_labels[loadtest_phase_COUNT] = { "Probe RTT (baseline):", "Probe RTT (storm):", "Probe RTT (hold):" };
+	for (int phase = 0; phase < loadtest_phase_COUNT && probes_count > 0; phase++) {
+		loadtest_printLatencies(phase_labels[phase], probes.rtt[phase].values, probes.rtt[phase].count);
+		if (probes.sent[phase] > probes.received[phase]) printf("  lost                     %lu of %lu\n", probes.sent[phase] - probes.received[phase], probes.sent[phase]);
+	}
+	if (probes.group.dropped > 0) printf("Probes disconnected:       %zu\n", probes.group.dropped);
+	printf(
+		"IdP introspections:        %lu (%lu active, %lu inactive, %lu HTTP 500, %lu dropped, peak concurrency %ld)\n",
+		atomic_load(&idp->introspections),
+		atomic_load(&idp->active),
+		atomic_load(&idp->inactive),
+		atomic_load(&idp->failed),
+		atomic_load(&idp->dropped),
+		atomic_load(&idp->peak_in_flight)
+	);
+	printf("IdP other requests:        %lu metadata, %lu token\n", atomic_load(&idp->metadata), atomic_load(&idp->token_requests));
+
+	// Cleanup
+	mosquitto_lib_cleanup();
+	for (long i = 0; i < tokens_count; i++) {
+		free(tokens[i]);
+		free(subjects[i]);
+	}
+	for (long i = 0; i < probes_count; i++) {
+		free(probe_tokens[i]);
+		free(probe_subjects[i]);
+	}
+	for (int phase = 0; phase < loadtest_phase_COUNT; phase++) free(probes.rtt[phase].values);
+	free(connack.values);
+	free(tokens);
+	free(subjects);
+	free(revoked);
+	free(probe_tokens);
+	free(probe_subjects);
+	free(storm.clients);
+	free(storm.fds);
+	free(storm.indexes);
+	free(probes.group.clients);
+	free(probes.group.fds);
+	free(probes.group.indexes);
+	bool clean = unexpected == 0 && states[loadtest_state_TIMEOUT] == 0 && states[loadtest_state_FAILED] == 0 && storm.dropped == 0;
+	return clean ? 0 : 3;
+}
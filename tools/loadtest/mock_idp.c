@@ -0,0 +1,531 @@
+/**
+ * mock_idp.c
+ *
+ * Local HTTP/1.1 identity provider minting RS256 tokens and serving OpenID
+ * Connect discovery, JWKS, introspection and client credentials with
+ * configurable latency and failure injection
+ */
+
+#include "mock_idp.h"
+
+
+struct mockidp_Connection {
+	struct mockidp_Server*	server;
+	int						socket;
+	unsigned short			random[3];		// erand48() state of the connection.
+};
+
+
+struct mockidp_Server* mockidp_start(
+	const struct mockidp_Settings* settings
+) {
+	struct mockidp_Server* server = calloc(1, sizeof(*server));
+	if (!server) return NULL;
+	server->settings = *settings;
+
+	// Load or generate signing key
+	if (settings->key_file) {
+		FILE* file = fopen(settings->key_file, "r");
+		if (file) {
+			server->key = PEM_read_PrivateKey(file, NULL, NULL, NULL);
+			fclose(file);
+		}
+		if (!server->key || EVP_PKEY_get_base_id(server->key) != EVP_PKEY_RSA) {
+			fprintf(stderr, "Cannot read RSA private key from %s.\n", settings->key_file);
+			EVP_PKEY_free(server->key);
+			free(server);
+			return NULL;
+		}
+	} else {
+		server->key = EVP_RSA_gen(2048);
+		if (!server->key) {
+			free(server);
+			return NULL;
+		}
+	}
+
+	// Listen on 127.0.0.1:<port>
+	server->socket = socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	if (server->socket >= 0) setsockopt(server->socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons((uint16_t) settings->port) };
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t address_length = sizeof(address);
+	if (
+		server->socket < 0
+		|| bind(server->socket, (struct sockaddr*) &address, sizeof(address)) != 0
+		|| listen(server->socket, 1024) != 0
+		|| getsockname(server->socket, (struct sockaddr*) &address, &address_length) != 0
+	) {
+		if (server->socket >= 0) close(server->socket);
+		EVP_PKEY_free(server->key);
+		free(server);
+		return NULL;
+	}
+	server->port = ntohs(address.sin_port);
+	snprintf(server->issuer, sizeof(server->issuer), "http://127.0.0.1:%d", server->port);
+
+	// Discovery document
+	cJSON* discovery = cJSON_CreateObject();
+	char url[128];
+	cJSON_AddStringToObject(discovery, "issuer", server->issuer);
+	snprintf(url, sizeof(url), "%s/introspect", server->issuer);
+	cJSON_AddStringToObject(discovery, "introspection_endpoint", url);
+	snprintf(url, sizeof(url), "%s/token", server->issuer);
+	cJSON_AddStringToObject(discovery, "token_endpoint", url);
+	snprintf(url, sizeof(url), "%s/jwks", server->issuer);
+	cJSON_AddStringToObject(discovery, "jwks_uri", url);
+	server->discovery = cJSON_PrintUnformatted(discovery);
+	cJSON_Delete(discovery);
+
+	// JSON Web Key Set
+	BIGNUM* modulus = NULL;
+	BIGNUM* exponent = NULL;
+	char* n = NULL;
+	char* e = NULL;
+	if (
+		EVP_PKEY_get_bn_param(server->key, OSSL_PKEY_PARAM_RSA_N, &modulus) == 1
+		&& EVP_PKEY_get_bn_param(server->key, OSSL_PKEY_PARAM_RSA_E, &exponent) == 1
+	) {
+		unsigned char bytes[1024];
+		int length = BN_bn2bin(modulus, bytes);
+		n = mockidp_base64urlEncode(bytes, (size_t) length);
+		length = BN_bn2bin(exponent, bytes);
+		e = mockidp_base64urlEncode(bytes, (size_t) length);
+	}
+	BN_free(modulus);
+	BN_free(exponent);
+	if (n && e) {
+		size_t jwks_size = strlen(n) + strlen(e) + 128;
+		server->jwks = malloc(jwks_size);
+		if (server->jwks) {
+			snprintf(
+				server->jwks,
+				jwks_size,
+				"{\"keys\":[{\"kty\":\"RSA\",\"use\":\"sig\",\"alg\":\"RS256\",\"kid\":\"%s\",\"n\":\"%s\",\"e\":\"%s\"}]}",
+				MOCKIDP_KEY_ID,
+				n,
+				e
+			);
+		}
+	}
+	free(n);
+	free(e);
+	if (!server->discovery || !server->jwks) {
+		close(server->socket);
+		EVP_PKEY_free(server->key);
+		free(server->discovery);
+		free(server->jwks);
+		free(server);
+		return NULL;
+	}
+
+	// Accept in background
+	if (pthread_create(&server->thread, NULL, mockidp_runAccept, server) != 0) {
+		close(server->socket);
+		EVP_PKEY_free(server->key);
+		free(server->discovery);
+		free(server->jwks);
+		free(server);
+		return NULL;
+	}
+	pthread_detach(server->thread);
+	return server;
+}
+
+
+char* mockidp_mintToken(
+	struct mockidp_Server* server,
+	const char* subject,
+	long lifetime
+) {
+	// Header and claims
+	unsigned long jti = atomic_fetch_add(&server->minted, 1) + 1;
+	int64_t now = (int64_t) time(NULL);
+	char header[128];
+	char claims[512];
+	snprintf(header, sizeof(header), "{\"alg\":\"RS256\",\"typ\":\"JWT\",\"kid\":\"%s\"}", MOCKIDP_KEY_ID);
+	int claims_length = snprintf(
+		claims,
+		sizeof(claims),
+		"{\"iss\":\"%s\",\"sub\":\"%s\",\"preferred_username\":\"%s\",\"aud\":\"mqtt\",\"client_id\":\"loadtest\",\"scope\":\"mqtt\","
+		"\"iat\":%lld,\"exp\":%lld,\"jti\":\"%lu\"}",
+		server->issuer,
+		subject,
+		subject,
+		(long long) now,
+		(long long) (now + lifetime),
+		jti
+	);
+	if (claims_length < 0 || (size_t) claims_length >= sizeof(claims)) return NULL;
+
+	// "<header>.<claims>"
+	char* encoded_header = mockidp_base64urlEncode((const unsigned char*) header, strlen(header));
+	char* encoded_claims = mockidp_base64urlEncode((const unsigned char*) claims, (size_t) claims_length);
+	char* token = NULL;
+	if (encoded_header && encoded_claims) {
+		size_t input_length = strlen(encoded_header) + 1 + strlen(encoded_claims);
+		token = malloc(input_length + 1);
+		if (token) snprintf(token, input_length + 1, "%s.%s", encoded_header, encoded_claims);
+	}
+	free(encoded_header);
+	free(encoded_claims);
+	if (!token) return NULL;
+
+	// ".<signature>"
+	unsigned char signature[512];
+	size_t signature_length = sizeof(signature);
+	EVP_MD_CTX* context = EVP_MD_CTX_new();
+	bool signed_ok = (
+		context
+		&& EVP_DigestSignInit(context, NULL, EVP_sha256(), NULL, server->key) == 1
+		&& EVP_DigestSign(context, signature, &signature_length, (const unsigned char*) token, strlen(token)) == 1
+	);
+	EVP_MD_CTX_free(context);
+	char* encoded_signature = signed_ok ? mockidp_base64urlEncode(signature, signature_length) : NULL;
+	size_t token_length = strlen(token);
+	char* signed_token = encoded_signature ? realloc(token, token_length + 1 + strlen(encoded_signature) + 1) : NULL;
+	if (!signed_token) {
+		free(encoded_signature);
+		free(token);
+		return NULL;
+	}
+	snprintf(signed_token + token_length, strlen(encoded_signature) + 2, ".%s", encoded_signature);
+	free(encoded_signature);
+	return signed_token;
+}
+
+
+static void* mockidp_runAccept(
+	void* arg
+) {
+	struct mockidp_Server* server = (struct mockidp_Server*) arg;
+	for (;;) {
+		int client_socket = accept(server->socket, NULL, NULL);
+		if (client_socket < 0) continue;
+		int nodelay = 1;
+		setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+		struct mockidp_Connection* connection = malloc(sizeof(*connection));
+		pthread_t thread;
+		if (!connection) {
+			close(client_socket);
+			continue;
+		}
+		connection->server = server;
+		connection->socket = client_socket;
+		uint64_t seed = (uint64_t) time(NULL) ^ ((atomic_fetch_add(&server->connections, 1) + 1) * 0x9E3779B97F4A7C15ULL);
+		connection->random[0] = (unsigned short) seed;
+		connection->random[1] = (unsigned short) (seed >> 16);
+		connection->random[2] = (unsigned short) (seed >> 32);
+		if (pthread_create(&thread, NULL, mockidp_runConnection, connection) != 0) {
+			close(client_socket);
+			free(connection);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+
+static void* mockidp_runConnection(
+	void* arg
+) {
+	struct mockidp_Connection* connection = (struct mockidp_Connection*) arg;
+	struct mockidp_Server* server = connection->server;
+	char* request = malloc(MOCKIDP_REQUEST_SIZE + 1);
+	size_t request_length = 0;
+	if (request) request[0] = '\0';
+
+	while (request) {
+		// Read request head
+		char* head_end = NULL;
+		while (!(head_end = strstr(request, "\r\n\r\n"))) {
+			if (request_length >= MOCKIDP_REQUEST_SIZE) goto close_connection;
+			ssize_t received = recv(connection->socket, request + request_length, MOCKIDP_REQUEST_SIZE - request_length, 0);
+			if (received <= 0) goto close_connection;
+			request_length += (size_t) received;
+			request[request_length] = '\0';
+		}
+		size_t head_length = (size_t) (head_end - request) + 4;
+		head_end[2] = '\0'; // Terminate head for header lookups (keeps one "\r\n")
+
+		// Read body
+		const char* content_length_header = mockidp_findHeader(request, "Content-Length:");
+		size_t content_length = content_length_header ? strtoul(content_length_header, NULL, 10) : 0;
+		if (head_length + content_length > MOCKIDP_REQUEST_SIZE) goto close_connection;
+		const char* expect = mockidp_findHeader(request, "Expect:");
+		if (expect && strncasecmp(expect, "100-continue", 12) == 0 && request_length < head_length + content_length) {
+			const char* continue_response = "HTTP/1.1 100 Continue\r\n\r\n";
+			if (send(connection->socket, continue_response, strlen(continue_response), MSG_NOSIGNAL) < 0) goto close_connection;
+		}
+		while (request_length < head_length + content_length) {
+			ssize_t received = recv(connection->socket, request + request_length, MOCKIDP_REQUEST_SIZE - request_length, 0);
+			if (received <= 0) goto close_connection;
+			request_length += (size_t) received;
+		}
+		char* body = request + head_length;
+		char saved = body[content_length];
+		body[content_length] = '\0';
+
+		// Route "<method> <path>[?query] HTTP/1.1"
+		char* method = request;
+		char* path = strchr(request, ' ');
+		if (!path) goto close_connection;
+		*path++ = '\0';
+		path[strcspn(path, " ?\r")] = '\0';
+		int http_code = 404;
+		char* response_body = NULL;
+		const char* static_body = "{\"error\":\"not_found\"}";
+		bool delayed = false;
+		if (strcmp(method, "GET") == 0 && strcmp(path, "/.well-known/openid-configuration") == 0) {
+			atomic_fetch_add(&server->metadata, 1);
+			http_code = 200;
+			static_body = server->discovery;
+		} else if (strcmp(method, "GET") == 0 && strcmp(path, "/jwks") == 0) {
+			atomic_fetch_add(&server->metadata, 1);
+			http_code = 200;
+			static_body = server->jwks;
+		} else if (strcmp(method, "POST") == 0 && strcmp(path, "/token") == 0) {
+			atomic_fetch_add(&server->token_requests, 1);
+			delayed = true;
+			char* access_token = mockidp_mintToken(server, "loadtest-client", 300);
+			size_t response_size = (access_token ? strlen(access_token) : 0) + 96;
+			response_body = malloc(response_size);
+			if (access_token && response_body) {
+				http_code = 200;
+				snprintf(response_body, response_size, "{\"access_token\":\"%s\",\"token_type\":\"Bearer\",\"expires_in\":300}", access_token);
+			} else {
+				http_code = 500;
+				static_body = "{\"error\":\"server_error\"}";
+			}
+			free(access_token);
+		} else if (strcmp(method, "POST") == 0 && strcmp(path, "/introspect") == 0) {
+			atomic_fetch_add(&server->introspections, 1);
+			long in_flight = atomic_fetch_add(&server->in_flight, 1) + 1;
+			long peak = atomic_load(&server->peak_in_flight);
+			while (in_flight > peak && !atomic_compare_exchange_weak(&server->peak_in_flight, &peak, in_flight));
+			delayed = true;
+
+			// Inject failures
+			double draw = erand48(connection->random);
+			if (draw < server->settings.drop_rate) {
+				atomic_fetch_add(&server->dropped, 1);
+				http_code = 0;
+			} else if (draw < server->settings.drop_rate + server->settings.failure_rate) {
+				atomic_fetch_add(&server->failed, 1);
+				http_code = 500;
+				static_body = "{\"error\":\"server_error\"}";
+			} else {
+				// Extract and decode token parameter
+				char* token = NULL;
+				for (char* parameter = body; parameter && *parameter; ) {
+					char* next = strchr(parameter, '&');
+					if (next) *next++ = '\0';
+					if (strncmp(parameter, "token=", 6) == 0) token = parameter + 6;
+					parameter = next;
+				}
+				if (token) {
+					char* out = token;
+					for (const char* in = token; *in; in++) {
+						if (*in == '%' && in[1] && in[2]) {
+							char hex[3] = { in[1], in[2], '\0' };
+							*out++ = (char) strtol(hex, NULL, 16);
+							in += 2;
+						} else {
+							*out++ = *in;
+						}
+					}
+					*out = '\0';
+				}
+				response_body = mockidp_introspect(server, token, &http_code);
+			}
+		}
+
+		// Respond after the injected latency
+		if (delayed && (server->settings.latency > 0 || server->settings.jitter > 0)) {
+			uint32_t delay = server->settings.latency + (uint32_t) (erand48(connection->random) * server->settings.jitter);
+			struct timespec wait = { .tv_sec = delay / 1000000, .tv_nsec = (long) (delay % 1000000) * 1000 };
+			nanosleep(&wait, NULL);
+		}
+		if (strcmp(path, "/introspect") == 0) atomic_fetch_sub(&server->in_flight, 1);
+		if (http_code == 0) {
+			free(response_body);
+			goto close_connection;
+		}
+		const char* response = response_body ? response_body : static_body;
+		size_t body_length = strlen(response);
+		char head[256];
+		int response_head_length = snprintf(
+			head,
+			sizeof(head),
+			"HTTP/1.1 %d Mock\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n",
+			http_code,
+			body_length
+		);
+		bool sent = (
+			send(connection->socket, head, (size_t) response_head_length, MSG_NOSIGNAL) >= 0
+			&& send(connection->socket, response, body_length, MSG_NOSIGNAL) >= 0
+		);
+		free(response_body);
+		if (!sent) goto close_connection;
+
+		// Keep pipelined bytes of the next request
+		body[content_length] = saved;
+		size_t consumed = head_length + content_length;
+		memmove(request, request + consumed, request_length - consumed);
+		request_length -= consumed;
+		request[request_length] = '\0';
+	}
+
+close_connection:
+	close(connection->socket);
+	free(request);
+	free(connection);
+	return NULL;
+}
+
+
+static char* mockidp_introspect(
+	struct mockidp_Server* server,
+	const char* token,
+	int* http_code
+) {
+	if (!token) {
+		*http_code = 400;
+		return strdup("{\"error\":\"invalid_request\"}");
+	}
+	*http_code = 200;
+
+	// Active: signed by this provider, not expired, not revoked
+	cJSON* claims = mockidp_verifyToken(server, token);
+	cJSON* sub = cJSON_GetObjectItemCaseSensitive(claims, "sub");
+	cJSON* exp = cJSON_GetObjectItemCaseSensitive(claims, "exp");
+	if (
+		!cJSON_IsString(sub)
+		|| !cJSON_IsNumber(exp)
+		|| exp->valuedouble <= (double) time(NULL)
+		|| strncmp(sub->valuestring, MOCKIDP_REVOKED_PREFIX, strlen(MOCKIDP_REVOKED_PREFIX)) == 0
+	) {
+		cJSON_Delete(claims);
+		atomic_fetch_add(&server->inactive, 1);
+		return strdup("{\"active\":false}");
+	}
+	atomic_fetch_add(&server->active, 1);
+
+	// Token claims plus "active", "username" and "token_type"
+	cJSON_AddBoolToObject(claims, "active", true);
+	cJSON_AddStringToObject(claims, "username", sub->valuestring);
+	cJSON_AddStringToObject(claims, "token_type", "Bearer");
+	char* response = cJSON_PrintUnformatted(claims);
+	cJSON_Delete(claims);
+	return response;
+}
+
+
+static cJSON* mockidp_verifyToken(
+	struct mockidp_Server* server,
+	const char* token
+) {
+	// "<header>.<claims>.<signature>"
+	const char* first_dot = strchr(token, '.');
+	const char* second_dot = first_dot ? strchr(first_dot + 1, '.') : NULL;
+	if (!second_dot || strchr(second_dot + 1, '.')) return NULL;
+
+	// Signature over "<header>.<claims>"
+	unsigned char* signature = NULL;
+	long signature_length = mockidp_base64urlDecode(second_dot + 1, strlen(second_dot + 1), &signature);
+	if (signature_length <= 0) {
+		free(signature);
+		return NULL;
+	}
+	EVP_MD_CTX* context = EVP_MD_CTX_new();
+	bool verified = (
+		context
+		&& EVP_DigestVerifyInit(context, NULL, EVP_sha256(), NULL, server->key) == 1
+		&& EVP_DigestVerify(context, signature, (size_t) signature_length, (const unsigned char*) token, (size_t) (second_dot - token)) == 1
+	);
+	EVP_MD_CTX_free(context);
+	free(signature);
+	if (!verified) return NULL;
+
+	// Claims
+	unsigned char* claims_json = NULL;
+	long claims_length = mockidp_base64urlDecode(first_dot + 1, (size_t) (second_dot - first_dot - 1), &claims_json);
+	cJSON* claims = claims_length > 0 ? cJSON_Parse((const char*) claims_json) : NULL;
+	free(claims_json);
+	if (!cJSON_IsObject(claims)) {
+		cJSON_Delete(claims);
+		return NULL;
+	}
+	return claims;
+}
+
+
+static const char* mockidp_findHeader(
+	const char* head,
+	const char* name
+) {
+	size_t name_length = strlen(name);
+	for (const char* line = strstr(head, "\r\n"); line && line[2]; line = strstr(line + 2, "\r\n")) {
+		if (strncasecmp(line + 2, name, name_length) == 0) {
+			const char* value = line + 2 + name_length;
+			while (*value == ' ') value++;
+			return value;
+		}
+	}
+	return NULL;
+}
+
+
+static char* mockidp_base64urlEncode(
+	const unsigned char* data,
+	size_t length
+) {
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+	char* text = malloc((length + 2) / 3 * 4 + 1);
+	if (!text) return NULL;
+	size_t out = 0;
+	for (size_t i = 0; i < length; i += 3) {
+		uint32_t group = (uint32_t) data[i] << 16;
+		if (i + 1 < length) group |= (uint32_t) data[i + 1] << 8;
+		if (i + 2 < length) group |= data[i + 2];
+		text[out++] = alphabet[(group >> 18) & 63];
+		text[out++] = alphabet[(group >> 12) & 63];
+		if (i + 1 < length) text[out++] = alphabet[(group >> 6) & 63];
+		if (i + 2 < length) text[out++] = alphabet[group & 63];
+	}
+	text[out] = '\0';
+	return text;
+}
+
+
+static long mockidp_base64urlDecode(
+	const char* text,
+	size_t length,
+	unsigned char** decoded
+) {
+	*decoded = malloc(length * 3 / 4 + 1);
+	if (!*decoded) return -1;
+	uint32_t group = 0;
+	int bits = 0;
+	long out = 0;
+	for (size_t i = 0; i < length; i++) {
+		char c = text[i];
+		int value;
+		if (c >= 'A' && c <= 'Z') value = c - 'A';
+		else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+		else if (c >= '0' && c <= '9') value = c - '0' + 52;
+		else if (c == '-') value = 62;
+		else if (c == '_') value = 63;
+		else return -1;
+		group = (group << 6) | (uint32_t) value;
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			(*decoded)[out++] = (unsigned char) (group >> bits);
+		}
+	}
+	(*decoded)[out] = '\0';
+	return out;
+}
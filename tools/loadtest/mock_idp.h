@@ -0,0 +1,200 @@
+/**
+ * mock_idp.h
+ *
+ * Local HTTP/1.1 identity provider minting RS256 tokens and serving OpenID
+ * Connect discovery, JWKS, introspection and client credentials with
+ * configurable latency and failure injection
+ */
+
+#ifndef OAUTH2PLUGIN_MOCK_IDP_H
+#define OAUTH2PLUGIN_MOCK_IDP_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdio.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/bn.h>
+#include <openssl/rsa.h>
+#include <openssl/core_names.h>
+#include "cJSON.h"
+
+
+#define MOCKIDP_REQUEST_SIZE 65536
+#define MOCKIDP_KEY_ID "loadtest"
+#define MOCKIDP_REVOKED_PREFIX "revoked-"		// Tokens of subjects with this prefix are inactive.
+
+
+struct mockidp_Settings {
+	int			port;				// Port on 127.0.0.1 (0 = ephemeral).
+	const char*	key_file;			// PEM private RSA key (NULL = generate a new key).
+	uint32_t	latency;			// Latency of introspection and token responses in microseconds.
+	uint32_t	jitter;				// Uniformly distributed extra latency in microseconds.
+	double		failure_rate;		// Fraction of introspection requests answered with HTTP 500.
+	double		drop_rate;			// Fraction of introspection requests whose connection is closed without response.
+};
+
+
+struct mockidp_Server {
+	int						socket;			// Listening socket.
+	int						port;			// Bound port on 127.0.0.1.
+	pthread_t				thread;			// Accept thread.
+	struct mockidp_Settings	settings;		// Latency and failure injection.
+	EVP_PKEY*				key;			// Signing key.
+	char					issuer[64];		// "http://127.0.0.1:<port>".
+	char*					discovery;		// OpenID Connect discovery document.
+	char*					jwks;			// JSON Web Key Set with the public key.
+	atomic_ulong			connections;	// Connections accepted.
+	atomic_ulong			minted;			// Tokens minted.
+	atomic_ulong			introspections;	// Introspection requests.
+	atomic_ulong			active;			// Tokens introspected active.
+	atomic_ulong			inactive;		// Tokens introspected inactive (revoked, expired or bad signature).
+	atomic_ulong			failed;			// Introspection requests answered with HTTP 500.
+	atomic_ulong			dropped;		// Introspection requests dropped without response.
+	atomic_ulong			metadata;		// Discovery and JWKS requests.
+	atomic_ulong			token_requests;	// Client credentials requests.
+	atomic_long				in_flight;		// Introspection requests being served.
+	atomic_long				peak_in_flight;	// Highest number of concurrent introspection requests.
+};
+
+
+/**
+ * @brief Load or generate the signing key, listen on 127.0.0.1 and serve requests in background threads.
+ *
+ * Every connection is served by its own thread with keep-alive, so pooled
+ * connections of the plugin are reused like with a real provider. Routes:
+ *   GET  /.well-known/openid-configuration		Discovery document
+ *   GET  /jwks									Public key (kid "loadtest")
+ *   POST /introspect							RFC 7662 introspection of minted tokens
+ *   POST /token								Client credentials grant (any client)
+ *
+ * @param settings	Port, key and failure injection.
+ * @return			Running server or NULL on failure. The server runs until the process exits.
+ */
+struct mockidp_Server* mockidp_start(
+	const struct mockidp_Settings* settings
+);
+
+
+/**
+ * @brief Mint a signed access token.
+ *
+ * Thread safe. Subjects starting with MOCKIDP_REVOKED_PREFIX get tokens that
+ * the introspection endpoint reports inactive.
+ *
+ * @param server	Running server.
+ * @param subject	"sub" and "preferred_username" claim.
+ * @param lifetime	Seconds until "exp".
+ * @return			Newly allocated token or NULL on failure.
+ */
+char* mockidp_mintToken(
+	struct mockidp_Server* server,
+	const char* subject,
+	long lifetime
+);
+
+
+/**
+ * @brief Accept connections.
+ *
+ * @param arg	Pointer to the mockidp_Server.
+ * @return		Always NULL.
+ */
+static void* mockidp_runAccept(
+	void* arg
+);
+
+
+/**
+ * @brief Serve the requests of one keep-alive connection.
+ *
+ * @param arg	Pointer to a mockidp_Connection.
+ * @return		Always NULL.
+ */
+static void* mockidp_runConnection(
+	void* arg
+);
+
+
+/**
+ * @brief Answer an introspection request.
+ *
+ * @param server	Running server.
+ * @param token		Value of the "token" form parameter. May be NULL.
+ * @param http_code	Output: HTTP status code.
+ * @return			Newly allocated response body or NULL on allocation failure.
+ */
+static char* mockidp_introspect(
+	struct mockidp_Server* server,
+	const char* token,
+	int* http_code
+);
+
+
+/**
+ * @brief Verify the signature of a minted token and return its claims.
+ *
+ * @param server	Running server.
+ * @param token		Token.
+ * @return			Claims (to be released with cJSON_Delete()) or NULL if the token is malformed or not signed by @p server.
+ */
+static cJSON* mockidp_verifyToken(
+	struct mockidp_Server* server,
+	const char* token
+);
+
+
+/**
+ * @brief Find a header value in a request head.
+ *
+ * @param head		Request head (null terminated).
+ * @param name		Header name including ':' (case insensitive).
+ * @return			Pointer to the value or NULL.
+ */
+static const char* mockidp_findHeader(
+	const char* head,
+	const char* name
+);
+
+
+/**
+ * @brief Encode bytes as unpadded base64url.
+ *
+ * @param data		Bytes.
+ * @param length	Number of bytes.
+ * @return			Newly allocated string or NULL on allocation failure.
+ */
+static char* mockidp_base64urlEncode(
+	const unsigned char* data,
+	size_t length
+);
+
+
+/**
+ * @brief Decode unpadded base64url.
+ *
+ * @param text		Encoded text.
+ * @param length	Length of @p text.
+ * @param decoded	Output: newly allocated bytes (null terminated).
+ * @return			Number of decoded bytes or -1 if @p text is invalid.
+ */
+static long mockidp_base64urlDecode(
+	const char* text,
+	size_t length,
+	unsigned char** decoded
+);
+
+#endif // OAUTH2PLUGIN_MOCK_IDP_H
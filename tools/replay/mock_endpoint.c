@@ -0,0 +1,180 @@
+/**
+ * mock_endpoint.c
+ *
+ * Local HTTP/1.1 introspection endpoint answering from recorded responses
+ */
+
+#include "mock_endpoint.h"
+
+
+struct mockendpoint_Connection {
+	struct mockendpoint_Server*	server;
+	int							socket;
+};
+
+
+struct mockendpoint_Server* mockendpoint_start(
+	mockendpoint_Handler handler,
+	void* userdata
+) {
+	struct mockendpoint_Server* server = calloc(1, sizeof(*server));
+	if (!server) return NULL;
+	server->handler = handler;
+	server->userdata = userdata;
+
+	// Listen on 127.0.0.1:<ephemeral>
+	server->socket = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = 0 };
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t address_length = sizeof(address);
+	if (
+		server->socket < 0
+		|| bind(server->socket, (struct sockaddr*) &address, sizeof(address)) != 0
+		|| listen(server->socket, 128) != 0
+		|| getsockname(server->socket, (struct sockaddr*) &address, &address_length) != 0
+	) {
+		if (server->socket >= 0) close(server->socket);
+		free(server);
+		return NULL;
+	}
+	server->port = ntohs(address.sin_port);
+
+	// Accept in background
+	if (pthread_create(&server->thread, NULL, mockendpoint_runAccept, server) != 0) {
+		close(server->socket);
+		free(server);
+		return NULL;
+	}
+	pthread_detach(server->thread);
+	return server;
+}
+
+
+static void* mockendpoint_runAccept(
+	void* arg
+) {
+	struct mockendpoint_Server* server = (struct mockendpoint_Server*) arg;
+	for (;;) {
+		int client_socket = accept(server->socket, NULL, NULL);
+		if (client_socket < 0) continue;
+		int nodelay = 1;
+		setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+		struct mockendpoint_Connection* connection = malloc(sizeof(*connection));
+		pthread_t thread;
+		if (!connection) {
+			close(client_socket);
+			continue;
+		}
+		connection->server = server;
+		connection->socket = client_socket;
+		if (pthread_create(&thread, NULL, mockendpoint_runConnection, connection) != 0) {
+			close(client_socket);
+			free(connection);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+
+static void* mockendpoint_runConnection(
+	void* arg
+) {
+	struct mockendpoint_Connection* connection = (struct mockendpoint_Connection*) arg;
+	char* request = malloc(MOCKENDPOINT_REQUEST_SIZE + 1);
+	size_t request_length = 0;
+	if (request) request[0] = '\0';
+
+	while (request) {
+		// Read request head
+		char* head_end = NULL;
+		while (!(head_end = strstr(request, "\r\n\r\n"))) {
+			if (request_length >= MOCKENDPOINT_REQUEST_SIZE) goto close_connection;
+			ssize_t received = recv(connection->socket, request + request_length, MOCKENDPOINT_REQUEST_SIZE - request_length, 0);
+			if (received <= 0) goto close_connection;
+			request_length += (size_t) received;
+			request[request_length] = '\0';
+		}
+		size_t head_length = (size_t) (head_end - request) + 4;
+		head_end[2] = '\0'; // Terminate head for header lookups (keeps one "\r\n")
+
+		// Read body
+		const char* content_length_header = mockendpoint_findHeader(request, "Content-Length:");
+		size_t content_length = content_length_header ? strtoul(content_length_header, NULL, 10) : 0;
+		if (head_length + content_length > MOCKENDPOINT_REQUEST_SIZE) goto close_connection;
+		const char* expect = mockendpoint_findHeader(request, "Expect:");
+		if (expect && strncasecmp(expect, "100-continue", 12) == 0 && request_length < head_length + content_length) {
+			const char* continue_response = "HTTP/1.1 100 Continue\r\n\r\n";
+			if (send(connection->socket, continue_response, strlen(continue_response), MSG_NOSIGNAL) < 0) goto close_connection;
+		}
+		while (request_length < head_length + content_length) {
+			ssize_t received = recv(connection->socket, request + request_length, MOCKENDPOINT_REQUEST_SIZE - request_length, 0);
+			if (received <= 0) goto close_connection;
+			request_length += (size_t) received;
+		}
+		char* body = request + head_length;
+		char saved = body[content_length];
+		body[content_length] = '\0';
+
+		// Extract token parameter
+		char* token = NULL;
+		for (char* parameter = body; parameter && *parameter; ) {
+			char* next = strchr(parameter, '&');
+			if (next) *next++ = '\0';
+			if (strncmp(parameter, "token=", 6) == 0) token = parameter + 6;
+			parameter = next;
+		}
+
+		// Respond
+		struct mockendpoint_Response response = { .http_code = 400, .body = NULL, .delay = 0 };
+		if (token) connection->server->handler(token, connection->server->userdata, &response);
+		if (response.delay > 0) {
+			struct timespec delay = { .tv_sec = response.delay / 1000000, .tv_nsec = (long) (response.delay % 1000000) * 1000 };
+			nanosleep(&delay, NULL);
+		}
+		if (response.http_code == 0) goto close_connection;
+		size_t body_length = response.body ? strlen(response.body) : 0;
+		char head[256];
+		int response_head_length = snprintf(
+			head,
+			sizeof(head),
+			"HTTP/1.1 %d Mock\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n",
+			response.http_code,
+			body_length
+		);
+		if (
+			send(connection->socket, head, (size_t) response_head_length, MSG_NOSIGNAL) < 0
+			|| (body_length > 0 && send(connection->socket, response.body, body_length, MSG_NOSIGNAL) < 0)
+		) goto close_connection;
+
+		// Keep pipelined bytes of the next request
+		body[content_length] = saved;
+		size_t consumed = head_length + content_length;
+		memmove(request, request + consumed, request_length - consumed);
+		request_length -= consumed;
+		request[request_length] = '\0';
+	}
+
+close_connection:
+	close(connection->socket);
+	free(request);
+	free(connection);
+	return NULL;
+}
+
+
+static const char* mockendpoint_findHeader(
+	const char* head,
+	const char* name
+) {
+	size_t name_length = strlen(name);
+	for (const char* line = strstr(head, "\r\n"); line && line[2]; line = strstr(line + 2, "\r\n")) {
+		if (strncasecmp(line + 2, name, name_length) == 0) {
+			const char* value = line + 2 + name_length;
+			while (*value == ' ') value++;
+			return value;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,109 @@
+/**
+ * mock_endpoint.h
+ *
+ * Local HTTP/1.1 introspection endpoint answering from recorded responses
+ */
+
+#ifndef OAUTH2PLUGIN_MOCK_ENDPOINT_H
+#define OAUTH2PLUGIN_MOCK_ENDPOINT_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+
+#define MOCKENDPOINT_REQUEST_SIZE 65536
+
+
+struct mockendpoint_Response {
+	int			http_code;		// HTTP status code (0 = close the connection without response).
+	const char*	body;			// Response body. May be NULL.
+	uint32_t	delay;			// Delay before responding in microseconds.
+};
+
+
+/**
+ * @brief Produce the response for a token.
+ *
+ * @param token		Value of the "token" form parameter (not URL decoded).
+ * @param userdata	Userdata passed to mockendpoint_start().
+ * @param response	Output: response to send. The body must stay valid until the response is sent.
+ */
+typedef void (*mockendpoint_Handler)(
+	const char* token,
+	void* userdata,
+	struct mockendpoint_Response* response
+);
+
+
+struct mockendpoint_Server {
+	int						socket;		// Listening socket.
+	int						port;		// Bound port on 127.0.0.1.
+	pthread_t				thread;		// Accept thread.
+	mockendpoint_Handler	handler;	// Response handler.
+	void*					userdata;	// Passed to handler.
+};
+
+
+/**
+ * @brief Listen on an ephemeral port of 127.0.0.1 and serve requests in background threads.
+ *
+ * Every connection is served by its own thread with keep-alive, so pooled
+ * connections of the plugin are reused like with a real endpoint.
+ *
+ * @param handler	Response handler.
+ * @param userdata	Passed to @p handler.
+ * @return			Running server or NULL on failure. The server runs until the process exits.
+ */
+struct mockendpoint_Server* mockendpoint_start(
+	mockendpoint_Handler handler,
+	void* userdata
+);
+
+
+/**
+ * @brief Accept connections.
+ *
+ * @param arg	Pointer to the mockendpoint_Server.
+ * @return		Always NULL.
+ */
+static void* mockendpoint_runAccept(
+	void* arg
+);
+
+
+/**
+ * @brief Serve the requests of one keep-alive connection.
+ *
+ * @param arg	Pointer to a mockendpoint_Connection.
+ * @return		Always NULL.
+ */
+static void* mockendpoint_runConnection(
+	void* arg
+);
+
+
+/**
+ * @brief Find a header value in a request head.
+ *
+ * @param head		Request head (null terminated).
+ * @param name		Header name including ':' (case insensitive).
+ * @return			Pointer to the value or NULL.
+ */
+static const char* mockendpoint_findHeader(
+	const char* head,
+	const char* name
+);
+
+#endif // OAUTH2PLUGIN_MOCK_ENDPOINT_H
@@ -0,0 +1,320 @@
+/**
+ * replay.c
+ *
+ * Replay a capture trace (plugin_opt_capture_file) through the authentication
+ * pipeline of the plugin against a local mock introspection endpoint and
+ * report throughput and latency.
+ *
+ * Build (from the repository root):
+ *   gcc -std=gnu2x -O2 -Isrc -Itools/common -Itools/replay \
+ *       -I/usr/local/include -I/usr/include/cjson \
+ *       -o oauth2-replay \
+ *       tools/replay/*.c tools/common/*.c $(ls src/*.c | grep -v src/plugin.c) \
+ *       -lcurl -lcjson -lresolv -lpthread -lcrypto
+ *
+ * Usage:
+ *   oauth2-replay [-s speed] [-l latency_factor] [-r repeat] [-o key=value]... [-v] trace
+ *
+ *   -s speed			Replay speed: 1 = original pacing, 10 = ten times faster,
+ *						0 = as fast as possible (default 0).
+ *   -l latency_factor	Scale the recorded introspection latency served by the mock
+ *						endpoint (default 1, 0 = respond immediately).
+ *   -r repeat			Replay the trace this many times (default 1).
+ *   -o key=value		Additional plugin option, e.g. -o username_validation=true.
+ *   -v					Print plugin log messages.
+ *
+ * Tokens are never part of a trace. Every event gets a synthetic token with
+ * the recorded length and shape (opaque or JWT structure) that the mock
+ * endpoint maps back to the recorded response, HTTP code and latency.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include <curl/curl.h>
+
+#include "broker_stub.h"
+#include "mock_endpoint.h"
+#include "config.h"
+#include "auth.h"
+#include "capture.h"
+#include "tools.h"
+
+
+struct replay_Event {
+	struct oauth2plugin_CaptureEvent	capture;	// Recorded event.
+	char*								token;		// Synthetic token (NULL if the client sent none).
+};
+
+
+struct replay_State {
+	pthread_mutex_t				mutex;			// Protects current.
+	const struct replay_Event*	current;		// Event being authenticated.
+	double						latency_factor;	// Scale of the recorded introspection latency.
+	unsigned long				mismatches;		// Requests for an unexpected token.
+};
+
+
+/**
+ * @brief Create a synthetic token with the recorded length and shape.
+ *
+ * @param capture	Recorded event.
+ * @return			Newly allocated token or NULL if the client sent none.
+ */
+static char* replay_synthesizeToken(
+	const struct oauth2plugin_CaptureEvent* capture
+) {
+	if (!(capture->flags & OAUTH2PLUGIN_CAPTURE_FLAG_TOKEN)) return NULL;
+
+	// Hex of the token hash, repeated to the recorded length (unique per recorded token)
+	char hash[OAUTH2PLUGIN_TOKEN_HASH_HEX_SIZE];
+	oauth2plugin_hexEncode(capture->token_hash, OAUTH2PLUGIN_TOKEN_HASH_SIZE, hash);
+	size_t length = capture->token_length < 16 ? 16 : capture->token_length;
+	char* token = malloc(length + 1);
+	if (!token) return NULL;
+	for (size_t i = 0; i < length; i++) token[i] = hash[i % (OAUTH2PLUGIN_TOKEN_HASH_HEX_SIZE - 1)];
+	token[length] = '\0';
+
+	// JWT structure: "<header>.<payload>.<signature>"
+	if (capture->flags & OAUTH2PLUGIN_CAPTURE_FLAG_JWT) {
+		token[length / 3] = '.';
+		token[2 * length / 3] = '.';
+	}
+	return token;
+}
+
+
+/**
+ * @brief Mock endpoint handler: answer with the response recorded for the current event.
+ */
+static void replay_handleRequest(
+	const char* token,
+	void* userdata,
+	struct mockendpoint_Response* response
+) {
+	struct replay_State* state = (struct replay_State*) userdata;
+	pthread_mutex_lock(&state->mutex);
+	const struct replay_Event* event = state->current;
+	if (!event || !event->token || strcmp(token, event->token) != 0) {
+		state->mismatches++;
+		pthread_mutex_unlock(&state->mutex);
+		response->http_code = 400;
+		return;
+	}
+	pthread_mutex_unlock(&state->mutex);
+	response->http_code = event->capture.http_code;
+	response->body = event->capture.response;
+	response->delay = (uint32_t) (event->capture.introspection_latency * state->latency_factor);
+}
+
+
+/**
+ * @brief Sort helper for latencies.
+ */
+static int replay_compareLatency(
+	const void* a,
+	const void* b
+) {
+	int64_t x = *(const int64_t*) a;
+	int64_t y = *(const int64_t*) b;
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * @brief Print percentiles of a latency array (sorted in place).
+ */
+static void replay_printLatencies(
+	const char* label,
+	int64_t* latencies,
+	size_t count
+) {
+	if (count == 0) return;
+	qsort(latencies, count, sizeof(*latencies), replay_compareLatency);
+	printf(
+		"%-22s p50 %8.3f ms   p90 %8.3f ms   p99 %8.3f ms   max %8.3f ms\n",
+		label,
+		latencies[count * 50 / 100] / 1000.0,
+		latencies[count * 90 / 100] / 1000.0,
+		latencies[count * 99 / 100] / 1000.0,
+		latencies[count - 1] / 1000.0
+	);
+}
+
+
+int main(
+	int argc,
+	char** argv
+) {
+	// Parse arguments
+	double speed = 0;
+	double latency_factor = 1;
+	long repeat = 1;
+	struct mosquitto_opt* options = calloc((size_t) argc + 3, sizeof(*options));
+	int options_count = 3; // introspection_endpoint, client_id, client_secret
+	int opt;
+	while ((opt = getopt(argc, argv, "s:l:r:o:v")) != -1) {
+		switch (opt) {
+			case 's': speed = strtod(optarg, NULL); break;
+			case 'l': latency_factor = strtod(optarg, NULL); break;
+			case 'r': repeat = strtol(optarg, NULL, 10); break;
+			case 'v': brokerstub_verbose = true; break;
+			case 'o': {
+				char* separator = strchr(optarg, '=');
+				if (!separator) {
+					fprintf(stderr, "Invalid option %s (expected key=value).\n", optarg);
+					return 2;
+				}
+				*separator = '\0';
+				options[options_count].key = optarg;
+				options[options_count].value = separator + 1;
+				options_count++;
+				break;
+			}
+			default:
+				fprintf(stderr, "Usage: %s [-s speed] [-l latency_factor] [-r repeat] [-o key=value]... [-v] trace\n", argv[0]);
+				return 2;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "Usage: %s [-s speed] [-l latency_factor] [-r repeat] [-o key=value]... [-v] trace\n", argv[0]);
+		return 2;
+	}
+
+	// Load trace
+	FILE* file = fopen(argv[optind], "rb");
+	if (!file || !oauth2plugin_readCaptureHeader(file)) {
+		fprintf(stderr, "Cannot read trace %s.\n", argv[optind]);
+		return 1;
+	}
+	size_t events_count = 0;
+	size_t events_size = 1024;
+	struct replay_Event* events = malloc(events_size * sizeof(*events));
+	while (events) {
+		if (events_count == events_size) {
+			events_size *= 2;
+			struct replay_Event* resized = realloc(events, events_size * sizeof(*events));
+			if (!resized) break;
+			events = resized;
+		}
+		if (!oauth2plugin_readCaptureEvent(file, &events[events_count].capture)) break;
+		events[events_count].token = replay_synthesizeToken(&events[events_count].capture);
+		events_count++;
+	}
+	fclose(file);
+	if (!events || events_count == 0) {
+		fprintf(stderr, "Trace %s contains no events.\n", argv[optind]);
+		return 1;
+	}
+
+	// Start mock endpoint
+	struct replay_State state = { .current = NULL, .latency_factor = latency_factor, .mismatches = 0 };
+	pthread_mutex_init(&state.mutex, NULL);
+	struct mockendpoint_Server* server = mockendpoint_start(replay_handleRequest, &state);
+	if (!server) {
+		fprintf(stderr, "Cannot start mock endpoint.\n");
+		return 1;
+	}
+
+	// Load plugin configuration pointing to the mock endpoint
+	char endpoint[64];
+	snprintf(endpoint, sizeof(endpoint), "http://127.0.0.1:%d/introspect", server->port);
+	options[0].key = "introspection_endpoint";
+	options[0].value = endpoint;
+	options[1].key = "client_id";
+	options[1].value = "replay";
+	options[2].key = "client_secret";
+	options[2].value = "replay";
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+	int error = MOSQ_ERR_SUCCESS;
+	struct oauth2plugin_Plugin* plugin = oauth2plugin_initPlugin(NULL, options, options_count, &error);
+	if (!plugin) {
+		fprintf(stderr, "Cannot initialize plugin (Error: %s).\n", mosquitto_strerror(error));
+		return 1;
+	}
+
+	// Replay
+	size_t total = events_count * (size_t) (repeat > 0 ? repeat : 1);
+	int64_t* latencies = malloc(total * sizeof(*latencies));
+	int64_t* recorded_latencies = malloc(total * sizeof(*recorded_latencies));
+	if (!latencies || !recorded_latencies) return 1;
+	size_t replayed = 0;
+	unsigned long outcome_differences = 0;
+	unsigned long outcomes[3] = { 0, 0, 0 }; // allow, deny, defer
+	int64_t replay_start = oauth2plugin_getMonotonicTime();
+	int64_t pass_start = replay_start;
+	for (long pass = 0; pass < (repeat > 0 ? repeat : 1); pass++) {
+		for (size_t i = 0; i < events_count; i++) {
+			struct replay_Event* event = &events[i];
+
+			// Pace to the recorded arrival times
+			if (speed > 0) {
+				int64_t due = pass_start + (int64_t) ((event->capture.timestamp - events[0].capture.timestamp) / speed);
+				int64_t now = oauth2plugin_getMonotonicTime();
+				if (due > now) {
+					struct timespec wait = { .tv_sec = (due - now) / 1000000, .tv_nsec = (long) ((due - now) % 1000000) * 1000 };
+					nanosleep(&wait, NULL);
+				}
+			}
+
+			// Authenticate
+			struct mosquitto* client = brokerstub_createClient(event->capture.client_id, event->capture.username, 0);
+			struct mosquitto_evt_basic_auth data = {
+				.client = client,
+				.username = event->capture.username,
+				.password = event->token
+			};
+			pthread_mutex_lock(&state.mutex);
+			state.current = event;
+			pthread_mutex_unlock(&state.mutex);
+			int64_t start = oauth2plugin_getMonotonicTime();
+			int result = oauth2plugin_callback_mosquittoBasicAuthentication(MOSQ_EVT_BASIC_AUTH, &data, plugin);
+			latencies[replayed] = oauth2plugin_getMonotonicTime() - start;
+			recorded_latencies[replayed] = event->capture.total_latency;
+			replayed++;
+			struct mosquitto_evt_disconnect disconnect = { .client = client };
+			oauth2plugin_callback_mosquittoDisconnect(MOSQ_EVT_DISCONNECT, &disconnect, plugin);
+			brokerstub_freeClient(client);
+
+			// Compare with recorded outcome
+			if (result == MOSQ_ERR_SUCCESS) outcomes[0]++;
+			else if (result == MOSQ_ERR_PLUGIN_DEFER) outcomes[2]++;
+			else outcomes[1]++;
+			if (result != event->capture.result) outcome_differences++;
+		}
+		pass_start = oauth2plugin_getMonotonicTime();
+	}
+	int64_t duration = oauth2plugin_getMonotonicTime() - replay_start;
+
+	// Report
+	printf("Events:                %zu (%zu per pass, %ld passes)\n", replayed, events_count, repeat > 0 ? repeat : 1);
+	printf("Duration:              %.3f s\n", duration / 1000000.0);
+	printf("Throughput:            %.1f auth/s\n", duration > 0 ? replayed * 1000000.0 / duration : 0.0);
+	printf("Outcomes:              %lu allow, %lu deny, %lu defer\n", outcomes[0], outcomes[1], outcomes[2]);
+	printf("Outcome differences:   %lu\n", outcome_differences);
+	printf("Unexpected requests:   %lu\n", state.mismatches);
+	replay_printLatencies("Latency (replay):", latencies, replayed);
+	replay_printLatencies("Latency (recorded):", recorded_latencies, replayed);
+
+	// Cleanup
+	oauth2plugin_freePlugin(plugin);
+	curl_global_cleanup();
+	for (size_t i = 0; i < events_count; i++) {
+		oauth2plugin_freeCaptureEvent(&events[i].capture);
+		free(events[i].token);
+	}
+	free(events);
+	free(latencies);
+	free(recorded_latencies);
+	free(options);
+	return outcome_differences == 0 ? 0 : 3;
+}
@@ -0,0 +1,377 @@
+/**
+ * sidecar.c
+ *
+ * Reference token verification sidecar (plugin_opt_verifier sidecar): answers
+ * verify requests on a Unix domain socket by calling the introspection
+ * endpoint with the plugin's own HTTP stack (discovery, DNS cache, keep-alive
+ * pool). Requests are pipelined: a reader thread per connection queues them
+ * for a pool of workers, which answer in completion order.
+ *
+ * Build (from the repository root):
+ *   gcc -std=gnu2x -O2 -Isrc -Itools/common \
+ *       -I/usr/local/include -I/usr/include/cjson \
+ *       -o oauth2-sidecar \
+ *       tools/sidecar/*.c tools/common/*.c $(ls src/*.c | grep -v src/plugin.c) \
+ *       -lcurl -lcjson -lresolv -lpthread -lcrypto
+ *
+ * Usage:
+ *   oauth2-sidecar -s socket [-w workers] [-o key=value]... [-v]
+ *
+ *   -s socket		Path of the Unix domain socket to listen on.
+ *   -w workers		Number of concurrent introspection requests (default 8).
+ *   -o key=value	Plugin option, e.g. -o issuer=https://idp.example.com
+ *					-o client_id=mqtt -o client_secret=secret. The options of
+ *					the default profile are used.
+ *   -v				Print plugin log messages.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+#include <curl/curl.h>
+#include "cJSON.h"
+
+#include "broker_stub.h"
+#include "config.h"
+#include "auth.h"
+#include "sidecar.h"
+
+
+struct sidecar_Connection {
+	int					socket;		// Client connection.
+	pthread_mutex_t		write;		// Keeps response frames whole.
+	atomic_long			references;	// Reader thread and queued requests.
+};
+
+
+struct sidecar_Request {
+	struct sidecar_Request*		next;		// Next queued request.
+	struct sidecar_Connection*	connection;	// Connection to answer on.
+	uint8_t*					body;		// Request frame body.
+	size_t						length;		// Length of @p body.
+};
+
+
+struct sidecar_Queue {
+	pthread_mutex_t				mutex;		// Protects the list.
+	pthread_cond_t				cond;		// Signalled when requests are queued.
+	struct sidecar_Request*		head;		// Oldest request.
+	struct sidecar_Request*		tail;		// Newest request.
+	struct oauth2plugin_Plugin*	plugin;		// Plugin state with the introspection configuration.
+};
+
+
+struct sidecar_ReaderArguments {
+	struct sidecar_Queue*		queue;		// Queue of the workers.
+	struct sidecar_Connection*	connection;	// Connection to read from.
+};
+
+
+/**
+ * @brief Release a reference to a connection; the socket is closed with the last one.
+ */
+static void sidecar_releaseConnection(
+	struct sidecar_Connection* connection
+) {
+	if (atomic_fetch_sub(&connection->references, 1) > 1) return;
+	close(connection->socket);
+	pthread_mutex_destroy(&connection->write);
+	free(connection);
+}
+
+
+/**
+ * @brief Convert a claim to the string the plugin would use in its templates.
+ */
+static char* sidecar_claimToString(
+	const cJSON* item
+) {
+	if (cJSON_IsString(item)) return strdup(item->valuestring);
+	if (cJSON_IsNumber(item)) {
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%d", item->valueint);
+		return strdup(buffer);
+	}
+	if (cJSON_IsBool(item)) return strdup(cJSON_IsTrue(item) ? "true" : "false");
+	if (cJSON_IsObject(item) && item->child && item->child->string) return strdup(item->child->string);
+	return NULL;
+}
+
+
+/**
+ * @brief Verify the token of a request and send the response.
+ */
+static void sidecar_handleRequest(
+	struct oauth2plugin_Plugin* plugin,
+	const struct sidecar_Request* request
+) {
+	uint8_t response[OAUTH2PLUGIN_SIDECAR_MAX_FRAME];
+	memcpy(response, request->body, 4); // Request id
+	uint8_t* status = &response[4];
+	uint8_t* exp = &response[5];
+	uint8_t* claim_count = &response[13];
+	uint8_t* cursor = &response[14];
+	uint8_t* end = response + sizeof(response);
+	*status = sidecar_status_ERROR;
+	memset(exp, 0, 8);
+	*claim_count = 0;
+
+	// Decode request
+	const uint8_t* input = request->body + 4;
+	const uint8_t* input_end = request->body + request->length;
+	if (input_end - input < 3 || *input++ != OAUTH2PLUGIN_SIDECAR_TYPE_VERIFY) goto respond;
+	size_t token_length = ((size_t) input[0] << 8) | input[1];
+	input += 2;
+	if ((size_t) (input_end - input) < token_length + 1) goto respond;
+	char* token = strndup((const char*) input, token_length);
+	if (!token) goto respond;
+	input += token_length;
+
+	// Introspect
+	struct oauth2plugin_Options* options = oauth2plugin_acquireOptions(plugin);
+	struct oauth2plugin_CURLBuffer buffer = { .data = NULL, .size = 0 };
+	long http_code = 0;
+	int error = oauth2plugin_callIntrospectionEndpoint(
+		options->http_pool,
+		options->introspection_endpoint,
+		options->client_id,
+		options->client_secret,
+		options->credentials,
+		token,
+		options->tls_verification,
+		options->timeout,
+		&buffer,
+		&http_code
+	);
+	oauth2plugin_releaseOptions(plugin, options);
+	free(token);
+	cJSON* cjson = error ? NULL : cJSON_Parse(buffer.data);
+	free(buffer.data);
+	if (!cjson) goto respond;
+	cJSON* active = cJSON_GetObjectItemCaseSensitive(cjson, "active");
+	*status = cJSON_IsTrue(active) ? sidecar_status_ACTIVE : sidecar_status_INACTIVE;
+	cJSON* cjson_exp = cJSON_GetObjectItemCaseSensitive(cjson, "exp");
+	if (cJSON_IsNumber(cjson_exp)) {
+		uint64_t value = (uint64_t) (int64_t) cjson_exp->valuedouble;
+		for (int i = 0; i < 8; i++) exp[i] = (uint8_t) (value >> (56 - 8 * i));
+	}
+
+	// Requested claims (only of active tokens)
+	size_t requested = *input++;
+	for (size_t i = 0; i < requested && *status == sidecar_status_ACTIVE; i++) {
+		if (input_end - input < 1) break;
+		size_t name_length = *input++;
+		if ((size_t) (input_end - input) < name_length) break;
+		char name[name_length + 1];
+		memcpy(name, input, name_length);
+		name[name_length] = '\0';
+		input += name_length;
+
+		char* value = sidecar_claimToString(cJSON_GetObjectItemCaseSensitive(cjson, name));
+		if (!value) continue;
+		size_t value_length = strlen(value);
+		if (value_length <= UINT16_MAX && (size_t) (end - cursor) >= 1 + name_length + 2 + value_length) {
+			*cursor++ = (uint8_t) name_length;
+			memcpy(cursor, name, name_length);
+			cursor += name_length;
+			*cursor++ = (uint8_t) (value_length >> 8);
+			*cursor++ = (uint8_t) value_length;
+			memcpy(cursor, value, value_length);
+			cursor += value_length;
+			(*claim_count)++;
+		}
+		free(value);
+	}
+	cJSON_Delete(cjson);
+
+respond:
+	pthread_mutex_lock(&request->connection->write);
+	oauth2plugin_writeSidecarFrame(request->connection->socket, response, (size_t) (cursor - response));
+	pthread_mutex_unlock(&request->connection->write);
+}
+
+
+/**
+ * @brief Worker thread: answer queued requests.
+ */
+static void* sidecar_work(
+	void* userdata
+) {
+	struct sidecar_Queue* queue = (struct sidecar_Queue*) userdata;
+	for (;;) {
+		pthread_mutex_lock(&queue->mutex);
+		while (!queue->head) pthread_cond_wait(&queue->cond, &queue->mutex);
+		struct sidecar_Request* request = queue->head;
+		queue->head = request->next;
+		if (!queue->head) queue->tail = NULL;
+		pthread_mutex_unlock(&queue->mutex);
+
+		sidecar_handleRequest(queue->plugin, request);
+		sidecar_releaseConnection(request->connection);
+		free(request->body);
+		free(request);
+	}
+	return NULL;
+}
+
+
+/**
+ * @brief Reader thread of a connection: queue its requests until it is closed.
+ */
+static void* sidecar_read(
+	void* userdata
+) {
+	struct sidecar_ReaderArguments* arguments = (struct sidecar_ReaderArguments*) userdata;
+	struct sidecar_Queue* queue = arguments->queue;
+	struct sidecar_Connection* connection = arguments->connection;
+	free(arguments);
+
+	for (;;) {
+		uint8_t* body = NULL;
+		size_t length = 0;
+		if (oauth2plugin_readSidecarFrame(connection->socket, 0, &body, &length) != MOSQ_ERR_SUCCESS) break;
+		struct sidecar_Request* request = calloc(1, sizeof(*request));
+		if (!request || length < 4) {
+			free(request);
+			free(body);
+			break;
+		}
+		atomic_fetch_add(&connection->references, 1);
+		request->connection = connection;
+		request->body = body;
+		request->length = length;
+
+		pthread_mutex_lock(&queue->mutex);
+		if (queue->tail) queue->tail->next = request;
+		else queue->head = request;
+		queue->tail = request;
+		pthread_cond_signal(&queue->cond);
+		pthread_mutex_unlock(&queue->mutex);
+	}
+
+	shutdown(connection->socket, SHUT_RD);
+	sidecar_releaseConnection(connection);
+	return NULL;
+}
+
+
+int main(
+	int argc,
+	char** argv
+) {
+	// Parse arguments
+	const char* socket_path = NULL;
+	long workers = 8;
+	struct mosquitto_opt* options = calloc((size_t) argc + 1, sizeof(*options));
+	int options_count = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:w:o:v")) != -1) {
+		switch (opt) {
+			case 's': socket_path = optarg; break;
+			case 'w': workers = strtol(optarg, NULL, 10); break;
+			case 'v': brokerstub_verbose = true; break;
+			case 'o': {
+				char* separator = strchr(optarg, '=');
+				if (!separator) {
+					fprintf(stderr, "Invalid option %s (expected key=value).\n", optarg);
+					return 2;
+				}
+				*separator = '\0';
+				options[options_count].key = optarg;
+				options[options_count].value = separator + 1;
+				options_count++;
+				break;
+			}
+			default:
+				fprintf(stderr, "Usage: %s -s socket [-w workers] [-o key=value]... [-v]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (!socket_path || workers < 1) {
+		fprintf(stderr, "Usage: %s -s socket [-w workers] [-o key=value]... [-v]\n", argv[0]);
+		return 2;
+	}
+
+	// Load plugin configuration (the sidecar itself always introspects)
+	options[options_count].key = "verifier";
+	options[options_count].value = "introspection";
+	options_count++;
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+	int error = MOSQ_ERR_SUCCESS;
+	struct oauth2plugin_Plugin* plugin = oauth2plugin_initPlugin(NULL, options, options_count, &error);
+	if (!plugin) {
+		fprintf(stderr, "Cannot initialize plugin (Error: %s).\n", mosquitto_strerror(error));
+		return 1;
+	}
+
+	// Listen
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Socket path %s is too long.\n", socket_path);
+		return 1;
+	}
+	strcpy(address.sun_path, socket_path);
+	unlink(socket_path);
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (
+		listener < 0
+		|| bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0
+		|| listen(listener, 64) != 0
+	) {
+		perror("Cannot listen");
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	// Start workers
+	struct sidecar_Queue queue = { .head = NULL, .tail = NULL, .plugin = plugin };
+	pthread_mutex_init(&queue.mutex, NULL);
+	pthread_cond_init(&queue.cond, NULL);
+	for (long i = 0; i < workers; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, sidecar_work, &queue) != 0) {
+			fprintf(stderr, "Cannot start worker.\n");
+			return 1;
+		}
+		pthread_detach(thread);
+	}
+	fprintf(stderr, "Listening on %s with %ld workers.\n", socket_path, workers);
+
+	// Accept connections (one reader thread each; the broker keeps a single connection)
+	for (;;) {
+		int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) continue;
+		struct sidecar_Connection* connection = calloc(1, sizeof(*connection));
+		struct sidecar_ReaderArguments* arguments = calloc(1, sizeof(*arguments));
+		if (!connection || !arguments) {
+			free(connection);
+			free(arguments);
+			close(fd);
+			continue;
+		}
+		connection->socket = fd;
+		pthread_mutex_init(&connection->write, NULL);
+		atomic_init(&connection->references, 1);
+		arguments->queue = &queue;
+		arguments->connection = connection;
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, sidecar_read, arguments) != 0) {
+			free(arguments);
+			sidecar_releaseConnection(connection);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+}